@@ -0,0 +1,269 @@
+"""Strong/weak scaling study of parallhull on the machine at hand, with the tables and plots of report/report.tex.
+
+    make scaling MODE=exec SCALING_ARGS="--ranks 1,2,4 --threads 1,2 --n 1e7 --reps 3"
+    python3 pyScripts/scaling.py --bin bin/exec --ranks 1,2,4 --threads 1,2 --subproblem 0,1e5,1e6 --dist disk,square
+
+Every combination of distribution x n x subproblem size x ranks x threads is run --reps times:
+ - with the MPI main through mpirun (local oversubscription, so a single box can stand in for the cluster)
+ - with main_nompi when ranks is 1
+The inputs are generated once with gendata in --data-dir. With --scaling strong n is the total number of points, with weak it is
+the number of points per CPU (ranks x threads), so the input grows with the CPUs. Every run writes its --metrics JSON, the time
+of a run is that of its slowest rank without MPI init and file read, like the execution times of the report, and the best of
+the repetitions is kept (the report kept the lowest of two acquisitions).
+
+Output in --out:
+ - runs.csv: every run
+ - summary.csv: one line per configuration with best/mean time, speedup and efficiency. A series is a set of runs differing only
+   in the CPUs: for the MPI main one per threads per rank (the ranks vary), for main_nompi the threads vary. Speedup and
+   efficiency are relative to the first point of the series (strong: speedup = cpus0 * t0 / t, weak: efficiency = t0 / t)
+ - <scaling>_<binary>_<dist>_<n>.{csv,gp,tex}: the series of a group, a gnuplot script for time and speedup plots, and the
+   pgfplots coordinates and tabular of the report
+ - subproblem_<binary>_<dist>_<n>.{csv,gp,tex} with more than one --subproblem: time and gain over no bound (or the largest
+   bound) on a single CPU, like the simulation section of the report
+"""
+import argparse
+import csv
+import json
+import os
+import shlex
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def parseList(text, convert):
+    return [convert(v) for v in text.split(",") if v != ""]
+
+
+def parseCount(text):
+    v = float(text)
+    if v < 0 or v != int(v):
+        raise argparse.ArgumentTypeError("%s is not a valid count" % text)
+    return int(v)
+
+
+def fmt(v):
+    # 3 significant digits, as in the tables of the report
+    return "%.3g" % v
+
+
+def inputFile(args, dist, n):
+    path = os.path.join(args.data_dir, "%s_%d_s%d" % (dist, n, args.seed))
+    if not os.path.exists(path) or os.path.getsize(path) != n * 8:
+        os.makedirs(args.data_dir, exist_ok=True)
+        print("generating %s" % path, flush=True)
+        subprocess.run([os.path.join(args.bin, "gendata"), "-n", str(n), "-d", dist, "-s", str(args.seed), "-o", path],
+                       check=True, stdout=subprocess.DEVNULL)
+    return path
+
+
+def runOnce(args, binary, path, ranks, threads, subproblem, workDir):
+    metricsFile = os.path.join(workDir, "metrics.json")
+    if os.path.exists(metricsFile):
+        os.remove(metricsFile)
+    cmd = ["-f", path, "-j", str(threads), "-m", metricsFile, "-l", "warning", "--subproblem", str(subproblem)]
+    cmd += shlex.split(args.extra)
+    if binary == "mpi":
+        cmd = shlex.split(args.mpirun) + ["-np", str(ranks), os.path.join(args.bin, "main")] + cmd
+    else:
+        cmd = [os.path.join(args.bin, "main_nompi")] + cmd
+    start = time.perf_counter()
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL, timeout=args.timeout)
+    wallTime = time.perf_counter() - start
+    with open(metricsFile) as f:
+        metrics = json.load(f)
+    # the slowest rank sets the time of the run, its read is part of the initialization as in the report
+    computeTime = max(r["totalTime"] - r["phaseTimes"]["read"] for r in metrics["ranks"])
+    readTime = max(r["phaseTimes"]["read"] for r in metrics["ranks"])
+    totalTime = max(r["totalTime"] for r in metrics["ranks"])
+    return computeTime, readTime, totalTime, wallTime
+
+
+def runSweep(args, writer):
+    runs = []
+    with tempfile.TemporaryDirectory() as workDir:
+        for scaling in args.scalings:
+            for dist in args.dist:
+                for n in args.n:
+                    for subproblem in args.subproblem:
+                        for ranks in args.ranks:
+                            for threads in args.threads:
+                                cpus = ranks * threads
+                                total = n if scaling == "strong" else n * cpus
+                                path = inputFile(args, dist, total)
+                                binaries = [b for b in ("mpi", "serial") if (b == "mpi" and not args.no_mpi) or (b == "serial" and not args.no_serial and ranks == 1)]
+                                for binary in binaries:
+                                    for rep in range(args.reps):
+                                        computeTime, readTime, totalTime, wallTime = runOnce(args, binary, path, ranks, threads, subproblem, workDir)
+                                        row = {"binary": binary, "scaling": scaling, "dist": dist, "n": n, "points": total, "ranks": ranks,
+                                               "threads": threads, "cpus": cpus, "subproblem": subproblem, "rep": rep,
+                                               "computeTime": computeTime, "readTime": readTime, "totalTime": totalTime, "wallTime": wallTime}
+                                        writer.writerow(row)
+                                        runs.append(row)
+                                    best = min(r["computeTime"] for r in runs[-args.reps:])
+                                    print("%-6s %-6s %-9s n=%-11d subproblem=%-10d ranks=%-3d threads=%-3d best %.4fs" % (scaling, binary, dist, n, subproblem, ranks, threads, best), flush=True)
+    return runs
+
+
+def summarize(runs):
+    configs = {}
+    for r in runs:
+        key = (r["scaling"], r["binary"], r["dist"], r["n"], r["subproblem"], r["ranks"], r["threads"])
+        configs.setdefault(key, []).append(r["computeTime"])
+
+    # series: the MPI main varies the ranks for a fixed number of threads per rank, main_nompi varies the threads
+    series = {}
+    for key, times in configs.items():
+        scaling, binary, dist, n, subproblem, ranks, threads = key
+        label = "threads=%d" % threads if binary == "mpi" else "nompi"
+        row = {"scaling": scaling, "binary": binary, "dist": dist, "n": n, "subproblem": subproblem, "series": label, "ranks": ranks,
+               "threads": threads, "cpus": ranks * threads, "best": min(times), "mean": statistics.mean(times),
+               "stdev": statistics.stdev(times) if len(times) > 1 else 0.}
+        series.setdefault((scaling, binary, dist, n, subproblem, label), []).append(row)
+
+    for key, rows in series.items():
+        rows.sort(key=lambda r: r["cpus"])
+        base = rows[0]
+        for r in rows:
+            if key[0] == "strong":
+                r["speedup"] = base["cpus"] * base["best"] / r["best"]
+                r["efficiency"] = r["speedup"] / r["cpus"]
+            else:
+                r["efficiency"] = base["best"] / r["best"]
+                r["speedup"] = r["efficiency"] * r["cpus"]
+    return series
+
+
+def seriesName(subproblem, label):
+    return label if subproblem == 0 else "%s,subproblem=%d" % (label, subproblem)
+
+
+def writeGroups(args, series):
+    fields = ["scaling", "binary", "dist", "n", "subproblem", "series", "ranks", "threads", "cpus", "best", "mean", "stdev", "speedup", "efficiency"]
+    with open(os.path.join(args.out, "summary.csv"), "w", newline="") as f:
+        w = csv.DictWriter(f, fieldnames=fields)
+        w.writeheader()
+        for key in sorted(series):
+            for r in series[key]:
+                w.writerow({k: fmt(r[k]) if isinstance(r[k], float) else r[k] for k in fields})
+
+    groups = {}
+    for key, rows in series.items():
+        scaling, binary, dist, n, subproblem, label = key
+        groups.setdefault((scaling, binary, dist, n), []).append((seriesName(subproblem, label), rows))
+
+    for (scaling, binary, dist, n), members in sorted(groups.items()):
+        members.sort()
+        name = "%s_%s_%s_%d" % (scaling, binary, dist, n)
+        maxCpus = max(r["cpus"] for _, rows in members for r in rows)
+
+        # one block per series, separated by two blank lines: gnuplot indexes them
+        with open(os.path.join(args.out, name + ".csv"), "w") as f:
+            for i, (label, rows) in enumerate(members):
+                f.write("%s# %s\ncpus,ranks,threads,best,mean,stdev,speedup,efficiency\n" % ("\n\n" if i else "", label))
+                for r in rows:
+                    f.write("%d,%d,%d,%s,%s,%s,%s,%s\n" % (r["cpus"], r["ranks"], r["threads"], fmt(r["best"]), fmt(r["mean"]), fmt(r["stdev"]), fmt(r["speedup"]), fmt(r["efficiency"])))
+
+        with open(os.path.join(args.out, name + ".gp"), "w") as f:
+            f.write("# gnuplot %s.gp, from the directory of the file\n" % name)
+            f.write("set datafile separator ','\nset key top left\nset grid\nset xlabel 'CPUs'\nset terminal pngcairo size 1280,800\n")
+            f.write("set output '%s_time.png'\nset ylabel 'time(s)'\nset yrange [0:*]\n" % name)
+            f.write("plot " + ", \\\n     ".join("'%s.csv' index %d using 1:4 with linespoints title '%s'" % (name, i, label) for i, (label, _) in enumerate(members)) + "\n")
+            ylabel = "time(1)/time(x)" if scaling == "strong" else "scaled speedup"
+            f.write("set output '%s_speedup.png'\nset ylabel '%s'\nset xrange [0:%d]\nset yrange [0:%d]\n" % (name, ylabel, maxCpus + 1, maxCpus + 1))
+            f.write("plot " + ", \\\n     ".join("'%s.csv' index %d using 1:7 with linespoints title '%s'" % (name, i, label) for i, (label, _) in enumerate(members))
+                    + ", \\\n     x with lines title 'Ideal'\n")
+
+        # the pgfplots coordinates and the tabular of the report, ready to be pasted in it
+        with open(os.path.join(args.out, name + ".tex"), "w") as f:
+            f.write("%% %s scaling, %s binary, %s, n=%d%s\n" % (scaling, binary, dist, n, " per CPU" if scaling == "weak" else ""))
+            f.write("% execution time\n")
+            for label, rows in members:
+                f.write("\\addplot coordinates {%s}; %% %s\n" % ("".join("(%d,%s)" % (r["cpus"], fmt(r["best"])) for r in rows), label))
+            f.write("% speedup\n")
+            for label, rows in members:
+                f.write("\\addplot coordinates {%s}; %% %s\n" % ("".join("(%d,%s)" % (r["cpus"], fmt(r["speedup"])) for r in rows), label))
+            f.write("\\addplot[color=Red,] coordinates {%s}; %% ideal\n" % "".join("(%d,%d)" % (c, c) for c in sorted({r["cpus"] for _, rows in members for r in rows})))
+
+            cpus = sorted({r["cpus"] for _, rows in members for r in rows})
+            byCpus = [{r["cpus"]: r for r in rows} for _, rows in members]
+            f.write("\\begin{tabular}{|c | %s|}\n\t\\hline\n" % " | ".join("c c" for _ in members))
+            f.write("\tNumber of CPUs & %s \\\\ [0.5ex]\n\t\\hline\n" % " & ".join("Time(%s) & Speedup" % label for label, _ in members))
+            for c in cpus:
+                cells = ["%s & %s" % (fmt(b[c]["best"]), fmt(b[c]["speedup"])) if c in b else "- & -" for b in byCpus]
+                f.write("\t%d & %s \\\\\n\t\\hline\n" % (c, " & ".join(cells)))
+            f.write("\\end{tabular}\n")
+
+
+def writeSubproblemStudy(args, series):
+    # time on the fewest CPUs of every series against the subproblem size, gain over no bound (0) or else over the largest bound
+    studies = {}
+    for (scaling, binary, dist, n, subproblem, label), rows in series.items():
+        if scaling != args.scalings[0]:
+            continue
+        first = rows[0]
+        studies.setdefault((binary, dist, n, label, first["cpus"]), {})[subproblem] = first["best"]
+
+    for (binary, dist, n, label, cpus), times in sorted(studies.items()):
+        if len(times) < 2:
+            continue
+        reference = 0 if 0 in times else max(times)
+        bounded = sorted((s for s in times if s != 0), reverse=True)
+        name = "subproblem_%s_%s_%d%s" % (binary, dist, n, "" if binary == "serial" else "_" + label.replace("=", ""))
+        with open(os.path.join(args.out, name + ".csv"), "w") as f:
+            f.write("subproblem,best,gain\n")
+            for s in bounded:
+                f.write("%d,%s,%s\n" % (s, fmt(times[s]), fmt((times[reference] - times[s]) / times[reference] * 100)))
+        with open(os.path.join(args.out, name + ".gp"), "w") as f:
+            f.write("# gnuplot %s.gp, from the directory of the file\n" % name)
+            f.write("set datafile separator ','\nset grid\nset logscale x\nset xlabel 'Upper Bound'\nset terminal pngcairo size 1280,600\nset key off\n")
+            f.write("set output '%s_time.png'\nset ylabel 'Execution time'\nplot '%s.csv' using 1:2 skip 1 with linespoints\n" % (name, name))
+            f.write("set output '%s_gain.png'\nset ylabel 'Gain (%%)'\nset style fill solid\nplot '%s.csv' using 1:3 skip 1 with boxes\n" % (name, name))
+        with open(os.path.join(args.out, name + ".tex"), "w") as f:
+            f.write("%% %s binary, %s, n=%d, %d CPU(s), gain over %s\n" % (binary, dist, n, cpus, "no upper bound" if reference == 0 else "an upper bound of %d" % reference))
+            # no bound is plotted at n, where a single subproblem holds all the points, as in the report
+            f.write("\\addplot[color=Blue,mark=square,] coordinates {%s}; %% execution time\n" % "".join("(%.0e,%s)" % (s if s else n, fmt(times[s])) for s in ([0] if 0 in times else []) + bounded))
+            f.write("\\addplot[color=Blue,fill] coordinates {%s}; %% gain in %%\n" % "".join("(%.0e,%s)" % (s, fmt((times[reference] - times[s]) / times[reference] * 100)) for s in bounded if s != reference))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bin", default="bin/exec", help="directory of main, main_nompi and gendata (DEFAULT=bin/exec)")
+    parser.add_argument("--out", default="scaling", help="output directory (DEFAULT=scaling)")
+    parser.add_argument("--data-dir", default="data/scaling", help="where the generated inputs are kept between runs (DEFAULT=data/scaling)")
+    parser.add_argument("--dist", type=lambda t: parseList(t, str), default=["disk"], help="distributions of gendata (DEFAULT=disk)")
+    parser.add_argument("--n", type=lambda t: parseList(t, parseCount), default=[10000000], help="points, per CPU with --scaling weak (DEFAULT=1e7)")
+    parser.add_argument("--ranks", type=lambda t: parseList(t, parseCount), default=[1, 2, 4], help="MPI ranks (DEFAULT=1,2,4)")
+    parser.add_argument("--threads", type=lambda t: parseList(t, parseCount), default=[1], help="threads per rank (DEFAULT=1)")
+    parser.add_argument("--subproblem", type=lambda t: parseList(t, parseCount), default=[0], help="--subproblem of main, 0 for no bound (DEFAULT=0)")
+    parser.add_argument("--scaling", choices=["strong", "weak", "both"], default="strong")
+    parser.add_argument("--reps", type=int, default=3, help="repetitions of every configuration, the best is kept (DEFAULT=3)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--mpirun", default="mpirun --oversubscribe" + (" --allow-run-as-root" if os.geteuid() == 0 else ""),
+                        help="launcher of the MPI runs, -np is appended (DEFAULT=%(default)s)")
+    parser.add_argument("--extra", default="", help="more arguments for main, e.g. \"-s 0\" to disable the prefilter")
+    parser.add_argument("--no-mpi", action="store_true", help="only run main_nompi")
+    parser.add_argument("--no-serial", action="store_true", help="only run the MPI main")
+    parser.add_argument("--timeout", type=float, default=None, help="seconds after which a run is considered failed")
+    args = parser.parse_args()
+    args.scalings = ["strong", "weak"] if args.scaling == "both" else [args.scaling]
+    if args.no_mpi and args.no_serial:
+        sys.exit("--no-mpi and --no-serial leave nothing to run")
+
+    os.makedirs(args.out, exist_ok=True)
+    fields = ["binary", "scaling", "dist", "n", "points", "ranks", "threads", "cpus", "subproblem", "rep", "computeTime", "readTime", "totalTime", "wallTime"]
+    with open(os.path.join(args.out, "runs.csv"), "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=fields)
+        writer.writeheader()
+        runs = runSweep(args, writer)
+
+    series = summarize(runs)
+    writeGroups(args, series)
+    writeSubproblemStudy(args, series)
+    print("results in %s" % args.out)
+
+
+if __name__ == "__main__":
+    main()
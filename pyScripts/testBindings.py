@@ -0,0 +1,135 @@
+"""Checks the parallhull Python module against the file based command line and times both.
+
+    python3 pyScripts/testBindings.py [--bin bin/exec] [-n 2000000] [-j 4]
+
+Build both first with `make build MODE=exec && make python MODE=exec`. The hull of random points given to parallhull.hull as
+float32 (copied by default and in place with copy=False), float64 and strided arrays, with both algorithms and with indices, must have the same
+vertices as the --output of the command line on a raw file of the same points. The timings compare writing the raw file and
+running the command line with a call of the module on the arrays. numpy is used when installed, array.array otherwise.
+"""
+import argparse
+import array
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+try:
+    import numpy as np
+except ImportError:
+    np = None
+
+
+def genPoints(n, seed):
+    if np is not None:
+        rng = np.random.default_rng(seed)
+        return rng.random(n, dtype=np.float32) * 1000, rng.random(n, dtype=np.float32) * 1000
+    rng = random.Random(seed)
+    return array.array("f", (rng.random() * 1000 for _ in range(n))), array.array("f", (rng.random() * 1000 for _ in range(n)))
+
+
+def copyOf(a, double=False):
+    if np is not None:
+        return a.astype(np.float64) if double else a.copy()
+    return array.array("d", a) if double else array.array("f", a)
+
+
+def strided(a):
+    # every point twice, a view of every other element holds the points again
+    if np is not None:
+        return np.repeat(a, 2)[::2]
+    return memoryview(array.array("f", (v for v in a for _ in range(2))))[::2]
+
+
+def asBytes(a):
+    return a.tobytes()
+
+
+def vertices(hx, hy):
+    return sorted(zip(("%f" % v for v in hx), ("%f" % v for v in hy)))
+
+
+def runCli(binDir, x, y, nThreads, workDir):
+    start = time.perf_counter()
+    rawFile = os.path.join(workDir, "points")
+    with open(rawFile, "wb") as f:
+        f.write(asBytes(x))
+        f.write(asBytes(y))
+    writeTime = time.perf_counter() - start
+    outFile = os.path.join(workDir, "hull.txt")
+    start = time.perf_counter()
+    subprocess.run([os.path.join(binDir, "main"), "-f", rawFile, "-o", outFile, "-j", str(nThreads), "-l", "warning"],
+                   check=True, stdout=subprocess.DEVNULL)
+    runTime = time.perf_counter() - start
+    with open(outFile) as f:
+        hull = sorted(tuple(line.strip().split(",")[:2]) for line in f if line.strip())
+    return hull, writeTime, runTime
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bin", default="bin/exec", help="directory of main and of the parallhull module")
+    parser.add_argument("-n", type=int, default=2000000, help="number of points")
+    parser.add_argument("-j", type=int, default=4, help="threads")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    sys.path.insert(0, args.bin)
+    import parallhull
+
+    x, y = genPoints(args.n, args.seed)
+    print("%d points, %d threads, %s arrays" % (args.n, args.j, "numpy" if np is not None else "array.array"))
+
+    with tempfile.TemporaryDirectory() as workDir:
+        expected, writeTime, runTime = runCli(args.bin, x, y, args.j, workDir)
+    print("command line: hull of %d vertices, raw file written in %.3fs, main ran in %.3fs" % (len(expected), writeTime, runTime))
+
+    failures = 0
+
+    def check(name, hull, seconds):
+        nonlocal failures
+        ok = vertices(hull[0], hull[1]) == expected
+        failures += not ok
+        print("%-28s %s  hull of %d vertices in %.3fs" % (name, "ok  " if ok else "FAIL", len(hull[0]), seconds))
+
+    cases = [
+        ("float32 copy=False", lambda: (copyOf(x), copyOf(y)), {"copy": False}),
+        ("float32", lambda: (x, y), {}),
+        ("float64", lambda: (copyOf(x, True), copyOf(y, True)), {}),
+        ("float32 strided", lambda: (strided(x), strided(y)), {}),
+        ("taskhull", lambda: (copyOf(x), copyOf(y)), {"algorithm": "taskhull"}),
+        ("schedule dynamic", lambda: (copyOf(x), copyOf(y)), {"schedule": "dynamic"}),
+    ]
+    for name, inputs, options in cases:
+        cx, cy = inputs()
+        start = time.perf_counter()
+        hull = parallhull.hull(cx, cy, threads=args.j, **options)
+        check(name, hull, time.perf_counter() - start)
+
+    # by default the arrays stay as they were, so the same ones hulled again give the same hull; the indices must point at the
+    # vertices
+    before = asBytes(x) + asBytes(y)
+    for attempt in ("first", "second"):
+        start = time.perf_counter()
+        check("same arrays, %s hull" % attempt, parallhull.hull(x, y, threads=args.j), time.perf_counter() - start)
+        if asBytes(x) + asBytes(y) != before:
+            failures += 1
+            print("the %s hull modified its input        FAIL" % attempt)
+    start = time.perf_counter()
+    hx, hy, hi = parallhull.hull(x, y, threads=args.j, indices=True)
+    seconds = time.perf_counter() - start
+    if any((x[i] != vx) or (y[i] != vy) for i, vx, vy in zip(hi, hx, hy)):
+        failures += 1
+        print("indices do not point at the vertices         FAIL")
+    check("indices", (hx, hy), seconds)
+
+    if failures:
+        print("%d checks failed" % failures)
+        sys.exit(1)
+    print("All checks passed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,107 @@
+"""Checks the convex layers of the command line (--layers) on integer grid points against a monotone chain in Python.
+
+    python3 pyScripts/testLayers.py [--bin bin/exec] [-n 30000] [--side 200] [-j 3]
+
+Build first with `make bin/exec/main_nompi MODE=exec`. Random points on a SIDExSIDE integer grid have many collinear and repeated
+points: a layer is made of the strict vertices of the hull of the points left, one point per coordinates, so the layers must be
+the same for 1 and -j threads and the same as the ones of the reference, which peels the points sorted once.
+"""
+import argparse
+import array
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def cross(o, a, b):
+    return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0])
+
+
+def referenceLayers(points):
+    # points sorted by x then y: every layer is the monotone chain of the points left, the first copy of a repeated point is taken
+    pts = sorted(points)
+    layers = []
+    while pts:
+        unique = [p for i, p in enumerate(pts) if (i == 0) or (p != pts[i - 1])]
+        if len(unique) < 3:
+            hull = unique
+        else:
+            lower, upper = [], []
+            for p in unique:
+                while (len(lower) >= 2) and (cross(lower[-2], lower[-1], p) <= 0):
+                    lower.pop()
+                lower.append(p)
+            for p in reversed(unique):
+                while (len(upper) >= 2) and (cross(upper[-2], upper[-1], p) <= 0):
+                    upper.pop()
+                upper.append(p)
+            hull = lower[:-1] + upper[:-1]
+            if len(hull) < 3: # collinear points: the two ends of the segment
+                hull = [unique[0], unique[-1]]
+        layers.append(sorted(hull))
+        taken = set(hull)
+        rest = []
+        for p in pts:
+            if p in taken:
+                taken.discard(p)
+            else:
+                rest.append(p)
+        pts = rest
+    return layers
+
+
+def runLayers(binDir, rawFile, nThreads, workDir):
+    outFile = os.path.join(workDir, "layers%d.txt" % nThreads)
+    start = time.perf_counter()
+    subprocess.run([os.path.join(binDir, "main_nompi"), "-f", rawFile, "--layers", "-o", outFile, "-j", str(nThreads), "-l", "error"],
+                   check=True, stdout=subprocess.DEVNULL)
+    seconds = time.perf_counter() - start
+    layers = []
+    with open(outFile) as f:
+        for line in f:
+            if line.startswith("#"):
+                layers.append([])
+            elif line.strip():
+                x, y = line.strip().split(",")[:2]
+                layers[-1].append((float(x), float(y)))
+    return [sorted(layer) for layer in layers], seconds
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bin", default="bin/exec", help="directory of main_nompi")
+    parser.add_argument("-n", type=int, default=30000, help="number of points")
+    parser.add_argument("--side", type=int, default=200, help="coordinates from 0 to SIDE-1")
+    parser.add_argument("-j", type=int, default=3, help="threads of the run compared with the single threaded one")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    points = [(float(rng.randrange(args.side)), float(rng.randrange(args.side))) for _ in range(args.n)]
+    expected = referenceLayers(points)
+    print("%d points on a %dx%d grid, %d layers" % (args.n, args.side, args.side, len(expected)))
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as workDir:
+        rawFile = os.path.join(workDir, "points")
+        with open(rawFile, "wb") as f:
+            f.write(array.array("f", (p[0] for p in points)).tobytes())
+            f.write(array.array("f", (p[1] for p in points)).tobytes())
+        for nThreads in sorted({1, args.j}):
+            layers, seconds = runLayers(args.bin, rawFile, nThreads, workDir)
+            bad = [i for i in range(max(len(layers), len(expected))) if (i >= len(layers)) or (i >= len(expected)) or (layers[i] != expected[i])]
+            failures += len(bad) > 0
+            print("%2d threads  %s  %d layers in %.3fs%s" % (nThreads, "FAIL" if bad else "ok  ", len(layers), seconds,
+                                                       ", first wrong layer %d" % (bad[0] + 1) if bad else ""))
+
+    if failures:
+        print("%d checks failed" % failures)
+        sys.exit(1)
+    print("All checks passed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,89 @@
+"""Checks that the sample hull prefilter never drops a hull vertex, on circle data where every point is close to the hull.
+
+    python3 pyScripts/testPrefilter.py [--bin bin/exec] [-n 200000] [--seed 7] [--np 3 4] [-j 3]
+
+Build first with `make build MODE=exec` and `make bin/exec/main_nompi MODE=exec`. gendata writes a circle, main runs on it through
+mpirun and main_nompi with threads, with the default prefilter and with --sample 0, and every hull must be the one of a monotone
+chain in Python. On a circle the hull vertices next to a vertex of the sample hull are outside its edges by less than the rounding
+of the coverage test, which is where a prefilter that is not conservative loses them.
+"""
+import argparse
+import array
+import os
+import shlex
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def cross(o, a, b):
+    return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0])
+
+
+def referenceHull(points):
+    # strict vertices, formatted like the output of main
+    pts = sorted(set(points))
+    lower, upper = [], []
+    for p in pts:
+        while (len(lower) >= 2) and (cross(lower[-2], lower[-1], p) <= 0):
+            lower.pop()
+        lower.append(p)
+    for p in reversed(pts):
+        while (len(upper) >= 2) and (cross(upper[-2], upper[-1], p) <= 0):
+            upper.pop()
+        upper.append(p)
+    return {"%f,%f" % p for p in lower[:-1] + upper[:-1]}
+
+
+def runHull(cmd, outFile):
+    start = time.perf_counter()
+    subprocess.run(cmd + ["-o", outFile, "-l", "error"], check=True, stdout=subprocess.DEVNULL)
+    seconds = time.perf_counter() - start
+    with open(outFile) as f:
+        lines = [",".join(line.strip().split(",")[:2]) for line in f if line.strip()]
+    return lines, seconds
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bin", default="bin/exec", help="directory of main and gendata")
+    parser.add_argument("-n", type=int, default=200000, help="number of points")
+    parser.add_argument("--seed", type=int, default=7)
+    parser.add_argument("--np", type=int, nargs="+", default=[3, 4], help="numbers of ranks")
+    parser.add_argument("-j", type=int, default=3, help="threads of main_nompi")
+    parser.add_argument("--mpirun", default="mpirun --oversubscribe" + (" --allow-run-as-root" if os.geteuid() == 0 else ""))
+    args = parser.parse_args()
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as workDir:
+        rawFile = os.path.join(workDir, "circle")
+        subprocess.run([os.path.join(args.bin, "gendata"), "-d", "circle", "-n", str(args.n), "-s", str(args.seed), "-o", rawFile],
+                       check=True, stdout=subprocess.DEVNULL)
+        coords = array.array("f")
+        with open(rawFile, "rb") as f:
+            coords.frombytes(f.read())
+        n = len(coords) // 2
+        expected = referenceHull(zip(coords[:n], coords[n:]))
+        print("%d circle points, %d hull vertices" % (n, len(expected)))
+
+        runs = [("%2d ranks  " % ranks, shlex.split(args.mpirun) + ["-np", str(ranks), os.path.join(args.bin, "main"), "-f", rawFile]) for ranks in args.np]
+        runs.append(("%2d threads" % args.j, [os.path.join(args.bin, "main_nompi"), "-f", rawFile, "-j", str(args.j)]))
+        for name, cmd in runs:
+            for sample in (None, 0):
+                if sample is not None:
+                    cmd = cmd + ["--sample", str(sample)]
+                lines, seconds = runHull(cmd, os.path.join(workDir, "hull.txt"))
+                ok = (len(lines) == len(expected)) and (set(lines) == expected)
+                failures += not ok
+                print("%s %-12s %s  %d vertices in %.3fs%s" % (name, "--sample 0" if sample is not None else "prefilter", "ok  " if ok else "FAIL",
+                                                            len(lines), seconds, "" if ok else ", %d missing" % len(expected - set(lines))))
+
+    if failures:
+        print("%d checks failed" % failures)
+        sys.exit(1)
+    print("All checks passed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,440 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+#ifndef NON_MPI_MODE
+    #include <mpi.h>
+#endif
+
+#define APPROX_SAMPLE_SIZE 4096 // strided sample of its slice a thread hulls to build its filter polygon
+#define APPROX_TILE_POINTS 4096 // points masked at once by the filter, the outside ones are copied while still in L1
+#define APPROX_MAX_DEPTH 40 // bisections of a wedge, 40 leave an angle of pi/2^41 between its directions: well below float precision
+
+// Epsilon-approximate hull (--approx): the extreme points along a set of directions sorted by angle form a convex polygon P
+// inside the hull H, and H is inside the intersection of the supporting half-planes of the directions. Between two
+// consecutive directions H can only stick out of P inside the triangle made by the two extreme points and the intersection of
+// their supporting lines, so the distance of the apex from the edge of P bounds the error.
+// A fixed set of k directions would need D/2 tan(pi/k) <= eps for a diameter D, which is far too pessimistic for real data
+// (k in the hundred thousands for eps=1e-5 D). The directions are chosen per wedge instead: starting from the 4 axis directions,
+// a wedge whose triangle is taller than eps is split by its bisector and the extreme point along it, until every triangle is
+// within eps or no point is left outside the edge.
+// Every thread reads its slice once: a strided sample is hulled and the slice is masked against it (hullQueryMask), a point
+// inside the sample hull can not be extreme along any direction, so only the few outside ones are copied as candidates for the
+// refinement. The hulls of the threads, and of the ranks (mpiHullMerge), are merged exactly: the hull of the union of hulls
+// each within eps of the hull of its own points is within eps of the hull of all of them
+
+typedef struct
+{
+    Data pts; // slice of the thread
+    double eps;
+    Data hull;
+    double bound;
+    ProcThreadIDCombo id;
+} ApproxThreadData;
+
+typedef struct
+{
+    float x, y;
+    PointIndex i; // when the candidates have indices
+} ApproxVertex;
+
+typedef struct
+{
+    Data *c; // candidates
+    double eps;
+    Data out; // vertices, in order
+} ApproxRefine;
+
+static void *approxThread(void *arg);
+static Data sliceCandidates(ApproxThreadData *th);
+static Data candidatesHull(Data *cand, double eps, double *bound, ProcThreadIDCombo *id);
+static inline void emitVertex(ApproxRefine *r, const ApproxVertex *v);
+static size_t partitionOutside(Data *c, size_t lo, size_t hi, const ApproxVertex *a, const ApproxVertex *b);
+static double refineWedge(ApproxRefine *r, const ApproxVertex *a, const ApproxVertex *b, double uax, double uay, double sa, double ubx, double uby, double sb, size_t lo, size_t hi, int depth);
+static double apexDistance(double uax, double uay, double sa, double ubx, double uby, double sb, double ax, double ay, double bx, double by);
+static Data extremesPolygon(const float *X, const float *Y, const PointIndex *I, size_t k);
+
+// Hull within eps (in the units of the coordinates) of the hull of the points of the rank, d is left untouched. errorBound gets
+// the distance guaranteed between the returned hull and the exact one, the largest among the ranks under MPI (collective then)
+Data approxHull(Data *d, double eps, int nThreads, int procID, double *errorBound)
+{
+    if (nThreads < 1)
+        nThreads = 1;
+    if (nThreads > MAX_THREADS)
+        nThreads = MAX_THREADS;
+    if (d->n < APPROX_SAMPLE_SIZE * (size_t)nThreads)
+        nThreads = (int)(d->n / APPROX_SAMPLE_SIZE) + 1;
+
+    pthread_t threads[MAX_THREADS];
+    ApproxThreadData ds[MAX_THREADS];
+    for (int i = 0; i < nThreads; i++)
+    {
+        size_t first = d->n * i / nThreads;
+        size_t last = d->n * (i+1) / nThreads;
+        ds[i].pts.n = last - first;
+        ds[i].pts.X = &d->X[first];
+        ds[i].pts.Y = &d->Y[first];
+        ds[i].pts.I = d->I == NULL ? NULL : &d->I[first];
+        ds[i].eps = eps;
+        ds[i].id.p = procID;
+        ds[i].id.t = i;
+        pthread_create(&threads[i], NULL, approxThread, (void*)&ds[i]);
+    }
+    for (int i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    // the hulls of the threads are merged as candidates of one more refinement
+    Data hull = ds[0].hull;
+    double bound = ds[0].bound;
+    if (nThreads > 1)
+    {
+        size_t total = 0;
+        for (int i = 0; i < nThreads; i++)
+            total += ds[i].hull.n;
+        Data all = { .n=0, .I=NULL };
+        all.X = malloc(total * sizeof(float) + MALLOC_PADDING);
+        all.Y = malloc(total * sizeof(float) + MALLOC_PADDING);
+        if (d->I != NULL)
+            all.I = malloc(total * sizeof(PointIndex) + MALLOC_PADDING);
+        if ((all.X == NULL) || (all.Y == NULL) || ((d->I != NULL) && (all.I == NULL)))
+            throwError("p[%2d] approxHull: Failed to allocate memory for the %ld vertices of the thread hulls", procID, total);
+        double threadsBound = 0;
+        for (int i = 0; i < nThreads; i++)
+        {
+            memcpy(&all.X[all.n], ds[i].hull.X, ds[i].hull.n * sizeof(float));
+            memcpy(&all.Y[all.n], ds[i].hull.Y, ds[i].hull.n * sizeof(float));
+            if (d->I != NULL)
+                memcpy(&all.I[all.n], ds[i].hull.I, ds[i].hull.n * sizeof(PointIndex));
+            all.n += ds[i].hull.n;
+            threadsBound = fmax(threadsBound, ds[i].bound);
+            free(ds[i].hull.X);
+            free(ds[i].hull.Y);
+            free(ds[i].hull.I);
+        }
+        // with eps=0 only the depth limit of the bisection can leave a (tiny) error, on top of the one of the threads
+        hull = candidatesHull(&all, 0, &bound, &ds[0].id);
+        bound += threadsBound;
+        free(all.X);
+        free(all.Y);
+        free(all.I);
+    }
+
+    #ifndef NON_MPI_MODE
+        int MPIErrCode = MPI_Allreduce(MPI_IN_PLACE, &bound, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        if (MPIErrCode != MPI_SUCCESS)
+            throwError("p[%2d] approxHull: Got error %d on reducing the error bound", procID, MPIErrCode);
+    #endif
+    if (bound > eps)
+        LOG(LOG_LVL_WARN, "p[%2d] approxHull: eps=%e is below the precision of the coordinates, the bound reached is %e", procID, eps, bound);
+    LOG(LOG_LVL_INFO, "p[%2d] approxHull: %ld vertices within %e of the exact hull (eps=%e)", procID, hull.n, bound, eps);
+
+    *errorBound = bound;
+    return hull;
+}
+
+static void *approxThread(void *arg)
+{
+    ApproxThreadData *th = (ApproxThreadData*)arg;
+    th->bound = 0;
+    if (th->pts.n == 0)
+    {
+        th->hull = (Data){ .n=0, .X=NULL, .Y=NULL, .I=NULL };
+        return NULL;
+    }
+
+    Data cand = sliceCandidates(th);
+    LOG(LOG_LVL_DEBUG, "p[%2d] t[%3d] approxThread: %ld candidates out of %ld points", th->id.p, th->id.t, cand.n, th->pts.n);
+    th->hull = candidatesHull(&cand, th->eps, &th->bound, &th->id);
+
+    free(cand.X);
+    free(cand.Y);
+    free(cand.I);
+    return NULL;
+}
+
+// the points of the slice that may be extreme along some direction: the vertices of the hull of a strided sample and the points
+// outside it. All the points when the sample hull is degenerate
+static Data sliceCandidates(ApproxThreadData *th)
+{
+    Data *pts = &th->pts;
+    size_t n = pts->n;
+    size_t sampleSize = n < APPROX_SAMPLE_SIZE ? n : APPROX_SAMPLE_SIZE;
+
+    Data sample = { .n=sampleSize, .I=NULL };
+    sample.X = malloc(sampleSize * 2 * sizeof(float) + MALLOC_PADDING);
+    if (pts->I != NULL)
+        sample.I = malloc(sampleSize * sizeof(PointIndex) + MALLOC_PADDING);
+    if ((sample.X == NULL) || ((pts->I != NULL) && (sample.I == NULL)))
+        throwError("p[%2d] t[%3d] sliceCandidates: Failed to allocate memory for the sample", th->id.p, th->id.t);
+    sample.Y = &sample.X[sampleSize];
+    for (size_t s = 0; s < sampleSize; s++)
+    {
+        size_t i = s * n / sampleSize;
+        sample.X[s] = pts->X[i];
+        sample.Y[s] = pts->Y[i];
+        if (pts->I != NULL)
+            sample.I[s] = pts->I[i];
+    }
+    Data sampleH = quickhull(&sample, &th->id);
+    free(sample.X);
+    free(sample.I);
+    bool filter = (sampleH.n >= 3) && (sampleSize < n);
+
+    size_t allocated = filter ? sampleH.n + n / 64 + APPROX_TILE_POINTS : n;
+    Data cand = { .n=0, .I=NULL };
+    cand.X = malloc(allocated * sizeof(float) + MALLOC_PADDING);
+    cand.Y = malloc(allocated * sizeof(float) + MALLOC_PADDING);
+    if (pts->I != NULL)
+        cand.I = malloc(allocated * sizeof(PointIndex) + MALLOC_PADDING);
+    if ((cand.X == NULL) || (cand.Y == NULL) || ((pts->I != NULL) && (cand.I == NULL)))
+        throwError("p[%2d] t[%3d] sliceCandidates: Failed to allocate memory for %ld candidates", th->id.p, th->id.t, allocated);
+
+    if (!filter)
+    {
+        memcpy(cand.X, pts->X, n * sizeof(float));
+        memcpy(cand.Y, pts->Y, n * sizeof(float));
+        if (pts->I != NULL)
+            memcpy(cand.I, pts->I, n * sizeof(PointIndex));
+        cand.n = n;
+        free(sampleH.X);
+        free(sampleH.Y);
+        free(sampleH.I);
+        return cand;
+    }
+
+    // the vertices of the sample hull are inside the mask (on its boundary), yet they may be extreme
+    memcpy(cand.X, sampleH.X, sampleH.n * sizeof(float));
+    memcpy(cand.Y, sampleH.Y, sampleH.n * sizeof(float));
+    if (pts->I != NULL)
+        memcpy(cand.I, sampleH.I, sampleH.n * sizeof(PointIndex));
+    cand.n = sampleH.n;
+
+    HullQuery q = hullQueryBuild(&sampleH, th->id.p);
+    uint64_t mask[APPROX_TILE_POINTS / 64];
+    for (size_t tile = 0; tile < n; tile += APPROX_TILE_POINTS)
+    {
+        size_t count = n - tile < APPROX_TILE_POINTS ? n - tile : APPROX_TILE_POINTS;
+        Data tilePts = { .n=count, .X=&pts->X[tile], .Y=&pts->Y[tile], .I=NULL };
+        hullQueryMask(&q, &tilePts, mask);
+
+        if (cand.n + count > allocated)
+        {
+            allocated = 2 * allocated < n ? 2 * allocated : n + sampleH.n;
+            cand.X = realloc(cand.X, allocated * sizeof(float) + MALLOC_PADDING);
+            cand.Y = realloc(cand.Y, allocated * sizeof(float) + MALLOC_PADDING);
+            if (pts->I != NULL)
+                cand.I = realloc(cand.I, allocated * sizeof(PointIndex) + MALLOC_PADDING);
+            if ((cand.X == NULL) || (cand.Y == NULL) || ((pts->I != NULL) && (cand.I == NULL)))
+                throwError("p[%2d] t[%3d] sliceCandidates: Failed to allocate memory for %ld candidates", th->id.p, th->id.t, allocated);
+        }
+        for (size_t w = 0; w * 64 < count; w++)
+        {
+            uint64_t bits = ~mask[w];
+            if (count - w * 64 < 64)
+                bits &= (1UL << (count - w * 64)) - 1;
+            while (bits)
+            {
+                size_t i = tile + w * 64 + __builtin_ctzll(bits);
+                cand.X[cand.n] = pts->X[i];
+                cand.Y[cand.n] = pts->Y[i];
+                if (pts->I != NULL)
+                    cand.I[cand.n] = pts->I[i];
+                cand.n++;
+                bits &= bits - 1;
+            }
+        }
+    }
+
+    hullQueryFree(&q);
+    free(sampleH.X);
+    free(sampleH.Y);
+    free(sampleH.I);
+    return cand;
+}
+
+// approximate hull of the candidates, which are reordered: the extremes along the 4 axis directions, then every wedge between
+// two of them is refined
+static Data candidatesHull(Data *cand, double eps, double *bound, ProcThreadIDCombo *id)
+{
+    static const double ux[4] = { 0, 1, 0, -1 }, uy[4] = { -1, 0, 1, 0 };
+    const float *X = cand->X, *Y = cand->Y;
+    size_t m = cand->n;
+
+    ApproxVertex e[5];
+    double s[5];
+    for (int j = 0; j < 4; j++)
+    {
+        size_t best = 0;
+        s[j] = -DBL_MAX;
+        for (size_t i = 0; i < m; i++)
+        {
+            double dot = ux[j] * X[i] + uy[j] * Y[i];
+            if (dot > s[j])
+            {
+                s[j] = dot;
+                best = i;
+            }
+        }
+        e[j] = (ApproxVertex){ .x=X[best], .y=Y[best], .i=cand->I == NULL ? 0 : cand->I[best] };
+    }
+    e[4] = e[0];
+    s[4] = s[0];
+
+    ApproxRefine r = { .c=cand, .eps=eps, .out={ .n=0, .I=NULL } };
+    r.out.X = malloc((m + 4) * sizeof(float) + MALLOC_PADDING);
+    r.out.Y = malloc((m + 4) * sizeof(float) + MALLOC_PADDING);
+    if (cand->I != NULL)
+        r.out.I = malloc((m + 4) * sizeof(PointIndex) + MALLOC_PADDING);
+    if ((r.out.X == NULL) || (r.out.Y == NULL) || ((cand->I != NULL) && (r.out.I == NULL)))
+        throwError("p[%2d] t[%3d] candidatesHull: Failed to allocate memory for %ld vertices", id->p, id->t, m + 4);
+
+    // a point outside the quadrilateral is outside exactly one of its edges (the triangles of the wedges are disjoint): the
+    // candidates outside every edge are moved in front of the ones left, the ones inside all of them stay at the end
+    *bound = 0;
+    size_t lo = 0;
+    for (int j = 0; j < 4; j++)
+    {
+        size_t count = partitionOutside(cand, lo, m, &e[j], &e[j+1]);
+        emitVertex(&r, &e[j]);
+        double b = refineWedge(&r, &e[j], &e[j+1], ux[j], uy[j], s[j], ux[(j+1) & 3], uy[(j+1) & 3], s[j+1], lo, lo + count, 0);
+        *bound = fmax(*bound, b);
+        lo += count;
+    }
+
+    Data hull = extremesPolygon(r.out.X, r.out.Y, r.out.I, r.out.n);
+    free(r.out.X);
+    free(r.out.Y);
+    free(r.out.I);
+    return hull;
+}
+
+static inline void emitVertex(ApproxRefine *r, const ApproxVertex *v)
+{
+    r->out.X[r->out.n] = v->x;
+    r->out.Y[r->out.n] = v->y;
+    if (r->out.I != NULL)
+        r->out.I[r->out.n] = v->i;
+    r->out.n++;
+}
+
+// moves the candidates in [lo, hi) strictly outside the edge a->b in front, returns how many they are
+static size_t partitionOutside(Data *c, size_t lo, size_t hi, const ApproxVertex *a, const ApproxVertex *b)
+{
+    double ex = (double)b->x - a->x, ey = (double)b->y - a->y;
+    size_t out = lo;
+    for (size_t i = lo; i < hi; i++)
+        if (ex * ((double)c->Y[i] - a->y) - ey * ((double)c->X[i] - a->x) < 0)
+        {
+            float t = c->X[out]; c->X[out] = c->X[i]; c->X[i] = t;
+            t = c->Y[out]; c->Y[out] = c->Y[i]; c->Y[i] = t;
+            if (c->I != NULL)
+            {
+                PointIndex ti = c->I[out]; c->I[out] = c->I[i]; c->I[i] = ti;
+            }
+            out++;
+        }
+    return out - lo;
+}
+
+// wedge between the directions ua and ub, with extreme points a and b and supports sa and sb. The candidates in [lo, hi) are the
+// ones outside the edge a->b (all in the triangle of the wedge), they are reordered. The vertices strictly between a and b are
+// appended to r->out, the bound reached in the wedge is returned
+static double refineWedge(ApproxRefine *r, const ApproxVertex *a, const ApproxVertex *b, double uax, double uay, double sa, double ubx, double uby, double sb, size_t lo, size_t hi, int depth)
+{
+    Data *c = r->c;
+    if (lo == hi) // nothing outside the edge: it is an edge of the exact hull
+        return 0;
+    double bound = apexDistance(uax, uay, sa, ubx, uby, sb, a->x, a->y, b->x, b->y);
+    if ((bound <= r->eps) || (depth == APPROX_MAX_DEPTH))
+        return bound;
+
+    double umx = uax + ubx, umy = uay + uby;
+    double len = hypot(umx, umy);
+    umx /= len;
+    umy /= len;
+    double sm = -DBL_MAX;
+    size_t best = lo;
+    for (size_t i = lo; i < hi; i++)
+    {
+        double dot = umx * c->X[i] + umy * c->Y[i];
+        if (dot > sm)
+        {
+            sm = dot;
+            best = i;
+        }
+    }
+    double sam = umx * a->x + umy * a->y, sbm = umx * b->x + umy * b->y;
+    if ((sm <= sam) || (sm <= sbm)) // a or b is the extreme along the bisector: only half of the wedge is left
+    {
+        if (sam >= sbm)
+            return refineWedge(r, a, b, umx, umy, sam, ubx, uby, sb, lo, hi, depth+1);
+        return refineWedge(r, a, b, uax, uay, sa, umx, umy, sbm, lo, hi, depth+1);
+    }
+
+    // m splits the candidates in the ones outside a->m, the ones outside m->b, and the ones inside the triangle a,m,b (dropped)
+    ApproxVertex m = { .x=c->X[best], .y=c->Y[best], .i=c->I == NULL ? 0 : c->I[best] };
+    size_t nLeft = partitionOutside(c, lo, hi, a, &m);
+    size_t nRight = partitionOutside(c, lo + nLeft, hi, &m, b);
+
+    double boundLeft = refineWedge(r, a, &m, uax, uay, sa, umx, umy, sm, lo, lo + nLeft, depth+1);
+    emitVertex(r, &m);
+    double boundRight = refineWedge(r, &m, b, umx, umy, sm, ubx, uby, sb, lo + nLeft, lo + nLeft + nRight, depth+1);
+    return fmax(boundLeft, boundRight);
+}
+
+// distance of the intersection of the supporting lines of the two directions from the segment a-b
+static double apexDistance(double uax, double uay, double sa, double ubx, double uby, double sb, double ax, double ay, double bx, double by)
+{
+    double det = uax * uby - uay * ubx; // sin of the angle between the directions, positive
+    double apexX = (sa * uby - sb * uay) / det;
+    double apexY = (uax * sb - ubx * sa) / det;
+
+    double ex = bx - ax, ey = by - ay;
+    double len2 = ex * ex + ey * ey;
+    double t = len2 > 0 ? ((apexX - ax) * ex + (apexY - ay) * ey) / len2 : 0;
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    return hypot(apexX - ax - t * ex, apexY - ay - t * ey);
+}
+
+// The extreme points in order of direction are the vertices of a convex polygon, CCW, possibly repeated or collinear: strictVertices
+// cleans them into a hull following the quickhull conventions (no collinear vertices, lowest and rightmost vertex first, closing point)
+static Data extremesPolygon(const float *X, const float *Y, const PointIndex *I, size_t k)
+{
+    Data hull;
+    hull.X = malloc((k + 1) * sizeof(float) + MALLOC_PADDING);
+    hull.Y = malloc((k + 1) * sizeof(float) + MALLOC_PADDING);
+    hull.I = I == NULL ? NULL : malloc((k + 1) * sizeof(PointIndex) + MALLOC_PADDING);
+    size_t *stack = malloc(2 * k * sizeof(size_t));
+    if ((hull.X == NULL) || (hull.Y == NULL) || ((I != NULL) && (hull.I == NULL)) || (stack == NULL))
+        throwError("approxHull: Failed to allocate memory for a hull of %ld vertices", k);
+
+    size_t h = strictVertices(X, Y, k, stack);
+    for (size_t i = 0; (h > 0) && (i <= h); i++)
+    {
+        size_t v = stack[i % h];
+        hull.X[i] = X[v];
+        hull.Y[i] = Y[v];
+        if (I != NULL)
+            hull.I[i] = I[v];
+    }
+    free(stack);
+
+    hull.n = h;
+    return hull;
+}
+
+// --output of --approx: the vertices preceded by a "# approx eps=E bound=B" line with the requested and guaranteed error
+void saveApproxHullTxt(Data *hull, double eps, double errorBound, char *fname)
+{
+    FILE *fileptr = fopen(fname, "w");
+    if (fileptr == NULL)
+    {
+        LOG(LOG_LVL_ERROR, "saveApproxHullTxt: Could not open %s", fname);
+        return;
+    }
+    fprintf(fileptr, "# approx eps=%e bound=%e\n", eps, errorBound);
+    writeHullPoints(fileptr, hull);
+    fclose(fileptr);
+}
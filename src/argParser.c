@@ -24,11 +24,39 @@ SUBOPT_BLANKSPACE SUBOPT_LOG_DEBUG "\t\t: Show debug messages and all above\n" \
 SUBOPT_BLANKSPACE SUBOPT_LOG_TRACE "\t\t: Show all messages\n"
 static const char *logLevelStrings[] = { SUBOPT_LOG_ERROR, SUBOPT_LOG_CRITICAL, SUBOPT_LOG_WARNING, SUBOPT_LOG_NOTICE, SUBOPT_LOG_INFO, SUBOPT_LOG_DEBUG, SUBOPT_LOG_TRACE };
 static const int loglvlsCount = sizeof(logLevelStrings)/sizeof(*logLevelStrings);
+static const char *algorithmStrings[] = { "quickhull", "taskhull" };
+static const char *queryFormatStrings[] = { "mask", "points" };
+static const char *scheduleStrings[] = { "static", "dynamic" };
+static const char *inputFormatStrings[] = { "raw", "text" };
 
 enum argpKeys{
     ARGP_FILE='f',
     ARGP_NTHREADS='j',
-    ARGP_LOG_LEVEL='l'
+    ARGP_LOG_LEVEL='l',
+    ARGP_SAMPLE_SIZE='s',
+    ARGP_METRICS='m',
+    ARGP_TRACE='t',
+    ARGP_ALGORITHM='a',
+    ARGP_OUTPUT='o',
+    ARGP_BATCH='b',
+    ARGP_GROUPS='g',
+    ARGP_QUERY='q',
+    ARGP_PERF_COUNTERS=0x100, // long options only
+    ARGP_INDICES,
+    ARGP_DAEMON,
+    ARGP_QUERY_OUTPUT,
+    ARGP_QUERY_FORMAT,
+    ARGP_APPROX,
+    ARGP_TUNE,
+    ARGP_TUNING_CACHE,
+    ARGP_SCHEDULE,
+    ARGP_Q16,
+    ARGP_VERIFY,
+    ARGP_INPUT_FORMAT,
+    ARGP_TEXT_CACHE,
+    ARGP_SUBPROBLEM,
+    ARGP_GRID_CULL,
+    ARGP_LAYERS
 };
 
 error_t argpParser(int key, char *arg, struct argp_state *state);
@@ -39,8 +67,32 @@ Params argParse(int argc, char *argv[])
 {
     static struct argp_option argpOptions[] = {
         { .name="file", .key=ARGP_FILE, .arg="FILENAME", .flags=0, .doc="Location of the file containing the points used calculate the hull\n", .group=1 },
+        { .name="input-format", .key=ARGP_INPUT_FORMAT, .arg="STRING", .flags=0, .doc="Format of --file (DEFAULT=raw)\n raw\t: All the x then all the y, as float32\n text\t: One x,y point per line, as written by --output (CSV with a comma, a semicolon or blanks between x and y, an optional header line). Parsed by all the --threads of every rank\n", .group=1 },
+        { .name="text-cache", .key=ARGP_TEXT_CACHE, .arg=NULL, .flags=0, .doc="With --input-format text, also write the points to the raw FILENAME.raw next to --file, and read that instead of parsing the text again while it is newer than the text\n", .group=1 },
         { .name="threads", .key=ARGP_NTHREADS, .arg="UINT", .flags=0, .doc="Number of threads to use\n", .group=1 },
         { .name="loglvl", .key=ARGP_LOG_LEVEL, .arg="STRING", .flags=0, .doc=LOG_LEVEL_DOC, .group=1 },
+        { .name="sample", .key=ARGP_SAMPLE_SIZE, .arg="UINT", .flags=0, .doc="Number of points sampled by each rank to build the prefilter hull (0 disables the prefilter)\n", .group=1 },
+        { .name="grid-cull", .key=ARGP_GRID_CULL, .arg="CELLS", .flags=OPTION_ARG_OPTIONAL, .doc="Replace the sample prefilter with a grid of CELLSxCELLS cells over the bounding box of all the points (DEFAULT=about 4 points per cell): the points of the cells with occupied cells on their left and on their right, both below and above, are dropped after one counting pass\n", .group=1 },
+        { .name="metrics", .key=ARGP_METRICS, .arg="FILENAME", .flags=0, .doc="Write per-phase metrics of the run (per rank and thread) as a JSON document\n", .group=1 },
+        { .name="trace", .key=ARGP_TRACE, .arg="FILENAME", .flags=0, .doc="Record per-thread begin/end events (quickhull iterations, merges, spin-waits, MPI transfers) and write them as a Chrome/Perfetto trace JSON file\n", .group=1 },
+        { .name="algorithm", .key=ARGP_ALGORITHM, .arg="STRING", .flags=0, .doc="Algorithm used for the hull of each rank (DEFAULT=quickhull)\n quickhull\t: Every thread runs quickhull on a static slice of the points, then the hulls are merged\n taskhull\t: One task-parallel quickhull on all the points of the rank, the outside set of every edge is a task run by a work-stealing pool of threads\n", .group=1 },
+        { .name="schedule", .key=ARGP_SCHEDULE, .arg="STRING", .flags=0, .doc="How the points of a rank are split among the threads of --algorithm quickhull (DEFAULT=static)\n static\t: One contiguous slice per thread\n dynamic\t: Cache-sized chunks claimed by the threads from a shared counter, each thread folds the hulls of its chunks into its own hull. Balances sorted or clustered inputs, where some slices are hulled far faster than others\n", .group=1 },
+        { .name="subproblem", .key=ARGP_SUBPROBLEM, .arg="UINT", .flags=0, .doc="With --schedule static, every thread splits its slice in subproblems of at most UINT points, hulls them one after the other and merges their hulls (0, the default, for a single quickhull per slice). Simulates more CPUs on a single one, see pyScripts/scaling.py\n", .group=1 },
+        { .name="output", .key=ARGP_OUTPUT, .arg="FILENAME", .flags=0, .doc="Write the vertices of the final hull, one x,y line each (x,y,index with --indices)\n", .group=1 },
+        { .name="batch", .key=ARGP_BATCH, .arg="FILENAME", .flags=0, .doc="Hull every file listed in FILENAME (one path per line) with one pool of threads, the results go to --output (stdout if not given) as a \"# line path n=N hull=H\" header followed by the vertices\n", .group=1 },
+        { .name="groups", .key=ARGP_GROUPS, .arg="FILENAME", .flags=0, .doc="Compute one hull per key instead of one hull of all the points. FILENAME is a raw file of one uint32 key per point of --file, in the same order. The results go to --output as a \"# key hull=H\" header followed by the vertices of each group\n", .group=1 },
+        { .name="layers", .key=ARGP_LAYERS, .arg="DEPTH", .flags=OPTION_ARG_OPTIONAL, .doc="Compute the convex layers (onion peeling) instead of one hull: layer 1 is the hull of the points, layer d+1 the hull of the points left without the vertices of layers 1 to d, up to DEPTH layers (DEFAULT=all). The results go to --output as a \"# layer D hull=H\" header followed by the vertices of each layer\n", .group=1 },
+        { .name="daemon", .key=ARGP_DAEMON, .arg="SOCKET", .flags=0, .doc="Serve hull requests on the Unix socket SOCKET with a pool of --threads workers until SIGINT, SIGTERM or a shutdown request. The points are passed in a memfd (see hulldClient.c and the hulldload tool)\n", .group=1 },
+        { .name="approx", .key=ARGP_APPROX, .arg="EPS", .flags=0, .doc="Compute a hull within EPS (in the units of the coordinates) of the exact one from the extreme points along directions refined until every gap is within EPS, in one pass over the points. The bound actually reached is logged and written at the top of --output\n", .group=1 },
+        { .name="query", .key=ARGP_QUERY, .arg="FILENAME", .flags=0, .doc="Once the hull of --file is computed, classify the points of FILENAME (same format as --file) as inside or outside of it\n", .group=1 },
+        { .name="query-output", .key=ARGP_QUERY_OUTPUT, .arg="FILENAME", .flags=0, .doc="Write the result of --query to FILENAME in the --query-format format\n", .group=1 },
+        { .name="query-format", .key=ARGP_QUERY_FORMAT, .arg="STRING", .flags=0, .doc="Format of --query-output (DEFAULT=mask)\n mask\t: One bit per query point, set when the point is inside the hull or on its boundary, as raw uint64 words (bit i of word w is point 64*w+i)\n points\t: The points inside, as a raw file in the format of --file\n", .group=1 },
+        { .name="q16", .key=ARGP_Q16, .arg=NULL, .flags=0, .doc="Read --file through its quantized companion FILENAME.q16 (written by gendata --q16 or --companion): the points whose 16 bit cell is surely inside a seed hull built from the extreme points of the blocks are culled without reading their exact coordinates, replacing the sample prefilter\n", .group=1 },
+        { .name="verify", .key=ARGP_VERIFY, .arg=NULL, .flags=0, .doc="Verify the final hull before writing it: convexity with one scan of its vertices, coverage with a threaded pass of every rank over its own part of --file. A failure ends the run with an error\n", .group=1 },
+        { .name="indices", .key=ARGP_INDICES, .arg=NULL, .flags=0, .doc="Track the position in the input file of every point, so that the hull reports which input points are its vertices\n", .group=1 },
+        { .name="tune", .key=ARGP_TUNE, .arg=NULL, .flags=0, .doc="Time the variants of the coverage kernel and of the quickhull iteration on this machine and store the fastest in the tuning cache, which later runs load at startup. Run it once on every node type\n", .group=1 },
+        { .name="tuning-cache", .key=ARGP_TUNING_CACHE, .arg="FILENAME", .flags=0, .doc="Tuning cache written by --tune and read at startup, one line per CPU model (DEFAULT=$XDG_CACHE_HOME/parallhull_tuning, or ~/.cache/parallhull_tuning)\n", .group=1 },
+        { .name="perf-counters", .key=ARGP_PERF_COUNTERS, .arg=NULL, .flags=0, .doc="Sample hardware counters (cycles, instructions, LLC misses, branch misses) per phase and thread with perf_event_open\n", .group=1 },
         { 0 }
     };
 
@@ -51,10 +103,36 @@ Params argParse(int argc, char *argv[])
 
     Params p = {
         .inputFile={0},
+        .inputFormat=INPUT_FORMAT_RAW,
+        .textCache=false,
+        .metricsFile={0},
+        .traceFile={0},
+        .perfCounters=false,
+        .trackIndices=false,
+        .outputFile={0},
+        .batchFile={0},
+        .groupsFile={0},
+        .daemonSocket={0},
+        .queryFile={0},
+        .queryOutput={0},
+        .queryFormat=QUERY_FORMAT_MASK,
+        .approxEps=0,
+        .tune=false,
+        .tuningCache={0},
+        .q16=false,
+        .verify=false,
+        .algorithm=ALGORITHM_QUICKHULL,
+        .schedule=SCHEDULE_STATIC,
+        .subproblemSize=0,
         .logLevel=LOG_LVL_INFO,
         .nProcs=-1,
         .nThreads=1,
-        .procID=-1
+        .procID=-1,
+        .prefilterSampleSize=PREFILTER_DEFAULT_SAMPLE_SIZE,
+        .gridCull=false,
+        .gridCells=0,
+        .layers=false,
+        .layersDepth=0
     };
     argp_parse(&argpData, argc, argv, 0, 0, &p);
 
@@ -80,12 +158,147 @@ error_t argpParser(int key, char *arg, struct argp_state *state)
         p->nThreads = parseUint(arg, 0, "nThreads");
         break;
 
+    case ARGP_SAMPLE_SIZE:
+        p->prefilterSampleSize = parseUint(arg, 0, "sample");
+        break;
+
+    case ARGP_GRID_CULL:
+        p->gridCull = true;
+        if (arg != NULL)
+            p->gridCells = parseUint(arg, 0, "grid-cull");
+        if ((arg != NULL) && ((p->gridCells < 3) || (p->gridCells > GRID_CULL_MAX_CELLS)))
+            throwError("grid-cull: the grid must have from 3 to %d cells per side", GRID_CULL_MAX_CELLS);
+        break;
+
+    case ARGP_LAYERS:
+        p->layers = true;
+        if (arg != NULL)
+            p->layersDepth = parseUint(arg, 0, "layers");
+        break;
+
+    case ARGP_METRICS:
+        strncpy(p->metricsFile, arg, 999);
+        break;
+
+    case ARGP_TRACE:
+        strncpy(p->traceFile, arg, 999);
+        break;
+
+    case ARGP_ALGORITHM:
+        parseEnumOption(arg, (int*)&p->algorithm, algorithmStrings, 0, ALGORITHM_COUNT, "algorithm");
+        break;
+
+    case ARGP_SCHEDULE:
+        parseEnumOption(arg, (int*)&p->schedule, scheduleStrings, 0, SCHEDULE_COUNT, "schedule");
+        break;
+
+    case ARGP_INPUT_FORMAT:
+        parseEnumOption(arg, (int*)&p->inputFormat, inputFormatStrings, 0, INPUT_FORMAT_COUNT, "input-format");
+        break;
+
+    case ARGP_TEXT_CACHE:
+        p->textCache = true;
+        break;
+
+    case ARGP_SUBPROBLEM:
+    {
+        char *endPtr;
+        double size = strtod(arg, &endPtr); // scientific notation like 1e5 is accepted
+        if ((*endPtr != 0) || (size < 0) || (size != (size_t)size))
+            throwError("subproblem: \"%s\" is not a valid number of points", arg);
+        p->subproblemSize = (size_t)size;
+        break;
+    }
+
+    case ARGP_PERF_COUNTERS:
+        p->perfCounters = true;
+        break;
+
+    case ARGP_INDICES:
+        p->trackIndices = true;
+        break;
+
+    case ARGP_Q16:
+        p->q16 = true;
+        break;
+
+    case ARGP_VERIFY:
+        p->verify = true;
+        break;
+
+    case ARGP_DAEMON:
+        if (strlen(arg) >= sizeof(p->daemonSocket))
+        {
+            LOG(LOG_LVL_ERROR, "Socket path \"%s\" is longer than %ld characters", arg, sizeof(p->daemonSocket) - 1);
+            return ARGP_ERR_UNKNOWN;
+        }
+        strcpy(p->daemonSocket, arg);
+        break;
+
+    case ARGP_OUTPUT:
+        strncpy(p->outputFile, arg, 999);
+        break;
+
+    case ARGP_BATCH:
+        if (access(arg, R_OK))
+        {
+            LOG(LOG_LVL_ERROR, "Manifest \"%s\" cannot be accessed or does not exist", arg);
+            return ARGP_ERR_UNKNOWN;
+        }
+        strncpy(p->batchFile, arg, 999);
+        break;
+
+    case ARGP_GROUPS:
+        if (access(arg, R_OK))
+        {
+            LOG(LOG_LVL_ERROR, "Keys file \"%s\" cannot be accessed or does not exist", arg);
+            return ARGP_ERR_UNKNOWN;
+        }
+        strncpy(p->groupsFile, arg, 999);
+        break;
+
+    case ARGP_APPROX:
+    {
+        char *endPtr;
+        p->approxEps = strtod(arg, &endPtr);
+        if ((*endPtr != 0) || !(p->approxEps > 0))
+            throwError("approx: \"%s\" is not a valid positive tolerance", arg);
+        break;
+    }
+
+    case ARGP_TUNE:
+        p->tune = true;
+        break;
+
+    case ARGP_TUNING_CACHE:
+        strncpy(p->tuningCache, arg, 999);
+        break;
+
+    case ARGP_QUERY:
+        if (access(arg, R_OK))
+        {
+            LOG(LOG_LVL_ERROR, "Query file \"%s\" cannot be accessed or does not exist", arg);
+            return ARGP_ERR_UNKNOWN;
+        }
+        strncpy(p->queryFile, arg, 999);
+        break;
+
+    case ARGP_QUERY_OUTPUT:
+        strncpy(p->queryOutput, arg, 999);
+        break;
+
+    case ARGP_QUERY_FORMAT:
+        parseEnumOption(arg, (int*)&p->queryFormat, queryFormatStrings, 0, QUERY_FORMAT_COUNT, "query-format");
+        break;
+
     case ARGP_LOG_LEVEL:
         parseEnumOption(arg, (int*)&p->logLevel, logLevelStrings, 0, loglvlsCount, "loglvl");
         setLogLevel(p->logLevel);
         break;
     
     case ARGP_KEY_END:
+        if (p->q16 && (p->inputFormat == INPUT_FORMAT_TEXT))
+            throwError("--q16 reads the companion of a raw file, it cannot be used with --input-format text");
         break;
     default:
         return ARGP_ERR_UNKNOWN;
@@ -0,0 +1,471 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <pthread.h>
+#ifndef NON_MPI_MODE
+    #include <mpi.h>
+#endif
+
+#define BATCH_LARGE_FILE_POINTS (1UL << 20) // files with at least this many points are split among all the workers
+#define BATCH_MIN_CHUNK_POINTS (1UL << 16) // smallest chunk of a large file hulled by one worker
+#define BATCH_CHUNKS_PER_THREAD 4 // chunks of a large file per worker, the idle workers take more of them
+
+// Batch mode (--batch): the files of a manifest are hulled by a pool of workers created once. A reader thread prefetches
+// the next files into recycled buffers while the workers hull the current ones. Small files are hulled by a single worker
+// with quickhull, large files are split in chunks taken by every worker that is free, the last one merges their hulls
+
+typedef struct BatchFile
+{
+    size_t line; // position in the manifest
+    const char *path;
+    bool readFailed;
+    Data d;
+    size_t capacity; // points that fit in the buffers of d, which are reused by the next files
+    double startTime;
+
+    // large files only
+    size_t nChunks;
+    size_t nextChunk; // protected by the batch mutex
+    size_t doneChunks; // atomic
+    Data *hulls;
+
+    struct BatchFile *next;
+} BatchFile;
+
+typedef struct
+{
+    char **paths;
+    size_t nPaths;
+    bool trackIndices;
+    int rank;
+    int nProcs;
+    int nThreads;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t readyCond; // a file was read, a large file has chunks or the reader is done
+    pthread_cond_t freeCond; // a buffer was recycled
+    BatchFile *readyHead, *readyTail;
+    BatchFile *freeList;
+    size_t nBuffers;
+    size_t maxBuffers; // files in flight: read, being hulled or waiting for a worker
+    BatchFile *large; // large file that still has chunks to hand out
+    bool readerDone;
+
+    pthread_mutex_t outMutex;
+    FILE *out;
+    size_t nHulled, nFailed;
+} Batch;
+
+typedef struct
+{
+    Batch *b;
+    ProcThreadIDCombo id;
+} BatchWorker;
+
+static void *batchReader(void *arg);
+static void *batchWorker(void *arg);
+static bool readBatchFile(BatchFile *f, bool trackIndices);
+static void hullChunk(Batch *b, BatchFile *f, size_t chunk, ProcThreadIDCombo *id);
+static void writeResult(Batch *b, BatchFile *f, Data *hull);
+static void recycle(Batch *b, BatchFile *f);
+static char **readManifest(const char *fname, size_t *nPaths);
+
+void runBatch(Params *p, int rank, int nProcs)
+{
+    double startTime = getTime();
+
+    if (p->nThreads > MAX_THREADS)
+        throwError("p[%2d] runBatch: At most %d threads are supported", rank, MAX_THREADS);
+    if (nProcs < 1)
+        nProcs = 1;
+
+    Batch b = {
+        .trackIndices=p->trackIndices,
+        .rank=rank,
+        .nProcs=nProcs,
+        .nThreads=p->nThreads < 1 ? 1 : p->nThreads,
+        .readyHead=NULL, .readyTail=NULL,
+        .freeList=NULL,
+        .nBuffers=0,
+        .large=NULL,
+        .readerDone=false,
+        .nHulled=0, .nFailed=0
+    };
+    b.maxBuffers = b.nThreads + 2; // one per worker and two being prefetched
+    b.paths = readManifest(p->batchFile, &b.nPaths);
+    pthread_mutex_init(&b.mutex, NULL);
+    pthread_cond_init(&b.readyCond, NULL);
+    pthread_cond_init(&b.freeCond, NULL);
+    pthread_mutex_init(&b.outMutex, NULL);
+
+    // every rank writes its results in memory, rank 0 gathers them in the output at the end
+    #ifdef NON_MPI_MODE
+        b.out = stdout;
+        if (p->outputFile[0] != 0)
+        {
+            b.out = fopen(p->outputFile, "w");
+            if (b.out == NULL)
+                throwError("runBatch: Could not open %s", p->outputFile);
+        }
+    #else
+        char *outBuf = NULL;
+        size_t outLen = 0;
+        b.out = open_memstream(&outBuf, &outLen);
+        if (b.out == NULL)
+            throwError("p[%2d] runBatch: open_memstream failed", rank);
+    #endif
+
+    pthread_t reader;
+    pthread_t threads[MAX_THREADS];
+    BatchWorker workers[MAX_THREADS];
+    pthread_create(&reader, NULL, batchReader, (void*)&b);
+    for (int i = 0; i < b.nThreads; i++)
+    {
+        workers[i].b = &b;
+        workers[i].id.p = rank;
+        workers[i].id.t = i;
+        pthread_create(&threads[i], NULL, batchWorker, (void*)&workers[i]);
+    }
+    pthread_join(reader, NULL);
+    for (int i = 0; i < b.nThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    while (b.freeList != NULL)
+    {
+        BatchFile *f = b.freeList;
+        b.freeList = f->next;
+        free(f->d.X);
+        free(f->d.I);
+        free(f);
+    }
+    for (size_t i = 0; i < b.nPaths; i++)
+        free(b.paths[i]);
+    free(b.paths);
+    pthread_mutex_destroy(&b.mutex);
+    pthread_cond_destroy(&b.readyCond);
+    pthread_cond_destroy(&b.freeCond);
+    pthread_mutex_destroy(&b.outMutex);
+
+    #ifdef NON_MPI_MODE
+        if (b.out != stdout)
+            fclose(b.out);
+    #else
+        fclose(b.out);
+        char *all = gatherText(outBuf, rank, nProcs, "");
+        free(outBuf);
+        if (rank == 0)
+        {
+            FILE *out = stdout;
+            if (p->outputFile[0] != 0)
+            {
+                out = fopen(p->outputFile, "w");
+                if (out == NULL)
+                    throwError("p[%2d] runBatch: Could not open %s", rank, p->outputFile);
+            }
+            fputs(all, out);
+            if (out != stdout)
+                fclose(out);
+            free(all);
+        }
+    #endif
+
+    double elapsed = getTime() - startTime;
+    LOG(LOG_LVL_NOTICE, "p[%2d] runBatch: Hulled %ld files (%ld could not be read) in %lfs, %.1lf files/s", rank, b.nHulled, b.nFailed, elapsed, (b.nHulled + b.nFailed) / elapsed);
+}
+
+// reads the files of this rank in manifest order, at most maxBuffers of them are in flight
+static void *batchReader(void *arg)
+{
+    Batch *b = (Batch*)arg;
+
+    for (size_t i = b->rank; i < b->nPaths; i += b->nProcs)
+    {
+        pthread_mutex_lock(&b->mutex);
+        while ((b->freeList == NULL) && (b->nBuffers == b->maxBuffers))
+            pthread_cond_wait(&b->freeCond, &b->mutex);
+        BatchFile *f = b->freeList;
+        if (f != NULL)
+            b->freeList = f->next;
+        else
+            b->nBuffers++;
+        pthread_mutex_unlock(&b->mutex);
+
+        if (f == NULL)
+        {
+            f = calloc(1, sizeof(BatchFile));
+            if (f == NULL)
+                throwError("p[%2d] batchReader: Failed to allocate memory for a file", b->rank);
+        }
+        f->line = i;
+        f->path = b->paths[i];
+        f->next = NULL;
+        f->startTime = getTime();
+        traceBegin(NULL, TRACE_READ);
+        f->readFailed = !readBatchFile(f, b->trackIndices);
+        traceEnd(NULL, TRACE_READ, f->d.n * 2 * sizeof(float));
+
+        pthread_mutex_lock(&b->mutex);
+        if (b->readyTail == NULL)
+            b->readyHead = f;
+        else
+            b->readyTail->next = f;
+        b->readyTail = f;
+        pthread_cond_signal(&b->readyCond);
+        pthread_mutex_unlock(&b->mutex);
+    }
+
+    pthread_mutex_lock(&b->mutex);
+    b->readerDone = true;
+    pthread_cond_broadcast(&b->readyCond);
+    pthread_mutex_unlock(&b->mutex);
+
+    return NULL;
+}
+
+static void *batchWorker(void *arg)
+{
+    BatchWorker *w = (BatchWorker*)arg;
+    Batch *b = w->b;
+    perfThreadOpen();
+    PerfValues perfStart = perfRead();
+
+    for (;;)
+    {
+        BatchFile *f = NULL;
+        size_t chunk = 0;
+        bool isChunk = false;
+
+        pthread_mutex_lock(&b->mutex);
+        for (;;)
+        {
+            // the chunks of a large file come first, it blocks the most memory
+            if (b->large != NULL)
+            {
+                f = b->large;
+                chunk = f->nextChunk++;
+                isChunk = true;
+                if (f->nextChunk == f->nChunks)
+                    b->large = NULL;
+                break;
+            }
+            if (b->readyHead != NULL)
+            {
+                f = b->readyHead;
+                b->readyHead = f->next;
+                if (b->readyHead == NULL)
+                    b->readyTail = NULL;
+
+                if (f->readFailed || (f->d.n < BATCH_LARGE_FILE_POINTS) || (b->nThreads == 1))
+                    break;
+
+                // hand out the chunks of the large file, the other workers join as soon as they are free
+                size_t nChunks = b->nThreads * BATCH_CHUNKS_PER_THREAD;
+                if (nChunks > f->d.n / BATCH_MIN_CHUNK_POINTS)
+                    nChunks = f->d.n / BATCH_MIN_CHUNK_POINTS;
+                f->nChunks = nChunks;
+                f->nextChunk = 0;
+                f->doneChunks = 0;
+                f->hulls = malloc(nChunks * sizeof(Data));
+                if (f->hulls == NULL)
+                    throwError("p[%2d] t[%3d] batchWorker: Failed to allocate memory for the hulls of %ld chunks", w->id.p, w->id.t, nChunks);
+                b->large = f;
+                pthread_cond_broadcast(&b->readyCond);
+                continue;
+            }
+            if (b->readerDone)
+                break;
+            pthread_cond_wait(&b->readyCond, &b->mutex);
+        }
+        pthread_mutex_unlock(&b->mutex);
+
+        if (f == NULL)
+            break;
+
+        if (isChunk)
+            hullChunk(b, f, chunk, &w->id);
+        else if (f->readFailed)
+        {
+            writeResult(b, f, NULL);
+            recycle(b, f);
+        }
+        else
+        {
+            traceBegin(&w->id, TRACE_QUICKHULL);
+            Data hull = { .n=0, .X=NULL, .Y=NULL, .I=NULL };
+            if (f->d.n > 0)
+                hull = quickhull(&f->d, &w->id);
+            traceEnd(&w->id, TRACE_QUICKHULL, hull.n);
+            writeResult(b, f, &hull);
+            free(hull.X);
+            free(hull.Y);
+            free(hull.I);
+            recycle(b, f);
+        }
+    }
+
+    perfAccumulate(&w->id, PHASE_QUICKHULL, &perfStart);
+    perfThreadClose();
+
+    return NULL;
+}
+
+// quickhull on a chunk of a large file, the worker that finishes the last chunk merges the hulls of all of them
+static void hullChunk(Batch *b, BatchFile *f, size_t chunk, ProcThreadIDCombo *id)
+{
+    size_t chunkSize = (f->d.n + f->nChunks - 1) / f->nChunks;
+    size_t first = chunk * chunkSize;
+    size_t last = first + chunkSize < f->d.n ? first + chunkSize : f->d.n;
+    Data pts = { .n=last-first, .X=&f->d.X[first], .Y=&f->d.Y[first], .I=f->d.I == NULL ? NULL : &f->d.I[first] };
+
+    traceBegin(id, TRACE_QUICKHULL);
+    f->hulls[chunk] = quickhull(&pts, id);
+    traceEnd(id, TRACE_QUICKHULL, f->hulls[chunk].n);
+
+    if (__atomic_add_fetch(&f->doneChunks, 1, __ATOMIC_ACQ_REL) < f->nChunks)
+        return;
+
+    // same pairwise order as the P1.2 merges of parallhullThread
+    size_t nParts = f->nChunks;
+    while (nParts > 1)
+    {
+        size_t halfNParts = nParts / 2;
+        for (size_t i = 0; i < halfNParts; i++)
+        {
+            traceBegin(id, TRACE_MERGE_P12);
+            Data h = mergeHulls(&f->hulls[i], &f->hulls[i+halfNParts], id);
+            traceEnd(id, TRACE_MERGE_P12, h.n);
+            free(f->hulls[i].X); free(f->hulls[i].Y); free(f->hulls[i].I);
+            free(f->hulls[i+halfNParts].X); free(f->hulls[i+halfNParts].Y); free(f->hulls[i+halfNParts].I);
+            f->hulls[i] = h;
+        }
+        if (nParts & 1UL)
+        {
+            f->hulls[halfNParts] = f->hulls[nParts-1];
+            nParts++;
+        }
+        nParts /= 2;
+    }
+
+    writeResult(b, f, &f->hulls[0]);
+    free(f->hulls[0].X); free(f->hulls[0].Y); free(f->hulls[0].I);
+    free(f->hulls);
+    recycle(b, f);
+}
+
+// one block per file: a "# line path n=N hull=H" header (or "# line path error") followed by the vertices like saveHullPointsTxt
+static void writeResult(Batch *b, BatchFile *f, Data *hull)
+{
+    pthread_mutex_lock(&b->outMutex);
+    if (hull == NULL)
+    {
+        fprintf(b->out, "# %ld %s error\n", f->line, f->path);
+        b->nFailed++;
+    }
+    else
+    {
+        fprintf(b->out, "# %ld %s n=%ld hull=%ld\n", f->line, f->path, f->d.n, hull->n);
+        writeHullPoints(b->out, hull);
+        b->nHulled++;
+    }
+    pthread_mutex_unlock(&b->outMutex);
+
+    LOG(LOG_LVL_INFO, "p[%2d] runBatch: %s: n=%ld, hullSize=%ld, %lfs from the read to the result", b->rank, f->path, f->d.n, hull == NULL ? 0 : hull->n, getTime() - f->startTime);
+}
+
+static void recycle(Batch *b, BatchFile *f)
+{
+    pthread_mutex_lock(&b->mutex);
+    f->next = b->freeList;
+    b->freeList = f;
+    pthread_cond_signal(&b->freeCond);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+// same format as readFile, into the buffers of f that only grow
+static bool readBatchFile(BatchFile *f, bool trackIndices)
+{
+    f->d.n = 0;
+    FILE *fileptr = fopen(f->path, "rb");
+    if (fileptr == NULL)
+    {
+        LOG(LOG_LVL_ERROR, "runBatch: Could not read file %s", f->path);
+        return false;
+    }
+
+    fseek(fileptr, 0, SEEK_END);
+    size_t n = ftell(fileptr) / (2 * sizeof(float));
+    rewind(fileptr);
+
+    if ((n > f->capacity) || (trackIndices && (f->d.I == NULL)))
+    {
+        free(f->d.X);
+        free(f->d.I);
+        f->d.I = NULL;
+        f->capacity = n;
+        f->d.X = malloc(n * 2 * sizeof(float) + MALLOC_PADDING);
+        if (trackIndices)
+            f->d.I = malloc(n * sizeof(PointIndex) + MALLOC_PADDING);
+        if ((f->d.X == NULL) || (trackIndices && (f->d.I == NULL)))
+            throwError("runBatch: Failed to allocate memory for the %ld points of %s", n, f->path);
+    }
+    f->d.n = n;
+    f->d.Y = &f->d.X[n];
+
+    bool ok = fread(f->d.X, n * 2 * sizeof(float), 1, fileptr) == 1 || n == 0;
+    fclose(fileptr);
+    if (!ok)
+    {
+        LOG(LOG_LVL_ERROR, "runBatch: Could not read the points of %s", f->path);
+        f->d.n = 0;
+        return false;
+    }
+
+    if (trackIndices)
+    {
+        if (n > (size_t)(PointIndex)-1)
+            throwError("runBatch: %s has %ld points, too many for the point indices: build with LARGE_POINT_INDICES", f->path, n);
+        for (size_t i = 0; i < n; i++)
+            f->d.I[i] = i;
+    }
+    return true;
+}
+
+// one path per line, empty lines and lines starting with # are skipped
+static char **readManifest(const char *fname, size_t *nPaths)
+{
+    FILE *f = fopen(fname, "r");
+    if (f == NULL)
+        throwError("runBatch: Could not read the manifest %s", fname);
+
+    size_t capacity = 1024;
+    char **paths = malloc(capacity * sizeof(char*));
+    if (paths == NULL)
+        throwError("runBatch: Failed to allocate memory for the manifest");
+    *nPaths = 0;
+
+    char *line = NULL;
+    size_t lineLen = 0;
+    while (getline(&line, &lineLen, f) != -1)
+    {
+        size_t len = strcspn(line, "\r\n");
+        line[len] = 0;
+        if ((len == 0) || (line[0] == '#'))
+            continue;
+
+        if (*nPaths == capacity)
+        {
+            capacity *= 2;
+            paths = realloc(paths, capacity * sizeof(char*));
+            if (paths == NULL)
+                throwError("runBatch: Failed to allocate memory for the manifest");
+        }
+        paths[*nPaths] = strdup(line);
+        if (paths[*nPaths] == NULL)
+            throwError("runBatch: Failed to allocate memory for the manifest");
+        (*nPaths)++;
+    }
+    free(line);
+    fclose(f);
+
+    return paths;
+}
@@ -0,0 +1,680 @@
+#include "parallhull.h"
+
+#include <argp.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+// Microbenchmarks of the hull kernels. Must be built with NON_MPI_MODE (see the bench target in the makefile)
+#ifndef NON_MPI_MODE
+    #error "bench.c must be compiled with -DNON_MPI_MODE"
+#endif
+
+#define MAX_LIST_ELEMS 32
+#define BENCH_RADIUS 1000.
+#define BENCH_SEED 0x5EEDULL
+#define BENCH_TMP_FILE "/tmp/parallhull_bench.bin"
+#define BENCH_GROUP_POINTS 64 // average points per group of the groupedHulls kernel
+#define BENCH_APPROX_EPS (BENCH_RADIUS * 1e-4) // eps of the approxHull kernel
+
+enum Kernel
+{
+    KERNEL_REMOVE_COVERED,
+    KERNEL_FIND_FARTHEST,
+    KERNEL_COVER_FARTHEST,
+    KERNEL_ADD_PTS,
+    KERNEL_MERGE_HULLS,
+    KERNEL_QUICKHULL,
+    KERNEL_TASKHULL,
+    KERNEL_GROUPED_HULLS,
+    KERNEL_HULL_QUERY,
+    KERNEL_APPROX_HULL,
+    KERNEL_READ_FILE,
+    KERNEL_READ_FILE_PART,
+    KERNEL_GRID_CULL,
+    KERNEL_COUNT
+};
+static const char *kernelNames[] = { "removeCoveredPoints", "findFarthestPts", "removeCoveredFindFarthest", "addPtsToHull", "mergeHulls", "quickhull", "taskhull", "groupedHulls", "hullQuery", "approxHull", "readFile", "readFilePart", "gridCull" };
+
+enum OutputFormat
+{
+    FORMAT_CSV,
+    FORMAT_JSON
+};
+
+typedef struct
+{
+    size_t sizes[MAX_LIST_ELEMS];
+    int sizesCount;
+    size_t hullSizes[MAX_LIST_ELEMS];
+    int hullSizesCount;
+    bool dists[DIST_COUNT];
+    bool kernels[KERNEL_COUNT];
+    int warmup;
+    int reps;
+    int nThreads; // workers of the taskhull, groupedHulls, hullQuery, approxHull and gridCull kernels
+    bool indices; // points carry their indices, to measure the cost of --indices
+    enum OutputFormat format;
+    char outputFile[1000];
+} BenchParams;
+
+typedef struct
+{
+    double min, median, p10, p90, mean;
+} Stats;
+
+// a benchmark run is setup(state) -> timed kernel(state) repeated, setup restores whatever the kernel destroys
+typedef struct
+{
+    Data src;       // original points
+    Data pts;       // working copy given to the kernel
+    Data uncovered; // points left uncovered by hull, input of addPtsToHull
+    Data hull;      // original hull (or h1 for the merges)
+    Data workHull;  // working copy of the hull
+    Data hull2;     // h2 for the merges
+    size_t allocatedElemsCount;
+    size_t *offsetCounter;
+    size_t *maxDistPtIndices;
+    size_t *maxDistPtIndicesSrc;
+    uint32_t *keys; // groupedHulls only
+    HullQuery query; // hullQuery only, built from hull
+    uint64_t *queryMask;
+    Params fileParams;
+} BenchState;
+
+enum argpKeys{
+    ARGP_SIZES='n',
+    ARGP_HULLS='h',
+    ARGP_DISTS='d',
+    ARGP_KERNELS='k',
+    ARGP_WARMUP='w',
+    ARGP_REPS='r',
+    ARGP_FORMAT='F',
+    ARGP_OUTPUT='o',
+    ARGP_LOG_LEVEL='l',
+    ARGP_NTHREADS='j',
+    ARGP_INDICES='i'
+};
+
+static error_t benchArgpParser(int key, char *arg, struct argp_state *state);
+static int parseSizeList(char *arg, size_t *list, const char *paramName);
+static void parseNameList(char *arg, bool *enabled, const char **names, int namesCount, const char *paramName);
+static double now();
+static int cmpDouble(const void *a, const void *b);
+static Stats computeStats(double *times, int reps);
+static Data allocData(size_t n, bool withIndices);
+static Data allocHull(size_t n);
+static void copyData(Data *dst, Data *src);
+static Data directionalHull(Data *pts, size_t h);
+static double runKernel(enum Kernel k, BenchState *s, BenchParams *bp);
+static void setupKernel(enum Kernel k, BenchState *s);
+static void printResult(FILE *out, BenchParams *bp, bool *first, enum Kernel k, const char *dist, size_t n, size_t h, Stats *st, int reps);
+
+int main(int argc, char *argv[])
+{
+    static struct argp_option argpOptions[] = {
+        { .name="sizes", .key=ARGP_SIZES, .arg="LIST", .flags=0, .doc="Comma separated list of point counts (e.g. 1e4,1e6)\n", .group=1 },
+        { .name="hulls", .key=ARGP_HULLS, .arg="LIST", .flags=0, .doc="Comma separated list of hull sizes\n", .group=1 },
+        { .name="dists", .key=ARGP_DISTS, .arg="LIST", .flags=0, .doc="Comma separated list of distributions: disk,square,circle,annulus,gaussian,clustered\n", .group=1 },
+        { .name="kernels", .key=ARGP_KERNELS, .arg="LIST", .flags=0, .doc="Comma separated list of kernels to run (default all)\n", .group=1 },
+        { .name="warmup", .key=ARGP_WARMUP, .arg="UINT", .flags=0, .doc="Untimed runs before the measurements\n", .group=1 },
+        { .name="reps", .key=ARGP_REPS, .arg="UINT", .flags=0, .doc="Timed runs per configuration\n", .group=1 },
+        { .name="format", .key=ARGP_FORMAT, .arg="csv|json", .flags=0, .doc="Output format\n", .group=1 },
+        { .name="output", .key=ARGP_OUTPUT, .arg="FILENAME", .flags=0, .doc="Write results to file instead of stdout\n", .group=1 },
+        { .name="threads", .key=ARGP_NTHREADS, .arg="UINT", .flags=0, .doc="Worker threads of the taskhull, groupedHulls, hullQuery, approxHull and gridCull kernels\n", .group=1 },
+        { .name="indices", .key=ARGP_INDICES, .arg=NULL, .flags=0, .doc="Points carry their indices like with --indices of main (the hulls of addPtsToHull and mergeHulls do not)\n", .group=1 },
+        { .name="loglvl", .key=ARGP_LOG_LEVEL, .arg="UINT", .flags=0, .doc="Log level (0=fatal ... 6=trace)\n", .group=1 },
+        { 0 }
+    };
+    static struct argp argpData = {
+        .options = argpOptions,
+        .parser = benchArgpParser,
+        .doc = "Microbenchmarks of the parallhull kernels. Results are reported in seconds."
+    };
+
+    BenchParams bp = {
+        .sizes = { 10000, 100000, 1000000 },
+        .sizesCount = 3,
+        .hullSizes = { 8, 64, 512 },
+        .hullSizesCount = 3,
+        .warmup = 3,
+        .reps = 15,
+        .nThreads = 1,
+        .indices = false,
+        .format = FORMAT_CSV,
+        .outputFile = {0}
+    };
+    for (int i = 0; i < DIST_COUNT; i++)
+        bp.dists[i] = true;
+    for (int i = 0; i < KERNEL_COUNT; i++)
+        bp.kernels[i] = true;
+
+    setLogLevel(LOG_LVL_WARN);
+    argp_parse(&argpData, argc, argv, 0, 0, &bp);
+
+    #ifndef __OPTIMIZE__
+        LOG(LOG_LVL_WARN, "bench was built without optimizations, build it with \"make bench MODE=exec\" to get meaningful numbers");
+    #endif
+
+    FILE *out = stdout;
+    if (bp.outputFile[0] != 0)
+    {
+        out = fopen(bp.outputFile, "w");
+        if (out == NULL)
+            throwError("Could not open output file %s", bp.outputFile);
+    }
+
+    if (bp.format == FORMAT_CSV)
+        fprintf(out, "kernel,dist,n,h,reps,min_s,median_s,p10_s,p90_s,mean_s,ns_per_pt\n");
+    else
+        fprintf(out, "[\n");
+    bool first = true;
+
+    double *times = malloc(bp.reps * sizeof(double));
+    if (times == NULL)
+        throwError("Failed to allocate memory for the measurements");
+
+    ProcThreadIDCombo id = { .p=0, .t=0 };
+
+    for (int dist = 0; dist < DIST_COUNT; dist++)
+    {
+        if (!bp.dists[dist]) continue;
+
+        for (int ni = 0; ni < bp.sizesCount; ni++)
+        {
+            size_t n = bp.sizes[ni];
+            BenchState s = { .fileParams = { .nProcs=2, .nThreads=1, .trackIndices=bp.indices } };
+            s.src = allocData(n, bp.indices);
+            s.pts = allocData(n, bp.indices);
+            genPoints(s.src.X, s.src.Y, 0, n, dist, BENCH_SEED, BENCH_RADIUS);
+            if (bp.indices)
+                for (size_t i = 0; i < n; i++)
+                    s.src.I[i] = i;
+
+            for (int k = 0; k < KERNEL_COUNT; k++)
+            {
+                if (!bp.kernels[k]) continue;
+
+                // kernels that do not depend on the hull size run once per (dist, n)
+                bool hullIndependent = (k == KERNEL_QUICKHULL) || (k == KERNEL_TASKHULL) || (k == KERNEL_GROUPED_HULLS) || (k == KERNEL_APPROX_HULL) || (k == KERNEL_READ_FILE) || (k == KERNEL_READ_FILE_PART) || (k == KERNEL_GRID_CULL);
+                // mergeHulls only depends on the hull size, run it for the first n only
+                if ((k == KERNEL_MERGE_HULLS) && (ni > 0)) continue;
+
+                if (k == KERNEL_READ_FILE || k == KERNEL_READ_FILE_PART)
+                {
+                    FILE *f = fopen(BENCH_TMP_FILE, "wb");
+                    if (f == NULL)
+                        throwError("Could not create temporary file %s", BENCH_TMP_FILE);
+                    fwrite(s.src.X, sizeof(float), n, f);
+                    fwrite(s.src.Y, sizeof(float), n, f);
+                    fclose(f);
+                    strcpy(s.fileParams.inputFile, BENCH_TMP_FILE);
+                }
+                if (k == KERNEL_GROUPED_HULLS)
+                {
+                    // keys scattered over the points with a multiplicative hash, so that the radix partition has to move them
+                    size_t nGroups = n / BENCH_GROUP_POINTS + 1;
+                    s.keys = malloc(n * sizeof(uint32_t) + MALLOC_PADDING);
+                    if (s.keys == NULL)
+                        throwError("Failed to allocate memory for the keys");
+                    for (size_t i = 0; i < n; i++)
+                        s.keys[i] = (uint32_t)(((i * 0x9E3779B97F4A7C15ULL) >> 32) % nGroups);
+                }
+
+                for (int hi = 0; hi < (hullIndependent ? 1 : bp.hullSizesCount); hi++)
+                {
+                    size_t h = 0;
+                    if (!hullIndependent)
+                    {
+                        s.hull = directionalHull(&s.src, bp.hullSizes[hi]);
+                        h = s.hull.n;
+                        s.allocatedElemsCount = 2 * h + 2;
+                        s.workHull = allocHull(s.allocatedElemsCount);
+                        s.offsetCounter = malloc(s.allocatedElemsCount * 2 * sizeof(size_t) + MALLOC_PADDING*2);
+                        s.maxDistPtIndicesSrc = malloc(s.allocatedElemsCount * sizeof(size_t) + MALLOC_PADDING*2);
+                        if ((s.offsetCounter == NULL) || (s.maxDistPtIndicesSrc == NULL))
+                            throwError("Failed to allocate memory for the benchmark state");
+                        if (k == KERNEL_ADD_PTS)
+                        {
+                            // addPtsToHull works on the points left uncovered by the current hull and their farthest points
+                            s.uncovered = allocData(n, bp.indices);
+                            copyData(&s.uncovered, &s.src);
+                            removeCoveredPoints(&s.hull, &s.uncovered, NULL, false, &id);
+                            findFarthestPts(&s.hull, &s.uncovered, s.maxDistPtIndicesSrc);
+                        }
+                        if (k == KERNEL_HULL_QUERY)
+                        {
+                            // the points are classified against their own directional hull, so most of them are inside
+                            s.query = hullQueryBuild(&s.hull, 0);
+                            s.queryMask = malloc((n + 63) / 64 * sizeof(uint64_t) + MALLOC_PADDING);
+                            if (s.queryMask == NULL)
+                                throwError("Failed to allocate memory for the query mask");
+                        }
+                        if (k == KERNEL_MERGE_HULLS)
+                        {
+                            Data other = allocData(n, false);
+                            genPoints(other.X, other.Y, 0, n, dist, BENCH_SEED + 1, BENCH_RADIUS);
+                            s.hull2 = directionalHull(&other, bp.hullSizes[hi]);
+                            free(other.X);
+                        }
+                    }
+
+                    for (int r = 0; r < bp.warmup + bp.reps; r++)
+                    {
+                        setupKernel(k, &s);
+                        double t = runKernel(k, &s, &bp);
+                        if (r >= bp.warmup)
+                            times[r - bp.warmup] = t;
+                    }
+                    Stats st = computeStats(times, bp.reps);
+                    size_t reportedH = (k == KERNEL_MERGE_HULLS) ? h + s.hull2.n : h;
+                    printResult(out, &bp, &first, k, distributionNames[dist], (k == KERNEL_MERGE_HULLS) ? reportedH : n, reportedH, &st, bp.reps);
+
+                    if (!hullIndependent)
+                    {
+                        free(s.hull.X); free(s.hull.Y);
+                        free(s.workHull.X); free(s.workHull.Y);
+                        free(s.offsetCounter);
+                        free(s.maxDistPtIndicesSrc);
+                        if (k == KERNEL_ADD_PTS)
+                        {
+                            free(s.uncovered.X);
+                            free(s.uncovered.I);
+                        }
+                        if (k == KERNEL_MERGE_HULLS)
+                        {
+                            free(s.hull2.X); free(s.hull2.Y);
+                        }
+                        if (k == KERNEL_HULL_QUERY)
+                        {
+                            hullQueryFree(&s.query);
+                            free(s.queryMask);
+                        }
+                    }
+                }
+                if (k == KERNEL_GROUPED_HULLS)
+                    free(s.keys);
+            }
+
+            free(s.src.X);
+            free(s.src.I);
+            free(s.pts.X);
+            free(s.pts.I);
+        }
+    }
+
+    if (bp.format == FORMAT_JSON)
+        fprintf(out, "\n]\n");
+    if (out != stdout)
+        fclose(out);
+
+    unlink(BENCH_TMP_FILE);
+    free(times);
+    return EXIT_SUCCESS;
+}
+
+static void setupKernel(enum Kernel k, BenchState *s)
+{
+    switch (k)
+    {
+    case KERNEL_REMOVE_COVERED:
+    case KERNEL_FIND_FARTHEST:
+    case KERNEL_COVER_FARTHEST:
+    case KERNEL_QUICKHULL:
+        copyData(&s->pts, &s->src);
+        break;
+
+    case KERNEL_ADD_PTS:
+        copyData(&s->pts, &s->uncovered);
+        s->workHull.n = s->hull.n;
+        memcpy(s->workHull.X, s->hull.X, (s->hull.n + 1) * sizeof(float));
+        memcpy(s->workHull.Y, s->hull.Y, (s->hull.n + 1) * sizeof(float));
+        s->maxDistPtIndices = &s->offsetCounter[s->allocatedElemsCount];
+        memcpy(s->maxDistPtIndices, s->maxDistPtIndicesSrc, s->hull.n * sizeof(size_t));
+        break;
+
+    default:
+        break;
+    }
+}
+
+static double runKernel(enum Kernel k, BenchState *s, BenchParams *bp)
+{
+    ProcThreadIDCombo id = { .p=0, .t=0 };
+    double start = 0, end = 0;
+
+    switch (k)
+    {
+    case KERNEL_REMOVE_COVERED:
+        start = now();
+        removeCoveredPoints(&s->hull, &s->pts, NULL, false, &id);
+        end = now();
+        break;
+
+    case KERNEL_FIND_FARTHEST:
+        start = now();
+        findFarthestPts(&s->hull, &s->pts, s->maxDistPtIndicesSrc);
+        end = now();
+        break;
+
+    case KERNEL_COVER_FARTHEST:
+        start = now();
+        removeCoveredFindFarthest(&s->hull, &s->pts, NULL, NULL, s->maxDistPtIndicesSrc, &id);
+        end = now();
+        break;
+
+    case KERNEL_ADD_PTS:
+    {
+        size_t allocated = s->allocatedElemsCount;
+        start = now();
+        addPtsToHull(&s->workHull, &s->pts, &s->maxDistPtIndices, &s->offsetCounter, &allocated, &id);
+        end = now();
+        break;
+    }
+    case KERNEL_MERGE_HULLS:
+    {
+        start = now();
+        Data h0 = mergeHulls(&s->hull, &s->hull2, &id);
+        end = now();
+        free(h0.X);
+        free(h0.Y);
+        free(h0.I);
+        break;
+    }
+    case KERNEL_QUICKHULL:
+    {
+        start = now();
+        Data h = quickhull(&s->pts, &id);
+        end = now();
+        free(h.X);
+        free(h.Y);
+        free(h.I);
+        break;
+    }
+    case KERNEL_TASKHULL:
+    {
+        // taskhull does not modify the points, so src is used directly
+        start = now();
+        Data h = taskhull(&s->src, 0, bp->nThreads);
+        end = now();
+        free(h.X);
+        free(h.Y);
+        free(h.I);
+        break;
+    }
+    case KERNEL_GROUPED_HULLS:
+    {
+        // groupedHulls does not modify the points either
+        start = now();
+        GroupedHulls g = groupedHulls(&s->src, s->keys, bp->nThreads, 0);
+        end = now();
+        freeGroupedHulls(&g);
+        break;
+    }
+    case KERNEL_HULL_QUERY:
+    {
+        // classification only, the table is built once per hull
+        start = now();
+        hullQueryClassify(&s->query, &s->src, s->queryMask, bp->nThreads, 0);
+        end = now();
+        break;
+    }
+    case KERNEL_APPROX_HULL:
+    {
+        // approxHull does not modify the points either
+        double bound;
+        start = now();
+        Data h = approxHull(&s->src, BENCH_APPROX_EPS, bp->nThreads, 0, &bound);
+        end = now();
+        free(h.X);
+        free(h.Y);
+        free(h.I);
+        break;
+    }
+    case KERNEL_READ_FILE:
+    {
+        Data d;
+        start = now();
+        readFile(&d, &s->fileParams);
+        end = now();
+        free(d.X);
+        free(d.I);
+        break;
+    }
+    case KERNEL_READ_FILE_PART:
+    {
+        // read one half of the file, like rank 0 of a 2 ranks run would
+        Data d;
+        start = now();
+        readFilePart(&d, &s->fileParams, 0);
+        end = now();
+        free(d.X);
+        free(d.I);
+        break;
+    }
+    case KERNEL_GRID_CULL:
+    {
+        // gridCullPoints replaces the allocation of the points, so every run gets its own copy
+        Data d = allocData(s->src.n, s->src.I != NULL);
+        copyData(&d, &s->src);
+        start = now();
+        gridCullPoints(&d, 0, bp->nThreads, 0, 1);
+        end = now();
+        free(d.X);
+        free(d.I);
+        break;
+    }
+    default:
+        break;
+    }
+
+    return end - start;
+}
+
+// Convex polygon made by the points of pts that are extreme along h evenly spaced directions, which is what quickhull has
+// after a few iterations. Starts from direction -pi/2 so that the first vertex is the lowest one as mergeHulls expects
+static Data directionalHull(Data *pts, size_t h)
+{
+    Data hull = allocHull(h + 1);
+    hull.n = 0;
+
+    for (size_t k = 0; k < h; k++)
+    {
+        double t = -M_PI_2 + 2. * M_PI * k / h;
+        double dx = cos(t), dy = sin(t);
+        size_t best = 0;
+        double bestDot = -DBL_MAX; // no INFINITY, -ffast-math assumes there is none
+        for (size_t i = 0; i < pts->n; i++)
+        {
+            double dot = dx * pts->X[i] + dy * pts->Y[i];
+            if (dot > bestDot)
+            {
+                bestDot = dot;
+                best = i;
+            }
+        }
+        // consecutive directions can share the same extreme point
+        if ((hull.n > 0) && (hull.X[hull.n-1] == pts->X[best]) && (hull.Y[hull.n-1] == pts->Y[best]))
+            continue;
+        if ((hull.n > 0) && (hull.X[0] == pts->X[best]) && (hull.Y[0] == pts->Y[best]))
+            continue;
+        hull.X[hull.n] = pts->X[best];
+        hull.Y[hull.n] = pts->Y[best];
+        hull.n++;
+    }
+    hull.X[hull.n] = hull.X[0];
+    hull.Y[hull.n] = hull.Y[0];
+
+    return hull;
+}
+
+static void printResult(FILE *out, BenchParams *bp, bool *first, enum Kernel k, const char *dist, size_t n, size_t h, Stats *st, int reps)
+{
+    double nsPerPt = n > 0 ? st->median * 1e9 / n : 0;
+    if (bp->format == FORMAT_CSV)
+        fprintf(out, "%s,%s,%ld,%ld,%d,%.9e,%.9e,%.9e,%.9e,%.9e,%.4lf\n", kernelNames[k], dist, n, h, reps, st->min, st->median, st->p10, st->p90, st->mean, nsPerPt);
+    else
+    {
+        fprintf(out, "%s  {\"kernel\": \"%s\", \"dist\": \"%s\", \"n\": %ld, \"h\": %ld, \"reps\": %d, \"min_s\": %.9e, \"median_s\": %.9e, \"p10_s\": %.9e, \"p90_s\": %.9e, \"mean_s\": %.9e, \"ns_per_pt\": %.4lf}",
+                *first ? "" : ",\n", kernelNames[k], dist, n, h, reps, st->min, st->median, st->p10, st->p90, st->mean, nsPerPt);
+        *first = false;
+    }
+    fflush(out);
+}
+
+static Stats computeStats(double *times, int reps)
+{
+    qsort(times, reps, sizeof(double), cmpDouble);
+
+    Stats st = { .min=times[0] };
+    st.median = (reps & 1) ? times[reps/2] : (times[reps/2 - 1] + times[reps/2]) / 2.;
+    st.p10 = times[(int)floor(0.1 * (reps-1))];
+    st.p90 = times[(int)ceil(0.9 * (reps-1))];
+    st.mean = 0;
+    for (int i = 0; i < reps; i++)
+        st.mean += times[i];
+    st.mean /= reps;
+
+    return st;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+// CLOCK_MONOTONIC counts from boot, so the double keeps nanosecond resolution (seconds from epoch would not)
+static double now()
+{
+    struct timespec timeStruct;
+    clock_gettime(CLOCK_MONOTONIC, &timeStruct);
+    return cvtTimespec2Double(timeStruct);
+}
+
+static Data allocData(size_t n, bool withIndices)
+{
+    Data d = { .n=n };
+    d.X = malloc(n * 2 * sizeof(float) + MALLOC_PADDING);
+    if (withIndices)
+        d.I = malloc(n * sizeof(PointIndex) + MALLOC_PADDING);
+    if ((d.X == NULL) || (withIndices && (d.I == NULL)))
+        throwError("Failed to allocate memory for %ld points", n);
+    d.Y = &d.X[n];
+    return d;
+}
+
+// hulls have X and Y in separate allocations, like the ones returned by quickhull
+static Data allocHull(size_t n)
+{
+    Data h = { .n=n };
+    h.X = malloc(n * sizeof(float) + MALLOC_PADDING);
+    h.Y = malloc(n * sizeof(float) + MALLOC_PADDING);
+    if ((h.X == NULL) || (h.Y == NULL))
+        throwError("Failed to allocate memory for a hull of %ld points", n);
+    return h;
+}
+
+// copies src->n points, dst must have room for them
+static void copyData(Data *dst, Data *src)
+{
+    memcpy(dst->X, src->X, src->n * sizeof(float));
+    memcpy(dst->Y, src->Y, src->n * sizeof(float));
+    if (src->I != NULL)
+        memcpy(dst->I, src->I, src->n * sizeof(PointIndex));
+    dst->n = src->n;
+}
+
+static error_t benchArgpParser(int key, char *arg, struct argp_state *state)
+{
+    BenchParams *bp = state->input;
+
+    switch (key)
+    {
+    case ARGP_SIZES:
+        bp->sizesCount = parseSizeList(arg, bp->sizes, "sizes");
+        break;
+    case ARGP_HULLS:
+        bp->hullSizesCount = parseSizeList(arg, bp->hullSizes, "hulls");
+        break;
+    case ARGP_DISTS:
+        parseNameList(arg, bp->dists, distributionNames, DIST_COUNT, "dists");
+        break;
+    case ARGP_KERNELS:
+        parseNameList(arg, bp->kernels, kernelNames, KERNEL_COUNT, "kernels");
+        break;
+    case ARGP_WARMUP:
+        bp->warmup = atoi(arg);
+        break;
+    case ARGP_REPS:
+        bp->reps = atoi(arg);
+        if (bp->reps < 1)
+            throwError("reps must be at least 1");
+        break;
+    case ARGP_FORMAT:
+        if (strcmp(arg, "csv") == 0)
+            bp->format = FORMAT_CSV;
+        else if (strcmp(arg, "json") == 0)
+            bp->format = FORMAT_JSON;
+        else
+            throwError("format: argument not valid");
+        break;
+    case ARGP_OUTPUT:
+        strncpy(bp->outputFile, arg, 999);
+        break;
+    case ARGP_LOG_LEVEL:
+        setLogLevel(atoi(arg));
+        break;
+    case ARGP_NTHREADS:
+        bp->nThreads = atoi(arg);
+        if (bp->nThreads < 1)
+            throwError("threads must be at least 1");
+        break;
+    case ARGP_INDICES:
+        bp->indices = true;
+        break;
+    case ARGP_KEY_END:
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+// accepts plain integers and scientific notation like 1e6
+static int parseSizeList(char *arg, size_t *list, const char *paramName)
+{
+    int count = 0;
+    for (char *tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        if (count == MAX_LIST_ELEMS)
+            throwError("%s: too many elements (max %d)", paramName, MAX_LIST_ELEMS);
+        char *endPtr;
+        double v = strtod(tok, &endPtr);
+        if ((*endPtr != 0) || (v < 1))
+            throwError("%s: \"%s\" is not a valid size", paramName, tok);
+        list[count++] = (size_t)v;
+    }
+    return count;
+}
+
+static void parseNameList(char *arg, bool *enabled, const char **names, int namesCount, const char *paramName)
+{
+    for (int i = 0; i < namesCount; i++)
+        enabled[i] = false;
+
+    for (char *tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        int i;
+        for (i = 0; i < namesCount; i++)
+            if (strcmp(tok, names[i]) == 0)
+                break;
+        if (i == namesCount)
+            throwError("%s: \"%s\" is not valid", paramName, tok);
+        enabled[i] = true;
+    }
+}
@@ -0,0 +1,508 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+
+#define LAYERS_SEED_VERTICES 32 // the seed polygon has at most this many vertices
+#define LAYERS_SEED_SAMPLE 8192 // points sampled to place the seed
+#define LAYERS_SEED_MIN_PEEL 16 // points of the sample outside the seed, at least
+#define LAYERS_SEED_MIN_POINTS (1UL << 14) // fewer points left are all candidates, a seed would not pay for its pass
+#define LAYERS_MIN_BAND 1024 // points outside the seed aimed at, at least
+#define LAYERS_SEED_SHRINK 1e-5 // the seed is shrunk by at least this fraction before the classification
+#define LAYERS_INITIAL_CAPACITY 64
+
+// Convex layers (onion peeling, --layers): layer 1 is the hull of the points, layer d+1 the hull of the points left once the
+// layers up to d are removed. A layer is made of the vertices of its hull, a point in the middle of an edge goes to a deeper layer.
+// Calling the hull engine on all the points left for every layer would cost O(layers * n) passes, so the points are kept split in
+// candidates and inner points. The inner points are strictly inside a seed polygon whose vertices are points still left: none of them
+// can be on the next layers as long as all the seed vertices are left, so they are not even looked at. Every layer is the hull of
+// the candidates only (parallhullThreaded, cleaned by strictVertices: a hull of quickhull decides its vertices with a rounded test,
+// the merges of the threads with exact cross products, so the same point could be a vertex or not depending on the slicing of the
+// threads), then its vertices are removed from the candidates by a threaded pass.
+// When a layer takes a seed vertex, the inner points go back to the candidates and a new seed is placed deeper.
+// The seed is an inner layer of a sample of the points, deep enough to leave about sqrt(2 * points * last layer size) points outside: the pass that rebuilds the seed reads all the points left,
+// the layers between two rebuilds only the candidates, which balances the two. The classification uses the seed shrunk by a margin
+// far above the rounding of the coverage kernel, so an inner point is surely inside the seed and the seed vertices stay candidates
+
+enum LayersMask
+{
+    LAYERS_MASK_SEED, // set for the points not strictly inside the seed
+    LAYERS_MASK_KEEP // set for the points not in a layer yet
+};
+
+typedef struct
+{
+    int mode;
+    Data src;
+    Data *seed;
+    uint64_t *removed; // bitmap over the positions of the input, set for the points of the layers found so far
+    Data keep; // the points with the mask bit set go here
+    Data drop; // the others here, unless drop.X is NULL
+    uint64_t *mask;
+    size_t (*counts)[2]; // per thread: points kept and dropped
+    pthread_barrier_t barrier;
+    int nThreads;
+} LayersSplit;
+
+typedef struct
+{
+    LayersSplit *split;
+    size_t first, n; // slice of src, first is a multiple of 64
+    ProcThreadIDCombo id;
+} LayersThreadData;
+
+typedef struct
+{
+    PointIndex ids[LAYERS_SEED_VERTICES];
+    int n; // 0 when there is no seed
+    Data polygon; // shrunk, closed: LAYERS_SEED_VERTICES + 1 vertices
+} LayersSeed;
+
+typedef struct
+{
+    double x, y;
+    size_t pos; // in the points the seed is placed among
+} SeedPoint;
+
+static void splitPoints(LayersSplit *split, size_t *kept, size_t *dropped, int nThreads, int procID);
+static void *splitThread(void *arg);
+static void copyPoint(Data *dst, size_t i, Data *src, size_t j);
+static void placeSeed(LayersSeed *seed, Data *pts, size_t band);
+static size_t chainHull(SeedPoint *p, size_t n, size_t *hull);
+static inline double seedCross(SeedPoint *o, SeedPoint *a, SeedPoint *b);
+static int cmpSeedPoints(const void *a, const void *b);
+static Data allocPoints(size_t n, int procID);
+
+ConvexLayers convexLayers(Data *d, size_t maxDepth, int nThreads, int procID)
+{
+    size_t n = d->n;
+    if (n > (size_t)(PointIndex)-1)
+        throwError("p[%2d] convexLayers: %ld points are too many for the point indices, build with LARGE_POINT_INDICES", procID, n);
+
+    ConvexLayers out = { .nLayers=0, .deeper=0 };
+    size_t capacity = LAYERS_INITIAL_CAPACITY;
+    out.offsets = malloc((capacity + 1) * sizeof(size_t));
+    out.vertices.n = 0;
+    out.vertices.X = malloc(n * 2 * sizeof(float) + MALLOC_PADDING);
+    out.vertices.Y = out.vertices.X == NULL ? NULL : &out.vertices.X[n];
+    out.vertices.I = d->I == NULL ? NULL : malloc(n * sizeof(PointIndex) + MALLOC_PADDING);
+    if ((out.offsets == NULL) || (out.vertices.X == NULL) || ((d->I != NULL) && (out.vertices.I == NULL)))
+        throwError("p[%2d] convexLayers: Failed to allocate memory for the layers", procID);
+    out.offsets[0] = 0;
+
+    // the points carry their position in d, a layer removes its vertices from the bitmap of the positions
+    Data cand = allocPoints(n, procID), inner = allocPoints(n, procID), scratch = allocPoints(n, procID);
+    memcpy(cand.X, d->X, n * sizeof(float));
+    memcpy(cand.Y, d->Y, n * sizeof(float));
+    for (size_t i = 0; i < n; i++)
+        cand.I[i] = i;
+    cand.n = n;
+    inner.n = 0;
+    uint64_t *removed = calloc((n + 63) / 64 + 1, sizeof(uint64_t));
+    uint64_t *mask = malloc(((n + 63) / 64 + MAX_THREADS) * sizeof(uint64_t) + MALLOC_PADDING);
+    size_t *order = malloc(2 * (n + 1) * sizeof(size_t)); // strictVertices rotates in place
+    LayersSeed seed = { .n=0, .polygon=allocPoints(LAYERS_SEED_VERTICES + 1, procID) };
+    if ((removed == NULL) || (mask == NULL) || (order == NULL))
+        throwError("p[%2d] convexLayers: Failed to allocate memory for the masks", procID);
+    LayersSplit split = { .removed=removed, .mask=mask, .seed=&seed.polygon };
+
+    size_t lastLayer = PREFILTER_HULL_MAX_SIZE, rebuilds = 0, visited = 0;
+    while ((cand.n + inner.n > 0) && ((maxDepth == 0) || (out.nLayers < maxDepth)))
+    {
+        if ((seed.n == 0) && (inner.n > 0))
+        {
+            memcpy(&cand.X[cand.n], inner.X, inner.n * sizeof(float));
+            memcpy(&cand.Y[cand.n], inner.Y, inner.n * sizeof(float));
+            memcpy(&cand.I[cand.n], inner.I, inner.n * sizeof(PointIndex));
+            cand.n += inner.n;
+            inner.n = 0;
+        }
+        if ((seed.n == 0) && (cand.n >= LAYERS_SEED_MIN_POINTS))
+        {
+            size_t band = (size_t)sqrt(2. * cand.n * lastLayer);
+            placeSeed(&seed, &cand, band > LAYERS_MIN_BAND ? band : LAYERS_MIN_BAND);
+            if (seed.n > 0)
+            {
+                size_t kept, dropped;
+                split.mode = LAYERS_MASK_SEED;
+                split.src = cand;
+                split.keep = scratch;
+                split.drop = inner;
+                splitPoints(&split, &kept, &dropped, nThreads, procID);
+                swapElems(cand, scratch);
+                cand.n = kept;
+                inner.n = dropped;
+                rebuilds++;
+                LOG(LOG_LVL_DEBUG, "p[%2d] convexLayers: Layer %ld, seed of %d vertices leaves %ld candidates and %ld inner points", procID, out.nLayers + 1, seed.n, cand.n, inner.n);
+            }
+        }
+
+        // the engine consumes its input
+        memcpy(scratch.X, cand.X, cand.n * sizeof(float));
+        memcpy(scratch.Y, cand.Y, cand.n * sizeof(float));
+        memcpy(scratch.I, cand.I, cand.n * sizeof(PointIndex));
+        scratch.n = cand.n;
+        visited += cand.n;
+        // the deep layers have few candidates: a thread per PREFILTER_PARALLEL_THRESHOLD candidates, like the passes of splitPoints
+        int hullThreads = nThreads;
+        if (cand.n < PREFILTER_PARALLEL_THRESHOLD * (size_t)hullThreads)
+            hullThreads = (int)(cand.n / PREFILTER_PARALLEL_THRESHOLD) + 1;
+        Data hull = parallhullThreaded(&scratch, (size_t)-1, procID, hullThreads, SCHEDULE_STATIC);
+        if (hull.n == 0)
+            throwError("p[%2d] convexLayers: Empty hull of %ld candidates at layer %ld", procID, cand.n, out.nLayers + 1);
+
+        if (out.nLayers == capacity)
+        {
+            capacity *= 2;
+            out.offsets = realloc(out.offsets, (capacity + 1) * sizeof(size_t));
+            if (out.offsets == NULL)
+                throwError("p[%2d] convexLayers: Failed to allocate memory for %ld layers", procID, capacity);
+        }
+        size_t nVertices = strictVertices(hull.X, hull.Y, hull.n, order);
+        for (size_t i = 0; i < nVertices; i++)
+        {
+            PointIndex pos = hull.I[order[i]];
+            removed[pos / 64] |= 1ULL << (pos % 64);
+            out.vertices.X[out.vertices.n] = hull.X[order[i]];
+            out.vertices.Y[out.vertices.n] = hull.Y[order[i]];
+            if (out.vertices.I != NULL)
+                out.vertices.I[out.vertices.n] = d->I[pos];
+            out.vertices.n++;
+        }
+        for (int i = 0; i < seed.n; i++)
+            if ((removed[seed.ids[i] / 64] >> (seed.ids[i] % 64)) & 1) // the inner points may be on the next layer now
+                seed.n = 0;
+        out.nLayers++;
+        out.offsets[out.nLayers] = out.vertices.n;
+        lastLayer = nVertices;
+        free(hull.X);
+        free(hull.Y);
+        free(hull.I);
+
+        size_t kept, dropped;
+        split.mode = LAYERS_MASK_KEEP;
+        split.src = cand;
+        split.keep = scratch;
+        split.drop.X = NULL;
+        splitPoints(&split, &kept, &dropped, nThreads, procID);
+        swapElems(cand, scratch);
+        cand.n = kept;
+        if (dropped != lastLayer)
+            throwError("p[%2d] convexLayers: Layer %ld has %ld vertices but %ld candidates were removed", procID, out.nLayers, lastLayer, dropped);
+    }
+    out.deeper = cand.n + inner.n;
+
+    LOG(LOG_LVL_INFO, "p[%2d] convexLayers: %ld layers of %ld points, %ld seeds, %.2lf candidates per point and layer", procID, out.nLayers, n,
+        rebuilds, out.nLayers > 0 ? (double)visited / n / out.nLayers : 0.);
+
+    free(cand.X); free(cand.I);
+    free(inner.X); free(inner.I);
+    free(scratch.X); free(scratch.I);
+    free(seed.polygon.X); free(seed.polygon.I);
+    free(removed);
+    free(mask);
+    free(order);
+    return out;
+}
+
+void freeConvexLayers(ConvexLayers *l)
+{
+    free(l->offsets);
+    free(l->vertices.X);
+    free(l->vertices.I);
+    l->nLayers = 0;
+}
+
+// Points of split->src split by their mask bit into split->keep and split->drop, in their order. The threads build the mask of their
+// slice and count, then every thread copies its points at the prefix sum of the counts of the previous ones
+static void splitPoints(LayersSplit *split, size_t *kept, size_t *dropped, int nThreads, int procID)
+{
+    size_t n = split->src.n;
+    if (nThreads > MAX_THREADS)
+        nThreads = MAX_THREADS;
+    if (n < PREFILTER_PARALLEL_THRESHOLD * (size_t)nThreads)
+        nThreads = (int)(n / PREFILTER_PARALLEL_THRESHOLD) + 1;
+
+    pthread_t threads[MAX_THREADS];
+    LayersThreadData ds[MAX_THREADS];
+    size_t counts[MAX_THREADS][2];
+    split->counts = counts;
+    split->nThreads = nThreads;
+    pthread_barrier_init(&split->barrier, NULL, nThreads);
+
+    size_t nWords = (n + 63) / 64;
+    size_t wordsPerThread = (nWords + nThreads - 1) / nThreads;
+    for (int i = 0; i < nThreads; i++)
+    {
+        size_t startPos = wordsPerThread * i * 64;
+        size_t endPos = wordsPerThread * (i+1) * 64;
+        if (startPos > n) startPos = n;
+        if (endPos > n) endPos = n;
+        ds[i].split = split;
+        ds[i].first = startPos;
+        ds[i].n = endPos - startPos;
+        ds[i].id.p = procID;
+        ds[i].id.t = i;
+        pthread_create(&threads[i], NULL, splitThread, (void*)&ds[i]);
+    }
+    for (int i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&split->barrier);
+
+    *kept = *dropped = 0;
+    for (int i = 0; i < nThreads; i++)
+    {
+        *kept += counts[i][0];
+        *dropped += counts[i][1];
+    }
+}
+
+static void *splitThread(void *arg)
+{
+    LayersThreadData *thData = (LayersThreadData*)arg;
+    LayersSplit *split = thData->split;
+    int t = thData->id.t;
+    size_t n = thData->n;
+    uint64_t *mask = &split->mask[thData->first / 64];
+    Data slice = { .n=n, .X=&split->src.X[thData->first], .Y=&split->src.Y[thData->first], .I=&split->src.I[thData->first] };
+
+    // 1) mask and count
+    size_t nWords = (n + 63) / 64;
+    if (split->mode == LAYERS_MASK_SEED)
+        buildUncoveredMask(split->seed, &slice, mask, true);
+    else
+        for (size_t w = 0; w < nWords; w++)
+        {
+            uint64_t bits = 0;
+            size_t count = n - w * 64 < 64 ? n - w * 64 : 64;
+            for (size_t j = 0; j < count; j++)
+            {
+                PointIndex pos = slice.I[w * 64 + j];
+                bits |= (uint64_t)!((split->removed[pos / 64] >> (pos % 64)) & 1) << j;
+            }
+            mask[w] = bits;
+        }
+    size_t keepCount = 0;
+    for (size_t w = 0; w < nWords; w++)
+        keepCount += __builtin_popcountll(mask[w]);
+    split->counts[t][0] = keepCount;
+    split->counts[t][1] = n - keepCount;
+    pthread_barrier_wait(&split->barrier);
+
+    // 2) copy to the prefix sum of the counts of the previous threads
+    size_t keepPos = 0, dropPos = 0;
+    for (int i = 0; i < t; i++)
+    {
+        keepPos += split->counts[i][0];
+        dropPos += split->counts[i][1];
+    }
+    for (size_t w = 0; w < nWords; w++)
+    {
+        uint64_t valid = n - w * 64 < 64 ? (1ULL << (n - w * 64)) - 1 : ~0ULL;
+        for (uint64_t bits = mask[w]; bits != 0; bits &= bits - 1)
+            copyPoint(&split->keep, keepPos++, &slice, w * 64 + __builtin_ctzll(bits));
+        if (split->drop.X != NULL)
+            for (uint64_t bits = ~mask[w] & valid; bits != 0; bits &= bits - 1)
+                copyPoint(&split->drop, dropPos++, &slice, w * 64 + __builtin_ctzll(bits));
+    }
+
+    return NULL;
+}
+
+static inline void copyPoint(Data *dst, size_t i, Data *src, size_t j)
+{
+    dst->X[i] = src->X[j];
+    dst->Y[i] = src->Y[j];
+    dst->I[i] = src->I[j];
+}
+
+// Seed polygon of the points of pts with about band points outside it, none if the band is too wide or too thin for a useful one.
+// The layers of a sample follow the layers of the points: the seed is the hull of the sample left once its outer layers, about as
+// many points of the sample as the band, are peeled. Its vertices are points of pts at the depth of the band all around
+static void placeSeed(LayersSeed *seed, Data *pts, size_t band)
+{
+    seed->n = 0;
+    size_t m = pts->n;
+    size_t s = m < LAYERS_SEED_SAMPLE ? m : LAYERS_SEED_SAMPLE;
+    size_t peel = (size_t)((double)band * s / m);
+    if ((2 * band >= m) || (peel < LAYERS_SEED_MIN_PEEL)) // a seed among the outer points would be taken by the next layers
+        return;
+
+    SeedPoint *sample = malloc(s * sizeof(SeedPoint));
+    size_t *hull = malloc((s + 1) * sizeof(size_t));
+    if ((sample == NULL) || (hull == NULL))
+        throwError("convexLayers: Failed to allocate memory for the seed sample");
+    for (size_t i = 0; i < s; i++) // stride over the points
+    {
+        size_t pos = i * m / s;
+        sample[i] = (SeedPoint){ .x=pts->X[pos], .y=pts->Y[pos], .pos=pos };
+    }
+    qsort(sample, s, sizeof(SeedPoint), cmpSeedPoints);
+
+    size_t peeled = 0, nv;
+    for (;;)
+    {
+        nv = chainHull(sample, s - peeled, hull);
+        if ((peeled >= peel) || (s - peeled - nv < 3))
+            break;
+        // the order by x is kept while the vertices are dropped
+        for (size_t i = 0; i < nv; i++)
+            sample[hull[i]].pos = (size_t)-1;
+        size_t k = 0;
+        for (size_t i = 0; i < s - peeled; i++)
+            if (sample[i].pos != (size_t)-1)
+                sample[k++] = sample[i];
+        peeled += nv;
+    }
+    if ((peeled < peel) || (nv < 3))
+    {
+        free(sample);
+        free(hull);
+        return;
+    }
+
+    // every subset of the vertices is a convex polygon with vertices in pts: evenly spread LAYERS_SEED_VERTICES of them are kept
+    double vx[LAYERS_SEED_VERTICES], vy[LAYERS_SEED_VERTICES];
+    size_t vpos[LAYERS_SEED_VERTICES];
+    int nSeed = nv < LAYERS_SEED_VERTICES ? (int)nv : LAYERS_SEED_VERTICES;
+    for (int i = 0; i < nSeed; i++)
+    {
+        SeedPoint *v = &sample[hull[i * nv / nSeed]];
+        vx[i] = v->x;
+        vy[i] = v->y;
+        vpos[i] = v->pos;
+    }
+    free(sample);
+    free(hull);
+
+    // shrunk towards its centroid so that the rounding of the coverage kernel and of the float vertices cannot put a point of
+    // the margin inside: the margin is at least 64 float ulps of the largest coordinate
+    double cx = 0, cy = 0, maxAbs = 0, minDist = DBL_MAX;
+    for (int i = 0; i < nSeed; i++)
+    {
+        cx += vx[i] / nSeed;
+        cy += vy[i] / nSeed;
+        maxAbs = fmax(maxAbs, fmax(fabs(vx[i]), fabs(vy[i])));
+    }
+    for (int i = 0; i < nSeed; i++)
+    {
+        int i1 = (i + 1) % nSeed;
+        double ex = vx[i1] - vx[i], ey = vy[i1] - vy[i];
+        minDist = fmin(minDist, (ex * (cy - vy[i]) - ey * (cx - vx[i])) / hypot(ex, ey));
+    }
+    double shrink = fmax(LAYERS_SEED_SHRINK, 64. * FLT_EPSILON * maxAbs / minDist);
+    if (!(minDist > 0) || (shrink > 0.5))
+        return;
+
+    for (int i = 0; i < nSeed; i++)
+    {
+        seed->polygon.X[i] = cx + (vx[i] - cx) * (1. - shrink);
+        seed->polygon.Y[i] = cy + (vy[i] - cy) * (1. - shrink);
+        seed->ids[i] = pts->I[vpos[i]];
+    }
+    seed->polygon.X[nSeed] = seed->polygon.X[0];
+    seed->polygon.Y[nSeed] = seed->polygon.Y[0];
+    seed->polygon.n = nSeed;
+    seed->n = nSeed;
+}
+
+// monotone chain over the first n points of p, sorted by x then y: positions in p of the strict CCW hull, the collinear points excluded
+static size_t chainHull(SeedPoint *p, size_t n, size_t *hull)
+{
+    if (n < 3)
+    {
+        for (size_t i = 0; i < n; i++)
+            hull[i] = i;
+        return n;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        while ((k >= 2) && (seedCross(&p[hull[k-2]], &p[hull[k-1]], &p[i]) <= 0))
+            k--;
+        hull[k++] = i;
+    }
+    for (size_t i = n - 1, lower = k + 1; i-- > 0;)
+    {
+        while ((k >= lower) && (seedCross(&p[hull[k-2]], &p[hull[k-1]], &p[i]) <= 0))
+            k--;
+        hull[k++] = i;
+    }
+    return k - 1; // the last is the first again
+}
+
+static inline double seedCross(SeedPoint *o, SeedPoint *a, SeedPoint *b)
+{
+    return (a->x - o->x) * (b->y - o->y) - (a->y - o->y) * (b->x - o->x);
+}
+
+static int cmpSeedPoints(const void *a, const void *b)
+{
+    const SeedPoint *p = (const SeedPoint*)a, *q = (const SeedPoint*)b;
+    if (p->x != q->x)
+        return p->x < q->x ? -1 : 1;
+    return (p->y > q->y) - (p->y < q->y);
+}
+
+// X and Y in one allocation, the positions in their own
+static Data allocPoints(size_t n, int procID)
+{
+    Data d = { .n=0 };
+    d.X = malloc(n * 2 * sizeof(float) + MALLOC_PADDING);
+    d.Y = d.X == NULL ? NULL : &d.X[n];
+    d.I = malloc(n * sizeof(PointIndex) + MALLOC_PADDING);
+    if ((d.X == NULL) || (d.I == NULL))
+        throwError("p[%2d] convexLayers: Failed to allocate memory for %ld points", procID, n);
+    return d;
+}
+
+// --layers: the layers go to --output as a "# layer D hull=H" header followed by the vertices of each layer
+void runConvexLayers(Params *p, int procID)
+{
+    double startTime = getTime();
+
+    PerfValues perfStart = perfRead();
+    traceBegin(NULL, TRACE_READ);
+    Data d;
+    size_t bytesRead;
+    if (p->inputFormat == INPUT_FORMAT_TEXT)
+        bytesRead = readFileText(&d, p, 0, 1);
+    else
+    {
+        readFile(&d, p);
+        bytesRead = d.n * 2 * sizeof(float);
+    }
+    traceEnd(NULL, TRACE_READ, bytesRead);
+    perfAccumulate(NULL, PHASE_READ, &perfStart);
+
+    double readTime = getTime();
+    metricsSetRead(readTime - startTime, bytesRead);
+    ConvexLayers l = convexLayers(&d, p->layersDepth, p->nThreads, procID);
+    double layersTime = getTime();
+    metricsSetPhaseTime(PHASE_QUICKHULL, layersTime - readTime);
+    metricsSetTotalTime(layersTime - startTime);
+
+    LOG(LOG_LVL_NOTICE, "p[%2d] runConvexLayers: %ld points in %ld layers%s, %ld points deeper. Read in %lfs, layers in %lfs", procID, d.n, l.nLayers,
+        l.deeper > 0 ? " (maximum depth reached)" : "", l.deeper, readTime - startTime, layersTime - readTime);
+
+    if (p->outputFile[0] != 0)
+    {
+        FILE *out = fopen(p->outputFile, "w");
+        if (out == NULL)
+            throwError("p[%2d] runConvexLayers: Could not open %s", procID, p->outputFile);
+        for (size_t i = 0; i < l.nLayers; i++)
+        {
+            size_t first = l.offsets[i];
+            Data hull = { .n=l.offsets[i+1] - first, .X=&l.vertices.X[first], .Y=&l.vertices.Y[first], .I=l.vertices.I == NULL ? NULL : &l.vertices.I[first] };
+            fprintf(out, "# layer %ld hull=%ld\n", i + 1, hull.n);
+            writeHullPoints(out, &hull);
+        }
+        fclose(out);
+    }
+
+    freeConvexLayers(&l);
+    free(d.X);
+    free(d.I);
+}
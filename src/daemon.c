@@ -0,0 +1,560 @@
+#define _GNU_SOURCE // MSG_CMSG_CLOEXEC
+#include "parallhull.h"
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define DAEMON_BACKLOG 64
+#define DAEMON_WAKE_STOP 's' // bytes written in the wake pipe of the accept loop
+#define DAEMON_WAKE_REAP 'r'
+
+// Daemon mode (--daemon): a pool of workers created once serves hull requests arriving on a Unix domain socket.
+// The client passes a memfd holding the points (see HULLD_BUFFER_BYTES) with SCM_RIGHTS, a worker hulls them in place
+// in the mapped memfd (consuming them) and writes the hull back in the same buffer, so the points are neither copied nor serialized.
+// Only memfds sealed against shrinking and growing are mapped: the size of the mapping cannot change under the workers, so a client
+// cannot make them fault (SIGBUS) on pages truncated away, which would end the daemon and every other client with it.
+// Every connection has a reader thread that queues its requests, the workers take them in arrival order
+
+enum DaemonLatency
+{
+    LATENCY_QUEUE,
+    LATENCY_HULL,
+    LATENCY_TOTAL,
+    LATENCY_COUNT
+};
+
+static const char *latencyNames[] = { "queueUs", "hullUs", "totalUs" };
+
+// a mapped memfd, shared by the requests that send the same memfd again (clients reuse their buffer)
+typedef struct
+{
+    dev_t dev;
+    ino_t ino;
+    size_t bytes;
+    void *base;
+    int refs; // atomic: the cache of the connection and every request using it
+} DaemonMapping;
+
+struct Daemon;
+
+typedef struct DaemonConnection
+{
+    int fd;
+    pthread_t reader;
+    pthread_mutex_t writeMutex; // the responses of different workers must not interleave
+    pthread_mutex_t mutex;
+    pthread_cond_t idleCond;
+    size_t inFlight; // queued or being hulled, protected by mutex
+    bool done; // the reader exited and can be joined, protected by the daemon mutex
+    DaemonMapping *cached; // reader thread only
+    struct Daemon *daemon;
+    struct DaemonConnection *next;
+} DaemonConnection;
+
+typedef struct DaemonRequest
+{
+    HulldRequest req;
+    DaemonConnection *conn;
+    DaemonMapping *map;
+    double recvTime;
+    struct DaemonRequest *next;
+} DaemonRequest;
+
+typedef struct Daemon
+{
+    int rank;
+    int nThreads;
+    int wakeFd; // write end of the wake pipe
+
+    pthread_mutex_t mutex;
+    pthread_cond_t queueCond;
+    DaemonRequest *head, *tail;
+    bool stopping;
+    DaemonConnection *connections;
+
+    // statistics, updated with atomics
+    uint64_t nRequests, nErrors, nPoints;
+    uint64_t hist[LATENCY_COUNT][HULLD_HIST_BUCKETS];
+} Daemon;
+
+typedef struct
+{
+    Daemon *d;
+    ProcThreadIDCombo id;
+} DaemonWorker;
+
+static int signalWakeFd = -1;
+
+static void *daemonReader(void *arg);
+static void *daemonWorker(void *arg);
+static void handleHullRequest(DaemonConnection *c, HulldRequest *req, int memfd, double recvTime);
+static void sendResponse(DaemonConnection *c, HulldResponse *resp, const char *payload);
+static char *statsJSON(Daemon *d);
+static void recordLatency(Daemon *d, enum DaemonLatency l, double seconds);
+static void releaseMapping(DaemonMapping *m);
+static void reapConnections(Daemon *d, bool all);
+static void wake(int fd, char what);
+
+static void stopSignalHandler(int sig)
+{
+    (void)sig;
+    wake(signalWakeFd, DAEMON_WAKE_STOP);
+}
+
+void runDaemon(Params *p, int procID)
+{
+    Daemon d = {
+        .rank=procID,
+        .nThreads=p->nThreads < 1 ? 1 : p->nThreads,
+        .head=NULL, .tail=NULL,
+        .stopping=false,
+        .connections=NULL,
+        .nRequests=0, .nErrors=0, .nPoints=0,
+        .hist={{0}}
+    };
+    if (d.nThreads > MAX_THREADS)
+        throwError("p[%2d] runDaemon: At most %d threads are supported", procID, MAX_THREADS);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0)
+        throwError("p[%2d] runDaemon: socket failed: %s", procID, strerror(errno));
+    struct sockaddr_un addr = { .sun_family=AF_UNIX };
+    strncpy(addr.sun_path, p->daemonSocket, sizeof(addr.sun_path) - 1);
+
+    // a socket left by a daemon that was killed would make bind fail, other files are not touched
+    struct stat st;
+    if ((stat(addr.sun_path, &st) == 0) && S_ISSOCK(st.st_mode))
+        unlink(addr.sun_path);
+    if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)))
+        throwError("p[%2d] runDaemon: Could not bind %s: %s", procID, addr.sun_path, strerror(errno));
+    if (listen(listenFd, DAEMON_BACKLOG))
+        throwError("p[%2d] runDaemon: listen failed: %s", procID, strerror(errno));
+
+    int wakePipe[2];
+    if (pipe(wakePipe))
+        throwError("p[%2d] runDaemon: pipe failed: %s", procID, strerror(errno));
+    d.wakeFd = wakePipe[1];
+    signalWakeFd = wakePipe[1];
+    struct sigaction sa = { .sa_handler=stopSignalHandler, .sa_flags=SA_RESTART };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN); // clients that disconnect are noticed by send
+
+    pthread_mutex_init(&d.mutex, NULL);
+    pthread_cond_init(&d.queueCond, NULL);
+    pthread_t threads[MAX_THREADS];
+    DaemonWorker workers[MAX_THREADS];
+    for (int i = 0; i < d.nThreads; i++)
+    {
+        workers[i].d = &d;
+        workers[i].id.p = procID;
+        workers[i].id.t = i;
+        pthread_create(&threads[i], NULL, daemonWorker, (void*)&workers[i]);
+    }
+
+    LOG(LOG_LVL_NOTICE, "p[%2d] runDaemon: Listening on %s with %d workers", procID, addr.sun_path, d.nThreads);
+    double startTime = getTime();
+
+    bool stop = false;
+    while (!stop)
+    {
+        struct pollfd fds[2] = { { .fd=listenFd, .events=POLLIN }, { .fd=wakePipe[0], .events=POLLIN } };
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throwError("p[%2d] runDaemon: poll failed: %s", procID, strerror(errno));
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            char buf[64];
+            ssize_t got = read(wakePipe[0], buf, sizeof(buf));
+            for (ssize_t i = 0; i < got; i++)
+                stop |= buf[i] == DAEMON_WAKE_STOP;
+            reapConnections(&d, false);
+        }
+
+        if ((fds[0].revents & POLLIN) && !stop)
+        {
+            int fd = accept(listenFd, NULL, NULL);
+            if (fd < 0)
+            {
+                LOG(LOG_LVL_WARN, "p[%2d] runDaemon: accept failed: %s", procID, strerror(errno));
+                continue;
+            }
+            DaemonConnection *c = calloc(1, sizeof(DaemonConnection));
+            if (c == NULL)
+                throwError("p[%2d] runDaemon: Failed to allocate a connection", procID);
+            c->fd = fd;
+            c->daemon = &d;
+            pthread_mutex_init(&c->writeMutex, NULL);
+            pthread_mutex_init(&c->mutex, NULL);
+            pthread_cond_init(&c->idleCond, NULL);
+            pthread_mutex_lock(&d.mutex);
+            c->next = d.connections;
+            d.connections = c;
+            pthread_mutex_unlock(&d.mutex);
+            pthread_create(&c->reader, NULL, daemonReader, (void*)c);
+            LOG(LOG_LVL_DEBUG, "p[%2d] runDaemon: Client connected (fd %d)", procID, fd);
+        }
+    }
+
+    // no new connections, the readers stop at the end of the request they are reading and wait for their requests
+    close(listenFd);
+    unlink(addr.sun_path);
+    pthread_mutex_lock(&d.mutex);
+    for (DaemonConnection *c = d.connections; c != NULL; c = c->next)
+        shutdown(c->fd, SHUT_RD);
+    pthread_mutex_unlock(&d.mutex);
+    reapConnections(&d, true);
+
+    pthread_mutex_lock(&d.mutex);
+    d.stopping = true;
+    pthread_cond_broadcast(&d.queueCond);
+    pthread_mutex_unlock(&d.mutex);
+    for (int i = 0; i < d.nThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    signalWakeFd = -1;
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    pthread_mutex_destroy(&d.mutex);
+    pthread_cond_destroy(&d.queueCond);
+
+    double elapsed = getTime() - startTime;
+    LOG(LOG_LVL_NOTICE, "p[%2d] runDaemon: Served %lu requests (%lu failed, %lu points) in %lfs", procID, d.nRequests, d.nErrors, d.nPoints, elapsed);
+}
+
+// joins the readers that exited, or all of them at shutdown
+static void reapConnections(Daemon *d, bool all)
+{
+    pthread_mutex_lock(&d->mutex);
+    DaemonConnection **prev = &d->connections;
+    while (*prev != NULL)
+    {
+        DaemonConnection *c = *prev;
+        if (!all && !c->done)
+        {
+            prev = &c->next;
+            continue;
+        }
+        *prev = c->next;
+        pthread_mutex_unlock(&d->mutex); // the reader takes the daemon mutex to set done
+        pthread_join(c->reader, NULL);
+        close(c->fd);
+        pthread_mutex_destroy(&c->writeMutex);
+        pthread_mutex_destroy(&c->mutex);
+        pthread_cond_destroy(&c->idleCond);
+        free(c);
+        pthread_mutex_lock(&d->mutex);
+    }
+    pthread_mutex_unlock(&d->mutex);
+}
+
+static void wake(int fd, char what)
+{
+    if (fd >= 0)
+        if (write(fd, &what, 1) < 0) {} // the pipe is full only if the accept loop already has plenty to wake up for
+}
+
+static ssize_t recvRequest(int sock, HulldRequest *req, int *memfd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { .iov_base=req, .iov_len=sizeof(*req) };
+    struct msghdr msg = { .msg_iov=&iov, .msg_iovlen=1, .msg_control=control, .msg_controllen=sizeof(control) };
+
+    ssize_t got;
+    do
+        got = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    while ((got < 0) && (errno == EINTR));
+
+    *memfd = -1;
+    if (got > 0)
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+            if ((cm->cmsg_level == SOL_SOCKET) && (cm->cmsg_type == SCM_RIGHTS))
+                memcpy(memfd, CMSG_DATA(cm), sizeof(int));
+    return got;
+}
+
+static void *daemonReader(void *arg)
+{
+    DaemonConnection *c = (DaemonConnection*)arg;
+    Daemon *d = c->daemon;
+
+    while (true)
+    {
+        HulldRequest req;
+        int memfd;
+        ssize_t got = recvRequest(c->fd, &req, &memfd);
+        if (got != sizeof(req))
+        {
+            if (memfd >= 0)
+                close(memfd);
+            break; // closed by the client (or at shutdown), a partial header means the same
+        }
+        double recvTime = getTime();
+
+        HulldResponse resp = { .magic=HULLD_MAGIC, .status=HULLD_OK, .id=req.id, .hullSize=0, .queueTime=0, .hullTime=0 };
+        if (req.magic != HULLD_MAGIC)
+            req.op = (uint32_t)-1;
+        switch (req.op)
+        {
+        case HULLD_OP_HULL:
+            handleHullRequest(c, &req, memfd, recvTime);
+            break;
+
+        case HULLD_OP_STATS:
+        {
+            char *json = statsJSON(d);
+            resp.hullSize = strlen(json);
+            sendResponse(c, &resp, json);
+            free(json);
+            break;
+        }
+        case HULLD_OP_SHUTDOWN:
+            sendResponse(c, &resp, NULL);
+            wake(d->wakeFd, DAEMON_WAKE_STOP);
+            break;
+
+        default:
+            __atomic_fetch_add(&d->nErrors, 1, __ATOMIC_RELAXED);
+            resp.status = HULLD_ERR_BAD_REQUEST;
+            sendResponse(c, &resp, NULL);
+            break;
+        }
+        if ((memfd >= 0) && (req.op != HULLD_OP_HULL))
+            close(memfd);
+    }
+
+    if (c->cached != NULL)
+        releaseMapping(c->cached);
+
+    pthread_mutex_lock(&c->mutex);
+    while (c->inFlight > 0)
+        pthread_cond_wait(&c->idleCond, &c->mutex);
+    pthread_mutex_unlock(&c->mutex);
+
+    pthread_mutex_lock(&d->mutex);
+    c->done = true;
+    pthread_mutex_unlock(&d->mutex);
+    wake(d->wakeFd, DAEMON_WAKE_REAP);
+    return NULL;
+}
+
+// validates the request and maps its memfd (or reuses the mapping of the previous request), then queues it. Takes the memfd
+static void handleHullRequest(DaemonConnection *c, HulldRequest *req, int memfd, double recvTime)
+{
+    Daemon *d = c->daemon;
+    HulldResponse resp = { .magic=HULLD_MAGIC, .status=HULLD_OK, .id=req->id, .hullSize=0, .queueTime=0, .hullTime=0 };
+
+    struct stat st;
+    int seals = memfd < 0 ? -1 : fcntl(memfd, F_GET_SEALS);
+    if ((memfd < 0) || (req->capacity == 0) || (req->n > req->capacity) || (req->capacity > SIZE_MAX / (8 * sizeof(float))))
+        resp.status = HULLD_ERR_BAD_REQUEST;
+    else if ((seals < 0) || ((seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)))
+        resp.status = HULLD_ERR_BUFFER;
+    else if (fstat(memfd, &st) || ((size_t)st.st_size < HULLD_BUFFER_BYTES(req->capacity)))
+        resp.status = HULLD_ERR_BUFFER;
+
+    DaemonMapping *map = NULL;
+    if (resp.status == HULLD_OK)
+    {
+        DaemonMapping *cached = c->cached;
+        if ((cached != NULL) && (cached->dev == st.st_dev) && (cached->ino == st.st_ino) && (cached->bytes == (size_t)st.st_size))
+        {
+            map = cached;
+            __atomic_fetch_add(&map->refs, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+            map = base == MAP_FAILED ? NULL : malloc(sizeof(DaemonMapping));
+            if (map == NULL)
+            {
+                if (base != MAP_FAILED)
+                    munmap(base, st.st_size);
+                resp.status = HULLD_ERR_BUFFER;
+            }
+            else
+            {
+                *map = (DaemonMapping){ .dev=st.st_dev, .ino=st.st_ino, .bytes=st.st_size, .base=base, .refs=2 }; // cache and request
+                if (cached != NULL)
+                    releaseMapping(cached);
+                c->cached = map;
+            }
+        }
+    }
+    if (memfd >= 0)
+        close(memfd); // the mapping keeps the memory alive
+
+    if (resp.status != HULLD_OK)
+    {
+        LOG(LOG_LVL_WARN, "p[%2d] runDaemon: Rejected request %lu (n=%lu, capacity=%lu): status %d", d->rank, req->id, req->n, req->capacity, resp.status);
+        __atomic_fetch_add(&d->nErrors, 1, __ATOMIC_RELAXED);
+        sendResponse(c, &resp, NULL);
+        return;
+    }
+
+    DaemonRequest *r = malloc(sizeof(DaemonRequest));
+    if (r == NULL)
+        throwError("p[%2d] runDaemon: Failed to allocate a request", d->rank);
+    *r = (DaemonRequest){ .req=*req, .conn=c, .map=map, .recvTime=recvTime, .next=NULL };
+
+    pthread_mutex_lock(&c->mutex);
+    c->inFlight++;
+    pthread_mutex_unlock(&c->mutex);
+
+    pthread_mutex_lock(&d->mutex);
+    if (d->tail == NULL)
+        d->head = r;
+    else
+        d->tail->next = r;
+    d->tail = r;
+    pthread_cond_signal(&d->queueCond);
+    pthread_mutex_unlock(&d->mutex);
+}
+
+static void *daemonWorker(void *arg)
+{
+    DaemonWorker *w = (DaemonWorker*)arg;
+    Daemon *d = w->d;
+
+    while (true)
+    {
+        pthread_mutex_lock(&d->mutex);
+        while ((d->head == NULL) && !d->stopping)
+            pthread_cond_wait(&d->queueCond, &d->mutex);
+        DaemonRequest *r = d->head;
+        if (r != NULL)
+        {
+            d->head = r->next;
+            if (d->head == NULL)
+                d->tail = NULL;
+        }
+        pthread_mutex_unlock(&d->mutex);
+        if (r == NULL)
+            break; // stopping and nothing left
+
+        double startTime = getTime();
+        size_t capacity = r->req.capacity;
+        HulldResponse resp = { .magic=HULLD_MAGIC, .status=HULLD_OK, .id=r->req.id, .hullSize=0, .queueTime=startTime - r->recvTime, .hullTime=0 };
+        if (r->req.n > 0)
+        {
+            float *base = (float*)r->map->base;
+            Data pts = { .n=r->req.n, .X=base, .Y=&base[capacity], .I=NULL };
+            Data hull = quickhull(&pts, &w->id);
+
+            float *hullX = (float*)((char*)r->map->base + HULLD_HULL_OFFSET(capacity));
+            memcpy(hullX, hull.X, hull.n * sizeof(float));
+            memcpy(&hullX[capacity], hull.Y, hull.n * sizeof(float));
+            resp.hullSize = hull.n;
+            free(hull.X);
+            free(hull.Y);
+        }
+        double endTime = getTime();
+        resp.hullTime = endTime - startTime;
+        releaseMapping(r->map);
+
+        // counted before the response, so that the client sees its request in the statistics it asks next
+        __atomic_fetch_add(&d->nRequests, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&d->nPoints, r->req.n, __ATOMIC_RELAXED);
+        recordLatency(d, LATENCY_QUEUE, resp.queueTime);
+        recordLatency(d, LATENCY_HULL, resp.hullTime);
+        recordLatency(d, LATENCY_TOTAL, getTime() - r->recvTime);
+        sendResponse(r->conn, &resp, NULL);
+        LOG(LOG_LVL_DEBUG, "p[%2d] t[%3d] runDaemon: Request %lu: n=%lu, hullSize=%lu, queued %lfs, hulled in %lfs", w->id.p, w->id.t, resp.id, r->req.n, resp.hullSize, resp.queueTime, resp.hullTime);
+
+        DaemonConnection *c = r->conn;
+        free(r);
+        pthread_mutex_lock(&c->mutex);
+        if (--c->inFlight == 0)
+            pthread_cond_signal(&c->idleCond);
+        pthread_mutex_unlock(&c->mutex);
+    }
+
+    return NULL;
+}
+
+static void releaseMapping(DaemonMapping *m)
+{
+    if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        munmap(m->base, m->bytes);
+        free(m);
+    }
+}
+
+static void sendAll(int fd, const void *buf, size_t count)
+{
+    const char *ptr = buf;
+    while (count > 0)
+    {
+        ssize_t sent = send(fd, ptr, count, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return; // the client went away, its reader will notice
+        }
+        ptr += sent;
+        count -= sent;
+    }
+}
+
+static void sendResponse(DaemonConnection *c, HulldResponse *resp, const char *payload)
+{
+    pthread_mutex_lock(&c->writeMutex);
+    sendAll(c->fd, resp, sizeof(*resp));
+    if (payload != NULL)
+        sendAll(c->fd, payload, resp->hullSize);
+    pthread_mutex_unlock(&c->writeMutex);
+}
+
+static void recordLatency(Daemon *d, enum DaemonLatency l, double seconds)
+{
+    uint64_t us = seconds > 0 ? (uint64_t)(seconds * 1e6) : 0;
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= HULLD_HIST_BUCKETS)
+        bucket = HULLD_HIST_BUCKETS - 1;
+    __atomic_fetch_add(&d->hist[l][bucket], 1, __ATOMIC_RELAXED);
+}
+
+static char *statsJSON(Daemon *d)
+{
+    char *buf = NULL;
+    size_t bufLen = 0;
+    FILE *f = open_memstream(&buf, &bufLen);
+    if (f == NULL)
+        throwError("p[%2d] runDaemon: open_memstream failed", d->rank);
+
+    fprintf(f, "{\"requests\": %lu, \"errors\": %lu, \"points\": %lu, \"workers\": %d", __atomic_load_n(&d->nRequests, __ATOMIC_RELAXED),
+            __atomic_load_n(&d->nErrors, __ATOMIC_RELAXED), __atomic_load_n(&d->nPoints, __ATOMIC_RELAXED), d->nThreads);
+    fprintf(f, ", \"bucketUpperUs\": [");
+    for (int b = 0; b < HULLD_HIST_BUCKETS; b++)
+        fprintf(f, "%s%lu", b == 0 ? "" : ", ", 1UL << b);
+    fprintf(f, "]");
+    for (int l = 0; l < LATENCY_COUNT; l++)
+    {
+        fprintf(f, ", \"%s\": [", latencyNames[l]);
+        for (int b = 0; b < HULLD_HIST_BUCKETS; b++)
+            fprintf(f, "%s%lu", b == 0 ? "" : ", ", __atomic_load_n(&d->hist[l][b], __ATOMIC_RELAXED));
+        fprintf(f, "]");
+    }
+    fprintf(f, "}\n");
+    fclose(f);
+
+    return buf;
+}
@@ -0,0 +1,319 @@
+#include "parallhull.h"
+
+#include <argp.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+// Synthetic data generator: writes the raw format read by readFile (n floats of X followed by n floats of Y), and with --q16 its
+// quantized companion read by --q16 of main. --companion writes only the companion of an existing raw file.
+// Must be built with NON_MPI_MODE (see the build target in the makefile)
+#ifndef NON_MPI_MODE
+    #error "genData.c must be compiled with -DNON_MPI_MODE"
+#endif
+
+#define GEN_DEFAULT_BLOCK_SIZE (1UL << 20) // points generated by a thread before each pwrite (8MB of buffers per thread)
+
+typedef struct
+{
+    size_t n;
+    enum Distribution dist;
+    uint64_t seed;
+    double radius;
+    int nThreads;
+    size_t blockSize;
+    char outputFile[1000];
+    bool q16;
+    char companionOf[1000]; // raw file read instead of generating the points
+} GenParams;
+
+typedef struct
+{
+    GenParams *gp;
+    int fd; // -1 with --companion
+    int q16Fd; // -1 without --q16
+    int inputFd; // --companion only
+    size_t *nextBlock; // shared block counter, blocks are claimed with an atomic add
+    int thID;
+} GenThreadData;
+
+enum argpKeys{
+    ARGP_NPOINTS='n',
+    ARGP_DIST='d',
+    ARGP_SEED='s',
+    ARGP_RADIUS='r',
+    ARGP_NTHREADS='j',
+    ARGP_BLOCK='b',
+    ARGP_OUTPUT='o',
+    ARGP_Q16=0x100, // long options only
+    ARGP_COMPANION
+};
+
+static error_t genArgpParser(int key, char *arg, struct argp_state *state);
+static void *genThread(void *arg);
+static void pwriteAll(int fd, const void *buf, size_t count, off_t offset);
+static void preadAll(int fd, void *buf, size_t count, off_t offset);
+
+int main(int argc, char *argv[])
+{
+    static struct argp_option argpOptions[] = {
+        { .name="npoints", .key=ARGP_NPOINTS, .arg="NUM", .flags=0, .doc="Number of points to generate (scientific notation like 1e9 is accepted)\n", .group=1 },
+        { .name="dist", .key=ARGP_DIST, .arg="STRING", .flags=0, .doc="Distribution: disk (default), square, circle, annulus, gaussian, clustered\n", .group=1 },
+        { .name="seed", .key=ARGP_SEED, .arg="UINT", .flags=0, .doc="Seed, the same seed always generates the same file regardless of the number of threads\n", .group=1 },
+        { .name="radius", .key=ARGP_RADIUS, .arg="FLOAT", .flags=0, .doc="Radius of the distribution (default npoints^(1/4), like genRawData.py)\n", .group=1 },
+        { .name="threads", .key=ARGP_NTHREADS, .arg="UINT", .flags=0, .doc="Number of threads to use (default all the online cpus)\n", .group=1 },
+        { .name="block", .key=ARGP_BLOCK, .arg="UINT", .flags=0, .doc="Points generated by each thread before writing them\n", .group=1 },
+        { .name="output", .key=ARGP_OUTPUT, .arg="FILENAME", .flags=0, .doc="Output file (default data/<dist>_<npoints>)\n", .group=1 },
+        { .name="q16", .key=ARGP_Q16, .arg=NULL, .flags=0, .doc="Also write the quantized companion FILENAME.q16 of the output, read by main --q16\n", .group=1 },
+        { .name="companion", .key=ARGP_COMPANION, .arg="FILENAME", .flags=0, .doc="Write only the quantized companion FILENAME.q16 of an existing raw file\n", .group=1 },
+        { 0 }
+    };
+    static struct argp argpData = {
+        .options = argpOptions,
+        .parser = genArgpParser,
+        .doc = "Generates a raw point file for parallhull using per-thread counter based random streams"
+    };
+
+    GenParams gp = {
+        .n = 0,
+        .dist = DIST_DISK,
+        .seed = 0,
+        .radius = 0,
+        .nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN),
+        .blockSize = GEN_DEFAULT_BLOCK_SIZE,
+        .outputFile = {0},
+        .q16 = false,
+        .companionOf = {0}
+    };
+    argp_parse(&argpData, argc, argv, 0, 0, &gp);
+
+    int inputFd = -1;
+    if (gp.companionOf[0] != 0)
+    {
+        inputFd = open(gp.companionOf, O_RDONLY);
+        if (inputFd < 0)
+            throwError("Could not read file %s", gp.companionOf);
+        gp.n = lseek(inputFd, 0, SEEK_END) / (2 * sizeof(float));
+        gp.q16 = true;
+        snprintf(gp.outputFile, sizeof(gp.outputFile), "%s", gp.companionOf);
+    }
+    // the companion is written by whole quantized blocks, a generation block must hold a whole number of them
+    if (gp.q16)
+        gp.blockSize = (gp.blockSize + Q16_BLOCK_POINTS - 1) / Q16_BLOCK_POINTS * Q16_BLOCK_POINTS;
+
+    if (gp.n == 0)
+        throwError("The number of points must be specified with --npoints");
+    if (gp.nThreads < 1)
+        gp.nThreads = 1;
+    if (gp.nThreads > MAX_THREADS)
+        gp.nThreads = MAX_THREADS;
+    if (gp.radius == 0)
+        gp.radius = pow((double)gp.n, 0.25);
+    if (gp.outputFile[0] == 0)
+        snprintf(gp.outputFile, sizeof(gp.outputFile), "data/%s_%.0e", distributionNames[gp.dist], (double)gp.n);
+
+    struct timespec timeStruct;
+    clock_gettime(CLOCK_MONOTONIC, &timeStruct);
+    double startTime = cvtTimespec2Double(timeStruct);
+
+    int fd = -1;
+    if (inputFd < 0)
+    {
+        fd = open(gp.outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throwError("Could not open output file %s", gp.outputFile);
+        if (ftruncate(fd, gp.n * 2 * sizeof(float)))
+            throwError("Could not resize %s to %ld bytes", gp.outputFile, gp.n * 2 * sizeof(float));
+    }
+
+    int q16Fd = -1;
+    char q16File[1010];
+    if (gp.q16)
+    {
+        Q16Header h = { .magic=Q16_MAGIC, .blockPoints=Q16_BLOCK_POINTS, .n=gp.n, .nBlocks=(gp.n + Q16_BLOCK_POINTS - 1) / Q16_BLOCK_POINTS, .reserved=0 };
+        snprintf(q16File, sizeof(q16File), "%s.q16", gp.outputFile);
+        q16Fd = open(q16File, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (q16Fd < 0)
+            throwError("Could not open output file %s", q16File);
+        if (ftruncate(q16Fd, Q16_DATA_OFFSET(h.nBlocks) + h.nBlocks * Q16_BLOCK_BYTES))
+            throwError("Could not resize %s to %ld bytes", q16File, Q16_DATA_OFFSET(h.nBlocks) + h.nBlocks * Q16_BLOCK_BYTES);
+        pwriteAll(q16Fd, &h, sizeof(h), 0);
+    }
+
+    size_t nextBlock = 0;
+    pthread_t threads[MAX_THREADS];
+    GenThreadData ds[MAX_THREADS];
+    for (int i = 0; i < gp.nThreads; i++)
+    {
+        ds[i].gp = &gp;
+        ds[i].fd = fd;
+        ds[i].q16Fd = q16Fd;
+        ds[i].inputFd = inputFd;
+        ds[i].nextBlock = &nextBlock;
+        ds[i].thID = i;
+        pthread_create(&threads[i], NULL, genThread, (void*)&ds[i]);
+    }
+    for (int i = 0; i < gp.nThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &timeStruct);
+    double endTime = cvtTimespec2Double(timeStruct);
+    if (q16Fd >= 0)
+        close(q16Fd);
+    if (inputFd >= 0)
+    {
+        close(inputFd);
+        LOG(LOG_LVL_NOTICE, "Wrote the companion %s of the %ld points of %s in %lfs", q16File, gp.n, gp.companionOf, endTime - startTime);
+        return EXIT_SUCCESS;
+    }
+    close(fd);
+    if (q16Fd >= 0)
+        LOG(LOG_LVL_NOTICE, "Wrote the companion %s", q16File);
+    LOG(LOG_LVL_NOTICE, "Generated %ld %s points (seed=%lu, radius=%lf) in %s in %lfs", gp.n, distributionNames[gp.dist], gp.seed, gp.radius, gp.outputFile, endTime - startTime);
+
+    return EXIT_SUCCESS;
+}
+
+static void *genThread(void *arg)
+{
+    GenThreadData *thData = (GenThreadData*)arg;
+    GenParams *gp = thData->gp;
+
+    float *X = malloc(gp->blockSize * 2 * sizeof(float));
+    if (X == NULL)
+        throwError("t[%3d] genThread: Failed to allocate the block buffers", thData->thID);
+    float *Y = &X[gp->blockSize];
+    uint16_t *q = malloc(Q16_BLOCK_BYTES);
+    if (q == NULL)
+        throwError("t[%3d] genThread: Failed to allocate the block buffers", thData->thID);
+    size_t q16Blocks = (gp->n + Q16_BLOCK_POINTS - 1) / Q16_BLOCK_POINTS;
+
+    size_t nBlocks = (gp->n + gp->blockSize - 1) / gp->blockSize;
+    for (size_t b = __atomic_fetch_add(thData->nextBlock, 1, __ATOMIC_RELAXED); b < nBlocks; b = __atomic_fetch_add(thData->nextBlock, 1, __ATOMIC_RELAXED))
+    {
+        size_t first = b * gp->blockSize;
+        size_t count = gp->blockSize;
+        if (first + count > gp->n)
+            count = gp->n - first;
+
+        if (thData->inputFd >= 0)
+        {
+            preadAll(thData->inputFd, X, count * sizeof(float), first * sizeof(float));
+            preadAll(thData->inputFd, Y, count * sizeof(float), (gp->n + first) * sizeof(float));
+        }
+        else
+        {
+            genPoints(X, Y, first, count, gp->dist, gp->seed, gp->radius);
+            pwriteAll(thData->fd, X, count * sizeof(float), first * sizeof(float));
+            pwriteAll(thData->fd, Y, count * sizeof(float), (gp->n + first) * sizeof(float));
+        }
+
+        // first is a multiple of Q16_BLOCK_POINTS (see main)
+        for (size_t s = 0; (thData->q16Fd >= 0) && (s < count); s += Q16_BLOCK_POINTS)
+        {
+            size_t qb = (first + s) / Q16_BLOCK_POINTS;
+            Q16Block hb;
+            q16EncodeBlock(&X[s], &Y[s], count - s < Q16_BLOCK_POINTS ? count - s : Q16_BLOCK_POINTS, &hb, q);
+            pwriteAll(thData->q16Fd, &hb, sizeof(hb), sizeof(Q16Header) + qb * sizeof(Q16Block));
+            pwriteAll(thData->q16Fd, q, Q16_BLOCK_BYTES, Q16_DATA_OFFSET(q16Blocks) + qb * Q16_BLOCK_BYTES);
+        }
+    }
+
+    free(X);
+    free(q);
+    return NULL;
+}
+
+static void pwriteAll(int fd, const void *buf, size_t count, off_t offset)
+{
+    const char *ptr = buf;
+    while (count > 0)
+    {
+        ssize_t written = pwrite(fd, ptr, count, offset);
+        if (written < 0)
+            throwError("pwrite failed at offset %ld", offset);
+        ptr += written;
+        count -= written;
+        offset += written;
+    }
+}
+
+static void preadAll(int fd, void *buf, size_t count, off_t offset)
+{
+    char *ptr = buf;
+    while (count > 0)
+    {
+        ssize_t got = pread(fd, ptr, count, offset);
+        if (got <= 0)
+            throwError("pread failed at offset %ld", offset);
+        ptr += got;
+        count -= got;
+        offset += got;
+    }
+}
+
+static error_t genArgpParser(int key, char *arg, struct argp_state *state)
+{
+    GenParams *gp = state->input;
+    char *endPtr;
+
+    switch (key)
+    {
+    case ARGP_NPOINTS:
+    {
+        double v = strtod(arg, &endPtr);
+        if ((*endPtr != 0) || (v < 1))
+            throwError("npoints: \"%s\" is not a valid number of points", arg);
+        gp->n = (size_t)v;
+        break;
+    }
+    case ARGP_DIST:
+    {
+        int dist = parseDistribution(arg);
+        if (dist < 0)
+            throwError("dist: argument not valid");
+        gp->dist = dist;
+        break;
+    }
+    case ARGP_SEED:
+        gp->seed = strtoull(arg, &endPtr, 0);
+        if (*endPtr != 0)
+            throwError("seed: argument not valid");
+        break;
+    case ARGP_RADIUS:
+        gp->radius = strtod(arg, &endPtr);
+        if ((*endPtr != 0) || (gp->radius <= 0))
+            throwError("radius: argument not valid");
+        break;
+    case ARGP_NTHREADS:
+        gp->nThreads = atoi(arg);
+        break;
+    case ARGP_BLOCK:
+    {
+        double v = strtod(arg, &endPtr);
+        if ((*endPtr != 0) || (v < 1))
+            throwError("block: argument not valid");
+        gp->blockSize = (size_t)v;
+        break;
+    }
+    case ARGP_OUTPUT:
+        strncpy(gp->outputFile, arg, 999);
+        break;
+    case ARGP_Q16:
+        gp->q16 = true;
+        break;
+    case ARGP_COMPANION:
+        strncpy(gp->companionOf, arg, 999);
+        break;
+    case ARGP_KEY_END:
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
@@ -0,0 +1,369 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+#include <immintrin.h>
+#ifndef NON_MPI_MODE
+    #include <mpi.h>
+#endif
+
+// Grid culling (--grid-cull): a coarse uniform grid over the bounding box of the points, and one counting pass that keeps for every
+// column the lowest and the highest occupied row. A point is dropped when occupied cells exist in all four quadrants strictly around
+// its cell: left-below, left-above, right-below and right-above. Then the point is strictly inside the hull of four points of those
+// cells (the vertical line through it crosses the segment of the two lower ones below it and the one of the two upper ones above it).
+// Keeping just the min/max cells of every column and row is not enough: a point in the corner of its cell can be outside the hull
+// of the four points around it in its own row and column. The quadrants of a column come from prefix and suffix scans of the column
+// minima and maxima, so they also cover what the row minima and maxima would tell. For dense data only a ring of cells one or two
+// cells wide along the boundary survives, O(n / cellsPerSide) points.
+// The cell of a point is floor((x - minX) * scale), monotonic in x, so a point in a column on the left of another one has a smaller x
+// whatever the rounding. Both passes use the same cellsOf8, the cells of a point cannot differ between them
+
+typedef struct {
+    Data pts;
+    int pass;
+    float box[4]; // minX, minY, -maxX, -maxY: a single min reduction
+    float scaleX, scaleY;
+    int32_t cells;
+    int32_t *colMin, *colMax; // pass 1: own histogram, pass 2: the interior rows (lo, hi) of every column, shared
+    uint64_t *mask;
+    size_t *counts;
+    Data *out;
+    pthread_barrier_t *barrier;
+    int nThreads;
+    ProcThreadIDCombo id;
+} GridCullThreadData;
+
+enum GridCullPass
+{
+    GRID_PASS_BOX,
+    GRID_PASS_COUNT,
+    GRID_PASS_CULL
+};
+
+static void runPass(GridCullThreadData *ds, int nThreads, int pass);
+static void *gridCullThread(void *arg);
+static void boundingBox(GridCullThreadData *thData);
+static void countColumns(GridCullThreadData *thData);
+static void cullPoints(GridCullThreadData *thData);
+static void interiorRows(int32_t *colMin, int32_t *colMax, int32_t cells);
+
+static inline void cellsOf8(const float *X, const float *Y, __m256 minX, __m256 minY, __m256 scaleX, __m256 scaleY, __m256i last, __m256i *col, __m256i *row)
+{
+    // the points are in the box, so only the lanes past the last point (padding) can be below 0, the gathers must not see them
+    __m256i zero = _mm256_setzero_si256();
+    *col = _mm256_max_epi32(_mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(X), minX), scaleX)), last), zero);
+    *row = _mm256_max_epi32(_mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(Y), minY), scaleY)), last), zero);
+}
+
+// d->X must be a single allocation holding X and Y (like the one of readFile): it is replaced by a smaller one with only the points
+// that survive. cellsPerSide 0 picks one from the number of points. With MPI every rank must call it, the grid is over all the points
+void gridCullPoints(Data *d, size_t cellsPerSide, int nThreads, int rank, int nProcs)
+{
+    double startTime = getTime();
+    traceBegin(NULL, TRACE_PREFILTER);
+
+    if (nThreads > MAX_THREADS)
+        nThreads = MAX_THREADS;
+    if (d->n < PREFILTER_PARALLEL_THRESHOLD * (size_t)nThreads)
+        nThreads = (int)(d->n / PREFILTER_PARALLEL_THRESHOLD) + 1;
+
+    size_t nWords = (d->n + 63) / 64;
+    GridCullThreadData ds[MAX_THREADS];
+    size_t counts[MAX_THREADS];
+    Data out = { .n=0 };
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, nThreads);
+
+    // slices start on a mask word so that every thread owns whole words, and on a multiple of 8 points for cellsOf8
+    size_t wordsPerThread = (nWords + nThreads - 1) / nThreads;
+    for (int i = 0; i < nThreads; i++)
+    {
+        size_t startPos = wordsPerThread * i * 64;
+        size_t endPos = wordsPerThread * (i+1) * 64;
+        if (startPos > d->n) startPos = d->n;
+        if (endPos > d->n) endPos = d->n;
+        ds[i].pts.X = &d->X[startPos];
+        ds[i].pts.Y = &d->Y[startPos];
+        ds[i].pts.I = d->I == NULL ? NULL : &d->I[startPos];
+        ds[i].pts.n = endPos - startPos;
+        ds[i].mask = NULL;
+        ds[i].colMin = ds[i].colMax = NULL;
+        ds[i].counts = counts;
+        ds[i].out = &out;
+        ds[i].barrier = &barrier;
+        ds[i].nThreads = nThreads;
+        ds[i].id.p = rank;
+        ds[i].id.t = i;
+    }
+
+    // 1) bounding box and number of points of all the ranks
+    runPass(ds, nThreads, GRID_PASS_BOX);
+    float box[4] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX }; // no INFINITY, -ffast-math assumes there is none
+    for (int i = 0; i < nThreads; i++)
+        for (int j = 0; j < 4; j++)
+            box[j] = fminf(box[j], ds[i].box[j]);
+    unsigned long total = d->n;
+    #ifndef NON_MPI_MODE
+        if (nProcs > 1)
+        {
+            int MPIErrCode = MPI_Allreduce(MPI_IN_PLACE, box, 4, MPI_FLOAT, MPI_MIN, MPI_COMM_WORLD);
+            if (!MPIErrCode)
+                MPIErrCode = MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+            if (MPIErrCode)
+                throwError("p[%2d] gridCullPoints: Got error %d on reducing the bounding box", rank, MPIErrCode);
+        }
+    #else
+        (void)nProcs;
+    #endif
+
+    size_t cells = cellsPerSide;
+    if (cells == 0)
+        cells = (size_t)sqrt((double)total / GRID_CULL_POINTS_PER_CELL);
+    if (cells > GRID_CULL_MAX_CELLS)
+        cells = GRID_CULL_MAX_CELLS;
+    // an interior cell needs a column on both sides, and an empty rank still takes part in the reductions of the other ones
+    if ((cells < 3) || (total == 0))
+    {
+        pthread_barrier_destroy(&barrier);
+        traceEnd(NULL, TRACE_PREFILTER, d->n);
+        return;
+    }
+
+    // 2) lowest and highest occupied row of every column, one histogram per thread
+    float width = -box[2] - box[0], height = -box[3] - box[1];
+    int32_t *colMin = malloc((nThreads + 1) * 2 * cells * sizeof(int32_t));
+    uint64_t *mask = malloc(nWords * sizeof(uint64_t) + MALLOC_PADDING);
+    if ((colMin == NULL) || (mask == NULL))
+        throwError("p[%2d] gridCullPoints: Failed to allocate memory for a grid of %ld cells per side", rank, cells);
+    for (int i = 0; i < nThreads; i++)
+    {
+        memcpy(ds[i].box, box, sizeof(box));
+        ds[i].cells = (int32_t)cells;
+        ds[i].scaleX = width > 0 ? (float)cells / width : 0;
+        ds[i].scaleY = height > 0 ? (float)cells / height : 0;
+        ds[i].colMin = &colMin[(i + 1) * 2 * cells];
+        ds[i].colMax = &ds[i].colMin[cells];
+        ds[i].mask = &mask[wordsPerThread * i];
+    }
+    runPass(ds, nThreads, GRID_PASS_COUNT);
+
+    int32_t *colMax = &colMin[cells];
+    for (size_t c = 0; c < cells; c++)
+    {
+        colMin[c] = (int32_t)cells;
+        colMax[c] = -1;
+        for (int i = 0; i < nThreads; i++)
+        {
+            colMin[c] = ds[i].colMin[c] < colMin[c] ? ds[i].colMin[c] : colMin[c];
+            colMax[c] = ds[i].colMax[c] > colMax[c] ? ds[i].colMax[c] : colMax[c];
+        }
+    }
+    #ifndef NON_MPI_MODE
+        if (nProcs > 1)
+        {
+            int MPIErrCode = MPI_Allreduce(MPI_IN_PLACE, colMin, (int)cells, MPI_INT32_T, MPI_MIN, MPI_COMM_WORLD);
+            if (!MPIErrCode)
+                MPIErrCode = MPI_Allreduce(MPI_IN_PLACE, colMax, (int)cells, MPI_INT32_T, MPI_MAX, MPI_COMM_WORLD);
+            if (MPIErrCode)
+                throwError("p[%2d] gridCullPoints: Got error %d on reducing the grid columns", rank, MPIErrCode);
+        }
+    #endif
+    interiorRows(colMin, colMax, (int32_t)cells);
+
+    // 3) mask and gather the points out of the interior
+    for (int i = 0; i < nThreads; i++)
+    {
+        ds[i].colMin = colMin;
+        ds[i].colMax = colMax;
+    }
+    if (d->n > 0)
+        runPass(ds, nThreads, GRID_PASS_CULL);
+    else
+        out = *d;
+
+    pthread_barrier_destroy(&barrier);
+    free(mask);
+    free(colMin);
+
+    metricsSetPrefilterRemoved(d->n - out.n);
+    LOG(LOG_LVL_INFO, "p[%2d] gridCullPoints: Removed %ld of %ld points (%.3lf%%) with a grid of %ldx%ld cells", rank, d->n - out.n, d->n,
+        d->n > 0 ? (double)(d->n - out.n) / d->n * 100. : 0., cells, cells);
+
+    if (d->n > 0)
+    {
+        free(d->X);
+        free(d->I);
+        *d = out;
+    }
+
+    traceEnd(NULL, TRACE_PREFILTER, d->n);
+    double finishTime = getTime();
+    metricsSetPhaseTime(PHASE_PREFILTER, finishTime - startTime);
+    LOG(LOG_LVL_NOTICE, "p[%2d] Grid cull finished in %lfs", rank, finishTime - startTime);
+}
+
+static void runPass(GridCullThreadData *ds, int nThreads, int pass)
+{
+    pthread_t threads[MAX_THREADS];
+    for (int i = 0; i < nThreads; i++)
+    {
+        ds[i].pass = pass;
+        pthread_create(&threads[i], NULL, gridCullThread, (void*)&ds[i]);
+    }
+    for (int i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+}
+
+static void *gridCullThread(void *arg)
+{
+    GridCullThreadData *thData = (GridCullThreadData*)arg;
+
+    perfThreadOpen();
+    PerfValues perfStart = perfRead();
+    if (thData->pass == GRID_PASS_BOX)
+        boundingBox(thData);
+    else if (thData->pass == GRID_PASS_COUNT)
+        countColumns(thData);
+    else
+        cullPoints(thData);
+    perfAccumulate(&thData->id, PHASE_PREFILTER, &perfStart);
+    perfThreadClose();
+
+    return NULL;
+}
+
+static void boundingBox(GridCullThreadData *thData)
+{
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    for (size_t i = 0; i < thData->pts.n; i++)
+    {
+        minX = fminf(minX, thData->pts.X[i]);
+        minY = fminf(minY, thData->pts.Y[i]);
+        maxX = fmaxf(maxX, thData->pts.X[i]);
+        maxY = fmaxf(maxY, thData->pts.Y[i]);
+    }
+    thData->box[0] = minX;
+    thData->box[1] = minY;
+    thData->box[2] = -maxX;
+    thData->box[3] = -maxY;
+}
+
+static void countColumns(GridCullThreadData *thData)
+{
+    int32_t cells = thData->cells;
+    int32_t *colMin = thData->colMin, *colMax = thData->colMax;
+    for (int32_t c = 0; c < cells; c++)
+    {
+        colMin[c] = cells;
+        colMax[c] = -1;
+    }
+
+    __m256 minX = _mm256_set1_ps(thData->box[0]), minY = _mm256_set1_ps(thData->box[1]);
+    __m256 scaleX = _mm256_set1_ps(thData->scaleX), scaleY = _mm256_set1_ps(thData->scaleY);
+    __m256i last = _mm256_set1_epi32(cells - 1);
+    int32_t col[8], row[8];
+    size_t n = thData->pts.n;
+    for (size_t i = 0; i < n; i += 8)
+    {
+        // the lanes past n read the padding of the allocation and are not counted
+        __m256i c, r;
+        cellsOf8(&thData->pts.X[i], &thData->pts.Y[i], minX, minY, scaleX, scaleY, last, &c, &r);
+        _mm256_storeu_si256((__m256i*)col, c);
+        _mm256_storeu_si256((__m256i*)row, r);
+        for (size_t j = 0; (j < 8) && (i + j < n); j++)
+        {
+            colMin[col[j]] = row[j] < colMin[col[j]] ? row[j] : colMin[col[j]];
+            colMax[col[j]] = row[j] > colMax[col[j]] ? row[j] : colMax[col[j]];
+        }
+    }
+}
+
+// Turns the occupied rows of every column into the rows of its interior cells, (colMin[c], colMax[c]) exclusive: above the lowest
+// occupied cell of both sides and below the highest one of both sides. Columns without occupied columns on both sides get none
+static void interiorRows(int32_t *colMin, int32_t *colMax, int32_t cells)
+{
+    int32_t *leftMin = malloc(2 * cells * sizeof(int32_t));
+    if (leftMin == NULL)
+        throwError("gridCullPoints: Failed to allocate memory for the interior rows");
+    int32_t *leftMax = &leftMin[cells];
+
+    int32_t lo = cells, hi = -1;
+    for (int32_t c = 0; c < cells; c++)
+    {
+        leftMin[c] = lo;
+        leftMax[c] = hi;
+        lo = colMin[c] < lo ? colMin[c] : lo;
+        hi = colMax[c] > hi ? colMax[c] : hi;
+    }
+    lo = cells;
+    hi = -1;
+    for (int32_t c = cells - 1; c >= 0; c--)
+    {
+        int32_t rightMin = lo, rightMax = hi;
+        lo = colMin[c] < lo ? colMin[c] : lo;
+        hi = colMax[c] > hi ? colMax[c] : hi;
+        colMin[c] = leftMin[c] > rightMin ? leftMin[c] : rightMin;
+        colMax[c] = leftMax[c] < rightMax ? leftMax[c] : rightMax;
+    }
+    free(leftMin);
+}
+
+static void cullPoints(GridCullThreadData *thData)
+{
+    int t = thData->id.t;
+    size_t n = thData->pts.n;
+
+    // 1) mask and left-pack the survivors inside the own slice, no other thread touches it
+    if (n > 0)
+    {
+        __m256 minX = _mm256_set1_ps(thData->box[0]), minY = _mm256_set1_ps(thData->box[1]);
+        __m256 scaleX = _mm256_set1_ps(thData->scaleX), scaleY = _mm256_set1_ps(thData->scaleY);
+        __m256i last = _mm256_set1_epi32(thData->cells - 1);
+        uint8_t *blockMasks = (uint8_t*)thData->mask; // little endian: byte k of the mask holds the bits of block k
+        for (size_t blk = 0; blk < (n + 7) / 8; blk++)
+        {
+            __m256i c, r;
+            cellsOf8(&thData->pts.X[blk*8], &thData->pts.Y[blk*8], minX, minY, scaleX, scaleY, last, &c, &r);
+            __m256i lo = _mm256_i32gather_epi32(thData->colMin, c, 4);
+            __m256i hi = _mm256_i32gather_epi32(thData->colMax, c, 4);
+            __m256i interior = _mm256_and_si256(_mm256_cmpgt_epi32(r, lo), _mm256_cmpgt_epi32(hi, r));
+            blockMasks[blk] = (uint8_t)~_mm256_movemask_ps(_mm256_castsi256_ps(interior));
+        }
+        if (n % 64 != 0) // compactPoints reads whole words
+            thData->mask[n / 64] &= (1ULL << (n % 64)) - 1;
+        thData->pts.n = compactPoints(&thData->pts, thData->mask, thData->pts.X, thData->pts.Y, thData->pts.I);
+    }
+    thData->counts[t] = thData->pts.n;
+
+    // 2) one thread allocates the output once every count is known
+    if (pthread_barrier_wait(thData->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        Data *out = thData->out;
+        out->n = 0;
+        for (int i = 0; i < thData->nThreads; i++)
+            out->n += thData->counts[i];
+        out->X = malloc(out->n * 2 * sizeof(float) + MALLOC_PADDING);
+        if (out->X == NULL)
+            throwError("p[%2d] gridCullPoints: Failed to allocate memory for the %ld surviving points", thData->id.p, out->n);
+        out->Y = &out->X[out->n];
+        out->I = NULL;
+        if (thData->pts.I != NULL)
+        {
+            out->I = malloc(out->n * sizeof(PointIndex) + MALLOC_PADDING);
+            if (out->I == NULL)
+                throwError("p[%2d] gridCullPoints: Failed to allocate memory for the indices of the %ld surviving points", thData->id.p, out->n);
+        }
+    }
+    pthread_barrier_wait(thData->barrier);
+
+    // 3) copy the survivors to their position, given by the prefix sum of the counts of the previous threads
+    size_t offset = 0;
+    for (int i = 0; i < t; i++)
+        offset += thData->counts[i];
+    memcpy(&thData->out->X[offset], thData->pts.X, thData->pts.n * sizeof(float));
+    memcpy(&thData->out->Y[offset], thData->pts.Y, thData->pts.n * sizeof(float));
+    if (thData->out->I != NULL)
+        memcpy(&thData->out->I[offset], thData->pts.I, thData->pts.n * sizeof(PointIndex));
+}
@@ -0,0 +1,523 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#define GROUPED_RADIX_BITS 11 // 3 passes cover 32 bit keys, 2048 counters per thread stay in L1
+#define GROUPED_RADIX_BUCKETS (1 << GROUPED_RADIX_BITS)
+#define GROUPED_RADIX_PASSES ((32 + GROUPED_RADIX_BITS - 1) / GROUPED_RADIX_BITS)
+#define GROUPED_SMALL_MAX 1024 // larger groups go to quickhull, smaller ones to a monotone chain on stack buffers (32KB)
+#define GROUPED_CHUNK_GROUPS 256 // groups taken at once by a thread
+
+// Grouped hulls: one hull per key. The points are bucketed by key with a stable parallel LSD radix sort (passes in which
+// every key has the same digit are skipped), then the groups are hulled by all the threads taking chunks of groups,
+// and finally the hulls are packed in CSR form
+
+typedef struct
+{
+    // input and the two ping-pong buffers of the sort, src/dst point to one of them
+    Data in;
+    uint32_t *inKeys;
+    Data buf[2];
+    uint32_t *bufKeys[2];
+    Data *src;
+    uint32_t *srcKeys;
+
+    size_t (*hist)[GROUPED_RADIX_BUCKETS]; // per thread
+    size_t *counts; // per thread: groups (then hull vertices) of the slice
+    size_t *groupStart;
+    size_t *hullSize;
+    size_t nextChunk;
+
+    GroupedHulls *out;
+    pthread_barrier_t barrier;
+    int nThreads;
+} GroupedJob;
+
+typedef struct
+{
+    GroupedJob *job;
+    ProcThreadIDCombo id;
+} GroupedThreadData;
+
+static void *groupedThread(void *arg);
+static size_t smallHull(const float *X, const float *Y, const PointIndex *I, size_t n, float *hX, float *hY, PointIndex *hI);
+static size_t largeHull(Data *pts, float *hX, float *hY, PointIndex *hI, ProcThreadIDCombo *id);
+
+GroupedHulls groupedHulls(Data *d, uint32_t *keys, int nThreads, int procID)
+{
+    if (nThreads < 1)
+        nThreads = 1;
+    if (nThreads > MAX_THREADS)
+        throwError("p[%2d] groupedHulls: At most %d threads are supported", procID, MAX_THREADS);
+
+    GroupedHulls out = { .nGroups=0 };
+    GroupedJob job = { .in=*d, .inKeys=keys, .nThreads=nThreads, .out=&out, .nextChunk=0 };
+    size_t n = d->n;
+
+    for (int b = 0; b < 2; b++)
+    {
+        job.buf[b].n = n;
+        job.buf[b].X = malloc(n * 2 * sizeof(float) + MALLOC_PADDING);
+        job.buf[b].Y = job.buf[b].X == NULL ? NULL : &job.buf[b].X[n];
+        job.buf[b].I = NULL;
+        if (d->I != NULL)
+            job.buf[b].I = malloc(n * sizeof(PointIndex) + MALLOC_PADDING);
+        job.bufKeys[b] = malloc(n * sizeof(uint32_t) + MALLOC_PADDING);
+        if ((job.buf[b].X == NULL) || ((d->I != NULL) && (job.buf[b].I == NULL)) || (job.bufKeys[b] == NULL))
+            throwError("p[%2d] groupedHulls: Failed to allocate memory to sort %ld points", procID, n);
+    }
+    job.hist = malloc(nThreads * sizeof(*job.hist));
+    job.counts = malloc(nThreads * sizeof(size_t));
+    if ((job.hist == NULL) || (job.counts == NULL))
+        throwError("p[%2d] groupedHulls: Failed to allocate memory for the histograms", procID);
+
+    pthread_t threads[MAX_THREADS];
+    GroupedThreadData ds[MAX_THREADS];
+    pthread_barrier_init(&job.barrier, NULL, nThreads);
+    for (int i = 0; i < nThreads; i++)
+    {
+        ds[i].job = &job;
+        ds[i].id.p = procID;
+        ds[i].id.t = i;
+        pthread_create(&threads[i], NULL, groupedThread, (void*)&ds[i]);
+    }
+    for (int i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&job.barrier);
+
+    for (int b = 0; b < 2; b++)
+    {
+        free(job.buf[b].X);
+        free(job.buf[b].I);
+        free(job.bufKeys[b]);
+    }
+    free(job.hist);
+    free(job.counts);
+    free(job.groupStart);
+    free(job.hullSize);
+
+    return out;
+}
+
+static void *groupedThread(void *arg)
+{
+    GroupedThreadData *thData = (GroupedThreadData*)arg;
+    GroupedJob *job = thData->job;
+    int t = thData->id.t;
+    int nThreads = job->nThreads;
+    size_t n = job->in.n;
+    bool withIndices = job->in.I != NULL;
+
+    size_t first = n * t / nThreads;
+    size_t last = n * (t+1) / nThreads;
+
+    // 1) stable LSD radix sort by key, the input is not modified
+    if (t == 0)
+    {
+        job->src = &job->in;
+        job->srcKeys = job->inKeys;
+    }
+    pthread_barrier_wait(&job->barrier);
+    int dstBuf = 0;
+    for (int pass = 0; pass < GROUPED_RADIX_PASSES; pass++)
+    {
+        int shift = pass * GROUPED_RADIX_BITS;
+        size_t *hist = job->hist[t];
+        memset(hist, 0, sizeof(job->hist[t]));
+        for (size_t i = first; i < last; i++)
+            hist[(job->srcKeys[i] >> shift) & (GROUPED_RADIX_BUCKETS - 1)]++;
+        pthread_barrier_wait(&job->barrier);
+
+        // every thread computes its own write positions: the points of a digit go after the smaller digits and the previous threads
+        size_t offsets[GROUPED_RADIX_BUCKETS];
+        bool trivial = false;
+        for (size_t digit = 0, pos = 0; digit < GROUPED_RADIX_BUCKETS; digit++)
+        {
+            size_t total = 0;
+            for (int u = 0; u < nThreads; u++)
+            {
+                if (u == t)
+                    offsets[digit] = pos + total;
+                total += job->hist[u][digit];
+            }
+            if (total == n)
+                trivial = true; // every key has this digit, the pass would not move anything
+            pos += total;
+        }
+
+        if (!trivial)
+        {
+            Data *src = job->src, *dst = &job->buf[dstBuf];
+            uint32_t *srcKeys = job->srcKeys, *dstKeys = job->bufKeys[dstBuf];
+            for (size_t i = first; i < last; i++)
+            {
+                size_t pos = offsets[(srcKeys[i] >> shift) & (GROUPED_RADIX_BUCKETS - 1)]++;
+                dstKeys[pos] = srcKeys[i];
+                dst->X[pos] = src->X[i];
+                dst->Y[pos] = src->Y[i];
+                if (withIndices)
+                    dst->I[pos] = src->I[i];
+            }
+        }
+        pthread_barrier_wait(&job->barrier); // the scatter is done and nobody reads the histograms anymore
+        if (!trivial)
+        {
+            if (t == 0)
+            {
+                job->src = &job->buf[dstBuf];
+                job->srcKeys = job->bufKeys[dstBuf];
+            }
+            dstBuf ^= 1;
+            pthread_barrier_wait(&job->barrier);
+        }
+    }
+    Data *sorted = job->src;
+    uint32_t *sortedKeys = job->srcKeys;
+    Data *scratch = &job->buf[dstBuf]; // free now: the hulls are written here, each at the start of its group
+
+    // 2) group boundaries: count the groups starting in the own slice, then write them at their prefix position
+    size_t nStarts = 0;
+    for (size_t i = first; i < last; i++)
+        nStarts += (i == 0) || (sortedKeys[i] != sortedKeys[i-1]);
+    job->counts[t] = nStarts;
+    if (pthread_barrier_wait(&job->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        size_t nGroups = 0;
+        for (int u = 0; u < nThreads; u++)
+            nGroups += job->counts[u];
+        job->out->nGroups = nGroups;
+        job->out->keys = malloc(nGroups * sizeof(uint32_t) + MALLOC_PADDING);
+        job->out->offsets = malloc((nGroups + 1) * sizeof(size_t) + MALLOC_PADDING);
+        job->groupStart = malloc((nGroups + 1) * sizeof(size_t) + MALLOC_PADDING);
+        job->hullSize = malloc(nGroups * sizeof(size_t) + MALLOC_PADDING);
+        if ((job->out->keys == NULL) || (job->out->offsets == NULL) || (job->groupStart == NULL) || (job->hullSize == NULL))
+            throwError("p[%2d] groupedHulls: Failed to allocate memory for %ld groups", thData->id.p, nGroups);
+        job->groupStart[nGroups] = n;
+    }
+    pthread_barrier_wait(&job->barrier);
+    {
+        size_t g = 0;
+        for (int u = 0; u < t; u++)
+            g += job->counts[u];
+        for (size_t i = first; i < last; i++)
+        {
+            if ((i == 0) || (sortedKeys[i] != sortedKeys[i-1]))
+            {
+                job->groupStart[g] = i;
+                job->out->keys[g] = sortedKeys[i];
+                g++;
+            }
+        }
+    }
+    pthread_barrier_wait(&job->barrier);
+
+    // 3) hull the groups, chunks of groups are taken dynamically since their sizes can be very different
+    size_t nGroups = job->out->nGroups;
+    for (size_t c = __atomic_fetch_add(&job->nextChunk, GROUPED_CHUNK_GROUPS, __ATOMIC_RELAXED); c < nGroups; c = __atomic_fetch_add(&job->nextChunk, GROUPED_CHUNK_GROUPS, __ATOMIC_RELAXED))
+    {
+        size_t cEnd = c + GROUPED_CHUNK_GROUPS < nGroups ? c + GROUPED_CHUNK_GROUPS : nGroups;
+        for (size_t g = c; g < cEnd; g++)
+        {
+            size_t start = job->groupStart[g];
+            size_t size = job->groupStart[g+1] - start;
+            PointIndex *I = withIndices ? &sorted->I[start] : NULL;
+            PointIndex *hI = withIndices ? &scratch->I[start] : NULL;
+            if (size <= GROUPED_SMALL_MAX)
+                job->hullSize[g] = smallHull(&sorted->X[start], &sorted->Y[start], I, size, &scratch->X[start], &scratch->Y[start], hI);
+            else
+            {
+                Data pts = { .n=size, .X=&sorted->X[start], .Y=&sorted->Y[start], .I=I };
+                job->hullSize[g] = largeHull(&pts, &scratch->X[start], &scratch->Y[start], hI, &thData->id);
+            }
+        }
+    }
+    pthread_barrier_wait(&job->barrier);
+
+    // 4) CSR: each thread sums the hull sizes of a range of groups, then writes the offsets and packs the vertices of the range
+    size_t gFirst = nGroups * t / nThreads;
+    size_t gLast = nGroups * (t+1) / nThreads;
+    size_t nVertices = 0;
+    for (size_t g = gFirst; g < gLast; g++)
+        nVertices += job->hullSize[g];
+    job->counts[t] = nVertices;
+    if (pthread_barrier_wait(&job->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        size_t total = 0;
+        for (int u = 0; u < nThreads; u++)
+            total += job->counts[u];
+        Data *v = &job->out->vertices;
+        v->n = total;
+        v->X = malloc(total * 2 * sizeof(float) + MALLOC_PADDING);
+        v->Y = v->X == NULL ? NULL : &v->X[total];
+        v->I = NULL;
+        if (withIndices)
+            v->I = malloc(total * sizeof(PointIndex) + MALLOC_PADDING);
+        if ((v->X == NULL) || (withIndices && (v->I == NULL)))
+            throwError("p[%2d] groupedHulls: Failed to allocate memory for %ld hull vertices", thData->id.p, total);
+        job->out->offsets[nGroups] = total;
+    }
+    pthread_barrier_wait(&job->barrier);
+    {
+        Data *v = &job->out->vertices;
+        size_t pos = 0;
+        for (int u = 0; u < t; u++)
+            pos += job->counts[u];
+        for (size_t g = gFirst; g < gLast; g++)
+        {
+            size_t start = job->groupStart[g];
+            size_t h = job->hullSize[g];
+            job->out->offsets[g] = pos;
+            memcpy(&v->X[pos], &scratch->X[start], h * sizeof(float));
+            memcpy(&v->Y[pos], &scratch->Y[start], h * sizeof(float));
+            if (withIndices)
+                memcpy(&v->I[pos], &scratch->I[start], h * sizeof(PointIndex));
+            pos += h;
+        }
+    }
+
+    return NULL;
+}
+
+// float -> uint32 with the same order, so that a point sorts by (x, y) as one uint64
+static inline uint64_t orderedBits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return (u & 0x80000000u) ? ~u : u | 0x80000000u;
+}
+
+static inline float fromOrderedBits(uint32_t u)
+{
+    u = (u & 0x80000000u) ? u & 0x7FFFFFFFu : ~u;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+// Batcher's merge exchange (Knuth 5.2.2 M), a sorting network for any n: the compare-exchanges do not depend on the data,
+// so they compile to conditional moves and the sort does not pay for mispredicted branches
+static void sortKeys(uint64_t *k, size_t n)
+{
+    if (n < 2)
+        return;
+    size_t top = 1;
+    while (top < (n + 1) / 2)
+        top <<= 1;
+    for (size_t p = top; p > 0; p >>= 1)
+    {
+        size_t q = top, r = 0, d = p;
+        while (true)
+        {
+            for (size_t i = 0; i + d < n; i++)
+                if ((i & p) == r)
+                {
+                    uint64_t a = k[i], b = k[i+d];
+                    k[i] = a < b ? a : b;
+                    k[i+d] = a < b ? b : a;
+                }
+            if (q == p)
+                break;
+            d = q - p;
+            q >>= 1;
+            r = p;
+        }
+    }
+}
+
+// > 0 when point c is to the left of a->b
+static inline double cross(const float *x, const float *y, size_t a, size_t b, size_t c)
+{
+    return ((double)x[b] - x[a]) * ((double)y[c] - y[a]) - ((double)y[b] - y[a]) * ((double)x[c] - x[a]);
+}
+
+// Andrew's monotone chain on the stack. The hull is written like the ones of quickhull: CCW from the lowest point (rightmost on ties),
+// without collinear points and without the closing point. Returns the number of vertices
+static size_t smallHull(const float *X, const float *Y, const PointIndex *I, size_t n, float *hX, float *hY, PointIndex *hI)
+{
+    uint64_t keys[GROUPED_SMALL_MAX];
+    float x[GROUPED_SMALL_MAX], y[GROUPED_SMALL_MAX];
+    size_t h[2 * GROUPED_SMALL_MAX];
+
+    // Akl-Toussaint: the points strictly inside the octagon of the extreme points cannot be vertices, so they are not sorted.
+    // The extremes in the directions x, x+y, y, y-x, ... are CCW
+    static const float dirX[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+    static const float dirY[8] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+    size_t e[8] = { 0 };
+    float best[8];
+    for (int k = 0; k < 8; k++)
+        best[k] = dirX[k] * X[0] + dirY[k] * Y[0];
+    for (size_t i = 1; i < n; i++)
+        for (int k = 0; k < 8; k++)
+        {
+            float v = dirX[k] * X[i] + dirY[k] * Y[i];
+            e[k] = v > best[k] ? i : e[k];
+            best[k] = v > best[k] ? v : best[k];
+        }
+    double qa[8], qb[8], qc[8]; // edge k of the octagon is qa*x + qb*y + qc > 0 on its inner side
+    for (int k = 0; k < 8; k++)
+    {
+        size_t from = e[k], to = e[(k+1) & 7];
+        qa[k] = (double)Y[from] - Y[to];
+        qb[k] = (double)X[to] - X[from];
+        qc[k] = -(qa[k] * X[from] + qb[k] * Y[from]);
+        if ((qa[k] == 0) && (qb[k] == 0))
+            qc[k] = 1; // the same point is extreme in two directions, the edge does not exist
+    }
+
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        bool inside = true;
+        for (int k = 0; k < 8; k++)
+            inside &= (qa[k] * X[i] + qb[k] * Y[i] + qc[k] > 0) & (i != e[k]);
+        keys[m] = (orderedBits(X[i]) << 32) | orderedBits(Y[i]);
+        m += !inside;
+    }
+    sortKeys(keys, m);
+    for (size_t i = 0; i < m; i++)
+    {
+        x[i] = fromOrderedBits(keys[i] >> 32);
+        y[i] = fromOrderedBits((uint32_t)keys[i]);
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < m; i++) // lower chain
+    {
+        while ((k >= 2) && (cross(x, y, h[k-2], h[k-1], i) <= 0))
+            k--;
+        h[k++] = i;
+    }
+    for (size_t i = m - 1, lowerSize = k + 1; i-- > 0;) // upper chain
+    {
+        while ((k >= lowerSize) && (cross(x, y, h[k-2], h[k-1], i) <= 0))
+            k--;
+        h[k++] = i;
+    }
+    if (k > 1)
+        k--; // the last point is the first one again
+
+    // all the points are the same point: the chain has it twice
+    if ((k == 2) && (keys[h[0]] == keys[h[1]]))
+        k = 1;
+
+    size_t lowest = 0;
+    for (size_t j = 1; j < k; j++)
+        if ((y[h[j]] < y[h[lowest]]) || ((y[h[j]] == y[h[lowest]]) && (x[h[j]] > x[h[lowest]])))
+            lowest = j;
+
+    for (size_t j = 0, v = lowest; j < k; j++, v = v + 1 < k ? v + 1 : 0)
+    {
+        hX[j] = x[h[v]];
+        hY[j] = y[h[v]];
+    }
+
+    // the keys do not carry the indices: the few vertices are looked up among the points of the group
+    if (hI != NULL)
+        for (size_t j = 0; j < k; j++)
+        {
+            size_t i = 0;
+            while ((X[i] != hX[j]) || (Y[i] != hY[j]))
+                i++;
+            hI[j] = I[i];
+        }
+
+    return k;
+}
+
+// quickhull permutes its input, which belongs to the caller of groupedHulls when no radix pass was needed, so it gets a copy
+static size_t largeHull(Data *pts, float *hX, float *hY, PointIndex *hI, ProcThreadIDCombo *id)
+{
+    Data copy = { .n=pts->n, .I=NULL };
+    copy.X = malloc(pts->n * 2 * sizeof(float) + MALLOC_PADDING);
+    if (pts->I != NULL)
+        copy.I = malloc(pts->n * sizeof(PointIndex) + MALLOC_PADDING);
+    if ((copy.X == NULL) || ((pts->I != NULL) && (copy.I == NULL)))
+        throwError("p[%2d] t[%3d] groupedHulls: Failed to allocate memory for a group of %ld points", id->p, id->t, pts->n);
+    copy.Y = &copy.X[pts->n];
+    memcpy(copy.X, pts->X, pts->n * sizeof(float));
+    memcpy(copy.Y, pts->Y, pts->n * sizeof(float));
+    if (pts->I != NULL)
+        memcpy(copy.I, pts->I, pts->n * sizeof(PointIndex));
+
+    Data hull = quickhull(&copy, id);
+    memcpy(hX, hull.X, hull.n * sizeof(float));
+    memcpy(hY, hull.Y, hull.n * sizeof(float));
+    if (hI != NULL)
+        memcpy(hI, hull.I, hull.n * sizeof(PointIndex));
+
+    size_t h = hull.n;
+    free(hull.X);
+    free(hull.Y);
+    free(hull.I);
+    free(copy.X);
+    free(copy.I);
+    return h;
+}
+
+void freeGroupedHulls(GroupedHulls *g)
+{
+    free(g->keys);
+    free(g->offsets);
+    free(g->vertices.X);
+    free(g->vertices.I);
+    g->nGroups = 0;
+}
+
+// --groups: the keys are a raw file of n uint32, the key of point i at position i
+void runGroupedHulls(Params *p, int procID)
+{
+    double startTime = getTime();
+
+    PerfValues perfStart = perfRead();
+    traceBegin(NULL, TRACE_READ);
+    Data d;
+    readFile(&d, p);
+
+    FILE *f = fopen(p->groupsFile, "rb");
+    if (f == NULL)
+        throwError("p[%2d] runGroupedHulls: Could not read the keys file %s", procID, p->groupsFile);
+    fseek(f, 0, SEEK_END);
+    size_t nKeys = ftell(f) / sizeof(uint32_t);
+    rewind(f);
+    if (nKeys != d.n)
+        throwError("p[%2d] runGroupedHulls: %s has %ld keys but %s has %ld points", procID, p->groupsFile, nKeys, p->inputFile, d.n);
+    uint32_t *keys = malloc(nKeys * sizeof(uint32_t) + MALLOC_PADDING);
+    if (keys == NULL)
+        throwError("p[%2d] runGroupedHulls: Failed to allocate memory for the keys", procID);
+    if ((nKeys > 0) && (fread(keys, nKeys * sizeof(uint32_t), 1, f) != 1))
+        throwError("p[%2d] runGroupedHulls: Could not read the keys from %s", procID, p->groupsFile);
+    fclose(f);
+    traceEnd(NULL, TRACE_READ, d.n * (2 * sizeof(float) + sizeof(uint32_t)));
+    perfAccumulate(NULL, PHASE_READ, &perfStart);
+
+    double readTime = getTime();
+    metricsSetRead(readTime - startTime, d.n * (2 * sizeof(float) + sizeof(uint32_t)));
+    GroupedHulls g = groupedHulls(&d, keys, p->nThreads, procID);
+    double hullTime = getTime();
+    metricsSetPhaseTime(PHASE_QUICKHULL, hullTime - readTime);
+    metricsSetTotalTime(hullTime - startTime);
+
+    LOG(LOG_LVL_NOTICE, "p[%2d] runGroupedHulls: %ld points in %ld groups, %ld hull vertices in total. Read in %lfs, hulls in %lfs", procID, d.n, g.nGroups, g.vertices.n, readTime - startTime, hullTime - readTime);
+
+    // a "# key hull=H" header per group followed by its vertices, like the blocks of --batch without their n=N
+    if (p->outputFile[0] != 0)
+    {
+        FILE *out = fopen(p->outputFile, "w");
+        if (out == NULL)
+            throwError("p[%2d] runGroupedHulls: Could not open %s", procID, p->outputFile);
+        for (size_t i = 0; i < g.nGroups; i++)
+        {
+            size_t first = g.offsets[i];
+            Data hull = { .n=g.offsets[i+1] - first, .X=&g.vertices.X[first], .Y=&g.vertices.Y[first], .I=g.vertices.I == NULL ? NULL : &g.vertices.I[first] };
+            fprintf(out, "# %u hull=%ld\n", g.keys[i], hull.n);
+            writeHullPoints(out, &hull);
+        }
+        fclose(out);
+    }
+
+    freeGroupedHulls(&g);
+    free(keys);
+    free(d.X);
+    free(d.I);
+}
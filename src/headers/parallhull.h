@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 // #define QUICKHULL_STEP_DEBUG // plots data useful for debug at each iteration of the quickhull algorithm
 // #define PARALLHULL_STEP_DEBUG
@@ -7,9 +9,35 @@
 // #define DEBUG
 // #define GUI_OUTPUT
 // #define NON_MPI_MODE
+// #define LARGE_POINT_INDICES // 64 bit point indices (--indices), needed only for inputs of more than 2^32 points
 
 #define GNUPLOT_RES "1920,1080"
 #define MALLOC_PADDING (12*sizeof(float))
+#define MAX_THREADS 256 // bound of the per-thread arrays: --threads is capped to it
+
+#define PREFILTER_DEFAULT_SAMPLE_SIZE 16384 // points sampled by each rank to build the prefilter hull
+#define PREFILTER_PARALLEL_THRESHOLD (1UL << 16) // minimum points per thread to split the prefilter across threads
+#define PREFILTER_HULL_MAX_SIZE 64 // the sample hull is decimated to this many vertices (a 64-gon inscribed in a circle covers 99.8% of it)
+#define GRID_CULL_POINTS_PER_CELL 4 // --grid-cull without a size: cells per side of the grid for this many points per cell on average
+#define GRID_CULL_MAX_CELLS 65536 // cells per side, the histogram of every thread holds 2 of them per column
+
+// daemon protocol (--daemon): fixed size messages on a Unix stream socket, the points travel in a memfd passed with SCM_RIGHTS.
+// Layout of a buffer of capacity c: X[c], Y[c], padding read by the SIMD kernels, then the hull X[c], Y[c] written by the daemon.
+// The daemon hulls the points in place (no copy), so a request consumes them like quickhull does. The memfd must be sealed against
+// shrinking and growing (F_SEAL_SHRINK | F_SEAL_GROW): a client truncating a mapped buffer would kill the daemon with SIGBUS
+#define HULLD_MAGIC 0x446C6C48u // "Hlld"
+#define HULLD_HULL_OFFSET(c) ((2 * (c) * sizeof(float) + MALLOC_PADDING + 63) & ~(size_t)63)
+#define HULLD_BUFFER_BYTES(c) (HULLD_HULL_OFFSET(c) + 2 * (c) * sizeof(float))
+#define HULLD_HIST_BUCKETS 32 // latency histograms: bucket b counts the latencies in [2^(b-1), 2^b) us, bucket 0 those under 1us
+
+// quantized companion of a raw file (<file>.q16, written by gendata --q16 or --companion, read with --q16). Layout: a Q16Header,
+// one Q16Block per block of Q16_BLOCK_POINTS points, then for every block its points as 16 bit offsets in the bounding box of the
+// block, Q16_BLOCK_POINTS of X followed by Q16_BLOCK_POINTS of Y (the last block is padded)
+#define Q16_MAGIC 0x36315150u // "PQ16"
+#define Q16_BLOCK_POINTS 4096
+#define Q16_DIRECTIONS 32 // extreme points kept for every block, they build the seed hull without reading the exact coordinates
+#define Q16_DATA_OFFSET(nBlocks) (sizeof(Q16Header) + (nBlocks) * sizeof(Q16Block))
+#define Q16_BLOCK_BYTES (2 * Q16_BLOCK_POINTS * sizeof(uint16_t))
 
 #define swapElems(elem1,elem2) { register typeof(elem1) swapVarTemp = elem1; elem1 = elem2; elem2 = swapVarTemp; }
 
@@ -28,6 +56,92 @@ enum LogLevel
 	LOG_LVL_TRACE
 };
 
+enum Distribution
+{
+    DIST_DISK,
+    DIST_SQUARE,
+    DIST_CIRCLE,
+    DIST_ANNULUS,
+    DIST_GAUSSIAN,
+    DIST_CLUSTERED,
+    DIST_COUNT
+};
+
+// phases of a run, used to report metrics
+enum Phase
+{
+    PHASE_READ,
+    PHASE_PREFILTER,
+    PHASE_QUICKHULL,
+    PHASE_MERGE_P12,
+    PHASE_MERGE_P2,
+    PHASE_MERGE_MPI,
+    PHASE_COUNT
+};
+
+// algorithm used to compute the hull of the points of a rank, selected with --algorithm
+enum Algorithm
+{
+    ALGORITHM_QUICKHULL,
+    ALGORITHM_TASKHULL,
+    ALGORITHM_COUNT
+};
+
+// how parallhullThreaded splits the points of a rank among its threads, selected with --schedule
+enum Schedule
+{
+    SCHEDULE_STATIC,
+    SCHEDULE_DYNAMIC,
+    SCHEDULE_COUNT
+};
+
+// format of --file, selected with --input-format
+enum InputFormat
+{
+    INPUT_FORMAT_RAW,
+    INPUT_FORMAT_TEXT,
+    INPUT_FORMAT_COUNT
+};
+
+// output of --query, selected with --query-format
+enum QueryFormat
+{
+    QUERY_FORMAT_MASK,
+    QUERY_FORMAT_POINTS,
+    QUERY_FORMAT_COUNT
+};
+
+// spans recorded with --trace
+enum TraceEvent
+{
+    TRACE_READ,
+    TRACE_PREFILTER,
+    TRACE_QUICKHULL,
+    TRACE_QUICKHULL_ITERATION,
+    TRACE_MERGE_P12,
+    TRACE_SPIN_WAIT,
+    TRACE_MERGE_P2,
+    TRACE_MPI_RECV,
+    TRACE_MERGE_MPI,
+    TRACE_MPI_SEND,
+    TRACE_TASK
+};
+
+// hardware events sampled with --perf-counters
+enum PerfEvent
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_EVENTS_COUNT
+};
+
+typedef struct
+{
+    uint64_t v[PERF_EVENTS_COUNT];
+} PerfValues;
+
 typedef struct
 {
     int nProcs;
@@ -35,15 +149,51 @@ typedef struct
     int nThreads;
 
     char inputFile[1000];
+    enum InputFormat inputFormat;
+    bool textCache; // keep the points of a text --file in the raw <inputFile>.raw
     enum LogLevel logLevel;
+    size_t prefilterSampleSize;
+    bool gridCull; // cull the interior cells of a grid instead of the sample prefilter
+    size_t gridCells; // cells per side of the --grid-cull grid, 0 for automatic
+    char metricsFile[1000];
+    bool perfCounters;
+    char traceFile[1000];
+    enum Algorithm algorithm;
+    enum Schedule schedule;
+    size_t subproblemSize; // 0 for no bound on the points of a quickhull call of --schedule static
+    bool trackIndices;
+    char outputFile[1000];
+    char batchFile[1000];
+    char groupsFile[1000];
+    bool layers; // convex layers (onion peeling) instead of one hull
+    size_t layersDepth; // layers computed by --layers, 0 for all of them
+    char daemonSocket[108]; // sun_path size
+    char queryFile[1000];
+    char queryOutput[1000];
+    enum QueryFormat queryFormat;
+    double approxEps; // 0 for the exact hull
+    bool tune;
+    char tuningCache[1000]; // empty for the default location (see tuningCachePath)
+    bool q16; // read through the quantized companion <inputFile>.q16
+    bool verify;
     
 } Params;
 
+// position of a point in the input file, carried next to its coordinates when --indices is given
+#ifdef LARGE_POINT_INDICES
+    typedef uint64_t PointIndex;
+    #define MPI_POINT_INDEX MPI_UINT64_T
+#else
+    typedef uint32_t PointIndex;
+    #define MPI_POINT_INDEX MPI_UINT32_T
+#endif
+
 typedef struct
 {
     size_t n;
     float *X;
     float *Y;
+    PointIndex *I; // NULL when indices are not tracked, otherwise moved together with X and Y (own allocation)
 } Data;
 
 typedef struct{
@@ -51,19 +201,128 @@ typedef struct{
     int t;
 } ProcThreadIDCombo;
 
+typedef struct
+{
+    uint32_t magic;
+    uint32_t blockPoints;
+    uint64_t n; // points of the raw file
+    uint64_t nBlocks;
+    uint64_t reserved;
+} Q16Header;
+
+// point i of the block is in [minX + q*w, minX + (q+1)*w] with q its offset and w = (maxX - minX) / 65535, the same for y
+typedef struct
+{
+    float minX, minY, maxX, maxY;
+    float extX[Q16_DIRECTIONS], extY[Q16_DIRECTIONS]; // exact point of the block farthest along each of Q16_DIRECTIONS directions
+} Q16Block;
+
+// hulls of grouped points in CSR form: the vertices of group g are [offsets[g], offsets[g+1]) of vertices, CCW from the lowest point
+typedef struct
+{
+    size_t nGroups;
+    uint32_t *keys; // ascending
+    size_t *offsets; // nGroups + 1
+    Data vertices; // X and Y in one allocation
+} GroupedHulls;
+
+// convex layers in CSR form: the vertices of layer l (0 the outermost) are [offsets[l], offsets[l+1]) of vertices, CCW from the lowest point
+typedef struct
+{
+    size_t nLayers;
+    size_t *offsets; // nLayers + 1
+    Data vertices; // X and Y in one allocation, I the indices of the input when it tracks them
+    size_t deeper; // points in no layer when the depth was bounded
+} ConvexLayers;
+
+// hull preprocessed for point-in-hull queries (hullQueryBuild): one wedge per edge around the interior point (cx, cy), found
+// through a table over the pseudo-angle of the point
+typedef struct
+{
+    size_t n; // vertices of the hull
+    double cx, cy;
+    double angle0; // pseudo-angle of vertex 0, the angles are relative to it
+    double *angles; // n, ascending from 0: wedge i holds the pseudo-angles in [angles[i], angles[i+1])
+    double *edges; // 4 per wedge: b, a, c of its edge (inside when b*x + a*y + c >= 0) and padding
+    int32_t *bucketFirst; // nBuckets + 1, last wedge starting at or before the start of each bucket
+    size_t nBuckets;
+    double bucketScale; // nBuckets / 4
+    int searchSteps;
+    float degX[2], degY[2]; // vertices of hulls with less than 3 of them
+} HullQuery;
+
+enum HulldOp
+{
+    HULLD_OP_HULL, // the memfd travels with the request
+    HULLD_OP_STATS, // the response is followed by hullSize bytes of JSON with the counters and the latency histograms
+    HULLD_OP_SHUTDOWN
+};
+
+enum HulldStatus
+{
+    HULLD_OK = 0,
+    HULLD_ERR_BAD_REQUEST = -1, // wrong magic, unknown op, n > capacity or missing memfd
+    HULLD_ERR_BUFFER = -2, // the memfd is not sealed, is smaller than HULLD_BUFFER_BYTES(capacity) or could not be mapped
+    HULLD_ERR_IO = -3 // client side: the daemon could not be reached or closed the connection
+};
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t op;
+    uint64_t id; // echoed in the response
+    uint64_t n; // points in the buffer
+    uint64_t capacity; // points that fit in the buffer, fixes its layout
+} HulldRequest;
+
+typedef struct
+{
+    uint32_t magic;
+    int32_t status;
+    uint64_t id;
+    uint64_t hullSize;
+    double queueTime; // s waited for a worker
+    double hullTime; // s spent in quickhull
+} HulldResponse;
+
+// client side view of a daemon buffer
+typedef struct
+{
+    int fd;
+    size_t capacity;
+    size_t bytes;
+    void *base;
+    float *X, *Y; // filled by the caller
+    float *hullX, *hullY; // written by the daemon, hullSize vertices CCW from the lowest one (no closing point)
+} HulldBuffer;
+
+typedef struct TaskPool TaskPool;
+typedef struct TaskWorker TaskWorker;
+typedef void (*TaskFn)(void *arg, TaskWorker *w);
+typedef void (*TaskBlockFn)(void *ctx, size_t block, TaskWorker *w);
+
 void setLogLevel(enum LogLevel lvl);
 void LOG (enum LogLevel lvl, char * line, ...);
 void throwError (char * line, ...);
+double getTime();
+#ifndef NON_MPI_MODE
+char *gatherText(char *local, int rank, int nProcs, const char *separator);
+#endif
 
 Params argParse(int argc, char *argv[]);
 
 
 void readFile(Data *d, Params *p);
 void readFilePart(Data *d, Params *p, int rank);
+void q16EncodeBlock(const float *X, const float *Y, size_t count, Q16Block *b, uint16_t *q);
+size_t readFileQ16(Data *d, Params *p, int rank, int nProcs);
+size_t readFileText(Data *d, Params *p, int rank, int nProcs);
+void initIndices(Data *d, size_t first, size_t total);
 
 void plotData(Data *points, Data *hull, int nUncovered, const char * title);
 void plotHullMergeStep(Data *h1, Data *h2, Data *h0, size_t h1Index, size_t h2Index, const char * title, const bool closeH0);
 void saveHullPointsTxt(Data *hull, char *fname);
+void writeHullPoints(FILE *fileptr, Data *hull);
 
 Data quickhull (Data *d, ProcThreadIDCombo *id);
 
@@ -72,8 +331,111 @@ Data quickhull (Data *d, ProcThreadIDCombo *id);
     int finalCoverageCheck(Data *hull, Data *pts, ProcThreadIDCombo *id);
 #endif
 
-Data parallhullThreaded(Data *d, size_t reducedProblemUB, int procID, int nThreads);
+void removeInteriorPoints(Data *hull, Data *pts, ProcThreadIDCombo *id);
 
-#ifndef NON_MPI_MODE
+// quickhull kernels, exposed so that they can be benchmarked in isolation
+void removeCoveredPoints(Data *hull, Data *uncoveredPts, uint64_t *uncoveredMask, bool keepOnEdge, ProcThreadIDCombo *id);
+void buildUncoveredMask(Data *hull, Data *pts, uint64_t *mask, bool keepOnEdge);
+size_t compactPoints(Data *pts, uint64_t *mask, float *dstX, float *dstY, PointIndex *dstI);
+void removeCoveredFindFarthest(Data *hull, Data *uncoveredPts, uint64_t *mask, double *maxDist, size_t *maxDistPtIndices, ProcThreadIDCombo *id);
+void findFarthestPts(Data *hull, Data *uncoveredPts, size_t *maxDistPtIndices);
+void addPtsToHull(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndicesPtr, size_t **offsetCounterPtr, size_t *allocatedElemsCount, ProcThreadIDCombo *id);
+
+// runtime selected variants of buildUncoveredMask (--tune)
+int getCoverageVariantsCount();
+const char *getCoverageVariantName(int v);
+int findCoverageVariant(const char *name);
+void setCoverageVariant(int v);
+int getCoverageVariant();
+// runtime selected variants of the coverage and farthest points step of quickhull (--tune)
+int getIterationVariantsCount();
+const char *getIterationVariantName(int v);
+int findIterationVariant(const char *name);
+void setIterationVariant(int v);
+int getIterationVariant();
+void loadTuning(Params *p, int procID);
+void runTuning(Params *p, int procID);
+
+Data parallhullThreaded(Data *d, size_t reducedProblemUB, int procID, int nThreads, enum Schedule schedule);
+Data mergeHulls(Data *h1, Data *h2, ProcThreadIDCombo *id);
+size_t strictVertices(const float *X, const float *Y, size_t k, size_t *order);
+
+void taskPoolRun(int nThreads, int procID, TaskFn root, void *arg);
+void taskSpawn(TaskWorker *w, TaskFn fn, void *arg);
+void taskParallelFor(TaskWorker *w, size_t nBlocks, TaskBlockFn body, TaskFn done, void *ctx);
+ProcThreadIDCombo *taskWorkerID(TaskWorker *w);
+
+Data taskhull(Data *d, int procID, int nThreads);
+
+void runBatch(Params *p, int rank, int nProcs);
+
+void runDaemon(Params *p, int procID);
+int hulldConnect(const char *socketPath);
+int hulldBufferCreate(HulldBuffer *b, size_t capacity);
+void hulldBufferDestroy(HulldBuffer *b);
+int hulldHull(int sock, HulldBuffer *b, size_t n, HulldResponse *resp);
+char *hulldStats(int sock);
+int hulldShutdown(int sock);
+
+HullQuery hullQueryBuild(Data *hull, int procID);
+void hullQueryFree(HullQuery *q);
+size_t hullQueryMask(HullQuery *q, Data *pts, uint64_t *mask);
+void hullQueryCellsMask(HullQuery *q, const double *X, const double *Y, size_t n, double hx, double hy, uint64_t *mask);
+size_t hullQueryClassify(HullQuery *q, Data *pts, uint64_t *mask, int nThreads, int procID);
+void hullQueryFilter(HullQuery *q, Data *d, int nThreads, int procID);
+void runQuery(Params *p, Data *hull, int procID);
+
+void runVerify(Params *p, Data *hull, double tolerance, int rank, int nProcs);
+
+GroupedHulls groupedHulls(Data *d, uint32_t *keys, int nThreads, int procID);
+void freeGroupedHulls(GroupedHulls *g);
+void runGroupedHulls(Params *p, int procID);
+
+ConvexLayers convexLayers(Data *d, size_t maxDepth, int nThreads, int procID);
+void freeConvexLayers(ConvexLayers *l);
+void runConvexLayers(Params *p, int procID);
+
+Data approxHull(Data *d, double eps, int nThreads, int procID, double *errorBound);
+void saveApproxHullTxt(Data *hull, double eps, double errorBound, char *fname);
+
+Data sampleHull(Data *d, size_t sampleSize, uint64_t seed, ProcThreadIDCombo *id);
+void prefilterPoints(Data *d, Data *hull, int nThreads, int procID);
+void gridCullPoints(Data *d, size_t cellsPerSide, int nThreads, int rank, int nProcs);
+
+extern const char *distributionNames[];
+int parseDistribution(const char *name);
+void genPoints(float *X, float *Y, size_t first, size_t count, enum Distribution dist, uint64_t seed, double radius);
+
+extern const char *phaseNames[];
+void metricsEnable(int rank, int nThreads);
+bool metricsEnabled();
+void metricsSetRead(double time, size_t bytes);
+void metricsSetPhaseTime(enum Phase phase, double time);
+void metricsSetPrefilterRemoved(size_t removed);
+void metricsSetTotalTime(double time);
+void metricsQuickhullBegin(ProcThreadIDCombo *id, size_t n);
+void metricsQuickhullIteration(ProcThreadIDCombo *id, size_t uncovered, size_t hullSize);
+void metricsQuickhullEnd(ProcThreadIDCombo *id, size_t hullSize, double time);
+void metricsMerge(ProcThreadIDCombo *id, enum Phase phase, int partner, size_t n1, size_t n2, size_t n0, double time, double waitTime);
+void metricsWrite(const char *fname, Params *p);
+
+void perfCountersEnable(int rank, int nThreads);
+bool perfCountersEnabled();
+void perfThreadOpen();
+void perfThreadClose();
+PerfValues perfRead();
+void perfAccumulate(ProcThreadIDCombo *id, enum Phase phase, PerfValues *start);
+void perfCountersReport();
+void perfCountersWriteJSON(FILE *f, int t);
+
+void traceEnable(int rank, int nThreads);
+void traceBegin(ProcThreadIDCombo *id, enum TraceEvent ev);
+void traceEnd(ProcThreadIDCombo *id, enum TraceEvent ev, uint64_t arg);
+void traceWrite(const char *fname, Params *p);
+
+#ifdef NON_MPI_MODE
+void sampleHullPrefilter(Data *d, size_t sampleSize, int nThreads);
+#else
 void mpiHullMerge(Data *h1, int rank, int nProcs);
+void mpiSampleHullPrefilter(Data *d, size_t sampleSize, int rank, int nProcs, int nThreads);
 #endif
\ No newline at end of file
@@ -0,0 +1,451 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#define QUERY_MIN_BUCKETS 64
+#define QUERY_MAX_BUCKETS (1UL << 22) // 16MB of table, hulls with more than 2M vertices get more than one wedge per bucket
+#define QUERY_PARALLEL_THRESHOLD (1UL << 16) // minimum points per thread
+
+// Point-in-hull queries. The plane is split in wedges around an interior point of the hull (the mean of its vertices), wedge
+// i is bounded by the rays through vertex i and i+1, so a point is inside the hull iff it is inside the edge of its wedge.
+// The wedges are found by pseudo-angle (monotone in the angle, no trigonometry): a table over uniform pseudo-angle buckets
+// gives the range of wedges a bucket overlaps, and a branchless binary search with a fixed number of steps picks the wedge
+// inside the range. With one bucket per half vertex the range holds one or two wedges for any reasonable hull, but the
+// search keeps the worst case at O(log h) when the vertices are crowded in a small angle.
+// Everything is done in double on 4 points at a time with AVX2 gathers, the test against the edge is the one of
+// removeCoveredPoints with keepOnEdge=false: points on the boundary are inside
+
+typedef struct
+{
+    Data pts;
+    HullQuery *q;
+    uint64_t *mask;
+    size_t *counts;
+    Data *out; // NULL when only the mask is wanted
+    pthread_barrier_t *barrier;
+    int nThreads;
+    ProcThreadIDCombo id;
+} QueryThreadData;
+
+static void *queryThread(void *arg);
+static void runQueryThreads(HullQuery *q, Data *pts, uint64_t *mask, size_t *counts, Data *out, int nThreads, int procID);
+
+// pseudo-angle around (cx, cy) in [0, 4): 0 along +x, 1 along +y, 2 along -x, 3 along -y. Used both for the vertices and the
+// queries, so that a point lying on a ray through a vertex gets the very same value
+static inline __m256d pseudoAngle4(__m256d x, __m256d y, __m256d cx, __m256d cy)
+{
+    __m256d signBit = _mm256_set1_pd(-0.);
+    __m256d dx = _mm256_sub_pd(x, cx);
+    __m256d dy = _mm256_sub_pd(y, cy);
+    __m256d l1 = _mm256_add_pd(_mm256_andnot_pd(signBit, dx), _mm256_andnot_pd(signBit, dy));
+    __m256d p = _mm256_div_pd(dy, _mm256_max_pd(l1, _mm256_set1_pd(DBL_MIN))); // the center itself gets 0
+    __m256d right = _mm256_blendv_pd(p, _mm256_add_pd(p, _mm256_set1_pd(4.)), _mm256_cmp_pd(dy, _mm256_setzero_pd(), _CMP_LT_OQ));
+    return _mm256_blendv_pd(right, _mm256_sub_pd(_mm256_set1_pd(2.), p), _mm256_cmp_pd(dx, _mm256_setzero_pd(), _CMP_LT_OQ));
+}
+
+// the 4 lanes of a 64 bit mask as 32 bit lanes, to select among the 32 bit wedge indices
+static inline __m128i narrowMask(__m256d m)
+{
+    __m256i packed = _mm256_permutevar8x32_epi32(_mm256_castpd_si256(m), _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+    return _mm256_castsi256_si128(packed);
+}
+
+// bits of the inside mask for 4 points given as doubles, with strict the points on the boundary are outside
+static inline uint64_t insideBits4(const HullQuery *q, __m256d x, __m256d y, bool strict)
+{
+    __m256d four = _mm256_set1_pd(4.);
+    __m256d ang = _mm256_sub_pd(pseudoAngle4(x, y, _mm256_set1_pd(q->cx), _mm256_set1_pd(q->cy)), _mm256_set1_pd(q->angle0));
+    ang = _mm256_add_pd(ang, _mm256_and_pd(_mm256_cmp_pd(ang, _mm256_setzero_pd(), _CMP_LT_OQ), four));
+
+    // the bucket width is a power of 2 fraction of 4, so the bucket of a point and the bucket bounds used to build the table are exact
+    __m256d bucketF = _mm256_min_pd(_mm256_mul_pd(ang, _mm256_set1_pd(q->bucketScale)), _mm256_set1_pd((double)(q->nBuckets - 1)));
+    __m128i bucket = _mm256_cvttpd_epi32(bucketF);
+    __m128i lo = _mm_i32gather_epi32(q->bucketFirst, bucket, 4);
+    __m128i hi = _mm_i32gather_epi32(&q->bucketFirst[1], bucket, 4);
+
+    // last wedge of [lo, hi] starting at or before the point
+    for (int step = (1 << q->searchSteps) >> 1; step > 0; step >>= 1)
+    {
+        __m128i idx = _mm_min_epi32(_mm_add_epi32(lo, _mm_set1_epi32(step)), hi);
+        __m256d idxAngle = _mm256_i32gather_pd(q->angles, idx, 8);
+        lo = _mm_blendv_epi8(lo, idx, narrowMask(_mm256_cmp_pd(idxAngle, ang, _CMP_LE_OQ)));
+    }
+
+    __m128i edge = _mm_slli_epi32(lo, 2);
+    __m256d b = _mm256_i32gather_pd(&q->edges[0], edge, 8);
+    __m256d a = _mm256_i32gather_pd(&q->edges[1], edge, 8);
+    __m256d c = _mm256_i32gather_pd(&q->edges[2], edge, 8);
+    __m256d dist = _mm256_fmadd_pd(a, y, _mm256_fmadd_pd(b, x, c));
+    if (strict)
+        return (uint64_t)_mm256_movemask_pd(_mm256_cmp_pd(dist, _mm256_setzero_pd(), _CMP_GT_OQ));
+    return (uint64_t)_mm256_movemask_pd(_mm256_cmp_pd(dist, _mm256_setzero_pd(), _CMP_GE_OQ));
+}
+
+// hulls of 1 or 2 vertices: inside means on the point or on the segment
+static bool insideDegenerate(const HullQuery *q, float x, float y)
+{
+    if (q->n == 0)
+        return false;
+    double x0 = q->degX[0], y0 = q->degY[0];
+    if (q->n == 1)
+        return (x == x0) && (y == y0);
+    double x1 = q->degX[1], y1 = q->degY[1];
+    if ((x1 - x0) * (y - y0) - (y1 - y0) * (x - x0) != 0)
+        return false;
+    return (x >= fmin(x0, x1)) && (x <= fmax(x0, x1)) && (y >= fmin(y0, y1)) && (y <= fmax(y0, y1));
+}
+
+// Preprocess a convex hull (CCW, no collinear vertices, as returned by quickhull) for hullQueryClassify and hullQueryFilter.
+// The hull is not referenced afterwards
+HullQuery hullQueryBuild(Data *hull, int procID)
+{
+    HullQuery q = { .n=hull->n, .searchSteps=0, .angles=NULL, .edges=NULL, .bucketFirst=NULL };
+    if (hull->n >= (1UL << 31))
+        throwError("p[%2d] hullQueryBuild: Hulls of %ld vertices are not supported", procID, hull->n);
+    if (hull->n < 3)
+    {
+        for (size_t i = 0; i < hull->n; i++)
+        {
+            q.degX[i] = hull->X[i];
+            q.degY[i] = hull->Y[i];
+        }
+        return q;
+    }
+
+    size_t n = hull->n;
+    q.nBuckets = QUERY_MIN_BUCKETS;
+    while ((q.nBuckets < 2 * n) && (q.nBuckets < QUERY_MAX_BUCKETS))
+        q.nBuckets <<= 1;
+    q.bucketScale = q.nBuckets / 4.;
+
+    q.angles = malloc((n + 4) * sizeof(double));
+    q.edges = malloc(n * 4 * sizeof(double));
+    q.bucketFirst = malloc((q.nBuckets + 1) * sizeof(int32_t));
+    if ((q.angles == NULL) || (q.edges == NULL) || (q.bucketFirst == NULL))
+        throwError("p[%2d] hullQueryBuild: Failed to allocate memory for a hull of %ld vertices", procID, n);
+
+    double sumX = 0, sumY = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        sumX += hull->X[i];
+        sumY += hull->Y[i];
+    }
+    q.cx = sumX / n;
+    q.cy = sumY / n;
+
+    // pseudo-angles of the vertices with the same kernel used for the queries, relative to vertex 0
+    __m256d cx = _mm256_set1_pd(q.cx), cy = _mm256_set1_pd(q.cy);
+    for (size_t i = 0; i < n; i += 4)
+    {
+        double vX[4] = { 0 }, vY[4] = { 0 };
+        for (size_t k = 0; (k < 4) && (i + k < n); k++)
+        {
+            vX[k] = hull->X[i+k];
+            vY[k] = hull->Y[i+k];
+        }
+        _mm256_storeu_pd(&q.angles[i], pseudoAngle4(_mm256_loadu_pd(vX), _mm256_loadu_pd(vY), cx, cy));
+    }
+    q.angle0 = q.angles[0];
+    q.angles[0] = 0;
+    for (size_t i = 1; i < n; i++)
+    {
+        double a = q.angles[i] - q.angle0;
+        if (a < 0)
+            a += 4.;
+        // vertices seen under (almost) the same angle could come out of order by one rounding, the search needs them sorted
+        q.angles[i] = a < q.angles[i-1] ? q.angles[i-1] : a;
+    }
+
+    // edge i goes from vertex i to vertex i+1, same line coefficients as buildUncoveredMask (padded to 4 for the gathers)
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t ip1 = i + 1 == n ? 0 : i + 1;
+        double x0 = hull->X[i], y0 = hull->Y[i], x1 = hull->X[ip1], y1 = hull->Y[ip1];
+        q.edges[4*i] = y0 - y1;
+        q.edges[4*i + 1] = x1 - x0;
+        q.edges[4*i + 2] = x0 * y1 - x1 * y0;
+        q.edges[4*i + 3] = 0;
+    }
+
+    // bucketFirst[k] is the last wedge starting at or before the start of bucket k, so the wedges of bucket k are
+    // [bucketFirst[k], bucketFirst[k+1]]
+    size_t maxSpan = 0;
+    size_t w = 0;
+    for (size_t k = 0; k <= q.nBuckets; k++)
+    {
+        double bucketStart = k / q.bucketScale;
+        while ((w + 1 < n) && (q.angles[w+1] <= bucketStart))
+            w++;
+        q.bucketFirst[k] = (int32_t)w;
+        if ((k > 0) && (w - q.bucketFirst[k-1] > maxSpan))
+            maxSpan = w - q.bucketFirst[k-1];
+    }
+    while ((1UL << q.searchSteps) <= maxSpan)
+        q.searchSteps++;
+
+    LOG(LOG_LVL_DEBUG, "p[%2d] hullQueryBuild: %ld vertices, %ld buckets, at most %ld wedges per bucket (%d search steps)", procID, n, q.nBuckets, maxSpan + 1, q.searchSteps);
+    return q;
+}
+
+void hullQueryFree(HullQuery *q)
+{
+    free(q->angles);
+    free(q->edges);
+    free(q->bucketFirst);
+    q->angles = NULL;
+    q->edges = NULL;
+    q->bucketFirst = NULL;
+}
+
+// Single threaded hullQueryClassify: set bit i of mask when point i is inside the hull, 64 points per mask word. Returns the
+// number of points inside
+size_t hullQueryMask(HullQuery *q, Data *pts, uint64_t *mask)
+{
+    size_t n = pts->n;
+    size_t inside = 0;
+    for (size_t w = 0; w * 64 < n; w++)
+    {
+        size_t base = w * 64;
+        size_t count = n - base < 64 ? n - base : 64;
+        uint64_t bits = 0;
+        if (q->n < 3)
+        {
+            for (size_t i = 0; i < count; i++)
+                bits |= (uint64_t)insideDegenerate(q, pts->X[base+i], pts->Y[base+i]) << i;
+        }
+        else
+        {
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4)
+            {
+                __m256d x = _mm256_cvtps_pd(_mm_loadu_ps(&pts->X[base+i]));
+                __m256d y = _mm256_cvtps_pd(_mm_loadu_ps(&pts->Y[base+i]));
+                bits |= insideBits4(q, x, y, false) << i;
+            }
+            if (i < count) // last partial word: never read past the last point
+            {
+                double tailX[4] = { 0 }, tailY[4] = { 0 };
+                for (size_t k = 0; k < count - i; k++)
+                {
+                    tailX[k] = pts->X[base+i+k];
+                    tailY[k] = pts->Y[base+i+k];
+                }
+                bits |= (insideBits4(q, _mm256_loadu_pd(tailX), _mm256_loadu_pd(tailY), false) & ((1UL << (count - i)) - 1)) << i;
+            }
+        }
+        mask[w] = bits;
+        inside += __builtin_popcountll(bits);
+    }
+    return inside;
+}
+
+// Set bit i of mask when the whole cell [X[i] - hx, X[i] + hx] x [Y[i] - hy, Y[i] + hy] is strictly inside the hull, for points
+// known only up to a cell (see quantized.c). A convex polygon holds a rectangle iff it holds its 4 corners, and with the corners
+// strictly inside no point of the cell can be on the boundary, so a cleared bit is the only conservative answer for a hull vertex
+void hullQueryCellsMask(HullQuery *q, const double *X, const double *Y, size_t n, double hx, double hy, uint64_t *mask)
+{
+    memset(mask, 0, (n + 63) / 64 * sizeof(uint64_t));
+    if (q->n < 3) // nothing is strictly inside a point or a segment
+        return;
+
+    __m256d dx = _mm256_set1_pd(hx), dy = _mm256_set1_pd(hy);
+    for (size_t i = 0; i < n; i += 4)
+    {
+        double cX[4], cY[4];
+        for (size_t k = 0; k < 4; k++) // the tail repeats the last cell, its bits are dropped below
+        {
+            cX[k] = X[i + k < n ? i + k : n - 1];
+            cY[k] = Y[i + k < n ? i + k : n - 1];
+        }
+        __m256d x = _mm256_loadu_pd(cX), y = _mm256_loadu_pd(cY);
+        __m256d x0 = _mm256_sub_pd(x, dx), x1 = _mm256_add_pd(x, dx);
+        __m256d y0 = _mm256_sub_pd(y, dy), y1 = _mm256_add_pd(y, dy);
+        uint64_t bits = insideBits4(q, x0, y0, true) & insideBits4(q, x1, y0, true) & insideBits4(q, x1, y1, true) & insideBits4(q, x0, y1, true);
+        if (n - i < 4)
+            bits &= (1UL << (n - i)) - 1;
+        mask[i / 64] |= bits << (i % 64);
+    }
+}
+
+// Set bit i of mask when point i is inside the hull (or on its boundary), clear it otherwise. mask must hold (pts->n + 63) / 64
+// words. Returns the number of points inside
+size_t hullQueryClassify(HullQuery *q, Data *pts, uint64_t *mask, int nThreads, int procID)
+{
+    size_t counts[MAX_THREADS];
+    if (nThreads > MAX_THREADS)
+        nThreads = MAX_THREADS;
+    if (pts->n < QUERY_PARALLEL_THRESHOLD * (size_t)nThreads)
+        nThreads = (int)(pts->n / QUERY_PARALLEL_THRESHOLD) + 1;
+
+    runQueryThreads(q, pts, mask, counts, NULL, nThreads, procID);
+
+    size_t inside = 0;
+    for (int i = 0; i < nThreads; i++)
+        inside += counts[i];
+    return inside;
+}
+
+// Keep only the points of d inside the hull (or on its boundary), in their order. d is replaced like prefilterPoints does
+void hullQueryFilter(HullQuery *q, Data *d, int nThreads, int procID)
+{
+    size_t counts[MAX_THREADS];
+    if (nThreads > MAX_THREADS)
+        nThreads = MAX_THREADS;
+    if (d->n < QUERY_PARALLEL_THRESHOLD * (size_t)nThreads)
+        nThreads = (int)(d->n / QUERY_PARALLEL_THRESHOLD) + 1;
+
+    uint64_t *mask = malloc((d->n + 63) / 64 * sizeof(uint64_t) + MALLOC_PADDING);
+    if (mask == NULL)
+        throwError("p[%2d] hullQueryFilter: Failed to allocate memory for the mask", procID);
+    Data out = { .n=0 };
+    runQueryThreads(q, d, mask, counts, &out, nThreads, procID);
+    free(mask);
+
+    free(d->X);
+    free(d->I);
+    *d = out;
+}
+
+// the slices start on a mask word so that every thread owns whole words
+static void runQueryThreads(HullQuery *q, Data *pts, uint64_t *mask, size_t *counts, Data *out, int nThreads, int procID)
+{
+    pthread_t threads[MAX_THREADS];
+    QueryThreadData ds[MAX_THREADS];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, nThreads);
+
+    size_t nWords = (pts->n + 63) / 64;
+    size_t wordsPerThread = (nWords + nThreads - 1) / nThreads;
+    for (int i = 0; i < nThreads; i++)
+    {
+        size_t startPos = wordsPerThread * i * 64;
+        size_t endPos = wordsPerThread * (i+1) * 64;
+        if (startPos > pts->n) startPos = pts->n;
+        if (endPos > pts->n) endPos = pts->n;
+        ds[i].pts.X = &pts->X[startPos];
+        ds[i].pts.Y = &pts->Y[startPos];
+        ds[i].pts.I = pts->I == NULL ? NULL : &pts->I[startPos];
+        ds[i].pts.n = endPos - startPos;
+        ds[i].q = q;
+        ds[i].mask = &mask[wordsPerThread * i];
+        ds[i].counts = counts;
+        ds[i].out = out;
+        ds[i].barrier = &barrier;
+        ds[i].nThreads = nThreads;
+        ds[i].id.p = procID;
+        ds[i].id.t = i;
+        pthread_create(&threads[i], NULL, queryThread, (void*)&ds[i]);
+    }
+    for (int i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_barrier_destroy(&barrier);
+}
+
+static void *queryThread(void *arg)
+{
+    QueryThreadData *thData = (QueryThreadData*)arg;
+    HullQuery *q = thData->q;
+    Data *pts = &thData->pts;
+    int t = thData->id.t;
+
+    // 1) classify the own slice
+    thData->counts[t] = hullQueryMask(q, pts, thData->mask);
+
+    if (thData->out == NULL)
+        return NULL;
+
+    // 2) left-pack the points inside the own slice, then one thread allocates the output once every count is known
+    if (pts->n > 0)
+        pts->n = compactPoints(pts, thData->mask, pts->X, pts->Y, pts->I);
+    if (pthread_barrier_wait(thData->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        Data *out = thData->out;
+        out->n = 0;
+        for (int i = 0; i < thData->nThreads; i++)
+            out->n += thData->counts[i];
+        out->X = malloc(out->n * 2 * sizeof(float) + MALLOC_PADDING);
+        if (out->X == NULL)
+            throwError("p[%2d] hullQueryFilter: Failed to allocate memory for the %ld points inside", thData->id.p, out->n);
+        out->Y = &out->X[out->n];
+        out->I = NULL;
+        if (pts->I != NULL)
+        {
+            out->I = malloc(out->n * sizeof(PointIndex) + MALLOC_PADDING);
+            if (out->I == NULL)
+                throwError("p[%2d] hullQueryFilter: Failed to allocate memory for the indices of the %ld points inside", thData->id.p, out->n);
+        }
+    }
+    pthread_barrier_wait(thData->barrier);
+
+    // 3) copy them to their position, given by the prefix sum of the counts of the previous threads
+    size_t offset = 0;
+    for (int i = 0; i < t; i++)
+        offset += thData->counts[i];
+    memcpy(&thData->out->X[offset], pts->X, pts->n * sizeof(float));
+    memcpy(&thData->out->Y[offset], pts->Y, pts->n * sizeof(float));
+    if (thData->out->I != NULL)
+        memcpy(&thData->out->I[offset], pts->I, pts->n * sizeof(PointIndex));
+
+    return NULL;
+}
+
+// --query: classify the points of p->queryFile against the hull of --file. The result goes to p->queryOutput as a raw
+// bitmask (uint64 words, bit i of word w set when point 64*w+i is inside) or as the raw file of the points inside, in the
+// layout of the input files
+void runQuery(Params *p, Data *hull, int procID)
+{
+    double startTime = getTime();
+    HullQuery q = hullQueryBuild(hull, procID);
+
+    Params queryParams = *p;
+    strcpy(queryParams.inputFile, p->queryFile);
+    queryParams.trackIndices = false;
+    Data d;
+    readFile(&d, &queryParams);
+    size_t n = d.n;
+    double readTime = getTime();
+
+    size_t inside;
+    uint64_t *mask = NULL;
+    if (p->queryFormat == QUERY_FORMAT_POINTS)
+    {
+        hullQueryFilter(&q, &d, p->nThreads, procID);
+        inside = d.n;
+    }
+    else
+    {
+        mask = malloc((n + 63) / 64 * sizeof(uint64_t) + MALLOC_PADDING);
+        if (mask == NULL)
+            throwError("p[%2d] runQuery: Failed to allocate memory for the mask", procID);
+        inside = hullQueryClassify(&q, &d, mask, p->nThreads, procID);
+    }
+    double queryTime = getTime();
+
+    LOG(LOG_LVL_NOTICE, "p[%2d] runQuery: %ld of %ld points inside the hull of %ld vertices. Read in %lfs, classified in %lfs (%.3e points/s)", procID, inside, n, hull->n,
+        readTime - startTime, queryTime - readTime, n / (queryTime - readTime));
+
+    if (p->queryOutput[0] != 0)
+    {
+        FILE *out = fopen(p->queryOutput, "wb");
+        if (out == NULL)
+            throwError("p[%2d] runQuery: Could not open %s", procID, p->queryOutput);
+        size_t written = 1;
+        if (mask != NULL)
+            written = fwrite(mask, (n + 63) / 64 * sizeof(uint64_t), 1, out);
+        else if (d.n > 0)
+            written = fwrite(d.X, d.n * 2 * sizeof(float), 1, out);
+        if ((n > 0) && (written != 1))
+            throwError("p[%2d] runQuery: Could not write %s", procID, p->queryOutput);
+        fclose(out);
+    }
+
+    free(mask);
+    free(d.X);
+    free(d.I);
+    hullQueryFree(&q);
+}
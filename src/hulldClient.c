@@ -0,0 +1,153 @@
+#define _GNU_SOURCE // memfd_create
+#include "parallhull.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Client side of the daemon protocol (see runDaemon). The calls are synchronous: one request in flight per socket,
+// threads that want to send requests concurrently open their own socket and buffer. Errors are returned, not thrown,
+// so that a failing daemon does not take its clients down
+
+static uint64_t nextRequestID = 0;
+
+// returns the connected socket or -1
+int hulldConnect(const char *socketPath)
+{
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    struct sockaddr_un addr = { .sun_family=AF_UNIX };
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)))
+    {
+        LOG(LOG_LVL_ERROR, "hulldConnect: Could not connect to %s: %s", socketPath, strerror(errno));
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// creates a memfd holding up to capacity points, seals its size as the daemon requires and maps it, returns 0 or -1
+int hulldBufferCreate(HulldBuffer *b, size_t capacity)
+{
+    b->capacity = capacity;
+    b->bytes = HULLD_BUFFER_BYTES(capacity);
+    b->fd = memfd_create("parallhull", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (b->fd < 0)
+        return -1;
+    if (ftruncate(b->fd, b->bytes) || fcntl(b->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW))
+    {
+        close(b->fd);
+        return -1;
+    }
+    b->base = mmap(NULL, b->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, b->fd, 0);
+    if (b->base == MAP_FAILED)
+    {
+        close(b->fd);
+        return -1;
+    }
+    b->X = (float*)b->base;
+    b->Y = &b->X[capacity];
+    b->hullX = (float*)((char*)b->base + HULLD_HULL_OFFSET(capacity));
+    b->hullY = &b->hullX[capacity];
+    return 0;
+}
+
+void hulldBufferDestroy(HulldBuffer *b)
+{
+    munmap(b->base, b->bytes);
+    close(b->fd);
+    b->fd = -1;
+    b->base = NULL;
+}
+
+static int sendRequest(int sock, HulldRequest *req, int memfd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { .iov_base=req, .iov_len=sizeof(*req) };
+    struct msghdr msg = { .msg_iov=&iov, .msg_iovlen=1 };
+    if (memfd >= 0)
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &memfd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    while ((sent < 0) && (errno == EINTR));
+    return sent == sizeof(*req) ? 0 : -1; // the header is far smaller than the socket buffer, it is never split
+}
+
+static int recvAll(int sock, void *buf, size_t count)
+{
+    char *ptr = buf;
+    while (count > 0)
+    {
+        ssize_t got = recv(sock, ptr, count, 0);
+        if ((got < 0) && (errno == EINTR))
+            continue;
+        if (got <= 0)
+            return -1;
+        ptr += got;
+        count -= got;
+    }
+    return 0;
+}
+
+static int request(int sock, enum HulldOp op, size_t n, size_t capacity, int memfd, HulldResponse *resp)
+{
+    HulldRequest req = {
+        .magic=HULLD_MAGIC,
+        .op=op,
+        .id=__atomic_fetch_add(&nextRequestID, 1, __ATOMIC_RELAXED),
+        .n=n,
+        .capacity=capacity
+    };
+    if (sendRequest(sock, &req, memfd) || recvAll(sock, resp, sizeof(*resp)) || (resp->magic != HULLD_MAGIC) || (resp->id != req.id))
+        return HULLD_ERR_IO;
+    return resp->status;
+}
+
+// hulls the first n points of b, the hull is in b->hullX and b->hullY (resp->hullSize vertices). Returns an HulldStatus
+int hulldHull(int sock, HulldBuffer *b, size_t n, HulldResponse *resp)
+{
+    if (n > b->capacity)
+        return HULLD_ERR_BAD_REQUEST;
+    return request(sock, HULLD_OP_HULL, n, b->capacity, b->fd, resp);
+}
+
+// the counters and latency histograms of the daemon as JSON (to be freed), NULL on error
+char *hulldStats(int sock)
+{
+    HulldResponse resp;
+    if (request(sock, HULLD_OP_STATS, 0, 0, -1, &resp) != HULLD_OK)
+        return NULL;
+    char *json = malloc(resp.hullSize + 1);
+    if (json == NULL)
+        return NULL;
+    if (recvAll(sock, json, resp.hullSize))
+    {
+        free(json);
+        return NULL;
+    }
+    json[resp.hullSize] = 0;
+    return json;
+}
+
+int hulldShutdown(int sock)
+{
+    HulldResponse resp;
+    return request(sock, HULLD_OP_SHUTDOWN, 0, 0, -1, &resp);
+}
@@ -0,0 +1,246 @@
+#include "parallhull.h"
+
+#include <argp.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Load generator for the daemon (--daemon): every client thread opens its own connection and memfd buffer, then refills it
+// and sends a hull request in a loop, the latencies measured by the clients are reported with the statistics of the daemon.
+// Must be built with NON_MPI_MODE (see the build target in the makefile)
+#ifndef NON_MPI_MODE
+    #error "hulldLoad.c must be compiled with -DNON_MPI_MODE"
+#endif
+
+#define LOAD_SEED 0x10ADULL
+
+typedef struct
+{
+    char socketPath[108];
+    int nClients;
+    size_t nRequests; // per client
+    size_t n;
+    enum Distribution dist;
+    bool shutdown;
+} LoadParams;
+
+typedef struct
+{
+    LoadParams *lp;
+    int thID;
+    double *latencies; // nRequests per client
+    size_t nFailed;
+    size_t hullSize;
+} LoadClient;
+
+enum argpKeys{
+    ARGP_SOCKET='s',
+    ARGP_CLIENTS='c',
+    ARGP_REQUESTS='r',
+    ARGP_NPOINTS='n',
+    ARGP_DIST='d',
+    ARGP_LOG_LEVEL='l',
+    ARGP_SHUTDOWN=0x100 // long options only
+};
+
+static error_t loadArgpParser(int key, char *arg, struct argp_state *state);
+static void *loadClient(void *arg);
+static int compareDoubles(const void *a, const void *b);
+
+int main(int argc, char *argv[])
+{
+    static struct argp_option argpOptions[] = {
+        { .name="socket", .key=ARGP_SOCKET, .arg="PATH", .flags=0, .doc="Socket of the daemon (main --daemon PATH)\n", .group=1 },
+        { .name="clients", .key=ARGP_CLIENTS, .arg="UINT", .flags=0, .doc="Concurrent clients, each with its own connection and buffer (default 1)\n", .group=1 },
+        { .name="requests", .key=ARGP_REQUESTS, .arg="UINT", .flags=0, .doc="Requests sent by each client (default 1000)\n", .group=1 },
+        { .name="npoints", .key=ARGP_NPOINTS, .arg="NUM", .flags=0, .doc="Points per request (default 1e4, scientific notation is accepted)\n", .group=1 },
+        { .name="dist", .key=ARGP_DIST, .arg="STRING", .flags=0, .doc="Distribution of the points: disk (default), square, circle, annulus, gaussian, clustered\n", .group=1 },
+        { .name="loglvl", .key=ARGP_LOG_LEVEL, .arg="UINT", .flags=0, .doc="Log level (0=fatal ... 6=trace, default 3)\n", .group=1 },
+        { .name="shutdown", .key=ARGP_SHUTDOWN, .arg=NULL, .flags=0, .doc="Stop the daemon at the end\n", .group=1 },
+        { 0 }
+    };
+    static struct argp argpData = {
+        .options = argpOptions,
+        .parser = loadArgpParser,
+        .doc = "Sends hull requests to a parallhull daemon and reports the latencies"
+    };
+
+    LoadParams lp = {
+        .socketPath = {0},
+        .nClients = 1,
+        .nRequests = 1000,
+        .n = 10000,
+        .dist = DIST_DISK,
+        .shutdown = false
+    };
+    setLogLevel(LOG_LVL_NOTICE);
+    argp_parse(&argpData, argc, argv, 0, 0, &lp);
+
+    if (lp.socketPath[0] == 0)
+        throwError("The socket of the daemon must be specified with --socket");
+    if (lp.nClients < 1)
+        lp.nClients = 1;
+    if (lp.nClients > MAX_THREADS)
+        lp.nClients = MAX_THREADS;
+
+    pthread_t threads[MAX_THREADS];
+    LoadClient clients[MAX_THREADS];
+    double startTime = getTime();
+    for (int i = 0; i < lp.nClients; i++)
+    {
+        clients[i] = (LoadClient){ .lp=&lp, .thID=i, .nFailed=0, .hullSize=0 };
+        clients[i].latencies = malloc(lp.nRequests * sizeof(double));
+        if (clients[i].latencies == NULL)
+            throwError("Failed to allocate memory for the latencies");
+        pthread_create(&threads[i], NULL, loadClient, (void*)&clients[i]);
+    }
+    for (int i = 0; i < lp.nClients; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = getTime() - startTime;
+
+    size_t total = lp.nClients * lp.nRequests;
+    double *all = malloc(total * sizeof(double));
+    if (all == NULL)
+        throwError("Failed to allocate memory for the latencies");
+    size_t nFailed = 0;
+    for (int i = 0; i < lp.nClients; i++)
+    {
+        memcpy(&all[i * lp.nRequests], clients[i].latencies, lp.nRequests * sizeof(double));
+        nFailed += clients[i].nFailed;
+        free(clients[i].latencies);
+    }
+    qsort(all, total, sizeof(double), compareDoubles);
+
+    printf("requests=%ld failed=%ld clients=%d n=%ld dist=%s hullSize=%ld\n", total, nFailed, lp.nClients, lp.n, distributionNames[lp.dist], clients[0].hullSize);
+    printf("throughput=%.1lf req/s (%.3e points/s) in %lfs\n", total / elapsed, (double)total * lp.n / elapsed, elapsed);
+    printf("latency_us: min=%.1lf p50=%.1lf p90=%.1lf p99=%.1lf max=%.1lf\n", all[0] * 1e6, all[total / 2] * 1e6, all[(size_t)(total * 0.9)] * 1e6,
+           all[(size_t)(total * 0.99)] * 1e6, all[total - 1] * 1e6);
+    free(all);
+
+    int sock = hulldConnect(lp.socketPath);
+    if (sock < 0)
+        throwError("Could not connect to %s", lp.socketPath);
+    char *stats = hulldStats(sock);
+    if (stats != NULL)
+        printf("daemon: %s", stats);
+    free(stats);
+    if (lp.shutdown && (hulldShutdown(sock) != HULLD_OK))
+        LOG(LOG_LVL_ERROR, "The daemon did not accept the shutdown");
+    close(sock);
+
+    return nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void *loadClient(void *arg)
+{
+    LoadClient *cl = (LoadClient*)arg;
+    LoadParams *lp = cl->lp;
+
+    int sock = hulldConnect(lp->socketPath);
+    if (sock < 0)
+        throwError("t[%3d] loadClient: Could not connect to %s", cl->thID, lp->socketPath);
+    HulldBuffer b;
+    if (hulldBufferCreate(&b, lp->n))
+        throwError("t[%3d] loadClient: Could not create a buffer of %ld points", cl->thID, lp->n);
+
+    // a request consumes the points: they are copied back from the original before each request (not timed), so every
+    // request must give the same hull
+    float *X = malloc(lp->n * 2 * sizeof(float));
+    if (X == NULL)
+        throwError("t[%3d] loadClient: Failed to allocate the points", cl->thID);
+    float *Y = &X[lp->n];
+    genPoints(X, Y, 0, lp->n, lp->dist, LOAD_SEED + cl->thID, pow((double)lp->n, 0.25));
+
+    for (size_t r = 0; r < lp->nRequests; r++)
+    {
+        memcpy(b.X, X, lp->n * sizeof(float));
+        memcpy(b.Y, Y, lp->n * sizeof(float));
+
+        HulldResponse resp;
+        double start = getTime();
+        int status = hulldHull(sock, &b, lp->n, &resp);
+        cl->latencies[r] = getTime() - start;
+
+        if (status != HULLD_OK)
+        {
+            LOG(LOG_LVL_ERROR, "t[%3d] loadClient: Request %ld failed with status %d", cl->thID, r, status);
+            cl->nFailed++;
+            if (status == HULLD_ERR_IO)
+            {
+                for (; r < lp->nRequests; r++)
+                    cl->latencies[r] = DBL_MAX; // sorted last, INFINITY is not there for -ffast-math
+                break;
+            }
+        }
+        else if (r == 0)
+            cl->hullSize = resp.hullSize;
+        else if (resp.hullSize != cl->hullSize)
+        {
+            LOG(LOG_LVL_ERROR, "t[%3d] loadClient: Request %ld returned a hull of %ld vertices instead of %ld", cl->thID, r, resp.hullSize, cl->hullSize);
+            cl->nFailed++;
+        }
+    }
+
+    free(X);
+    hulldBufferDestroy(&b);
+    close(sock);
+    return NULL;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static error_t loadArgpParser(int key, char *arg, struct argp_state *state)
+{
+    LoadParams *lp = state->input;
+    char *endPtr;
+
+    switch (key)
+    {
+    case ARGP_SOCKET:
+        strncpy(lp->socketPath, arg, sizeof(lp->socketPath) - 1);
+        break;
+    case ARGP_CLIENTS:
+        lp->nClients = (int)strtol(arg, &endPtr, 10);
+        if ((*endPtr != 0) || (lp->nClients < 1))
+            throwError("clients: argument not valid");
+        break;
+    case ARGP_REQUESTS:
+        lp->nRequests = strtoull(arg, &endPtr, 10);
+        if ((*endPtr != 0) || (lp->nRequests < 1))
+            throwError("requests: argument not valid");
+        break;
+    case ARGP_NPOINTS:
+    {
+        double v = strtod(arg, &endPtr);
+        if ((*endPtr != 0) || (v < 1))
+            throwError("npoints: \"%s\" is not a valid number of points", arg);
+        lp->n = (size_t)v;
+        break;
+    }
+    case ARGP_DIST:
+    {
+        int dist = parseDistribution(arg);
+        if (dist < 0)
+            throwError("dist: argument not valid");
+        lp->dist = dist;
+        break;
+    }
+    case ARGP_LOG_LEVEL:
+        setLogLevel(atoi(arg));
+        break;
+    case ARGP_SHUTDOWN:
+        lp->shutdown = true;
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
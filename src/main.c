@@ -22,22 +22,115 @@ int main (int argc, char *argv[])
     Data d = {
         .n=0,
         .X=NULL,
-        .Y=NULL
+        .Y=NULL,
+        .I=NULL
     };
     Params p = argParse(argc, argv);
+    loadTuning(&p, 0);
+    if (p.tune)
+    {
+        runTuning(&p, 0);
+        if ((p.inputFile[0] == 0) && (p.batchFile[0] == 0) && (p.daemonSocket[0] == 0)) // nothing else to do
+            return EXIT_SUCCESS;
+    }
+    if (p.metricsFile[0] != 0)
+        metricsEnable(0, p.nThreads);
+    if (p.perfCounters)
+        perfCountersEnable(0, p.nThreads);
+    if (p.traceFile[0] != 0)
+        traceEnable(0, p.nThreads);
+
+    if (p.batchFile[0] != 0)
+    {
+        runBatch(&p, 0, 1);
+        perfCountersReport();
+        if (p.metricsFile[0] != 0)
+            metricsWrite(p.metricsFile, &p);
+        if (p.traceFile[0] != 0)
+            traceWrite(p.traceFile, &p);
+        return EXIT_SUCCESS;
+    }
+
+    if (p.groupsFile[0] != 0)
+    {
+        runGroupedHulls(&p, 0);
+        perfCountersReport();
+        if (p.metricsFile[0] != 0)
+            metricsWrite(p.metricsFile, &p);
+        if (p.traceFile[0] != 0)
+            traceWrite(p.traceFile, &p);
+        return EXIT_SUCCESS;
+    }
+
+    if (p.layers)
+    {
+        runConvexLayers(&p, 0);
+        perfCountersReport();
+        if (p.metricsFile[0] != 0)
+            metricsWrite(p.metricsFile, &p);
+        if (p.traceFile[0] != 0)
+            traceWrite(p.traceFile, &p);
+        return EXIT_SUCCESS;
+    }
+
+    if (p.daemonSocket[0] != 0)
+    {
+        runDaemon(&p, 0);
+        perfCountersReport();
+        if (p.metricsFile[0] != 0)
+            metricsWrite(p.metricsFile, &p);
+        return EXIT_SUCCESS;
+    }
 
-    readFile(&d, &p);
+    PerfValues perfStart = perfRead();
+    traceBegin(NULL, TRACE_READ);
+    size_t bytesRead;
+    if (p.q16)
+        bytesRead = readFileQ16(&d, &p, 0, 1);
+    else if (p.inputFormat == INPUT_FORMAT_TEXT)
+        bytesRead = readFileText(&d, &p, 0, 1);
+    else
+    {
+        readFile(&d, &p);
+        bytesRead = d.n * 2 * sizeof(float);
+    }
+    traceEnd(NULL, TRACE_READ, bytesRead);
+    perfAccumulate(NULL, PHASE_READ, &perfStart);
     clock_gettime(_POSIX_MONOTONIC_CLOCK, &timeStruct);
     fileReadTime = cvtTimespec2Double(timeStruct);
+    metricsSetRead(fileReadTime - startTime, bytesRead);
     LOG(LOG_LVL_DEBUG, "Check endianity of raw file content: X[0]=%f  X[1]=%f", d.X[0], d.X[1]);
     LOG(LOG_LVL_NOTICE, "File read in %lfs", fileReadTime - startTime);
 
-    Data hull = parallhullThreaded(&d, -1, 0, p.nThreads);
+    // same choice as with MPI: no prefilter for the approximate hull and --q16
+    if (p.gridCull && (p.approxEps == 0))
+        gridCullPoints(&d, p.gridCells, p.nThreads, 0, 1);
+    else if ((p.prefilterSampleSize > 0) && (p.approxEps == 0) && !p.q16)
+        sampleHullPrefilter(&d, p.prefilterSampleSize, p.nThreads);
+    clock_gettime(_POSIX_MONOTONIC_CLOCK, &timeStruct);
+    double prefilterTime = cvtTimespec2Double(timeStruct);
+
+    double approxBound = 0;
+    Data hull;
+    if (p.approxEps > 0)
+        hull = approxHull(&d, p.approxEps, p.nThreads, 0, &approxBound);
+    else
+        hull = (p.algorithm == ALGORITHM_TASKHULL) ? taskhull(&d, 0, p.nThreads) : parallhullThreaded(&d, p.subproblemSize > 0 ? p.subproblemSize : (size_t)-1, 0, p.nThreads, p.schedule);
     clock_gettime(_POSIX_MONOTONIC_CLOCK, &timeStruct);
     quickhullTime = cvtTimespec2Double(timeStruct);
 
     LOG(LOG_LVL_NOTICE, "Parallhull finished in %lfs", quickhullTime - fileReadTime);
     LOG(LOG_LVL_INFO, "Final Hull size = %ld", hull.n);
+    if (p.approxEps > 0)
+        LOG(LOG_LVL_NOTICE, "Approximate hull within %e of the exact one (eps=%e)", approxBound, p.approxEps);
+
+    metricsSetPhaseTime(PHASE_QUICKHULL, quickhullTime - prefilterTime);
+    metricsSetTotalTime(quickhullTime - startTime);
+    perfCountersReport();
+    if (p.metricsFile[0] != 0)
+        metricsWrite(p.metricsFile, &p);
+    if (p.traceFile[0] != 0)
+        traceWrite(p.traceFile, &p);
 
     #ifdef DEBUG
         // check hull for duplicates before common errors
@@ -51,9 +144,13 @@ int main (int argc, char *argv[])
         if (hullConvexityCheck(&hull, &fakeID))
             throwError("Final Hull is not convex");
         free(d.X);
-        d.n = 0; d.X = NULL; d.Y = NULL;
-        readFile(&d, &p);
-        if (finalCoverageCheck(&hull, &d, &fakeID))
+        free(d.I);
+        d.n = 0; d.X = NULL; d.Y = NULL; d.I = NULL;
+        if (p.inputFormat == INPUT_FORMAT_TEXT)
+            readFileText(&d, &p, 0, 1);
+        else
+            readFile(&d, &p);
+        if ((p.approxEps == 0) && finalCoverageCheck(&hull, &d, &fakeID)) // an approximate hull leaves points out by design
             throwError("Final Hull does not cover all points");
     #endif
 
@@ -62,10 +159,22 @@ int main (int argc, char *argv[])
             plotData(&d, &hull, 0, "Complete Hull");
     #endif
 
-    // saveHullPointsTxt(&hull, "hullPts.txt");
+    if (p.verify)
+        runVerify(&p, &hull, approxBound, 0, 1);
+
+    if ((p.outputFile[0] != 0) && (p.approxEps > 0))
+        saveApproxHullTxt(&hull, p.approxEps, approxBound, p.outputFile);
+    else if (p.outputFile[0] != 0)
+        saveHullPointsTxt(&hull, p.outputFile);
+    if (p.queryFile[0] != 0)
+        runQuery(&p, &hull, 0);
 
     free(d.X);
-    d.X = NULL; d.Y = NULL;
+    free(d.I);
+    d.X = NULL; d.Y = NULL; d.I = NULL;
+    free(hull.X);
+    free(hull.Y);
+    free(hull.I);
 
     return EXIT_SUCCESS;
 }
@@ -81,7 +190,8 @@ int main (int argc, char *argv[])
     Data d = {
         .n=0,
         .X=NULL,
-        .Y=NULL
+        .Y=NULL,
+        .I=NULL
     };
     Params p = argParse(argc, argv);
 
@@ -96,33 +206,149 @@ int main (int argc, char *argv[])
     if (MPIErrCode !=MPI_SUCCESS)
         throwError("MPI_Comm_rank failed with code %d", MPIErrCode);
 
+    // the cache holds one line per CPU model, every rank picks the one of its node
+    loadTuning(&p, rank);
+    if (p.tune)
+    {
+        if (rank == 0)
+            runTuning(&p, rank);
+        MPI_Barrier(MPI_COMM_WORLD);
+        loadTuning(&p, rank);
+        if ((p.inputFile[0] == 0) && (p.batchFile[0] == 0) && (p.daemonSocket[0] == 0)) // nothing else to do
+        {
+            MPI_Finalize();
+            return EXIT_SUCCESS;
+        }
+    }
+
     initTime = MPI_Wtime();
+    if (p.metricsFile[0] != 0)
+        metricsEnable(rank, p.nThreads);
+    if (p.perfCounters)
+        perfCountersEnable(rank, p.nThreads);
+    if (p.traceFile[0] != 0)
+        traceEnable(rank, p.nThreads);
     LOG(LOG_LVL_NOTICE, "p[%d] MPI run with: nProcs = %2d \tnThreads = %3d\n", rank, p.nProcs, p.nThreads);
     LOG(LOG_LVL_NOTICE, "p[%d] MPI init took %lfs", rank, initTime - startTime);
 
-    readFilePart(&d, &p, rank);
+    if (p.batchFile[0] != 0)
+    {
+        // the files of the manifest are split among the ranks, MPI_Init is paid once for all of them
+        runBatch(&p, rank, p.nProcs);
+        perfCountersReport();
+        if (p.metricsFile[0] != 0)
+            metricsWrite(p.metricsFile, &p);
+        if (p.traceFile[0] != 0)
+            traceWrite(p.traceFile, &p);
+        MPI_Finalize();
+        return EXIT_SUCCESS;
+    }
+
+    if (p.groupsFile[0] != 0)
+    {
+        // the groups are not split among the ranks: a group could span several file parts
+        if ((rank == 0) && (p.nProcs > 1))
+            LOG(LOG_LVL_WARN, "p[%d] --groups runs on rank 0 only, the other %d ranks stay idle", rank, p.nProcs - 1);
+        if (rank == 0)
+            runGroupedHulls(&p, rank);
+        // the idle ranks take part in the gathers of the metrics and of the trace
+        perfCountersReport();
+        if (p.metricsFile[0] != 0)
+            metricsWrite(p.metricsFile, &p);
+        if (p.traceFile[0] != 0)
+            traceWrite(p.traceFile, &p);
+        MPI_Finalize();
+        return EXIT_SUCCESS;
+    }
+
+    if (p.layers)
+    {
+        // every layer needs the points left by all the previous ones: the ranks would exchange them once per layer
+        if ((rank == 0) && (p.nProcs > 1))
+            LOG(LOG_LVL_WARN, "p[%d] --layers runs on rank 0 only, the other %d ranks stay idle", rank, p.nProcs - 1);
+        if (rank == 0)
+            runConvexLayers(&p, rank);
+        perfCountersReport();
+        if (p.metricsFile[0] != 0)
+            metricsWrite(p.metricsFile, &p);
+        if (p.traceFile[0] != 0)
+            traceWrite(p.traceFile, &p);
+        MPI_Finalize();
+        return EXIT_SUCCESS;
+    }
+
+    if (p.daemonSocket[0] != 0)
+    {
+        // the daemon is local to a node: rank 0 serves, the other ranks stay idle
+        if ((rank == 0) && (p.nProcs > 1))
+            LOG(LOG_LVL_WARN, "p[%d] --daemon runs on rank 0 only, the other %d ranks stay idle", rank, p.nProcs - 1);
+        if (rank == 0)
+            runDaemon(&p, rank);
+        MPI_Finalize();
+        return EXIT_SUCCESS;
+    }
+
+    PerfValues perfStart = perfRead();
+    traceBegin(NULL, TRACE_READ);
+    size_t bytesRead;
+    if (p.q16)
+        bytesRead = readFileQ16(&d, &p, rank, p.nProcs);
+    else if (p.inputFormat == INPUT_FORMAT_TEXT)
+        bytesRead = readFileText(&d, &p, rank, p.nProcs);
+    else
+    {
+        readFilePart(&d, &p, rank);
+        bytesRead = d.n * 2 * sizeof(float);
+    }
+    traceEnd(NULL, TRACE_READ, bytesRead);
+    perfAccumulate(NULL, PHASE_READ, &perfStart);
 
     if (rank == 0)
         LOG(LOG_LVL_DEBUG, "Check endianity of raw file content: X[0]=%f  X[1]=%f", d.X[0], d.X[1]);
 
     fileReadTime = MPI_Wtime();
     LOG(LOG_LVL_NOTICE, "p[%d] File read in %lfs", rank, fileReadTime - startTime);
-
-    Data hull = parallhullThreaded(&d, -1, rank, p.nThreads);
+    metricsSetRead(fileReadTime - initTime, bytesRead);
+
+    // the approximate hull reads every point once anyway, the prefilter would only add a pass. With --q16 the points left are
+    // already outside a seed hull built from far more points than the sample
+    if (p.gridCull && (p.approxEps == 0))
+        gridCullPoints(&d, p.gridCells, p.nThreads, rank, p.nProcs);
+    else if ((p.prefilterSampleSize > 0) && (p.approxEps == 0) && !p.q16)
+        mpiSampleHullPrefilter(&d, p.prefilterSampleSize, rank, p.nProcs, p.nThreads);
+    double prefilterTime = MPI_Wtime();
+
+    double approxBound = 0;
+    Data hull;
+    if (p.approxEps > 0)
+        hull = approxHull(&d, p.approxEps, p.nThreads, rank, &approxBound);
+    else
+        hull = (p.algorithm == ALGORITHM_TASKHULL) ? taskhull(&d, rank, p.nThreads) : parallhullThreaded(&d, p.subproblemSize > 0 ? p.subproblemSize : (size_t)-1, rank, p.nThreads, p.schedule);
 
     localHullTime = MPI_Wtime();
     LOG(LOG_LVL_NOTICE, "p[%d] Local quickhull finished in %lfs", rank, localHullTime - fileReadTime);
+    metricsSetPhaseTime(PHASE_QUICKHULL, localHullTime - prefilterTime);
     
     mpiHullMerge(&hull, rank, p.nProcs);
 
     mergeTime = MPI_Wtime();
     LOG(LOG_LVL_NOTICE, "p[%d] Hull merge finished in %lfs", rank, mergeTime - localHullTime);
+    metricsSetPhaseTime(PHASE_MERGE_MPI, mergeTime - localHullTime);
+    metricsSetTotalTime(mergeTime - initTime);
+    perfCountersReport();
+    if (p.metricsFile[0] != 0)
+        metricsWrite(p.metricsFile, &p);
+    if (p.traceFile[0] != 0)
+        traceWrite(p.traceFile, &p);
 
     #ifdef DEBUG
-        if (rank == 0)
+        if ((rank == 0) && (p.approxEps == 0)) // an approximate hull leaves points out by design
         {
             Data fullData;
-            readFile(&fullData, &p);
+            if (p.inputFormat == INPUT_FORMAT_TEXT)
+                readFileText(&fullData, &p, 0, 1);
+            else
+                readFile(&fullData, &p);
 
             ProcThreadIDCombo id = { .p=0, .t=0 };
 
@@ -131,6 +357,7 @@ int main (int argc, char *argv[])
             LOG(LOG_LVL_NOTICE, "Final checks ok!");
 
             free(fullData.X);
+            free(fullData.I);
         }
     #endif
 
@@ -139,16 +366,31 @@ int main (int argc, char *argv[])
             plotData(&d, &hull, 0, "Complete Hull");
     #endif
 
+    // every rank checks the final hull against its own points
+    if (p.verify)
+        runVerify(&p, &hull, approxBound, rank, p.nProcs);
+
     if (rank == 0)
     {
         LOG(LOG_LVL_NOTICE, "Total time taken: %lfs", mergeTime - startTime);
         LOG(LOG_LVL_NOTICE, "Total time taken(without init): %lfs", mergeTime - initTime);
         LOG(LOG_LVL_NOTICE, "Computation time taken: %lfs", mergeTime - fileReadTime);
+        if (p.approxEps > 0)
+            LOG(LOG_LVL_NOTICE, "Approximate hull of %ld vertices within %e of the exact one (eps=%e)", hull.n, approxBound, p.approxEps);
+        if ((p.outputFile[0] != 0) && (p.approxEps > 0))
+            saveApproxHullTxt(&hull, p.approxEps, approxBound, p.outputFile);
+        else if (p.outputFile[0] != 0)
+            saveHullPointsTxt(&hull, p.outputFile);
+        // the merged hull is on rank 0 only, the queries are classified there with its threads
+        if (p.queryFile[0] != 0)
+            runQuery(&p, &hull, rank);
     }
 
     free(d.X);
+    free(d.I);
     free(hull.X);
     free(hull.Y);
+    free(hull.I);
 
     MPI_Finalize();
     return EXIT_SUCCESS;
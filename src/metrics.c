@@ -0,0 +1,291 @@
+#include "parallhull.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#ifndef NON_MPI_MODE
+    #include <mpi.h>
+#endif
+
+#define METRICS_INITIAL_CAPACITY 64
+
+typedef struct
+{
+    size_t n;
+    size_t hullSize;
+    double time;
+    size_t iterationsCount;
+    size_t iterationsCapacity;
+    size_t *uncovered; // points still uncovered at each iteration
+    size_t *hullSizes; // hull size at each iteration (before adding the farthest points)
+} QuickhullMetrics;
+
+typedef struct
+{
+    enum Phase phase;
+    int partner;
+    size_t n1, n2, n0;
+    double time;
+    double waitTime;
+} MergeMetrics;
+
+typedef struct
+{
+    QuickhullMetrics *quickhulls;
+    size_t quickhullsCount;
+    size_t quickhullsCapacity;
+    MergeMetrics *merges;
+    size_t mergesCount;
+    size_t mergesCapacity;
+    double waitTime;
+} ThreadMetrics;
+
+typedef struct
+{
+    bool enabled;
+    int rank;
+    int nThreads;
+    size_t readBytes;
+    double phaseTimes[PHASE_COUNT];
+    size_t prefilterRemoved;
+    double totalTime;
+    ThreadMetrics threads[MAX_THREADS];
+    ThreadMetrics procMerges; // MPI merges are done by the process, not by one of the threads
+} ProcMetrics;
+
+const char *phaseNames[] = { "read", "prefilter", "quickhull", "mergeP1.2", "mergeP2", "mergeMPI" };
+
+static ProcMetrics metrics = { .enabled=false };
+
+static void *growArray(void *arr, size_t *capacity, size_t count, size_t elemSize);
+static ThreadMetrics *getThreadMetrics(ProcThreadIDCombo *id);
+static void writeSizeArray(FILE *f, size_t *arr, size_t count);
+static void writeString(FILE *f, const char *str);
+static void writeMerges(FILE *f, ThreadMetrics *tm);
+static char *serializeProc();
+
+void metricsEnable(int rank, int nThreads)
+{
+    metrics.enabled = true;
+    metrics.rank = rank;
+    metrics.nThreads = nThreads;
+}
+
+bool metricsEnabled()
+{
+    return metrics.enabled;
+}
+
+void metricsSetRead(double time, size_t bytes)
+{
+    if (!metrics.enabled) return;
+    metrics.phaseTimes[PHASE_READ] = time;
+    metrics.readBytes = bytes;
+}
+
+void metricsSetPhaseTime(enum Phase phase, double time)
+{
+    if (!metrics.enabled) return;
+    metrics.phaseTimes[phase] = time;
+}
+
+void metricsSetPrefilterRemoved(size_t removed)
+{
+    if (!metrics.enabled) return;
+    metrics.prefilterRemoved = removed;
+}
+
+void metricsSetTotalTime(double time)
+{
+    if (!metrics.enabled) return;
+    metrics.totalTime = time;
+}
+
+void metricsQuickhullBegin(ProcThreadIDCombo *id, size_t n)
+{
+    if (!metrics.enabled) return;
+    ThreadMetrics *tm = getThreadMetrics(id);
+
+    tm->quickhulls = growArray(tm->quickhulls, &tm->quickhullsCapacity, tm->quickhullsCount, sizeof(QuickhullMetrics));
+    QuickhullMetrics *qm = &tm->quickhulls[tm->quickhullsCount++];
+    memset(qm, 0, sizeof(QuickhullMetrics));
+    qm->n = n;
+}
+
+void metricsQuickhullIteration(ProcThreadIDCombo *id, size_t uncovered, size_t hullSize)
+{
+    if (!metrics.enabled) return;
+    QuickhullMetrics *qm = &getThreadMetrics(id)->quickhulls[getThreadMetrics(id)->quickhullsCount - 1];
+
+    size_t capacity = qm->iterationsCapacity;
+    qm->uncovered = growArray(qm->uncovered, &capacity, qm->iterationsCount, sizeof(size_t));
+    qm->hullSizes = growArray(qm->hullSizes, &qm->iterationsCapacity, qm->iterationsCount, sizeof(size_t));
+    qm->uncovered[qm->iterationsCount] = uncovered;
+    qm->hullSizes[qm->iterationsCount] = hullSize;
+    qm->iterationsCount++;
+}
+
+void metricsQuickhullEnd(ProcThreadIDCombo *id, size_t hullSize, double time)
+{
+    if (!metrics.enabled) return;
+    QuickhullMetrics *qm = &getThreadMetrics(id)->quickhulls[getThreadMetrics(id)->quickhullsCount - 1];
+    qm->hullSize = hullSize;
+    qm->time = time;
+}
+
+void metricsMerge(ProcThreadIDCombo *id, enum Phase phase, int partner, size_t n1, size_t n2, size_t n0, double time, double waitTime)
+{
+    if (!metrics.enabled) return;
+    ThreadMetrics *tm = phase == PHASE_MERGE_MPI ? &metrics.procMerges : getThreadMetrics(id);
+
+    tm->merges = growArray(tm->merges, &tm->mergesCapacity, tm->mergesCount, sizeof(MergeMetrics));
+    tm->merges[tm->mergesCount++] = (MergeMetrics){ .phase=phase, .partner=partner, .n1=n1, .n2=n2, .n0=n0, .time=time, .waitTime=waitTime };
+    tm->waitTime += waitTime;
+}
+
+// Every rank serializes its own metrics, rank 0 collects them and writes the whole document
+void metricsWrite(const char *fname, Params *p)
+{
+    if (!metrics.enabled) return;
+
+    char *local = serializeProc();
+
+    #ifdef NON_MPI_MODE
+        char *all = local;
+    #else
+        char *all = gatherText(local, metrics.rank, p->nProcs, ",\n");
+        free(local);
+        if (metrics.rank != 0)
+            return;
+    #endif
+
+    FILE *f = fopen(fname, "w");
+    if (f == NULL)
+    {
+        LOG(LOG_LVL_ERROR, "metricsWrite: Could not open %s", fname);
+        free(all);
+        return;
+    }
+    fprintf(f, "{\n\"inputFile\": ");
+    writeString(f, p->inputFile);
+    fprintf(f, ",\n\"nProcs\": %d,\n\"nThreads\": %d,\n\"ranks\": [\n%s\n]\n}\n", p->nProcs < 1 ? 1 : p->nProcs, p->nThreads, all);
+    fclose(f);
+    free(all);
+
+    LOG(LOG_LVL_INFO, "Metrics written to %s", fname);
+}
+
+static char *serializeProc()
+{
+    char *buf = NULL;
+    size_t bufLen = 0;
+    FILE *f = open_memstream(&buf, &bufLen);
+    if (f == NULL)
+        throwError("p[%2d] metrics: open_memstream failed", metrics.rank);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // thread merges are timed by each thread, at rank level report the time summed over the threads
+    metrics.phaseTimes[PHASE_MERGE_P12] = metrics.phaseTimes[PHASE_MERGE_P2] = 0;
+    for (int t = 0; t < metrics.nThreads; t++)
+        for (size_t m = 0; m < metrics.threads[t].mergesCount; m++)
+            metrics.phaseTimes[metrics.threads[t].merges[m].phase] += metrics.threads[t].merges[m].time;
+
+    fprintf(f, "{\"rank\": %d, \"readBytes\": %ld, \"prefilterRemoved\": %ld, \"totalTime\": %.9e, \"peakRSSKB\": %ld,\n \"phaseTimes\": {", metrics.rank, metrics.readBytes, metrics.prefilterRemoved, metrics.totalTime, usage.ru_maxrss);
+    for (int i = 0; i < PHASE_COUNT; i++)
+        fprintf(f, "%s\"%s\": %.9e", i == 0 ? "" : ", ", phaseNames[i], metrics.phaseTimes[i]);
+    fprintf(f, "},\n");
+    if (perfCountersEnabled())
+    {
+        fprintf(f, " \"perfCounters\": ");
+        perfCountersWriteJSON(f, -1);
+        fprintf(f, ",\n");
+    }
+    fprintf(f, " \"mpiWaitTime\": %.9e, \"mpiMerges\": ", metrics.procMerges.waitTime);
+    writeMerges(f, &metrics.procMerges);
+    fprintf(f, ",\n \"threads\": [");
+
+    for (int t = 0; t < metrics.nThreads; t++)
+    {
+        ThreadMetrics *tm = &metrics.threads[t];
+        fprintf(f, "%s\n  {\"thread\": %d, \"waitTime\": %.9e, \"quickhulls\": [", t == 0 ? "" : ",", t, tm->waitTime);
+        for (size_t q = 0; q < tm->quickhullsCount; q++)
+        {
+            QuickhullMetrics *qm = &tm->quickhulls[q];
+            fprintf(f, "%s\n   {\"n\": %ld, \"hullSize\": %ld, \"time\": %.9e, \"iterations\": %ld, \"uncovered\": ", q == 0 ? "" : ",", qm->n, qm->hullSize, qm->time, qm->iterationsCount);
+            writeSizeArray(f, qm->uncovered, qm->iterationsCount);
+            fprintf(f, ", \"hullSizes\": ");
+            writeSizeArray(f, qm->hullSizes, qm->iterationsCount);
+            fprintf(f, "}");
+        }
+        fprintf(f, "],\n   \"merges\": ");
+        writeMerges(f, tm);
+        if (perfCountersEnabled())
+        {
+            fprintf(f, ",\n   \"perfCounters\": ");
+            perfCountersWriteJSON(f, t);
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n ]}");
+    fclose(f);
+
+    return buf;
+}
+
+static void writeMerges(FILE *f, ThreadMetrics *tm)
+{
+    fprintf(f, "[");
+    for (size_t m = 0; m < tm->mergesCount; m++)
+    {
+        MergeMetrics *mm = &tm->merges[m];
+        fprintf(f, "%s{\"phase\": \"%s\", \"partner\": %d, \"n1\": %ld, \"n2\": %ld, \"n0\": %ld, \"time\": %.9e, \"waitTime\": %.9e}",
+                m == 0 ? "" : ", ", phaseNames[mm->phase], mm->partner, mm->n1, mm->n2, mm->n0, mm->time, mm->waitTime);
+    }
+    fprintf(f, "]");
+}
+
+static void writeSizeArray(FILE *f, size_t *arr, size_t count)
+{
+    fprintf(f, "[");
+    for (size_t i = 0; i < count; i++)
+        fprintf(f, "%s%ld", i == 0 ? "" : ", ", arr[i]);
+    fprintf(f, "]");
+}
+
+// JSON string of str: the file names come from the command line, so quotes, backslashes and control characters are escaped
+static void writeString(FILE *f, const char *str)
+{
+    fprintf(f, "\"");
+    for (const unsigned char *c = (const unsigned char*)str; *c != 0; c++)
+    {
+        if ((*c == '"') || (*c == '\\'))
+            fprintf(f, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(f, "\\u%04x", *c);
+        else
+            fputc(*c, f);
+    }
+    fprintf(f, "\"");
+}
+
+static ThreadMetrics *getThreadMetrics(ProcThreadIDCombo *id)
+{
+    if ((id->t < 0) || (id->t >= MAX_THREADS))
+        throwError("p[%2d] t[%3d] metrics: thread id out of range", id->p, id->t);
+    return &metrics.threads[id->t];
+}
+
+// make sure there is room for one more element
+static void *growArray(void *arr, size_t *capacity, size_t count, size_t elemSize)
+{
+    if (count < *capacity)
+        return arr;
+
+    *capacity = *capacity == 0 ? METRICS_INITIAL_CAPACITY : *capacity * 2;
+    arr = realloc(arr, *capacity * elemSize);
+    if (arr == NULL)
+        throwError("metrics: Failed to allocate memory");
+    return arr;
+}
@@ -1,6 +1,7 @@
 #include "parallhull.h"
 
 #include <math.h>
+#include <string.h>
 #include <pthread.h>
 
 #ifdef NON_MPI_MODE
@@ -13,12 +14,12 @@
     #include <stdio.h>
 #endif
 
-#define MAX_THREADS 256
+#define PARALLHULL_CHUNK_POINTS (1 << 15) // points of a chunk of --schedule dynamic: 256KB of coordinates, about the size of L2
 
-typedef enum {
-    NPO_CONTINUE,
-    NPO_SWAP
-} NextPtOp;
+typedef struct {
+    float x, y;
+    PointIndex i;
+} MergeVertex;
 
 
 typedef struct {
@@ -29,16 +30,23 @@ typedef struct {
     ProcThreadIDCombo id;
     int *finishRecord;
     size_t *dataSize;
+    enum Schedule schedule;
+    size_t *nextChunk; // --schedule dynamic: first chunk not claimed yet
+    size_t chunkSize;
+    size_t nChunks;
 } ThreadData;
 
 static void *parallhullThread(void *arg);
-static Data mergeHulls(Data *h1, Data *h2, ProcThreadIDCombo *id);
-static inline NextPtOp findNextMergePoint(Data *mergedH, Data *mainH, Data *altH, size_t *mainHIndex, size_t *altHIndex, ProcThreadIDCombo *id);
+static void sliceHull(ThreadData *thData);
+static void chunksHull(ThreadData *thData);
+static inline bool lexLess(const MergeVertex *a, const MergeVertex *b);
+static void sortedVertices(Data *h, MergeVertex *dst, MergeVertex *buf, bool withIndices);
+static int cmpMergeVertices(const void *a, const void *b);
 #ifdef DEBUG
     static inline bool mergeHullCoverageCheck(Data *h0, Data *h1, Data *h2, ProcThreadIDCombo *id);
 #endif
 
-Data parallhullThreaded(Data *d, size_t reducedProblemUB, int procID, int nThreads)
+Data parallhullThreaded(Data *d, size_t reducedProblemUB, int procID, int nThreads, enum Schedule schedule)
 {
     #ifdef NON_MPI_MODE
         struct timespec timeStruct;
@@ -52,13 +60,25 @@ Data parallhullThreaded(Data *d, size_t reducedProblemUB, int procID, int nThrea
     for (int i = 0; i < MAX_THREADS; i++)
         finishRecord[i] = 0;
 
-    // decide how many elements each thread gets(at the beginning)
+    // dynamic: chunks of at most PARALLHULL_CHUNK_POINTS, at least one per thread so that every thread has a hull to merge in P2
+    size_t chunkSize = (d->n + nThreads - 1) / nThreads;
+    if (chunkSize > PARALLHULL_CHUNK_POINTS)
+        chunkSize = PARALLHULL_CHUNK_POINTS;
+    if (chunkSize == 0)
+        chunkSize = 1;
+    size_t nChunks = (d->n + chunkSize - 1) / chunkSize;
+    if ((schedule == SCHEDULE_DYNAMIC) && (nChunks < (size_t)nThreads))
+        nThreads = nChunks > 0 ? (int)nChunks : 1;
+    size_t nextChunk = nThreads; // chunk i is the first one of thread i
+
+    // static: every thread needs a point at least, quickhull does not take empty slices
+    if ((schedule == SCHEDULE_STATIC) && (d->n < (size_t)nThreads))
+        nThreads = d->n > 0 ? (int)d->n : 1;
+
+    // decide how many elements each thread gets(at the beginning), the slices differ by one point at most
     size_t dataSize[MAX_THREADS];
-    double n = d->n;
-    n = ceil(n/nThreads);
-    for (int i = 0; i < nThreads-1; i++)
-        dataSize[i] = (size_t)n;
-    dataSize[nThreads-1] = d->n - ((size_t)n * (nThreads-1)); // last thread might have less elements due to non-divisibility of d->n with nThreads
+    for (int i = 0; i < nThreads; i++)
+        dataSize[i] = d->n * (i+1) / nThreads - d->n * i / nThreads;
     
     pthread_t threads[MAX_THREADS];
     ThreadData ds[MAX_THREADS];
@@ -73,6 +93,10 @@ Data parallhullThreaded(Data *d, size_t reducedProblemUB, int procID, int nThrea
         ds[i].id.t = i;
         ds[i].finishRecord = finishRecord;
         ds[i].dataSize = dataSize;
+        ds[i].schedule = schedule;
+        ds[i].nextChunk = &nextChunk;
+        ds[i].chunkSize = chunkSize;
+        ds[i].nChunks = nChunks;
         pthread_create(&threads[i], NULL, parallhullThread, (void*)&ds[i]);
     }
 
@@ -82,6 +106,7 @@ Data parallhullThreaded(Data *d, size_t reducedProblemUB, int procID, int nThrea
         pthread_join(threads[i], NULL);
         free(hulls[i].X);
         free(hulls[i].Y);
+        free(hulls[i].I);
     }
 
     #ifdef DEBUG
@@ -103,6 +128,75 @@ Data parallhullThreaded(Data *d, size_t reducedProblemUB, int procID, int nThrea
 static void *parallhullThread(void *arg)
 {
     ThreadData *thData = (ThreadData*)arg;
+    int thID = thData->id.t;
+    perfThreadOpen();
+
+    // P1: each thread works on its own data in the first part here
+    if (thData->schedule == SCHEDULE_DYNAMIC)
+        chunksHull(thData);
+    else
+        sliceHull(thData);
+
+    LOG(LOG_LVL_INFO, "p[%2d] t[%3d] parallhullThread: Thread subproblem solved", thData->id.p, thID);
+
+    thData->finishRecord[thID] = 1;
+
+    // P2: thread merge their results with each other in a ordered manner
+    int s = 0;
+    int thID2merge = thID + 1;
+    while ((((thID>>s) & 1) == 0) && (thID2merge < thData->nThreads))
+    {
+        double waitStartTime = getTime();
+        traceBegin(&thData->id, TRACE_SPIN_WAIT);
+        while (thData->finishRecord[thID2merge] < s+1) // spinlock (the assumption here is that threads should take more or less the same amount of time to merge, and this kinds of keeps the cpu "warm")
+            __builtin_ia32_pause();
+        traceEnd(&thData->id, TRACE_SPIN_WAIT, thID2merge);
+        
+        double mergeStartTime = getTime();
+        PerfValues perfStart = perfRead(); // the spin-wait is left out, it would only inflate cycles and instructions
+        traceBegin(&thData->id, TRACE_MERGE_P2);
+        Data h = mergeHulls(&thData->hulls[thID], &thData->hulls[thID2merge], &thData->id);
+        traceEnd(&thData->id, TRACE_MERGE_P2, h.n);
+        perfAccumulate(&thData->id, PHASE_MERGE_P2, &perfStart);
+        metricsMerge(&thData->id, PHASE_MERGE_P2, thID2merge, thData->hulls[thID].n, thData->hulls[thID2merge].n, h.n, getTime() - mergeStartTime, mergeStartTime - waitStartTime);
+
+        LOG(LOG_LVL_INFO, "p[%2d] t[%3d] parallhullThread: Merging hull with hull in thread %d. s=%d", thData->id.p, thID, thID2merge, s);
+
+        #ifdef DEBUG
+            if (hullConvexityCheck(&h, &thData->id))
+            {
+                plotHullMergeStep(&thData->hulls[thID], &thData->hulls[thID2merge], &h, 0, 0, "Plot of the error", false);
+                throwError("p[%2d] t[%3d] parallhullThread: Merged hull is not convex", thData->id.p, thID);
+            }
+            if (mergeHullCoverageCheck(&h, &thData->hulls[thID], &thData->hulls[thID2merge], &thData->id))
+            {
+                plotHullMergeStep(&thData->hulls[thID], &thData->hulls[thID2merge], &h, 0, 0, "Plot of the error", false);
+                throwError("p[%2d] t[%3d] parallhullThread: Merged Hull does not cover all the points in the hull", thData->id.p, thID);
+            }
+        #endif
+
+        // each thread manages to free its own memory
+        free(thData->hulls[thID].X);
+        free(thData->hulls[thID].Y);
+        free(thData->hulls[thID].I);
+        
+        thData->hulls[thID] = h;
+
+        s++;
+        thID2merge = thID + (1<<s);
+
+        thData->finishRecord[thID] = s+1;
+    }
+
+    thData->finishRecord[thID] = 0x7FFFFFFF; // cannot stall spinlock anymore
+    perfThreadClose();
+    
+    return NULL;
+}
+
+// P1 of --schedule static: the slice of the thread, split in parts of at most reducedProblemUB points
+static void sliceHull(ThreadData *thData)
+{
     int thID = thData->id.t;
     Data rd = { .n=thData->dataSize[thID] };
     {
@@ -112,34 +206,38 @@ static void *parallhullThread(void *arg)
             startElem += thData->dataSize[i];
         rd.X = &fd.X[startElem];
         rd.Y = &fd.Y[startElem];
+        rd.I = fd.I == NULL ? NULL : &fd.I[startElem];
     }
 
-    // P1: each thread works on its own data in the first part here
     if (rd.n > thData->reducedProblemUB)
     {
         size_t nParts = (size_t)ceil((double)rd.n / thData->reducedProblemUB);
         Data *hulls = malloc(nParts * sizeof(Data));
         if (hulls == NULL)
-            throwError("p[%2d] t[%3d] parallhullThread: Could not allocate %ld elements of 8 bytes in memory on thread %d", thData->id.p, thID, nParts * sizeof(Data), thID);
+            throwError("p[%2d] t[%3d] sliceHull: Could not allocate %ld elements of 8 bytes in memory on thread %d", thData->id.p, thID, nParts * sizeof(Data), thID);
 
         size_t avgPartSize = (size_t)(ceil((double)rd.n / nParts));
 
         // P1.1: sequentially compute quickhull on each partition generated using the specified upper bound on the size of the rrd(Reduced Reduced problem Data)
         for (size_t i = 0; i < nParts; i++)
         {
-            LOG(LOG_LVL_TRACE, "p[%2d] t[%3d] parallhullThread: Solving reduced problem %ld", thData->id.p, thID, i);
+            LOG(LOG_LVL_TRACE, "p[%2d] t[%3d] sliceHull: Solving reduced problem %ld", thData->id.p, thID, i);
 
             size_t startPos = avgPartSize * i;
 
-            Data pts = { .X=&rd.X[startPos], .Y=&rd.Y[startPos], .n=avgPartSize };
+            Data pts = { .X=&rd.X[startPos], .Y=&rd.Y[startPos], .I=rd.I == NULL ? NULL : &rd.I[startPos], .n=avgPartSize };
 
             if (i == nParts-1)
                 pts.n = rd.n - avgPartSize * (nParts-1);
 
+            PerfValues perfStart = perfRead();
+            traceBegin(&thData->id, TRACE_QUICKHULL);
             hulls[i] = quickhull(&pts, &thData->id);
+            traceEnd(&thData->id, TRACE_QUICKHULL, hulls[i].n);
+            perfAccumulate(&thData->id, PHASE_QUICKHULL, &perfStart);
         }
 
-        LOG(LOG_LVL_INFO, "p[%2d] t[%3d] parallhullThread: Quickhull on subproblem/s done, now merging", thData->id.p, thID);
+        LOG(LOG_LVL_INFO, "p[%2d] t[%3d] sliceHull: Quickhull on subproblem/s done, now merging", thData->id.p, thID);
 
         // P1.2: sequentially merge the convex hulls generated in every rrd
         while (nParts > 1)
@@ -147,26 +245,34 @@ static void *parallhullThread(void *arg)
             size_t halfNParts = nParts / 2;
             for (size_t i = 0; i < halfNParts; i++)
             {
-                LOG(LOG_LVL_TRACE, "p[%2d] t[%3d] parallhullThread: Merging thread internal hulls %ld(size=%ld) and %ld(size=%ld)", thData->id.p, thID, i, hulls[i].n, i + halfNParts, hulls[i+halfNParts].n);
+                LOG(LOG_LVL_TRACE, "p[%2d] t[%3d] sliceHull: Merging thread internal hulls %ld(size=%ld) and %ld(size=%ld)", thData->id.p, thID, i, hulls[i].n, i + halfNParts, hulls[i+halfNParts].n);
+                double mergeStartTime = getTime();
+                PerfValues perfStart = perfRead();
+                traceBegin(&thData->id, TRACE_MERGE_P12);
                 Data h = mergeHulls(&hulls[i], &hulls[i+halfNParts], &thData->id);
+                traceEnd(&thData->id, TRACE_MERGE_P12, h.n);
+                perfAccumulate(&thData->id, PHASE_MERGE_P12, &perfStart);
+                metricsMerge(&thData->id, PHASE_MERGE_P12, (int)(i + halfNParts), hulls[i].n, hulls[i+halfNParts].n, h.n, getTime() - mergeStartTime, 0);
 
                 #ifdef DEBUG
                     if (hullConvexityCheck(&h, &thData->id))
                     {
                         plotHullMergeStep(&hulls[i], &hulls[i+halfNParts], &h, 0, 0, "Plot of the error", false);
-                        throwError("p[%2d] t[%3d] parallhullThread: Merged hull is not convex", thData->id.p, thID);
+                        throwError("p[%2d] t[%3d] sliceHull: Merged hull is not convex", thData->id.p, thID);
                     }
                     if (mergeHullCoverageCheck(&h, &hulls[i], &hulls[i+halfNParts], &thData->id))
                     {
                         plotHullMergeStep(&hulls[i], &hulls[i+halfNParts], &h, 0, 0, "Plot of the error", false);
-                        throwError("p[%2d] t[%3d] parallhullThread: Merged Hull does not cover all the points in the hull", thData->id.p, thID);
+                        throwError("p[%2d] t[%3d] sliceHull: Merged Hull does not cover all the points in the hull", thData->id.p, thID);
                     }
                 #endif
 
                 free(hulls[i].X);
                 free(hulls[i].Y);
+                free(hulls[i].I);
                 free(hulls[i+halfNParts].X);
                 free(hulls[i+halfNParts].Y);
+                free(hulls[i+halfNParts].I);
                 
                 hulls[i] = h;
             }
@@ -183,54 +289,70 @@ static void *parallhullThread(void *arg)
         free(hulls);
     }
     else
+    {
+        PerfValues perfStart = perfRead();
+        traceBegin(&thData->id, TRACE_QUICKHULL);
         thData->hulls[thID] = quickhull(&rd, &thData->id);
+        traceEnd(&thData->id, TRACE_QUICKHULL, thData->hulls[thID].n);
+        perfAccumulate(&thData->id, PHASE_QUICKHULL, &perfStart);
+    }
+}
 
-    LOG(LOG_LVL_INFO, "p[%2d] t[%3d] parallhullThread: Thread subproblem solved", thData->id.p, thID);
-
-    thData->finishRecord[thID] = 1;
-
-    // P2: thread merge their results with each other in a ordered manner
-    int s = 0;
-    int thID2merge = thID + 1;
-    while ((((thID>>s) & 1) == 0) && (thID2merge < thData->nThreads))
+// P1 of --schedule dynamic: thread t starts from chunk t, then claims the first chunk not claimed yet until none is left, folding
+// the hull of every chunk into its own hull. Threads that get clustered or already hulled looking chunks just claim more of them
+static void chunksHull(ThreadData *thData)
+{
+    int thID = thData->id.t;
+    Data fd = thData->fullData;
+    Data hull = { .n=0, .X=NULL, .Y=NULL, .I=NULL };
+    size_t nClaimed = 0;
+    for (size_t c = thID; c < thData->nChunks; c = __atomic_fetch_add(thData->nextChunk, 1, __ATOMIC_RELAXED))
     {
-        while (thData->finishRecord[thID2merge] < s+1) // spinlock (the assumption here is that threads should take more or less the same amount of time to merge, and this kinds of keeps the cpu "warm")
-            __builtin_ia32_pause();
-        
-        Data h = mergeHulls(&thData->hulls[thID], &thData->hulls[thID2merge], &thData->id);
+        size_t first = c * thData->chunkSize;
+        Data pts = { .X=&fd.X[first], .Y=&fd.Y[first], .I=fd.I == NULL ? NULL : &fd.I[first], .n=thData->chunkSize };
+        if (first + pts.n > fd.n)
+            pts.n = fd.n - first;
+
+        PerfValues perfStart = perfRead();
+        traceBegin(&thData->id, TRACE_QUICKHULL);
+        Data h = quickhull(&pts, &thData->id);
+        traceEnd(&thData->id, TRACE_QUICKHULL, h.n);
+        perfAccumulate(&thData->id, PHASE_QUICKHULL, &perfStart);
+        if (nClaimed++ == 0)
+        {
+            hull = h;
+            continue;
+        }
 
-        LOG(LOG_LVL_INFO, "p[%2d] t[%3d] parallhullThread: Merging hull with hull in thread %d. s=%d", thData->id.p, thID, thID2merge, s);
+        double mergeStartTime = getTime();
+        perfStart = perfRead();
+        traceBegin(&thData->id, TRACE_MERGE_P12);
+        Data merged = mergeHulls(&hull, &h, &thData->id);
+        traceEnd(&thData->id, TRACE_MERGE_P12, merged.n);
+        perfAccumulate(&thData->id, PHASE_MERGE_P12, &perfStart);
+        metricsMerge(&thData->id, PHASE_MERGE_P12, (int)c, hull.n, h.n, merged.n, getTime() - mergeStartTime, 0);
 
         #ifdef DEBUG
-            if (hullConvexityCheck(&h, &thData->id))
-            {
-                plotHullMergeStep(&thData->hulls[thID], &thData->hulls[thID2merge], &h, 0, 0, "Plot of the error", false);
-                throwError("p[%2d] t[%3d] parallhullThread: Merged hull is not convex", thData->id.p, thID);
-            }
-            if (mergeHullCoverageCheck(&h, &thData->hulls[thID], &thData->hulls[thID2merge], &thData->id))
-            {
-                plotHullMergeStep(&thData->hulls[thID], &thData->hulls[thID2merge], &h, 0, 0, "Plot of the error", false);
-                throwError("p[%2d] t[%3d] parallhullThread: Merged Hull does not cover all the points in the hull", thData->id.p, thID);
-            }
+            if (hullConvexityCheck(&merged, &thData->id))
+                throwError("p[%2d] t[%3d] chunksHull: Merged hull is not convex", thData->id.p, thID);
+            if (mergeHullCoverageCheck(&merged, &hull, &h, &thData->id))
+                throwError("p[%2d] t[%3d] chunksHull: Merged Hull does not cover all the points in the hull", thData->id.p, thID);
         #endif
 
-        // each thread manages to free its own memory
-        free(thData->hulls[thID].X);
-        free(thData->hulls[thID].Y);
-        
-        thData->hulls[thID] = h;
-
-        s++;
-        thID2merge = thID + (1<<s);
-
-        thData->finishRecord[thID] = s+1;
+        free(hull.X);
+        free(hull.Y);
+        free(hull.I);
+        free(h.X);
+        free(h.Y);
+        free(h.I);
+        hull = merged;
     }
+    LOG(LOG_LVL_INFO, "p[%2d] t[%3d] chunksHull: Hulled %ld chunks of %ld points", thData->id.p, thID, nClaimed, thData->chunkSize);
 
-    thData->finishRecord[thID] = 0x7FFFFFFF; // cannot stall spinlock anymore
-    
-    return NULL;
+    thData->hulls[thID] = hull;
 }
 
+
 #ifndef NON_MPI_MODE
 void mpiHullMerge(Data *h1, int rank, int nProcs)
 {
@@ -242,6 +364,8 @@ void mpiHullMerge(Data *h1, int rank, int nProcs)
     while ((((modRank>>s) & 1) == 0) && (rank2receive < nProcs))
     {
         Data h2;
+        double waitStartTime = MPI_Wtime();
+        traceBegin(NULL, TRACE_MPI_RECV);
         { // receive
             LOG(LOG_LVL_DEBUG, "p[%2d] mpiHullMerge: receiving data from rank %d", rank, rank2receive);
 
@@ -265,10 +389,32 @@ void mpiHullMerge(Data *h1, int rank, int nProcs)
                 throwError("p[%2d] mpiHullMerge: Got error %d on receiving the partial hull Xs from p[%d]", rank, MPIErrCode, rank2receive);
             h2.Y[h2.n] = h2.Y[0];
             h2.Y[h2.n+1] = h2.Y[1];
+
+            // every rank tracks indices or none does
+            h2.I = NULL;
+            if (h1->I != NULL)
+            {
+                h2.I = malloc((h2.n + 1) * sizeof(PointIndex) + MALLOC_PADDING);
+                if (h2.I == NULL)
+                    throwError("p[%2d] mpiHullMerge: Failed to allocate memory for the indices of the hull to be received", rank);
+
+                MPIErrCode = MPI_Recv(h2.I, h2.n, MPI_POINT_INDEX, rank2receive, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                if (MPIErrCode)
+                    throwError("p[%2d] mpiHullMerge: Got error %d on receiving the partial hull indices from p[%d]", rank, MPIErrCode, rank2receive);
+                h2.I[h2.n] = h2.I[0];
+                h2.I[h2.n+1] = h2.I[1];
+            }
         }
+        traceEnd(NULL, TRACE_MPI_RECV, rank2receive);
         
         ProcThreadIDCombo id = {.p=rank, .t=0};
+        double mergeStartTime = MPI_Wtime();
+        PerfValues perfStart = perfRead();
+        traceBegin(NULL, TRACE_MERGE_MPI);
         Data h0 = mergeHulls(h1, &h2, &id);
+        traceEnd(NULL, TRACE_MERGE_MPI, h0.n);
+        perfAccumulate(NULL, PHASE_MERGE_MPI, &perfStart);
+        metricsMerge(&id, PHASE_MERGE_MPI, rank2receive, h1->n, h2.n, h0.n, MPI_Wtime() - mergeStartTime, mergeStartTime - waitStartTime);
 
         LOG(LOG_LVL_INFO, "p[%2d] mpiHullMerge: Merging hull with hull in proc %d", rank, rank2receive);
 
@@ -288,8 +434,10 @@ void mpiHullMerge(Data *h1, int rank, int nProcs)
         // each thread manages to free its own memory
         free(h1->X);
         free(h1->Y);
+        free(h1->I);
         free(h2.X);
         free(h2.Y);
+        free(h2.I);
 
         *h1 = h0;
 
@@ -305,6 +453,7 @@ void mpiHullMerge(Data *h1, int rank, int nProcs)
             rank2send = rank & (0xFFFFFFFE<<s);
         }
         LOG(LOG_LVL_DEBUG, "p[%2d] mpiHullMerge: sending data to rank %d with s=%d", rank, rank2send, s);
+        traceBegin(NULL, TRACE_MPI_SEND);
 
         MPIErrCode = MPI_Send(&h1->n, 1, MPI_UNSIGNED_LONG, rank2send, 0, MPI_COMM_WORLD);
         if (MPIErrCode)
@@ -317,150 +466,209 @@ void mpiHullMerge(Data *h1, int rank, int nProcs)
         MPIErrCode = MPI_Send(h1->Y, h1->n, MPI_FLOAT, rank2send, 2, MPI_COMM_WORLD);
         if (MPIErrCode)
             throwError("p[%2d] mpiHullMerge: Got error %d on sending the partial hull Xs from p[%d]", rank, MPIErrCode, rank2send);
+
+        if (h1->I != NULL)
+        {
+            MPIErrCode = MPI_Send(h1->I, h1->n, MPI_POINT_INDEX, rank2send, 3, MPI_COMM_WORLD);
+            if (MPIErrCode)
+                throwError("p[%2d] mpiHullMerge: Got error %d on sending the partial hull indices from p[%d]", rank, MPIErrCode, rank2send);
+        }
+        traceEnd(NULL, TRACE_MPI_SEND, rank2send);
     }
 }
 #endif
 
-static Data mergeHulls(Data *h1, Data *h2, ProcThreadIDCombo *id)
+// Hull of the vertices of two hulls (CCW from the lowest vertex, rightmost on ties) in the same form, with its closing point. Every
+// hull is walked along its lower and upper chains, which gives its vertices sorted by x then y in linear time, the two sorted lists
+// are merged and Andrew's monotone chain runs on them. Nothing is assumed beyond the order of the vertices: hulls of 0, 1 or 2 points,
+// collinear or repeated vertices and hulls lying on a line are merged like any other, and the merged hull has none of them
+Data mergeHulls(Data *h1, Data *h2, ProcThreadIDCombo *id)
 {
+    size_t total = h1->n + h2->n;
     Data h0;
     h0.n = 0;
-    h0.X = malloc((h1->n + h2->n) * sizeof(float) + MALLOC_PADDING);
-    h0.Y = malloc((h1->n + h2->n) * sizeof(float) + MALLOC_PADDING);
+    h0.X = malloc((total + 1) * sizeof(float) + MALLOC_PADDING);
+    h0.Y = malloc((total + 1) * sizeof(float) + MALLOC_PADDING);
     if ((h0.X == NULL) || (h0.Y == NULL))
         throwError("p[%2d] t[%3d] mergeHulls: Failed to allocate memory for merged hull", id->p, id->t);
-
-    Data *mainH, *altH;
-    size_t mainHIndex = 0, altHindex = 0;
-
-    // set an additional point at the end of h1 and h2 to avoid errors(memory space available in padding)
-    h1->X[h1->n+1] = h1->X[1];
-    h1->Y[h1->n+1] = h1->Y[1];
-    h2->X[h2->n+1] = h2->X[1];
-    h2->Y[h2->n+1] = h2->Y[1];
-    h0.X[0] = NAN; h0.Y[0] = NAN; // needed for first loop iter
-
+    // the merged hull keeps the indices only if both hulls have them (the sample hulls of the prefilter never do)
+    const bool withIndices = (h1->I != NULL) && (h2->I != NULL);
+    h0.I = NULL;
+    if (withIndices)
     {
-    if (h1->Y[0] < h2->Y[0])
-    {
-        mainH = h1;
-        altH = h2;
+        h0.I = malloc((total + 1) * sizeof(PointIndex) + MALLOC_PADDING);
+        if (h0.I == NULL)
+            throwError("p[%2d] t[%3d] mergeHulls: Failed to allocate memory for the indices of the merged hull", id->p, id->t);
     }
-    else if (h1->Y[0] > h2->Y[0])
+
+    // sorted gets the vertices of h1 then those of h2, each sorted, order all of them sorted
+    MergeVertex *sorted = malloc(total * 3 * sizeof(MergeVertex) + MALLOC_PADDING);
+    size_t *stack = malloc((total + 1) * sizeof(size_t));
+    if ((sorted == NULL) || (stack == NULL))
+        throwError("p[%2d] t[%3d] mergeHulls: Failed to allocate memory for the vertices of the hulls", id->p, id->t);
+    MergeVertex *order = &sorted[total], *scratch = &sorted[2 * total];
+    sortedVertices(h1, sorted, scratch, withIndices);
+    sortedVertices(h2, &sorted[h1->n], scratch, withIndices);
+    for (size_t i = 0, j = h1->n, k = 0; k < total; k++)
+        order[k] = (j == total) || ((i < h1->n) && !lexLess(&sorted[j], &sorted[i])) ? sorted[i++] : sorted[j++];
+
+    #define CROSS(a, b, c) (((double)order[b].x - order[a].x) * ((double)order[c].y - order[a].y) - ((double)order[b].y - order[a].y) * ((double)order[c].x - order[a].x))
+    size_t k = 0;
+    for (size_t i = 0; i < total; i++) // lower chain
     {
-        mainH = h2;
-        altH = h1;
+        while ((k >= 2) && (CROSS(stack[k-2], stack[k-1], i) <= 0))
+            k--;
+        stack[k++] = i;
     }
-    else if (h1->X[0] >= h2->X[0]) // last two cases are here in case of equality (look at the X coordinate and choose the rightmost) (likely a rare occurence)
+    for (size_t i = total > 0 ? total - 1 : 0, lowerSize = k + 1; i-- > 0;) // upper chain
     {
-        mainH = h1;
-        altH = h2;
+        while ((k >= lowerSize) && (CROSS(stack[k-2], stack[k-1], i) <= 0))
+            k--;
+        stack[k++] = i;
     }
-    else
+    #undef CROSS
+    if (k > 1)
+        k--; // the last point is the first one again
+    // all the points are the same point: the chain has it twice
+    if ((k == 2) && (order[stack[0]].x == order[stack[1]].x) && (order[stack[0]].y == order[stack[1]].y))
+        k = 1;
+
+    // lowest vertex first, rightmost on ties
+    size_t lowest = 0;
+    for (size_t j = 1; j < k; j++)
     {
-        mainH = h2;
-        altH = h1;
-    }
+        MergeVertex *a = &order[stack[j]], *b = &order[stack[lowest]];
+        if ((a->y < b->y) || ((a->y == b->y) && (a->x > b->x)))
+            lowest = j;
     }
-
-    while ((mainHIndex < mainH->n) || ((mainHIndex <= mainH->n) && ((h0.X[h0.n-1] != h0.X[0]) || (h0.Y[h0.n-1] != h0.Y[0]))))
+    for (size_t j = 0, v = lowest; (k > 0) && (j <= k); j++, v = v + 1 < k ? v + 1 : 0)
     {
-        #ifdef DEBUG
-            if (mainHIndex > mainH->n)
-            {
-                plotHullMergeStep(mainH, altH, &h0, mainHIndex, altHindex, "Plot of the error", false);
-                throwError("p[%2d] t[%3d] mergeHull: Cannot add points from an hull that has already been read completely. mainHIndex=%ld, mainH.n=%ld, altHIndex=%ld, altH.n=%ld, h0.n=%ld", id->p, id->t, mainHIndex, mainH->n, altHindex, altH->n, h0.n);
-            }
-        #endif
+        MergeVertex *a = &order[stack[v]];
+        h0.X[j] = a->x;
+        h0.Y[j] = a->y;
+        if (withIndices)
+            h0.I[j] = a->i;
+    }
+    h0.n = k;
+    free(sorted);
+    free(stack);
 
-        #ifdef PARALLHULL_STEP_DEBUG
-            // show partial hull with gnuplot at each iteration and wait for user input to resume
-            char plotTitle[200];
-            sprintf(plotTitle, "Merged Hull: h0.n=%lu, mainH.n=%ld, altH.n=%ld, mainHIndex=%ld, altHIndex=%ld", h0.n, mainH->n, altH->n, mainHIndex, altHindex);
-            LOG(LOG_LVL_DEBUG, "%s", plotTitle);
-            plotHullMergeStep(mainH, altH, &h0, mainHIndex, altHindex, plotTitle, false);
-            getchar();
-        #endif
+    return h0;
+}
 
-        // add pt
-        h0.X[h0.n] = mainH->X[mainHIndex];
-        h0.Y[h0.n] = mainH->Y[mainHIndex];
-        h0.n++;
-        mainHIndex++;
+static inline bool lexLess(const MergeVertex *a, const MergeVertex *b)
+{
+    return (a->x < b->x) || ((a->x == b->x) && (a->y < b->y));
+}
 
-        NextPtOp npo = findNextMergePoint(&h0, mainH, altH, &mainHIndex, &altHindex, id);
+// The vertices of h sorted by x then y: the lower chain goes CCW from the lexicographically smallest vertex to the largest one, the
+// upper chain CW, both in increasing order, and they are merged. Vertices slightly out of order (float rounding of the hull of a
+// thread) are caught by a final check and sorted. buf holds h->n vertices
+static void sortedVertices(Data *h, MergeVertex *dst, MergeVertex *buf, bool withIndices)
+{
+    size_t n = h->n;
+    if (n == 0)
+        return;
+    for (size_t i = 0; i < n; i++)
+        buf[i] = (MergeVertex){ .x=h->X[i], .y=h->Y[i], .i=withIndices ? h->I[i] : 0 };
+    size_t first = 0, last = 0;
+    for (size_t i = 1; i < n; i++)
+    {
+        if (lexLess(&buf[i], &buf[first]))
+            first = i;
+        if (lexLess(&buf[last], &buf[i]))
+            last = i;
+    }
 
-        if (npo == NPO_SWAP)
+    // the lower chain is [first, last] CCW, the upper chain the other vertices CW from first
+    size_t nLower = (last + n - first) % n + 1;
+    size_t lower = first, upper = first == 0 ? n - 1 : first - 1, l = 0, u = 0;
+    for (size_t k = 0; k < n; k++)
+    {
+        bool takeLower = (u == n - nLower) || ((l < nLower) && !lexLess(&buf[upper], &buf[lower]));
+        if (takeLower)
+        {
+            dst[k] = buf[lower];
+            lower = lower + 1 == n ? 0 : lower + 1;
+            l++;
+        }
+        else
         {
-            swapElems(mainH, altH)
-            swapElems(mainHIndex, altHindex)
+            dst[k] = buf[upper];
+            upper = upper == 0 ? n - 1 : upper - 1;
+            u++;
         }
     }
-    h0.n--;
-
-    h0.X = realloc(h0.X, (h0.n + 1) * sizeof(float) + MALLOC_PADDING);
-    h0.Y = realloc(h0.Y, (h0.n + 1) * sizeof(float) + MALLOC_PADDING);
 
-    return h0;
+    for (size_t k = 1; k < n; k++)
+        if (lexLess(&dst[k], &dst[k-1]))
+        {
+            qsort(dst, n, sizeof(MergeVertex), cmpMergeVertices);
+            break;
+        }
 }
 
-static inline NextPtOp findNextMergePoint(Data *mergedH, Data *mainH, Data *altH, size_t *mainHIndex, size_t *altHIndex, ProcThreadIDCombo *id)
+static int cmpMergeVertices(const void *a, const void *b)
 {
-    #ifdef DEBUG
-        if (*mainHIndex > mainH->n+1)
-            throwError("p[%2d] t[%3d] findNextMergePoint: mainHIndex > mainH.n", id->p, id->t);
-        if (*altHIndex > altH->n+1)
-            throwError("p[%2d] t[%3d] findNextMergePoint: altHIndex > altH.n", id->p, id->t);
-    #endif
+    const MergeVertex *p = (const MergeVertex*)a, *q = (const MergeVertex*)b;
+    return lexLess(q, p) - lexLess(p, q);
+}
 
-    if (*altHIndex > altH->n)
-        return NPO_CONTINUE;
+// The k points of X and Y go around a convex polygon CCW, possibly with repeated points and points in the middle of an edge, like
+// the extreme points of approxHull or a hull whose vertices were decided by the rounded test of quickhull. order gets the positions
+// of its strict vertices (one point per coordinates, no collinear ones) in the order of the hulls of quickhull, lowest and rightmost
+// first, and the count is returned. Collinear points give the two ends of their segment, identical ones a single point.
+// order has room for 2 * k positions, the second half is scratch for the rotation
+size_t strictVertices(const float *X, const float *Y, size_t k, size_t *order)
+{
+    if (k == 0)
+        return 0;
 
-    NextPtOp retval = NPO_CONTINUE;
-    size_t lastIndex = mergedH->n - 1;
+    #define CROSS(a, b, c) (((double)X[b] - X[a]) * ((double)Y[c] - Y[a]) - ((double)Y[b] - Y[a]) * ((double)X[c] - X[a]))
+    size_t n = 0;
+    for (size_t j = 0; j < k; j++)
     {
-        double a,b,c;
-        a = (double)mainH->X[*mainHIndex] - mergedH->X[lastIndex];
-        b = (double)mergedH->Y[lastIndex] - mainH->Y[*mainHIndex];
-        c = (double)mergedH->X[lastIndex] * mainH->Y[*mainHIndex] - (double)mainH->X[*mainHIndex] * mergedH->Y[lastIndex];
-        
-        // now find min dist point starting from 
-        double previousDist = INFINITY;
-        double currentDist = a * altH->Y[*altHIndex] + b * altH->X[*altHIndex] + c;
-
-        while ((previousDist >= currentDist) && (*altHIndex < altH->n) && (currentDist >= 0)) // while distance is decreasing and we are not looking through already looked data
-        {
-            (*altHIndex)++;
-            previousDist = currentDist;
-            currentDist = a * altH->Y[*altHIndex] + b * altH->X[*altHIndex] + c;
-        }
-
-        if (currentDist < 0)
-            retval = NPO_SWAP;
-        else // (previousDist >= currentDist) || (*altHIndex <= altH->n)
-            (*altHIndex)--;
+        if ((n > 0) && (X[order[n-1]] == X[j]) && (Y[order[n-1]] == Y[j]))
+            continue;
+        while ((n >= 2) && (CROSS(order[n-2], order[n-1], j) <= 0))
+            n--;
+        order[n++] = j;
     }
-
-    // need to check if point in altH[altHIndex] is the correct one for the chosen hull or not. It might not belong to the convex hull and be covered by the line casted a successive point in the hull
-    if (retval == NPO_SWAP)
+    // close the cycle: the last vertices against the first one, then the first one against its neighbours
+    while ((n >= 3) && (CROSS(order[n-2], order[n-1], order[0]) <= 0))
+        n--;
+    size_t start = 0;
+    while ((n - start >= 3) && (CROSS(order[n-1], order[start], order[start+1]) <= 0))
+        start++;
+    #undef CROSS
+
+    size_t h = n - start;
+    if (h < 3)
     {
-        while (*altHIndex < altH->n)
+        // collinear points: the two ends of the segment, lexicographically smallest and largest
+        size_t lo = 0, hi = 0;
+        for (size_t j = 1; j < k; j++)
         {
-            double a,b,c;
-            a = (double)altH->X[*altHIndex] - mergedH->X[lastIndex];
-            b = (double)mergedH->Y[lastIndex] - altH->Y[*altHIndex];
-            c = (double)mergedH->X[lastIndex] * altH->Y[*altHIndex] - (double)altH->X[*altHIndex] * mergedH->Y[lastIndex];
-
-            size_t altHIndexP1 = *altHIndex + 1;
-            double dist = a * altH->Y[altHIndexP1] + b * altH->X[altHIndexP1] + c;
-
-            if (dist > 0) break; // ignore dist == 0 since it is on the same line just get the point farther
-            
-            (*altHIndex) = altHIndexP1;
+            if ((X[j] < X[lo]) || ((X[j] == X[lo]) && (Y[j] < Y[lo])))
+                lo = j;
+            if ((X[j] > X[hi]) || ((X[j] == X[hi]) && (Y[j] > Y[hi])))
+                hi = j;
         }
+        order[0] = lo;
+        order[1] = hi;
+        return (X[lo] == X[hi]) && (Y[lo] == Y[hi]) ? 1 : 2;
     }
 
-    return retval;
+    // lowest vertex first, rightmost on ties
+    size_t first = start;
+    for (size_t i = start + 1; i < n; i++)
+        if ((Y[order[i]] < Y[order[first]]) || ((Y[order[i]] == Y[order[first]]) && (X[order[i]] > X[order[first]])))
+            first = i;
+    // rotate order[start, n) to order[0, h) from first: the tail goes after the stack, then everything moves down
+    for (size_t i = start; i < first; i++)
+        order[n + i - start] = order[i];
+    memmove(order, &order[first], h * sizeof(size_t));
+    return h;
 }
 
 #ifdef DEBUG
@@ -6,7 +6,9 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <math.h>
-#ifndef NON_MPI_MODE
+#ifdef NON_MPI_MODE
+    #include <time.h>
+#else
     #include <mpi.h>
 #endif
 
@@ -76,6 +78,83 @@ void throwError (char * line, ...)
     #endif
 }
 
+// same clocks used by the timing code of the rest of the program
+double getTime()
+{
+    #ifdef NON_MPI_MODE
+        struct timespec timeStruct;
+        clock_gettime(_POSIX_MONOTONIC_CLOCK, &timeStruct);
+        return cvtTimespec2Double(timeStruct);
+    #else
+        return MPI_Wtime();
+    #endif
+}
+
+#ifndef NON_MPI_MODE
+// Collect a string from every rank on rank 0, joined with separator. Returns the joined string on rank 0 and NULL elsewhere
+char *gatherText(char *local, int rank, int nProcs, const char *separator)
+{
+    int localLen = (int)strlen(local);
+    int *lens = NULL, *displs = NULL;
+    char *all = NULL;
+    size_t sepLen = strlen(separator);
+
+    if (rank == 0)
+    {
+        lens = malloc(nProcs * sizeof(int));
+        displs = malloc(nProcs * sizeof(int));
+        if ((lens == NULL) || (displs == NULL))
+            throwError("p[%2d] gatherText: Failed to allocate memory", rank);
+    }
+
+    int MPIErrCode = MPI_Gather(&localLen, 1, MPI_INT, lens, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (MPIErrCode)
+        throwError("p[%2d] gatherText: Got error %d on gathering the lengths", rank, MPIErrCode);
+
+    size_t total = 0;
+    if (rank == 0)
+    {
+        for (int i = 0; i < nProcs; i++)
+        {
+            displs[i] = (int)(total + i * sepLen);
+            total += lens[i];
+        }
+        total += (nProcs - 1) * sepLen;
+        all = malloc(total + 1);
+        if (all == NULL)
+            throwError("p[%2d] gatherText: Failed to allocate memory", rank);
+    }
+
+    MPIErrCode = MPI_Gatherv(local, localLen, MPI_CHAR, all, lens, displs, MPI_CHAR, 0, MPI_COMM_WORLD);
+    if (MPIErrCode)
+        throwError("p[%2d] gatherText: Got error %d on gathering the text", rank, MPIErrCode);
+
+    if (rank == 0)
+    {
+        for (int i = 1; i < nProcs; i++)
+            memcpy(&all[displs[i] - sepLen], separator, sepLen);
+        all[total] = 0;
+        free(lens);
+        free(displs);
+    }
+
+    return all;
+}
+#endif
+
+// with --indices every point gets its position in the file, the points of the rank start at first
+void initIndices(Data *d, size_t first, size_t total)
+{
+    if (total > (size_t)(PointIndex)-1)
+        throwError("The file has %ld points, too many for the point indices: build with LARGE_POINT_INDICES", total);
+
+    d->I = malloc(d->n * sizeof(PointIndex) + MALLOC_PADDING);
+    if (d->I == NULL)
+        throwError("Failed to allocate memory for the point indices");
+    for (size_t i = 0; i < d->n; i++)
+        d->I[i] = first + i;
+}
+
 void readFile(Data *d, Params *p)
 {
     FILE *fileptr = fopen(p->inputFile, "rb");
@@ -94,6 +173,10 @@ void readFile(Data *d, Params *p)
     fread(d->X, d->n * 2 * sizeof(float), 1, fileptr);
 
     fclose(fileptr);
+
+    d->I = NULL;
+    if (p->trackIndices)
+        initIndices(d, 0, d->n);
 }
 
 void readFilePart(Data *d, Params *p, int rank)
@@ -129,6 +212,55 @@ void readFilePart(Data *d, Params *p, int rank)
     fread(d->Y, d->n * sizeof(float), 1, fileptr);
 
     fclose(fileptr);
+
+    d->I = NULL;
+    if (p->trackIndices)
+        initIndices(d, stdReducedSize * rank, n);
+}
+
+// Quantize a block of count <= Q16_BLOCK_POINTS points for the companion file: b gets the bounding box and the extreme points of
+// the block, q the X offsets followed by the Y offsets (Q16_BLOCK_POINTS each, the unused tail zeroed). The offsets are rounded
+// down, so a point is always in the cell of its offset (see readFileQ16)
+void q16EncodeBlock(const float *X, const float *Y, size_t count, Q16Block *b, uint16_t *q)
+{
+    double dirX[Q16_DIRECTIONS], dirY[Q16_DIRECTIONS], best[Q16_DIRECTIONS];
+    for (int k = 0; k < Q16_DIRECTIONS; k++)
+    {
+        dirX[k] = cos(2. * M_PI * k / Q16_DIRECTIONS);
+        dirY[k] = sin(2. * M_PI * k / Q16_DIRECTIONS);
+        best[k] = X[0] * dirX[k] + Y[0] * dirY[k];
+        b->extX[k] = X[0];
+        b->extY[k] = Y[0];
+    }
+
+    b->minX = b->maxX = X[0];
+    b->minY = b->maxY = Y[0];
+    for (size_t i = 0; i < count; i++)
+    {
+        b->minX = fminf(b->minX, X[i]);
+        b->maxX = fmaxf(b->maxX, X[i]);
+        b->minY = fminf(b->minY, Y[i]);
+        b->maxY = fmaxf(b->maxY, Y[i]);
+        for (int k = 0; k < Q16_DIRECTIONS; k++)
+        {
+            double dot = X[i] * dirX[k] + Y[i] * dirY[k];
+            if (dot > best[k])
+            {
+                best[k] = dot;
+                b->extX[k] = X[i];
+                b->extY[k] = Y[i];
+            }
+        }
+    }
+
+    double scaleX = b->maxX > b->minX ? 65535. / ((double)b->maxX - b->minX) : 0;
+    double scaleY = b->maxY > b->minY ? 65535. / ((double)b->maxY - b->minY) : 0;
+    memset(q, 0, Q16_BLOCK_BYTES);
+    for (size_t i = 0; i < count; i++)
+    {
+        q[i] = (uint16_t)fmin(floor(((double)X[i] - b->minX) * scaleX), 65535.);
+        q[Q16_BLOCK_POINTS + i] = (uint16_t)fmin(floor(((double)Y[i] - b->minY) * scaleY), 65535.);
+    }
 }
 
 void plotData(Data *points, Data *hull, int nUncovered, const char * title)
@@ -219,15 +351,28 @@ void plotHullMergeStep(Data *h1, Data *h2, Data *h0, size_t h1Index, size_t h2In
     pclose(gnuplotPipe);
 }
 
+// one vertex per line as x,y or, when the hull has indices, x,y,index (index of the vertex in the input file)
+void writeHullPoints(FILE *fileptr, Data *hull)
+{
+    for (size_t i = 0; i < hull->n; i++)
+    {
+        if (hull->I != NULL)
+            fprintf(fileptr, "%f,%f,%lu\n", hull->X[i], hull->Y[i], (unsigned long)hull->I[i]);
+        else
+            fprintf(fileptr, "%f,%f\n", hull->X[i], hull->Y[i]);
+    }
+}
+
 void saveHullPointsTxt(Data *hull, char *fname)
 {
     FILE *fileptr = fopen(fname, "w");
-
-    for (size_t i = 0; i < hull->n; i++)
+    if (fileptr == NULL)
     {
-        fprintf(fileptr, "%f,%f\n", hull->X[i], hull->Y[i]);
+        LOG(LOG_LVL_ERROR, "saveHullPointsTxt: Could not open %s", fname);
+        return;
     }
-    
+
+    writeHullPoints(fileptr, hull);
 
     fclose(fileptr);
 }
@@ -0,0 +1,222 @@
+#include "parallhull.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define PROC_SLOT MAX_THREADS // counters of the phases run by the main thread (read, prefilter setup, MPI merge)
+
+typedef struct
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} PerfEventDesc;
+
+static const PerfEventDesc eventDescs[PERF_EVENTS_COUNT] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "llcMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branchMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+typedef struct
+{
+    bool enabled;
+    bool available[PERF_EVENTS_COUNT]; // decided by the main thread, worker threads open the same subset
+    int rank;
+    int nThreads;
+    PerfValues counts[MAX_THREADS+1][PHASE_COUNT];
+} PerfState;
+
+static PerfState perf = { .enabled=false };
+
+// the group is per OS thread: the counters of a thread measure only that thread (pid=0, cpu=-1)
+static __thread int groupFd = -1;
+static __thread int eventFds[PERF_EVENTS_COUNT];
+static __thread int eventsCount = 0;
+
+static int openGroup(bool probe);
+static long perfEventOpen(struct perf_event_attr *attr, pid_t pid, int cpu, int groupFd, unsigned long flags);
+
+void perfCountersEnable(int rank, int nThreads)
+{
+    perf.rank = rank;
+    perf.nThreads = nThreads;
+    memset(perf.counts, 0, sizeof(perf.counts));
+
+    // probe which events can be opened (perf_event_paranoid, virtual machines without a PMU, ...) and open the group of the main thread
+    if (openGroup(true) == 0)
+    {
+        LOG(LOG_LVL_WARN, "p[%2d] perfCounters: No hardware counter can be opened (errno=%d: %s), check /proc/sys/kernel/perf_event_paranoid. Continuing without counters", rank, errno, strerror(errno));
+        return;
+    }
+    perf.enabled = true;
+
+    for (int i = 0; i < PERF_EVENTS_COUNT; i++)
+        if (!perf.available[i])
+            LOG(LOG_LVL_WARN, "p[%2d] perfCounters: Event %s not available, it will be reported as 0", rank, eventDescs[i].name);
+}
+
+bool perfCountersEnabled()
+{
+    return perf.enabled;
+}
+
+void perfThreadOpen()
+{
+    if (!perf.enabled || (groupFd >= 0))
+        return;
+    openGroup(false);
+}
+
+void perfThreadClose()
+{
+    for (int i = 0; i < eventsCount; i++)
+        close(eventFds[i]);
+    eventsCount = 0;
+    groupFd = -1;
+}
+
+PerfValues perfRead()
+{
+    PerfValues v = { 0 };
+    if (groupFd < 0)
+        return v;
+
+    // PERF_FORMAT_GROUP | TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING layout: nr, enabled, running, values[nr]
+    uint64_t buf[3 + PERF_EVENTS_COUNT];
+    if (read(groupFd, buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t)))
+        return v;
+
+    // scale in case the group was multiplexed with other users of the PMU
+    double scale = (buf[2] > 0) ? (double)buf[1] / buf[2] : 1.;
+    for (int i = 0, k = 0; i < PERF_EVENTS_COUNT; i++)
+        if (perf.available[i])
+            v.v[i] = (uint64_t)(buf[3 + k++] * scale);
+
+    return v;
+}
+
+void perfAccumulate(ProcThreadIDCombo *id, enum Phase phase, PerfValues *start)
+{
+    if (!perf.enabled || (groupFd < 0))
+        return;
+
+    PerfValues end = perfRead();
+    int slot = (id == NULL) ? PROC_SLOT : id->t;
+    if ((slot < 0) || (slot > PROC_SLOT))
+        return;
+
+    for (int i = 0; i < PERF_EVENTS_COUNT; i++)
+        perf.counts[slot][phase].v[i] += end.v[i] - start->v[i];
+}
+
+// counters of the whole rank: sum over the threads plus the phases run by the main thread
+static PerfValues rankTotal(enum Phase phase)
+{
+    PerfValues v = perf.counts[PROC_SLOT][phase];
+    for (int t = 0; t < perf.nThreads; t++)
+        for (int i = 0; i < PERF_EVENTS_COUNT; i++)
+            v.v[i] += perf.counts[t][phase].v[i];
+    return v;
+}
+
+void perfCountersReport()
+{
+    if (!perf.enabled)
+        return;
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        PerfValues v = rankTotal(phase);
+        if (v.v[PERF_CYCLES] == 0)
+            continue;
+        LOG(LOG_LVL_NOTICE, "p[%2d] perfCounters %-10s: cycles=%.3e instructions=%.3e IPC=%.2lf llcMisses=%.3e branchMisses=%.3e", perf.rank, phaseNames[phase],
+            (double)v.v[PERF_CYCLES], (double)v.v[PERF_INSTRUCTIONS], (double)v.v[PERF_INSTRUCTIONS] / v.v[PERF_CYCLES], (double)v.v[PERF_LLC_MISSES], (double)v.v[PERF_BRANCH_MISSES]);
+    }
+}
+
+static void writeValues(FILE *f, PerfValues *v)
+{
+    fprintf(f, "{");
+    for (int i = 0; i < PERF_EVENTS_COUNT; i++)
+        fprintf(f, "%s\"%s\": %lu", i == 0 ? "" : ", ", eventDescs[i].name, v->v[i]);
+    fprintf(f, "}");
+}
+
+void perfCountersWriteJSON(FILE *f, int t)
+{
+    fprintf(f, "{");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        PerfValues v = (t < 0) ? rankTotal(phase) : perf.counts[t][phase];
+        fprintf(f, "%s\"%s\": ", phase == 0 ? "" : ", ", phaseNames[phase]);
+        writeValues(f, &v);
+    }
+    fprintf(f, "}");
+}
+
+// Open the events of the group on the calling thread, returns how many were opened.
+// When probing, the events that fail are marked as not available so that every thread reads the same layout
+static int openGroup(bool probe)
+{
+    int leader = -1;
+    int opened = 0;
+    int savedErrno = 0;
+    for (int i = 0; i < PERF_EVENTS_COUNT; i++)
+    {
+        if (!probe && !perf.available[i])
+            continue;
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = eventDescs[i].type;
+        attr.config = eventDescs[i].config;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1; // user space only works with perf_event_paranoid <= 2
+        attr.exclude_hv = 1;
+        attr.disabled = (leader < 0);
+
+        int fd = (int)perfEventOpen(&attr, 0, -1, leader, 0);
+        if (fd < 0)
+        {
+            savedErrno = errno;
+            if (probe)
+            {
+                perf.available[i] = false;
+                continue;
+            }
+            // the layout of the group read would not match the one of the main thread anymore, this thread goes without counters
+            LOG(LOG_LVL_WARN, "p[%2d] perfThreadOpen: Could not open event %s on a worker thread (errno=%d)", perf.rank, eventDescs[i].name, errno);
+            eventsCount = opened;
+            perfThreadClose();
+            return 0;
+        }
+        if (probe)
+            perf.available[i] = true;
+        if (leader < 0)
+            leader = fd;
+        eventFds[opened++] = fd;
+    }
+
+    if (leader >= 0)
+    {
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    groupFd = leader;
+    eventsCount = opened;
+    errno = savedErrno;
+    return opened;
+}
+
+static long perfEventOpen(struct perf_event_attr *attr, pid_t pid, int cpu, int groupFd, unsigned long flags)
+{
+    return syscall(__NR_perf_event_open, attr, pid, cpu, groupFd, flags);
+}
@@ -0,0 +1,101 @@
+#include "parallhull.h"
+
+#include <math.h>
+#include <string.h>
+
+#define CLUSTERS_COUNT 16
+#define ANNULUS_INNER_RATIO 0.99 // inner radius of the annulus as a fraction of the outer one
+
+const char *distributionNames[] = { "disk", "square", "circle", "annulus", "gaussian", "clustered" };
+
+// Counter based generator: every value is a pure function of (seed, stream, counter), so any range of points can be generated
+// independently by any thread and the output does not depend on how the work is split
+static inline uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline double uniform01(uint64_t seed, uint64_t stream, uint64_t counter)
+{
+    uint64_t key = mix64(seed + 0x9E3779B97F4A7C15ULL * (stream + 1));
+    return (double)(mix64(counter ^ key) >> 11) * 0x1.0p-53;
+}
+
+static inline double gaussian(uint64_t seed, uint64_t stream, uint64_t counter)
+{
+    // Box-Muller, 1-u avoids log(0)
+    double u1 = 1. - uniform01(seed, stream, counter);
+    double u2 = uniform01(seed, stream+1, counter);
+    return sqrt(-2. * log(u1)) * cos(2. * M_PI * u2);
+}
+
+int parseDistribution(const char *name)
+{
+    for (int i = 0; i < DIST_COUNT; i++)
+        if (strcmp(name, distributionNames[i]) == 0)
+            return i;
+    return -1;
+}
+
+void genPoints(float *X, float *Y, size_t first, size_t count, enum Distribution dist, uint64_t seed, double radius)
+{
+    // every distribution is centered in (radius, radius) so that all coordinates are positive like in pyScripts/genRawData.py
+    for (size_t k = 0; k < count; k++)
+    {
+        uint64_t i = first + k;
+        double x, y;
+        switch (dist)
+        {
+        case DIST_DISK:
+        {
+            double r = radius * sqrt(uniform01(seed, 0, i));
+            double t = 2. * M_PI * uniform01(seed, 1, i);
+            x = r * cos(t);
+            y = r * sin(t);
+            break;
+        }
+        case DIST_SQUARE:
+            x = radius * (2. * uniform01(seed, 0, i) - 1.);
+            y = radius * (2. * uniform01(seed, 1, i) - 1.);
+            break;
+
+        case DIST_CIRCLE:
+        {
+            double t = 2. * M_PI * uniform01(seed, 0, i);
+            x = radius * cos(t);
+            y = radius * sin(t);
+            break;
+        }
+        case DIST_ANNULUS:
+        {
+            // uniform in area between ANNULUS_INNER_RATIO*radius and radius: almost every point is close to the hull
+            const double inner2 = ANNULUS_INNER_RATIO * ANNULUS_INNER_RATIO;
+            double r = radius * sqrt(inner2 + (1. - inner2) * uniform01(seed, 0, i));
+            double t = 2. * M_PI * uniform01(seed, 1, i);
+            x = r * cos(t);
+            y = r * sin(t);
+            break;
+        }
+        case DIST_GAUSSIAN:
+            x = radius / 3. * gaussian(seed, 0, i);
+            y = radius / 3. * gaussian(seed, 2, i);
+            break;
+
+        case DIST_CLUSTERED:
+        default:
+        {
+            // cluster centers are themselves drawn from a disk of radius 0.8*radius using the cluster id as counter
+            uint64_t c = mix64(i ^ mix64(seed + 0x51ED27ULL)) % CLUSTERS_COUNT;
+            double cr = 0.8 * radius * sqrt(uniform01(seed, 4, c));
+            double ct = 2. * M_PI * uniform01(seed, 5, c);
+            x = cr * cos(ct) + radius / 40. * gaussian(seed, 0, i);
+            y = cr * sin(ct) + radius / 40. * gaussian(seed, 2, i);
+            break;
+        }
+        }
+        X[k] = (float)(x + radius);
+        Y[k] = (float)(y + radius);
+    }
+}
@@ -0,0 +1,389 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifdef NON_MPI_MODE
+    #include <time.h>
+    #include <unistd.h> // needed to get the _POSIX_MONOTONIC_CLOCK and measure time
+#else
+    #include <mpi.h>
+#endif
+
+#define PREFILTER_SHRINK_ULPS 64. // the sample hull is shrunk by at least this many float ulps of its largest coordinate before the culling
+
+typedef struct {
+    int n;
+    float X[PREFILTER_HULL_MAX_SIZE];
+    float Y[PREFILTER_HULL_MAX_SIZE];
+} SampleHullBuffer;
+
+typedef struct {
+    Data pts;
+    Data *hull;
+    uint64_t *mask;
+    size_t *counts; // survivors of every thread, the prefix sum gives the output position
+    Data *out;
+    pthread_barrier_t *barrier;
+    int nThreads;
+    ProcThreadIDCombo id;
+} PrefilterThreadData;
+
+static void *prefilterThread(void *arg);
+static void decimateHull(Data *hull, size_t maxSize);
+static bool shrinkHull(Data *hull, Data *shrunk);
+#ifndef NON_MPI_MODE
+    static void sampleHullReduceOp(void *inBuf, void *inoutBuf, int *len, MPI_Datatype *datatype);
+    static void bufferToHull(SampleHullBuffer *buf, Data *hull, ProcThreadIDCombo *id);
+    static void hullToBuffer(Data *hull, SampleHullBuffer *buf);
+#endif
+
+// splitmix64: cheap and good enough to pick the sample, any rank can reproduce its own sequence from the seed
+static inline uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+Data sampleHull(Data *d, size_t sampleSize, uint64_t seed, ProcThreadIDCombo *id)
+{
+    Data sample = { .n=sampleSize };
+    sample.X = malloc(sampleSize * 2 * sizeof(float) + MALLOC_PADDING);
+    if (sample.X == NULL)
+        throwError("p[%2d] t[%3d] sampleHull: Failed to allocate memory for the sample", id->p, id->t);
+    sample.Y = &sample.X[sampleSize];
+
+    uint64_t state = seed;
+    for (size_t i = 0; i < sampleSize; i++)
+    {
+        size_t pos = splitmix64(&state) % d->n;
+        sample.X[i] = d->X[pos];
+        sample.Y[i] = d->Y[pos];
+    }
+
+    Data hull = quickhull(&sample, id);
+    free(sample.X);
+
+    if (hull.n > PREFILTER_HULL_MAX_SIZE)
+        decimateHull(&hull, PREFILTER_HULL_MAX_SIZE);
+
+    return hull;
+}
+
+// Keep at most maxSize vertices of the hull. Dropping vertices of a convex polygon gives a convex polygon contained in the original one,
+// so the result is still a valid (just a bit less effective) filter. Vertex 0 is always kept since mergeHulls needs the lowest point first
+static void decimateHull(Data *hull, size_t maxSize)
+{
+    double step = (double)hull->n / maxSize;
+    for (size_t i = 1; i < maxSize; i++)
+    {
+        size_t src = (size_t)(step * i);
+        hull->X[i] = hull->X[src];
+        hull->Y[i] = hull->Y[src];
+    }
+    hull->n = maxSize;
+    hull->X[hull->n] = hull->X[0];
+    hull->Y[hull->n] = hull->Y[0];
+}
+
+// Copy of the hull shrunk towards its centroid, false if it is too thin to shrink. buildUncoveredMask rounds b*x + c + a*y, whose
+// error grows with |a*y| + |b*x| + |c|: a point just outside an edge, like the hull vertices next to a sample vertex on a circle,
+// can be seen strictly inside. The edges move inward by at least PREFILTER_SHRINK_ULPS float ulps of the largest coordinate, far
+// more than that error and the rounding of the shrunk vertices, so every point dropped is surely inside (like the seed of convexLayers)
+static bool shrinkHull(Data *hull, Data *shrunk)
+{
+    double cx = 0, cy = 0, maxAbs = 0, minDist = DBL_MAX;
+    for (size_t i = 0; i < hull->n; i++)
+    {
+        cx += (double)hull->X[i] / hull->n;
+        cy += (double)hull->Y[i] / hull->n;
+        maxAbs = fmax(maxAbs, fmax(fabs(hull->X[i]), fabs(hull->Y[i])));
+    }
+    for (size_t i = 0; i < hull->n; i++)
+    {
+        double ex = (double)hull->X[i+1] - hull->X[i], ey = (double)hull->Y[i+1] - hull->Y[i];
+        minDist = fmin(minDist, (ex * (cy - hull->Y[i]) - ey * (cx - hull->X[i])) / hypot(ex, ey));
+    }
+    double shrink = PREFILTER_SHRINK_ULPS * FLT_EPSILON * maxAbs / minDist;
+    if (!(minDist > 0) || (shrink > 0.5))
+        return false;
+
+    shrunk->n = hull->n;
+    shrunk->I = NULL;
+    shrunk->X = malloc((hull->n + 1) * 2 * sizeof(float) + MALLOC_PADDING);
+    if (shrunk->X == NULL)
+        throwError("shrinkHull: Failed to allocate memory for %ld vertices", hull->n);
+    shrunk->Y = &shrunk->X[hull->n + 1];
+    for (size_t i = 0; i <= hull->n; i++)
+    {
+        shrunk->X[i] = cx + (hull->X[i] - cx) * (1. - shrink);
+        shrunk->Y[i] = cy + (hull->Y[i] - cy) * (1. - shrink);
+    }
+    return true;
+}
+
+// d->X must be a single allocation holding X and Y (like the one of readFile): it is replaced by a smaller one with only the survivors.
+// Only the points surely inside hull are dropped, the ones on its boundary or within the rounding of the test are kept
+void prefilterPoints(Data *d, Data *hull, int nThreads, int procID)
+{
+    if ((hull->n < 3) || (d->n == 0)) // degenerate hull, nothing can be strictly inside it
+        return;
+    Data shrunk;
+    if (!shrinkHull(hull, &shrunk))
+    {
+        LOG(LOG_LVL_DEBUG, "p[%2d] prefilterPoints: Sample hull of %ld vertices too thin to filter", procID, hull->n);
+        return;
+    }
+
+    if (nThreads > MAX_THREADS)
+        nThreads = MAX_THREADS;
+    if (d->n < PREFILTER_PARALLEL_THRESHOLD * (size_t)nThreads)
+        nThreads = (int)(d->n / PREFILTER_PARALLEL_THRESHOLD) + 1;
+
+    size_t nWords = (d->n + 63) / 64;
+    uint64_t *mask = malloc(nWords * sizeof(uint64_t));
+    if (mask == NULL)
+        throwError("p[%2d] prefilterPoints: Failed to allocate memory for the mask", procID);
+
+    pthread_t threads[MAX_THREADS];
+    PrefilterThreadData ds[MAX_THREADS];
+    size_t counts[MAX_THREADS];
+    Data out = { .n=0 };
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, nThreads);
+
+    // slices start on a mask word so that every thread owns whole words
+    size_t wordsPerThread = (nWords + nThreads - 1) / nThreads;
+    for (int i = 0; i < nThreads; i++)
+    {
+        size_t startPos = wordsPerThread * i * 64;
+        size_t endPos = wordsPerThread * (i+1) * 64;
+        if (startPos > d->n) startPos = d->n;
+        if (endPos > d->n) endPos = d->n;
+        ds[i].pts.X = &d->X[startPos];
+        ds[i].pts.Y = &d->Y[startPos];
+        ds[i].pts.I = d->I == NULL ? NULL : &d->I[startPos];
+        ds[i].pts.n = endPos - startPos;
+        ds[i].hull = &shrunk;
+        ds[i].mask = &mask[wordsPerThread * i];
+        ds[i].counts = counts;
+        ds[i].out = &out;
+        ds[i].barrier = &barrier;
+        ds[i].nThreads = nThreads;
+        ds[i].id.p = procID;
+        ds[i].id.t = i;
+        pthread_create(&threads[i], NULL, prefilterThread, (void*)&ds[i]);
+    }
+    for (int i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_barrier_destroy(&barrier);
+    free(mask);
+    free(shrunk.X);
+
+    metricsSetPrefilterRemoved(d->n - out.n);
+    LOG(LOG_LVL_INFO, "p[%2d] prefilterPoints: Removed %ld of %ld points (%.3lf%%) using a sample hull of %ld vertices", procID, d->n - out.n, d->n, (double)(d->n - out.n) / d->n * 100., hull->n);
+
+    free(d->X);
+    free(d->I);
+    *d = out;
+}
+
+static void *prefilterThread(void *arg)
+{
+    PrefilterThreadData *thData = (PrefilterThreadData*)arg;
+    int t = thData->id.t;
+
+    perfThreadOpen();
+    PerfValues perfStart = perfRead();
+    traceBegin(&thData->id, TRACE_PREFILTER);
+
+    // 1) mask and left-pack the survivors inside the own slice, no other thread touches it
+    if (thData->pts.n > 0)
+    {
+        buildUncoveredMask(thData->hull, &thData->pts, thData->mask, true);
+        thData->pts.n = compactPoints(&thData->pts, thData->mask, thData->pts.X, thData->pts.Y, thData->pts.I);
+    }
+    thData->counts[t] = thData->pts.n;
+
+    // 2) one thread allocates the output once every count is known
+    if (pthread_barrier_wait(thData->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        Data *out = thData->out;
+        out->n = 0;
+        for (int i = 0; i < thData->nThreads; i++)
+            out->n += thData->counts[i];
+        out->X = malloc(out->n * 2 * sizeof(float) + MALLOC_PADDING);
+        if (out->X == NULL)
+            throwError("p[%2d] prefilterPoints: Failed to allocate memory for the %ld surviving points", thData->id.p, out->n);
+        out->Y = &out->X[out->n];
+        out->I = NULL;
+        if (thData->pts.I != NULL)
+        {
+            out->I = malloc(out->n * sizeof(PointIndex) + MALLOC_PADDING);
+            if (out->I == NULL)
+                throwError("p[%2d] prefilterPoints: Failed to allocate memory for the indices of the %ld surviving points", thData->id.p, out->n);
+        }
+    }
+    pthread_barrier_wait(thData->barrier);
+
+    // 3) copy the survivors to their position, given by the prefix sum of the counts of the previous threads
+    size_t offset = 0;
+    for (int i = 0; i < t; i++)
+        offset += thData->counts[i];
+    memcpy(&thData->out->X[offset], thData->pts.X, thData->pts.n * sizeof(float));
+    memcpy(&thData->out->Y[offset], thData->pts.Y, thData->pts.n * sizeof(float));
+    if (thData->out->I != NULL)
+        memcpy(&thData->out->I[offset], thData->pts.I, thData->pts.n * sizeof(PointIndex));
+
+    traceEnd(&thData->id, TRACE_PREFILTER, thData->pts.n);
+    perfAccumulate(&thData->id, PHASE_PREFILTER, &perfStart);
+    perfThreadClose();
+
+    return NULL;
+}
+
+#ifdef NON_MPI_MODE
+
+// single process: the sample hull of all the points is the filter, the threads cull like they do for every rank with MPI
+void sampleHullPrefilter(Data *d, size_t sampleSize, int nThreads)
+{
+    double startTime = getTime();
+    PerfValues perfStart = perfRead();
+    traceBegin(NULL, TRACE_PREFILTER);
+    ProcThreadIDCombo id = { .p=0, .t=0 };
+
+    Data hull = { .n=0, .X=NULL, .Y=NULL, .I=NULL };
+    if (d->n > 0)
+        hull = sampleHull(d, sampleSize, 0xC0FFEEULL, &id);
+    perfAccumulate(NULL, PHASE_PREFILTER, &perfStart); // sample hull, the filtering is counted by each thread
+    LOG(LOG_LVL_DEBUG, "p[%2d] sampleHullPrefilter: Sample hull has %ld vertices, computed in %lfs", 0, hull.n, getTime() - startTime);
+
+    prefilterPoints(d, &hull, nThreads, 0);
+
+    free(hull.X);
+    free(hull.Y);
+
+    traceEnd(NULL, TRACE_PREFILTER, d->n);
+    double finishTime = getTime();
+    metricsSetPhaseTime(PHASE_PREFILTER, finishTime - startTime);
+    LOG(LOG_LVL_NOTICE, "Sample hull prefilter finished in %lfs", finishTime - startTime);
+}
+
+#else
+
+static ProcThreadIDCombo reduceOpID; // mergeHulls wants an id for the logs, and MPI user functions cannot call MPI_Comm_rank
+
+void mpiSampleHullPrefilter(Data *d, size_t sampleSize, int rank, int nProcs, int nThreads)
+{
+    double startTime = MPI_Wtime();
+    PerfValues perfStart = perfRead();
+    traceBegin(NULL, TRACE_PREFILTER);
+    int MPIErrCode;
+    ProcThreadIDCombo id = { .p=rank, .t=0 };
+    reduceOpID = id;
+
+    Data localHull = { .n=0 };
+    if (d->n > 0)
+        localHull = sampleHull(d, sampleSize, 0xC0FFEEULL + rank, &id);
+
+    SampleHullBuffer buf;
+    hullToBuffer(&localHull, &buf);
+    free(localHull.X);
+    free(localHull.Y);
+
+    MPI_Datatype bufType;
+    MPI_Op reduceOp;
+    MPIErrCode = MPI_Type_contiguous(sizeof(SampleHullBuffer), MPI_BYTE, &bufType);
+    if (MPIErrCode)
+        throwError("p[%2d] mpiSampleHullPrefilter: Got error %d on creating the sample hull datatype", rank, MPIErrCode);
+    MPI_Type_commit(&bufType);
+    MPI_Op_create(sampleHullReduceOp, 1, &reduceOp);
+
+    MPIErrCode = MPI_Allreduce(MPI_IN_PLACE, &buf, 1, bufType, reduceOp, MPI_COMM_WORLD);
+    if (MPIErrCode)
+        throwError("p[%2d] mpiSampleHullPrefilter: Got error %d on the sample hull allreduce", rank, MPIErrCode);
+
+    MPI_Op_free(&reduceOp);
+    MPI_Type_free(&bufType);
+
+    Data globalHull;
+    bufferToHull(&buf, &globalHull, &id);
+
+    double reduceTime = MPI_Wtime();
+    perfAccumulate(NULL, PHASE_PREFILTER, &perfStart); // sample hull and allreduce, the filtering is counted by each thread
+    LOG(LOG_LVL_DEBUG, "p[%2d] mpiSampleHullPrefilter: Global sample hull has %ld vertices, computed in %lfs", rank, globalHull.n, reduceTime - startTime);
+
+    prefilterPoints(d, &globalHull, nThreads, rank);
+
+    free(globalHull.X);
+    free(globalHull.Y);
+
+    traceEnd(NULL, TRACE_PREFILTER, d->n);
+    double finishTime = MPI_Wtime();
+    metricsSetPhaseTime(PHASE_PREFILTER, finishTime - startTime);
+    LOG(LOG_LVL_NOTICE, "p[%2d] Sample hull prefilter finished in %lfs", rank, finishTime - startTime);
+}
+
+static void sampleHullReduceOp(void *inBuf, void *inoutBuf, int *len, MPI_Datatype *datatype)
+{
+    SampleHullBuffer *in = (SampleHullBuffer*)inBuf;
+    SampleHullBuffer *inout = (SampleHullBuffer*)inoutBuf;
+
+    for (int i = 0; i < *len; i++)
+    {
+        if (in[i].n < 3) // nothing to add
+            continue;
+        if (inout[i].n < 3)
+        {
+            inout[i] = in[i];
+            continue;
+        }
+
+        Data h1, h2;
+        bufferToHull(&in[i], &h1, &reduceOpID);
+        bufferToHull(&inout[i], &h2, &reduceOpID);
+
+        Data h0 = mergeHulls(&h1, &h2, &reduceOpID);
+        if (h0.n > PREFILTER_HULL_MAX_SIZE)
+            decimateHull(&h0, PREFILTER_HULL_MAX_SIZE);
+        hullToBuffer(&h0, &inout[i]);
+
+        free(h0.X); free(h0.Y);
+        free(h1.X); free(h1.Y);
+        free(h2.X); free(h2.Y);
+    }
+}
+
+static void bufferToHull(SampleHullBuffer *buf, Data *hull, ProcThreadIDCombo *id)
+{
+    hull->n = buf->n;
+    hull->I = NULL;
+    hull->X = malloc((hull->n + 1) * sizeof(float) + MALLOC_PADDING);
+    hull->Y = malloc((hull->n + 1) * sizeof(float) + MALLOC_PADDING);
+    if ((hull->X == NULL) || (hull->Y == NULL))
+        throwError("p[%2d] t[%3d] bufferToHull: Failed to allocate memory for the sample hull", id->p, id->t);
+
+    memcpy(hull->X, buf->X, hull->n * sizeof(float));
+    memcpy(hull->Y, buf->Y, hull->n * sizeof(float));
+    if (hull->n > 0)
+    {
+        hull->X[hull->n] = hull->X[0];
+        hull->Y[hull->n] = hull->Y[0];
+    }
+}
+
+static void hullToBuffer(Data *hull, SampleHullBuffer *buf)
+{
+    // hulls with less than 3 vertices have no interior, send them as empty
+    buf->n = hull->n < 3 ? 0 : (int)hull->n;
+    memcpy(buf->X, hull->X, buf->n * sizeof(float));
+    memcpy(buf->Y, hull->Y, buf->n * sizeof(float));
+}
+
+#endif
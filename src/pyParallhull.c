@@ -0,0 +1,235 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h> // before any standard header, as the Python docs require
+
+#include "parallhull.h"
+
+#include <string.h>
+
+// CPython module "parallhull" (make python): the threaded engine on points that are already in memory, e.g. numpy arrays, with no
+// raw file in between. The coordinates come through the buffer protocol and are copied (converted to float32 when needed), since
+// the engine uses its input as working memory. With copy=False, writable C-contiguous float32 arrays are hulled in place with no
+// copy: their contents are destroyed, like quickhull destroys its input. The GIL is released during the conversion and the hull, so several
+// Python threads can hull different arrays at once. The hull comes back as numpy arrays (array.array when numpy is not installed),
+// CCW from the lowest vertex without the closing point, like --output.
+// Wrong arguments raise Python exceptions, an allocation failure in the engine still ends the process (throwError)
+
+static const char *algorithmNames[] = { "quickhull", "taskhull" };
+static const char *scheduleNames[] = { "static", "dynamic" };
+
+static PyObject *numpyModule; // NULL when numpy is not installed
+static PyObject *arrayModule;
+
+typedef struct
+{
+    Py_buffer view;
+    bool isDouble;
+    bool inPlace;
+    float *coords; // the buffer itself when in place, else a converted copy
+} PyCoords;
+
+static int getCoords(PyObject *obj, const char *name, PyCoords *c);
+static void convertCoords(PyCoords *c, size_t n);
+static int findName(const char *name, const char **names, int count, const char *option);
+static PyObject *newArray(const void *data, size_t n, size_t itemSize, const char *dtype, const char *typecode);
+
+PyDoc_STRVAR(pyHullDoc,
+"hull(x, y, *, threads=1, algorithm='quickhull', schedule='static', indices=False, copy=True)\n"
+"--\n\n"
+"Convex hull of the points (x[i], y[i]).\n\n"
+"x and y are 1-d buffers (numpy arrays, array.array, ...) of float32 or float64 of the same length, left untouched.\n"
+"copy=False hulls writable contiguous float32 buffers in place, saving the copy: their contents are destroyed. The other\n"
+"buffers are converted to float32 anyway.\n"
+"algorithm and schedule are those of --algorithm and --schedule of the command line.\n\n"
+"Returns (hx, hy), or (hx, hy, hi) with indices=True where hi are the positions in x and y of the vertices. The vertices are\n"
+"CCW from the lowest one, float32 (the coordinates) and uint32 (the indices) numpy arrays, array.array without numpy.");
+
+static PyObject *pyHull(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = { "x", "y", "threads", "algorithm", "schedule", "indices", "copy", NULL };
+    PyObject *xObj, *yObj;
+    int nThreads = 1, trackIndices = 0, copy = 1;
+    const char *algorithmName = algorithmNames[ALGORITHM_QUICKHULL], *scheduleName = scheduleNames[SCHEDULE_STATIC];
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|$isspp:hull", keywords, &xObj, &yObj, &nThreads, &algorithmName, &scheduleName, &trackIndices, &copy))
+        return NULL;
+
+    int algorithm = findName(algorithmName, algorithmNames, ALGORITHM_COUNT, "algorithm");
+    int schedule = findName(scheduleName, scheduleNames, SCHEDULE_COUNT, "schedule");
+    if ((algorithm < 0) || (schedule < 0))
+        return NULL;
+    if ((nThreads < 1) || (nThreads > MAX_THREADS))
+        return PyErr_Format(PyExc_ValueError, "threads must be in [1, %d], got %d", MAX_THREADS, nThreads);
+
+    PyCoords x, y;
+    if (getCoords(xObj, "x", &x) < 0)
+        return NULL;
+    if (getCoords(yObj, "y", &y) < 0)
+    {
+        PyBuffer_Release(&x.view);
+        return NULL;
+    }
+    size_t n = x.view.shape[0];
+    PyObject *result = NULL;
+    if ((size_t)y.view.shape[0] != n)
+    {
+        PyErr_Format(PyExc_ValueError, "x and y must have the same length, got %zd and %zd", x.view.shape[0], y.view.shape[0]);
+        PyBuffer_Release(&x.view);
+        PyBuffer_Release(&y.view);
+        return NULL;
+    }
+    if (trackIndices && (n > (size_t)(PointIndex)-1))
+    {
+        PyErr_Format(PyExc_ValueError, "%zu points are too many for the point indices, build with LARGE_POINT_INDICES", n);
+        PyBuffer_Release(&x.view);
+        PyBuffer_Release(&y.view);
+        return NULL;
+    }
+
+    // x and y sharing memory (the same array twice, or the two halves of an interleaved one) cannot be used as two working buffers
+    char *xFirst = x.view.buf, *yFirst = y.view.buf;
+    bool overlap = (n > 0) && (xFirst < yFirst + n * y.view.itemsize) && (yFirst < xFirst + n * x.view.itemsize);
+    x.inPlace = !copy && !overlap && !x.isDouble && !x.view.readonly && PyBuffer_IsContiguous(&x.view, 'C');
+    y.inPlace = !copy && !overlap && !y.isDouble && !y.view.readonly && PyBuffer_IsContiguous(&y.view, 'C');
+    x.coords = x.inPlace ? x.view.buf : malloc(n * sizeof(float) + MALLOC_PADDING);
+    y.coords = y.inPlace ? y.view.buf : malloc(n * sizeof(float) + MALLOC_PADDING);
+    Data d = { .n=n, .X=x.coords, .Y=y.coords, .I=NULL };
+    if (trackIndices)
+        d.I = malloc(n * sizeof(PointIndex) + MALLOC_PADDING);
+    if ((x.coords == NULL) || (y.coords == NULL) || (trackIndices && (d.I == NULL)))
+    {
+        PyErr_NoMemory();
+        if (!x.inPlace)
+            free(x.coords);
+        if (!y.inPlace)
+            free(y.coords);
+        free(d.I);
+        PyBuffer_Release(&x.view);
+        PyBuffer_Release(&y.view);
+        return NULL;
+    }
+
+    // the buffers stay exported until released, so their owners cannot resize them while the GIL is off
+    Data hull = { .n=0, .X=NULL, .Y=NULL, .I=NULL };
+    Py_BEGIN_ALLOW_THREADS
+    if (!x.inPlace)
+        convertCoords(&x, n);
+    if (!y.inPlace)
+        convertCoords(&y, n);
+    if (d.I != NULL)
+        for (size_t i = 0; i < n; i++)
+            d.I[i] = i;
+    if (n > 0)
+        hull = (algorithm == ALGORITHM_TASKHULL) ? taskhull(&d, 0, nThreads) : parallhullThreaded(&d, -1, 0, nThreads, schedule);
+    Py_END_ALLOW_THREADS
+
+    if (!x.inPlace)
+        free(x.coords);
+    if (!y.inPlace)
+        free(y.coords);
+    free(d.I);
+    PyBuffer_Release(&x.view);
+    PyBuffer_Release(&y.view);
+
+    PyObject *hx = newArray(hull.X, hull.n, sizeof(float), "float32", "f");
+    PyObject *hy = newArray(hull.Y, hull.n, sizeof(float), "float32", "f");
+    PyObject *hi = NULL;
+    if (trackIndices)
+        hi = sizeof(PointIndex) == 8 ? newArray(hull.I, hull.n, 8, "uint64", "Q") : newArray(hull.I, hull.n, 4, "uint32", "I");
+    if ((hx != NULL) && (hy != NULL) && (!trackIndices || (hi != NULL)))
+        result = trackIndices ? PyTuple_Pack(3, hx, hy, hi) : PyTuple_Pack(2, hx, hy);
+    Py_XDECREF(hx);
+    Py_XDECREF(hy);
+    Py_XDECREF(hi);
+    free(hull.X);
+    free(hull.Y);
+    free(hull.I);
+    return result;
+}
+
+// 1-d buffer of float32 or float64 in the native byte order, its strides are kept for the conversion
+static int getCoords(PyObject *obj, const char *name, PyCoords *c)
+{
+    if (PyObject_GetBuffer(obj, &c->view, PyBUF_RECORDS_RO) < 0)
+        return -1;
+    const char *format = c->view.format;
+    if ((format[0] == '@') || (format[0] == '=') || (format[0] == '<'))
+        format++;
+    c->isDouble = strcmp(format, "d") == 0;
+    if (c->view.ndim != 1)
+        PyErr_Format(PyExc_ValueError, "%s must be 1-dimensional, got %d dimensions", name, c->view.ndim);
+    else if (!c->isDouble && (strcmp(format, "f") != 0))
+        PyErr_Format(PyExc_TypeError, "%s must hold float32 or float64 in the native byte order, got format '%s'", name, c->view.format);
+    else
+        return 0;
+    PyBuffer_Release(&c->view);
+    return -1;
+}
+
+static void convertCoords(PyCoords *c, size_t n)
+{
+    const char *src = c->view.buf;
+    Py_ssize_t stride = c->view.strides[0];
+    if (c->isDouble)
+        for (size_t i = 0; i < n; i++)
+            c->coords[i] = *(const double*)&src[i * stride];
+    else if (stride == sizeof(float))
+        memcpy(c->coords, src, n * sizeof(float));
+    else
+        for (size_t i = 0; i < n; i++)
+            c->coords[i] = *(const float*)&src[i * stride];
+}
+
+static int findName(const char *name, const char **names, int count, const char *option)
+{
+    for (int i = 0; i < count; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    PyErr_Format(PyExc_ValueError, "unknown %s '%s'", option, name);
+    return -1;
+}
+
+// the data is copied once into a bytearray that the array wraps, so the array is writable and owns its memory
+static PyObject *newArray(const void *data, size_t n, size_t itemSize, const char *dtype, const char *typecode)
+{
+    PyObject *bytes = PyByteArray_FromStringAndSize(n > 0 ? data : "", n * itemSize);
+    if (bytes == NULL)
+        return NULL;
+    PyObject *array;
+    if (numpyModule != NULL)
+        array = PyObject_CallMethod(numpyModule, "frombuffer", "Os", bytes, dtype);
+    else
+        array = PyObject_CallMethod(arrayModule, "array", "sO", typecode, bytes);
+    Py_DECREF(bytes);
+    return array;
+}
+
+static PyMethodDef pyParallhullMethods[] = {
+    { "hull", (PyCFunction)(void(*)(void))pyHull, METH_VARARGS | METH_KEYWORDS, pyHullDoc },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef pyParallhullModule = {
+    PyModuleDef_HEAD_INIT,
+    .m_name="parallhull",
+    .m_doc="Threaded convex hull of points in memory (see hull)",
+    .m_size=-1,
+    .m_methods=pyParallhullMethods
+};
+
+PyMODINIT_FUNC PyInit_parallhull(void)
+{
+    numpyModule = PyImport_ImportModule("numpy");
+    if (numpyModule == NULL)
+    {
+        PyErr_Clear();
+        arrayModule = PyImport_ImportModule("array");
+        if (arrayModule == NULL)
+            return NULL;
+    }
+
+    // the engine logs to stdout, only the problems are worth it inside an interpreter
+    setLogLevel(LOG_LVL_WARN);
+    Params p = { .tuningCache={0} };
+    loadTuning(&p, 0);
+
+    return PyModule_Create(&pyParallhullModule);
+}
@@ -0,0 +1,303 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define Q16_CELL_SLACK 1e-6 // relative widening of the cells and shrinking of the inscribed disc, covers the rounding of the decoding
+#define Q16_DENSE_FETCH 64 // candidates of a block from which its whole exact slice is read instead of one point at a time
+
+// --q16: read a raw file through its quantized companion (<file>.q16). The extreme points stored for every block build a seed hull
+// whose vertices are points of the file, so it lies inside the final hull. The quantized points are then tested against it: a point
+// is known only up to its cell, and is dropped when the whole cell is strictly inside the seed hull (first against the disc inscribed
+// in it, then against the hull itself with hullQueryCellsMask), so no vertex of the final hull can be dropped. Blocks whose bounding
+// box is strictly inside are dropped without reading their offsets. Only the remaining candidates are read from the raw file, one
+// point at a time or the whole slice of the block when they are many.
+// The quantized points take half the bytes of the exact ones, so on inputs whose candidates are sparse the read shrinks to about half,
+// and to almost nothing on inputs whose blocks are spatially coherent (sorted or tiled), where most blocks are culled whole
+
+typedef struct
+{
+    float *X, *Y;
+    size_t *I; // position in the file
+    size_t n;
+    size_t allocated;
+} Candidates;
+
+typedef struct
+{
+    Q16Block *blocks; // of the rank
+    size_t firstBlock; // global index of blocks[0]
+    size_t nBlocks;
+    size_t fileBlocks;
+    size_t n; // points of the file
+    int q16Fd, rawFd;
+    HullQuery *seed;
+    double rIn; // radius of the disc around (seed->cx, seed->cy) inscribed in the seed hull
+    size_t *nextBlock;
+    Candidates out;
+    size_t culledBlocks;
+    size_t bytesRead;
+    ProcThreadIDCombo id;
+} Q16ThreadData;
+
+static void *q16Thread(void *arg);
+static void q16Fetch(Q16ThreadData *thData, size_t first, size_t count, uint16_t *cand, size_t nCand, float *exact);
+static void preadAll(int fd, void *buf, size_t count, off_t offset, ProcThreadIDCombo *id);
+
+// The points of the blocks of the rank that may be vertices of the hull go to d (X and Y in one allocation, like readFilePart).
+// Returns the bytes read
+size_t readFileQ16(Data *d, Params *p, int rank, int nProcs)
+{
+    ProcThreadIDCombo id = { .p=rank, .t=0 };
+    char path[1010];
+    snprintf(path, sizeof(path), "%s.q16", p->inputFile);
+
+    int q16Fd = open(path, O_RDONLY);
+    if (q16Fd < 0)
+        throwError("p[%2d] readFileQ16: Could not open %s, write it with gendata --companion %s", rank, path, p->inputFile);
+    int rawFd = open(p->inputFile, O_RDONLY);
+    if (rawFd < 0)
+        throwError("p[%2d] readFileQ16: Could not read file %s", rank, p->inputFile);
+
+    Q16Header h;
+    preadAll(q16Fd, &h, sizeof(h), 0, &id);
+    if ((h.magic != Q16_MAGIC) || (h.blockPoints != Q16_BLOCK_POINTS) || (h.nBlocks != (h.n + Q16_BLOCK_POINTS - 1) / Q16_BLOCK_POINTS))
+        throwError("p[%2d] readFileQ16: %s is not a companion file with blocks of %d points", rank, path, Q16_BLOCK_POINTS);
+    struct stat st;
+    if (fstat(rawFd, &st) || ((size_t)st.st_size != h.n * 2 * sizeof(float)))
+        throwError("p[%2d] readFileQ16: %s is for %ld points, %s does not have them: write the companion again", rank, path, h.n, p->inputFile);
+    if (p->trackIndices && (h.n > (size_t)(PointIndex)-1))
+        throwError("The file has %ld points, too many for the point indices: build with LARGE_POINT_INDICES", h.n);
+
+    // the blocks are split among the ranks, every rank builds its seed hull from the extremes of its own blocks only
+    size_t firstBlock = h.nBlocks * rank / nProcs;
+    size_t nBlocks = h.nBlocks * (rank + 1) / nProcs - firstBlock;
+    size_t bytesRead = sizeof(h) + nBlocks * sizeof(Q16Block);
+    Q16Block *blocks = malloc(nBlocks * sizeof(Q16Block) + 1);
+    if (blocks == NULL)
+        throwError("p[%2d] readFileQ16: Failed to allocate memory for %ld blocks", rank, nBlocks);
+    preadAll(q16Fd, blocks, nBlocks * sizeof(Q16Block), sizeof(Q16Header) + firstBlock * sizeof(Q16Block), &id);
+
+    Data ext = { .n=nBlocks * Q16_DIRECTIONS, .I=NULL };
+    ext.X = malloc(ext.n * 2 * sizeof(float) + MALLOC_PADDING);
+    if (ext.X == NULL)
+        throwError("p[%2d] readFileQ16: Failed to allocate memory for the extreme points", rank);
+    ext.Y = &ext.X[ext.n];
+    for (size_t b = 0; b < nBlocks; b++)
+    {
+        memcpy(&ext.X[b * Q16_DIRECTIONS], blocks[b].extX, sizeof(blocks[b].extX));
+        memcpy(&ext.Y[b * Q16_DIRECTIONS], blocks[b].extY, sizeof(blocks[b].extY));
+    }
+    Data seedHull = { .n=0, .X=NULL, .Y=NULL, .I=NULL };
+    if (ext.n > 0)
+        seedHull = quickhull(&ext, &id);
+    free(ext.X);
+    HullQuery seed = hullQueryBuild(&seedHull, rank);
+
+    // no INFINITY as a start: -ffast-math assumes finite values
+    double rIn = 0;
+    for (size_t i = 0; (seedHull.n >= 3) && (i < seedHull.n); i++)
+    {
+        double x0 = seedHull.X[i], y0 = seedHull.Y[i], x1 = seedHull.X[i+1], y1 = seedHull.Y[i+1];
+        double dist = ((x1 - x0) * (seed.cy - y0) - (y1 - y0) * (seed.cx - x0)) / hypot(x1 - x0, y1 - y0);
+        if ((i == 0) || (dist < rIn))
+            rIn = dist;
+    }
+    rIn *= 1. - Q16_CELL_SLACK;
+    LOG(LOG_LVL_INFO, "p[%2d] readFileQ16: Seed hull of %ld vertices from the extremes of %ld blocks, inscribed disc of radius %lf", rank, seedHull.n, nBlocks, rIn);
+    free(seedHull.X);
+    free(seedHull.Y);
+
+    int nThreads = p->nThreads;
+    if (nThreads > MAX_THREADS)
+        nThreads = MAX_THREADS;
+    if ((size_t)nThreads > nBlocks)
+        nThreads = nBlocks > 0 ? (int)nBlocks : 1;
+
+    pthread_t threads[MAX_THREADS];
+    Q16ThreadData ds[MAX_THREADS];
+    size_t nextBlock = 0;
+    for (int i = 0; i < nThreads; i++)
+    {
+        ds[i] = (Q16ThreadData){ .blocks=blocks, .firstBlock=firstBlock, .nBlocks=nBlocks, .fileBlocks=h.nBlocks, .n=h.n, .q16Fd=q16Fd, .rawFd=rawFd,
+            .seed=&seed, .rIn=rIn, .nextBlock=&nextBlock, .culledBlocks=0, .bytesRead=0 };
+        ds[i].out = (Candidates){ .X=NULL, .Y=NULL, .I=NULL, .n=0, .allocated=0 };
+        ds[i].id.p = rank;
+        ds[i].id.t = i;
+        pthread_create(&threads[i], NULL, q16Thread, (void*)&ds[i]);
+    }
+    size_t total = 0, culledBlocks = 0;
+    for (int i = 0; i < nThreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        total += ds[i].out.n;
+        culledBlocks += ds[i].culledBlocks;
+        bytesRead += ds[i].bytesRead;
+    }
+
+    d->n = total;
+    d->X = malloc(total * 2 * sizeof(float) + MALLOC_PADDING);
+    if (d->X == NULL)
+        throwError("p[%2d] readFileQ16: Failed to allocate memory for points", rank);
+    d->Y = &d->X[total];
+    d->I = NULL;
+    if (p->trackIndices)
+    {
+        d->I = malloc(total * sizeof(PointIndex) + MALLOC_PADDING);
+        if (d->I == NULL)
+            throwError("Failed to allocate memory for the point indices");
+    }
+    size_t offset = 0;
+    for (int i = 0; i < nThreads; i++)
+    {
+        Candidates *c = &ds[i].out;
+        memcpy(&d->X[offset], c->X, c->n * sizeof(float));
+        memcpy(&d->Y[offset], c->Y, c->n * sizeof(float));
+        for (size_t k = 0; (d->I != NULL) && (k < c->n); k++)
+            d->I[offset + k] = c->I[k];
+        offset += c->n;
+        free(c->X);
+        free(c->Y);
+        free(c->I);
+    }
+
+    size_t firstPoint = firstBlock * Q16_BLOCK_POINTS;
+    size_t rankPoints = (firstBlock + nBlocks) * Q16_BLOCK_POINTS < h.n ? nBlocks * Q16_BLOCK_POINTS : h.n - firstPoint;
+    LOG(LOG_LVL_INFO, "p[%2d] readFileQ16: Kept %ld of %ld points (%.3lf%%), %ld of %ld blocks culled whole, read %.1lfMB instead of %.1lfMB", rank, total,
+        rankPoints, rankPoints > 0 ? (double)total / rankPoints * 100. : 0., culledBlocks, nBlocks, bytesRead / 1e6, rankPoints * 2 * sizeof(float) / 1e6);
+
+    hullQueryFree(&seed);
+    free(blocks);
+    close(q16Fd);
+    close(rawFd);
+    return bytesRead;
+}
+
+static void *q16Thread(void *arg)
+{
+    Q16ThreadData *thData = (Q16ThreadData*)arg;
+    HullQuery *seed = thData->seed;
+
+    uint16_t *q = malloc(Q16_BLOCK_BYTES);
+    double *cX = malloc(Q16_BLOCK_POINTS * sizeof(double));
+    double *cY = malloc(Q16_BLOCK_POINTS * sizeof(double));
+    uint16_t *cand = malloc(Q16_BLOCK_POINTS * sizeof(uint16_t));
+    uint64_t *mask = malloc(Q16_BLOCK_POINTS / 64 * sizeof(uint64_t));
+    float *exact = malloc(Q16_BLOCK_POINTS * 2 * sizeof(float));
+    if ((q == NULL) || (cX == NULL) || (cY == NULL) || (cand == NULL) || (mask == NULL) || (exact == NULL))
+        throwError("p[%2d] t[%3d] q16Thread: Failed to allocate the block buffers", thData->id.p, thData->id.t);
+
+    for (size_t b = __atomic_fetch_add(thData->nextBlock, 1, __ATOMIC_RELAXED); b < thData->nBlocks; b = __atomic_fetch_add(thData->nextBlock, 1, __ATOMIC_RELAXED))
+    {
+        Q16Block *blk = &thData->blocks[b];
+        size_t first = (thData->firstBlock + b) * Q16_BLOCK_POINTS;
+        size_t count = first + Q16_BLOCK_POINTS > thData->n ? thData->n - first : Q16_BLOCK_POINTS;
+
+        // the bounding box is a cell too
+        double boxX = 0.5 * ((double)blk->minX + blk->maxX), boxY = 0.5 * ((double)blk->minY + blk->maxY);
+        double boxHx = 0.5 * ((double)blk->maxX - blk->minX) * (1. + Q16_CELL_SLACK), boxHy = 0.5 * ((double)blk->maxY - blk->minY) * (1. + Q16_CELL_SLACK);
+        hullQueryCellsMask(seed, &boxX, &boxY, 1, boxHx, boxHy, mask);
+        if (mask[0] & 1)
+        {
+            thData->culledBlocks++;
+            continue;
+        }
+
+        preadAll(thData->q16Fd, q, Q16_BLOCK_BYTES, Q16_DATA_OFFSET(thData->fileBlocks) + (thData->firstBlock + b) * Q16_BLOCK_BYTES, &thData->id);
+        thData->bytesRead += Q16_BLOCK_BYTES;
+
+        // centers of the cells, those inside the disc inscribed in the seed hull (shrunk by the half diagonal of a cell) are dropped
+        double wx = ((double)blk->maxX - blk->minX) / 65535., wy = ((double)blk->maxY - blk->minY) / 65535.;
+        double hx = 0.5 * wx * (1. + Q16_CELL_SLACK), hy = 0.5 * wy * (1. + Q16_CELL_SLACK);
+        double ox = blk->minX + 0.5 * wx, oy = blk->minY + 0.5 * wy;
+        double r = thData->rIn - hypot(hx, hy);
+        double r2 = r > 0 ? r * r : -1.;
+        size_t nc = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            double x = ox + q[i] * wx, y = oy + q[Q16_BLOCK_POINTS + i] * wy;
+            double dx = x - seed->cx, dy = y - seed->cy;
+            if (dx * dx + dy * dy < r2)
+                continue;
+            cX[nc] = x;
+            cY[nc] = y;
+            cand[nc] = (uint16_t)i;
+            nc++;
+        }
+
+        // then the remaining cells against the seed hull itself
+        hullQueryCellsMask(seed, cX, cY, nc, hx, hy, mask);
+        size_t nCand = 0;
+        for (size_t k = 0; k < nc; k++)
+            if (!((mask[k / 64] >> (k % 64)) & 1))
+                cand[nCand++] = cand[k];
+
+        if (nCand > 0)
+            q16Fetch(thData, first, count, cand, nCand, exact);
+    }
+
+    free(q);
+    free(cX);
+    free(cY);
+    free(cand);
+    free(mask);
+    free(exact);
+    return NULL;
+}
+
+// read the exact coordinates of the candidates of the block starting at point first and append them to the output of the thread
+static void q16Fetch(Q16ThreadData *thData, size_t first, size_t count, uint16_t *cand, size_t nCand, float *exact)
+{
+    Candidates *out = &thData->out;
+    if (out->n + nCand > out->allocated)
+    {
+        out->allocated = 2 * (out->n + nCand);
+        out->X = realloc(out->X, out->allocated * sizeof(float));
+        out->Y = realloc(out->Y, out->allocated * sizeof(float));
+        out->I = realloc(out->I, out->allocated * sizeof(size_t));
+        if ((out->X == NULL) || (out->Y == NULL) || (out->I == NULL))
+            throwError("p[%2d] t[%3d] q16Fetch: Failed to allocate memory for %ld candidates", thData->id.p, thData->id.t, out->allocated);
+    }
+
+    if (nCand >= Q16_DENSE_FETCH)
+    {
+        preadAll(thData->rawFd, exact, count * sizeof(float), first * sizeof(float), &thData->id);
+        preadAll(thData->rawFd, &exact[Q16_BLOCK_POINTS], count * sizeof(float), (thData->n + first) * sizeof(float), &thData->id);
+        thData->bytesRead += count * 2 * sizeof(float);
+        for (size_t k = 0; k < nCand; k++)
+        {
+            out->X[out->n + k] = exact[cand[k]];
+            out->Y[out->n + k] = exact[Q16_BLOCK_POINTS + cand[k]];
+        }
+    }
+    else
+    {
+        for (size_t k = 0; k < nCand; k++)
+        {
+            preadAll(thData->rawFd, &out->X[out->n + k], sizeof(float), (first + cand[k]) * sizeof(float), &thData->id);
+            preadAll(thData->rawFd, &out->Y[out->n + k], sizeof(float), (thData->n + first + cand[k]) * sizeof(float), &thData->id);
+        }
+        thData->bytesRead += nCand * 2 * sizeof(float);
+    }
+    for (size_t k = 0; k < nCand; k++)
+        out->I[out->n + k] = first + cand[k];
+    out->n += nCand;
+}
+
+static void preadAll(int fd, void *buf, size_t count, off_t offset, ProcThreadIDCombo *id)
+{
+    char *ptr = buf;
+    while (count > 0)
+    {
+        ssize_t got = pread(fd, ptr, count, offset);
+        if (got <= 0)
+            throwError("p[%2d] t[%3d] preadAll: Read failed at offset %ld", id->p, id->t, offset);
+        ptr += got;
+        count -= got;
+        offset += got;
+    }
+}
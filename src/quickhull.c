@@ -1,6 +1,8 @@
 #include "parallhull.h"
 
 #include <math.h>
+#include <float.h>
+#include <string.h>
 #include <immintrin.h>
 #ifdef NON_MPI_MODE
     #include <time.h>
@@ -12,16 +14,13 @@
 
 
 
-#define USE_MANUAL_AVX_PIPELINE_OPTIMIZATION // without this takes removeCoveredPoints takes more than triple the time
-
 #define HULL_ALLOC_ELEMS 1000
+#define COVERAGE_TILE_WORDS 16 // 16*64 points per tile of removeCoveredFindFarthest: 8KB of coordinates, comfortably inside L1
 
 
 static void getExtremeCoordsPts(Data *pts, size_t ptIndices[4]);
 static void extremeCoordsInit(Data *hull, Data *uncoveredPts, size_t ptIndices[4]);
-static void removeCoveredPoints(Data *hull, Data *uncoveredPts, char *uncoveredCache, ProcThreadIDCombo *id);
-static void findFarthestPts(Data *hull, Data *uncoveredPts, size_t *maxDistPtIndices);
-static void addPtsToHull(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndicesPtr, size_t **offsetCounterPtr, size_t *allocatedElemsCount, ProcThreadIDCombo *id);
+static void coverAndFindFarthest(Data *hull, Data *uncoveredPts, uint64_t *mask, double *maxDist, size_t *maxDistPtIndices, ProcThreadIDCombo *id);
 
 Data quickhull (Data *d, ProcThreadIDCombo *id)
 {
@@ -41,6 +40,17 @@ Data quickhull (Data *d, ProcThreadIDCombo *id)
 
     Data hull, uncoveredPts;
     uncoveredPts = *d;
+    #ifdef DEBUG
+        // d is consumed by the compaction of the covered points, keep a copy for the final check
+        Data dCopy = { .n=d->n };
+        dCopy.X = malloc(d->n * 2 * sizeof(float) + MALLOC_PADDING);
+        if (dCopy.X == NULL)
+            throwError("p[%2d] t[%3d] quickhull: Failed to allocate memory for the debug copy of the points", id->p, id->t);
+        dCopy.Y = &dCopy.X[d->n];
+        memcpy(dCopy.X, d->X, d->n * sizeof(float));
+        memcpy(dCopy.Y, d->Y, d->n * sizeof(float));
+    #endif
+    metricsQuickhullBegin(id, d->n);
 
     hull.n = 0;
     size_t allocatedElemsCount = HULL_ALLOC_ELEMS < uncoveredPts.n ? HULL_ALLOC_ELEMS+1 : uncoveredPts.n+1;
@@ -50,10 +60,20 @@ Data quickhull (Data *d, ProcThreadIDCombo *id)
     hull.Y = malloc(allocatedElemsCount * sizeof(float) + MALLOC_PADDING);
     if (hull.Y == NULL)
         throwError("p[%2d] t[%3d] extremeCoordsInit: Failed to allocate initial memory for the hull coordinates", id->p, id->t);
+    hull.I = NULL;
+    if (d->I != NULL)
+    {
+        hull.I = malloc(allocatedElemsCount * sizeof(PointIndex) + MALLOC_PADDING);
+        if (hull.I == NULL)
+            throwError("p[%2d] t[%3d] extremeCoordsInit: Failed to allocate initial memory for the hull indices", id->p, id->t);
+    }
     size_t *offsetCounter = malloc(allocatedElemsCount * 2 * sizeof(size_t) + MALLOC_PADDING*2);
     if (offsetCounter == NULL)
         throwError("p[%2d] t[%3d] quickhull: Failed to allocate memory", id->p, id->t);
     size_t *maxDistPtIndices = &offsetCounter[allocatedElemsCount];
+    uint64_t *uncoveredMask = malloc((d->n + 63) / 64 * sizeof(uint64_t) + MALLOC_PADDING);
+    if (uncoveredMask == NULL)
+        throwError("p[%2d] t[%3d] quickhull: Failed to allocate memory for the uncovered mask", id->p, id->t);
 
     // init
     size_t ptIndices[4];
@@ -62,12 +82,15 @@ Data quickhull (Data *d, ProcThreadIDCombo *id)
     
     while (uncoveredPts.n > 0)
     {
-        if (allocatedElemsCount * sizeof(size_t) * 2 >= uncoveredPts.n)
-            removeCoveredPoints(&hull, &uncoveredPts, (char*)offsetCounter, id);
-        else
-            removeCoveredPoints(&hull, &uncoveredPts, NULL, id);
+        traceBegin(id, TRACE_QUICKHULL_ITERATION);
+        // offsetCounter is only used by addPtsToHull, until then it can hold the farthest distances
+        coverAndFindFarthest(&hull, &uncoveredPts, uncoveredMask, (double*)offsetCounter, maxDistPtIndices, id);
         
-        if (uncoveredPts.n == 0) break;
+        if (uncoveredPts.n == 0)
+        {
+            traceEnd(id, TRACE_QUICKHULL_ITERATION, 0);
+            break;
+        }
 
         iterCount++;   
         #ifdef NON_MPI_MODE 
@@ -79,6 +102,7 @@ Data quickhull (Data *d, ProcThreadIDCombo *id)
         #endif
 
         LOG(LOG_LVL_TRACE, "p[%2d] t[%3d] quickhull: Iteration %5d lasted %.3es, %.3es from the begining. nUncovered=%.3e, hullSize=%ld", id->p, id->t, iterCount, iterTime-previousIterTime, iterTime-startTime, (float)uncoveredPts.n, hull.n);
+        metricsQuickhullIteration(id, uncoveredPts.n, hull.n);
         
         #ifdef QUICKHULL_STEP_DEBUG
             // show partial hull with gnuplot at each iteration and wait for user input to resume
@@ -88,12 +112,12 @@ Data quickhull (Data *d, ProcThreadIDCombo *id)
             getchar();
         #endif
 
-        findFarthestPts(&hull, &uncoveredPts, maxDistPtIndices);
         #ifdef DEBUG
             size_t oldNUncovered = uncoveredPts.n;
         #endif
 
         addPtsToHull(&hull, &uncoveredPts, &maxDistPtIndices, &offsetCounter, &allocatedElemsCount, id);
+        traceEnd(id, TRACE_QUICKHULL_ITERATION, uncoveredPts.n);
 
         #ifdef DEBUG
             if (hullConvexityCheck(&hull, id))
@@ -111,13 +135,19 @@ Data quickhull (Data *d, ProcThreadIDCombo *id)
 
     #ifdef DEBUG
         LOG(LOG_LVL_DEBUG, "p[%2d] t[%3d] quickhull: DEBUG macro is defined! Now checking whether all points are actually inside the hull", id->p, id->t);
-        if (finalCoverageCheck(&hull, d, id) != 0)
+        if (finalCoverageCheck(&hull, &dCopy, id) != 0)
             throwError("p[%2d] t[%3d] quickhull: There are still %ld points that are not inside the hull", id->p, id->t, uncoveredPts.n);
+        free(dCopy.X);
     #endif
 
     free(offsetCounter);
+    free(uncoveredMask);
     hull.X = realloc(hull.X, (hull.n+1) * sizeof(float) + MALLOC_PADDING);
     hull.Y = realloc(hull.Y, (hull.n+1) * sizeof(float) + MALLOC_PADDING);
+    if (hull.I != NULL)
+        hull.I = realloc(hull.I, (hull.n+1) * sizeof(PointIndex) + MALLOC_PADDING);
+
+    metricsQuickhullEnd(id, hull.n, getTime() - startTime);
 
     return hull;
 }
@@ -159,6 +189,7 @@ static void extremeCoordsInit(Data *hull, Data *uncoveredPts, size_t ptIndices[4
                 ptIndices[j] = -1;
                 for (int k = j; k < 3; k++)
                     swapElems(ptIndices[k], ptIndices[k+1])
+                j--; // the element shifted into position j has to be checked too
             }
         }
     }
@@ -167,10 +198,14 @@ static void extremeCoordsInit(Data *hull, Data *uncoveredPts, size_t ptIndices[4
     {
         hull->X[i] = uncoveredPts->X[ptIndices[i]];
         hull->Y[i] = uncoveredPts->Y[ptIndices[i]];
+        if (hull->I != NULL)
+            hull->I[i] = uncoveredPts->I[ptIndices[i]];
         hull->n++;
     }
     hull->X[hull->n] = hull->X[0];
     hull->Y[hull->n] = hull->Y[0];
+    if (hull->I != NULL)
+        hull->I[hull->n] = hull->I[0];
 
     // remove points from uncovered set
     // sort first
@@ -185,165 +220,511 @@ static void extremeCoordsInit(Data *hull, Data *uncoveredPts, size_t ptIndices[4
         uncoveredPts->n--;
         swapElems(uncoveredPts->X[ptIndices[i]], uncoveredPts->X[uncoveredPts->n]);
         swapElems(uncoveredPts->Y[ptIndices[i]], uncoveredPts->Y[uncoveredPts->n]);
+        if (uncoveredPts->I != NULL)
+            swapElems(uncoveredPts->I[ptIndices[i]], uncoveredPts->I[uncoveredPts->n]);
     }
 }
 
-static void removeCoveredPoints(Data *hull, Data *uncoveredPts, char *uncoveredCache, ProcThreadIDCombo *id)
+void removeInteriorPoints(Data *hull, Data *pts, ProcThreadIDCombo *id)
+{
+    removeCoveredPoints(hull, pts, NULL, true, id);
+}
+
+// byte k of leftPackLUT[m] is the position of the k-th set bit of m, used as permutation to left-pack the selected lanes of a vector
+static uint64_t leftPackLUT[256];
+#ifdef LARGE_POINT_INDICES
+    // same for 4 lanes of 64 bits, given as pairs of 32 bit lanes: bytes 2k and 2k+1 select the halves of the k-th set lane of m
+    static uint64_t leftPackLUT64[16];
+#endif
+
+__attribute__((constructor)) static void initLeftPackLUT()
+{
+    for (int m = 0; m < 256; m++)
+    {
+        uint64_t entry = 0;
+        int k = 0;
+        for (int bit = 0; bit < 8; bit++)
+            if (m & (1 << bit))
+                entry |= (uint64_t)bit << (8 * k++);
+        leftPackLUT[m] = entry;
+    }
+    #ifdef LARGE_POINT_INDICES
+    for (int m = 0; m < 16; m++)
+    {
+        uint64_t entry = 0;
+        int k = 0;
+        for (int bit = 0; bit < 4; bit++)
+            if (m & (1 << bit))
+            {
+                entry |= (uint64_t)(2*bit) << (8 * k++);
+                entry |= (uint64_t)(2*bit + 1) << (8 * k++);
+            }
+        leftPackLUT64[m] = entry;
+    }
+    #endif
+}
+
+// bits of the uncovered mask for 4 consecutive points: bit i is set when point i is outside the edge (dist < threshold)
+static inline uint64_t uncoveredBits4(const float *X, const float *Y, __m256d a, __m256d b, __m256d c, __m256d threshold)
+{
+    __m256d ptX = _mm256_cvtps_pd(_mm_loadu_ps(X));
+    __m256d ptY = _mm256_cvtps_pd(_mm_loadu_ps(Y));
+    __m256d dist = _mm256_fmadd_pd(b, ptX, c);
+    dist = _mm256_fmadd_pd(a, ptY, dist);
+    return (uint64_t)_mm256_movemask_pd(_mm256_cmp_pd(dist, threshold, _CMP_LT_OQ));
+}
+
+// keepOnEdge=true keeps the points lying exactly on an edge of the hull (only the strictly interior ones are removed).
+// uncoveredMask must hold at least (uncoveredPts->n + 63) / 64 words, if NULL it is allocated here.
+// The uncovered points are packed at the beginning of uncoveredPts, the covered ones are overwritten
+void removeCoveredPoints(Data *hull, Data *uncoveredPts, uint64_t *uncoveredMask, bool keepOnEdge, ProcThreadIDCombo *id)
 {
     bool allocatedMem = false;
-    if (uncoveredCache == NULL)
+    if (uncoveredMask == NULL)
     {
         allocatedMem = true;
-        uncoveredCache = malloc(uncoveredPts->n * sizeof(char) + MALLOC_PADDING);
-        if (uncoveredCache == NULL)
-            throwError("p[%2d] t[%3d] removeCoveredPoints: Failed to allocate memory for the uncoveredCache", id->p, id->t);
+        uncoveredMask = malloc((uncoveredPts->n + 63) / 64 * sizeof(uint64_t) + MALLOC_PADDING);
+        if (uncoveredMask == NULL)
+            throwError("p[%2d] t[%3d] removeCoveredPoints: Failed to allocate memory for the uncoveredMask", id->p, id->t);
     }
 
-    // zero cache
-    for (size_t i = 0; i < uncoveredPts->n; i++)
-        uncoveredCache[i] = 0;
-    
-    for (size_t h = 0; h < hull->n; h++)
+    buildUncoveredMask(hull, uncoveredPts, uncoveredMask, keepOnEdge);
+    uncoveredPts->n = compactPoints(uncoveredPts, uncoveredMask, uncoveredPts->X, uncoveredPts->Y, uncoveredPts->I);
+
+    if (allocatedMem)
+        free(uncoveredMask);
+}
+
+// chains independent dependency chains of 4 points keep the FMA pipelines busy (removeCoveredPoints took more than triple the
+// time with a single one), tileWords*64 points are tested against every edge while in L1. Both are constants in the variants
+// made by COVERAGE_VARIANTS, the best ones depend on the microarchitecture and are picked at runtime (see tuning.c)
+static inline __attribute__((always_inline)) void buildUncoveredMaskImpl(Data *hull, Data *pts, uint64_t *mask, bool keepOnEdge, const int chains, const size_t tileWords)
+{
+    size_t n = pts->n;
+    size_t nWords = (n + 63) / 64;
+    float *X = pts->X;
+    float *Y = pts->Y;
+
+    // a point is uncovered when dist < threshold. DBL_MIN is the smallest positive normal double, and since with -ffast-math
+    // denormals are flushed to zero, dist < DBL_MIN behaves as dist <= 0 without adding a comparison to the inner loops
+    __m256d threshold = keepOnEdge ? _mm256_set1_pd(DBL_MIN) : _mm256_setzero_pd();
+
+    // points are processed in tiles small enough to stay in L1 while every edge of the hull is tested against them,
+    // so X and Y are read from memory once instead of once per edge, and the mask words of the tile never leave L1
+    for (size_t tile = 0; tile < nWords; tile += tileWords)
     {
-        __m256i shuffleMask = _mm256_setr_epi64x(0xFFFFFFFFFFFF0800, 0xFFFFFFFFFFFFFFFF, 0xFFFFFFFF0800FFFF , 0xFFFFFFFFFFFFFFFF);
-        __m256d a, b, c;
+        size_t tileEnd = tile + tileWords < nWords ? tile + tileWords : nWords;
+        for (size_t w = tile; w < tileEnd; w++)
+            mask[w] = 0;
+
+        for (size_t h = 0; h < hull->n; h++)
         {
-            __m128 hX0s = _mm_broadcast_ss(&hull->X[h]);
-            __m128 hX1s = _mm_broadcast_ss(&hull->X[h+1]);
-            __m128 hY0s = _mm_broadcast_ss(&hull->Y[h]);
-            __m128 hY1s = _mm_broadcast_ss(&hull->Y[h+1]);
-            __m256d hX0 = _mm256_cvtps_pd(hX0s);
-            __m256d hX1 = _mm256_cvtps_pd(hX1s);
-            __m256d hY0 = _mm256_cvtps_pd(hY0s);
-            __m256d hY1 = _mm256_cvtps_pd(hY1s);
-            a = _mm256_sub_pd(hX1, hX0);
-            b = _mm256_sub_pd(hY0, hY1);
-            c = _mm256_fmsub_pd(hX0, hY1, _mm256_mul_pd(hX1, hY0));
+            __m256d a, b, c;
+            {
+                __m256d hX0 = _mm256_cvtps_pd(_mm_broadcast_ss(&hull->X[h]));
+                __m256d hX1 = _mm256_cvtps_pd(_mm_broadcast_ss(&hull->X[h+1]));
+                __m256d hY0 = _mm256_cvtps_pd(_mm_broadcast_ss(&hull->Y[h]));
+                __m256d hY1 = _mm256_cvtps_pd(_mm_broadcast_ss(&hull->Y[h+1]));
+                a = _mm256_sub_pd(hX1, hX0);
+                b = _mm256_sub_pd(hY0, hY1);
+                c = _mm256_fmsub_pd(hX0, hY1, _mm256_mul_pd(hX1, hY0));
+            }
+
+            for (size_t w = tile; w < tileEnd; w++)
+            {
+                if (mask[w] == ~0UL) // every point of the word is already known to be outside the hull
+                    continue;
+
+                size_t base = w * 64;
+                uint64_t bits = 0;
+                if (base + 64 <= n)
+                {
+                    for (size_t i = 0; i < 64; i += 4 * chains)
+                    {
+                        uint64_t chainBits = 0;
+                        #pragma GCC unroll 16
+                        for (int k = 0; k < chains; k++)
+                            chainBits |= uncoveredBits4(&X[base+i+4*k], &Y[base+i+4*k], a, b, c, threshold) << (4*k);
+                        bits |= chainBits << i;
+                    }
+                }
+                else // last partial word: never read past the last point
+                {
+                    size_t i = 0;
+                    for (; i + 4 <= n - base; i += 4)
+                        bits |= uncoveredBits4(&X[base+i], &Y[base+i], a, b, c, threshold) << i;
+                    if (i < n - base)
+                    {
+                        float tailX[4] = { 0 }, tailY[4] = { 0 };
+                        for (size_t k = 0; k < n - base - i; k++)
+                        {
+                            tailX[k] = X[base+i+k];
+                            tailY[k] = Y[base+i+k];
+                        }
+                        uint64_t tailBits = uncoveredBits4(tailX, tailY, a, b, c, threshold) & ((1UL << (n - base - i)) - 1);
+                        bits |= tailBits << i;
+                    }
+                }
+                mask[w] |= bits;
+            }
         }
-        size_t l = 12;
-        #ifdef USE_MANUAL_AVX_PIPELINE_OPTIMIZATION
-        for (size_t i=0, j=4, k=8; l < uncoveredPts->n; i+=16, j+=16, k+=16, l+=16) // loop using inline
-        {
-            __m256d iDist, jDist, kDist, lDist;
-            __m256d ptXi = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->X[i]));
-            __m256d ptYi = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->Y[i]));
-            __m256d ptXj = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->X[j]));
-            __m256d ptYj = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->Y[j]));
-            __m256d ptXk = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->X[k]));
-            __m256d ptYk = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->Y[k]));
-            __m256d ptXl = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->X[l]));
-            __m256d ptYl = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->Y[l]));
-        
-            __m128i u128 = _mm_loadu_si128((__m128i_u*)&uncoveredCache[i]);
+    }
+}
+
+// (chains, tileWords) of the variants of buildUncoveredMask, chains must divide 16. c4t16 is the one used without a tuning
+#define COVERAGE_VARIANTS(V) \
+    V(1, 4) V(1, 16) V(1, 64) \
+    V(2, 4) V(2, 16) V(2, 64) \
+    V(4, 4) V(4, 16) V(4, 64) \
+    V(8, 4) V(8, 16) V(8, 64)
+#define COVERAGE_DEFAULT_VARIANT "c4t16"
+
+#define DEFINE_COVERAGE_VARIANT(CHAINS, TILE_WORDS) \
+    static void buildUncoveredMask_c##CHAINS##t##TILE_WORDS(Data *hull, Data *pts, uint64_t *mask, bool keepOnEdge) \
+    { \
+        buildUncoveredMaskImpl(hull, pts, mask, keepOnEdge, CHAINS, TILE_WORDS); \
+    }
+COVERAGE_VARIANTS(DEFINE_COVERAGE_VARIANT)
+#undef DEFINE_COVERAGE_VARIANT
+
+typedef void (*CoverageKernel)(Data *hull, Data *pts, uint64_t *mask, bool keepOnEdge);
+#define COVERAGE_VARIANT_ENTRY(CHAINS, TILE_WORDS) { .name="c" #CHAINS "t" #TILE_WORDS, .fn=buildUncoveredMask_c##CHAINS##t##TILE_WORDS },
+static const struct
+{
+    const char *name;
+    CoverageKernel fn;
+} coverageVariants[] = { COVERAGE_VARIANTS(COVERAGE_VARIANT_ENTRY) };
+#undef COVERAGE_VARIANT_ENTRY
+static const int coverageVariantsCount = sizeof(coverageVariants) / sizeof(*coverageVariants);
 
-            iDist = _mm256_fmadd_pd(b, ptXi, c);
-            jDist = _mm256_fmadd_pd(b, ptXj, c);
-            kDist = _mm256_fmadd_pd(b, ptXk, c);
-            lDist = _mm256_fmadd_pd(b, ptXl, c);
+static int coverageVariant; // index in coverageVariants
 
-            iDist = _mm256_fmadd_pd(a, ptYi, iDist);
-            jDist = _mm256_fmadd_pd(a, ptYj, jDist);
-            kDist = _mm256_fmadd_pd(a, ptYk, kDist);
-            lDist = _mm256_fmadd_pd(a, ptYl, lDist);
+__attribute__((constructor)) static void initCoverageVariant()
+{
+    coverageVariant = findCoverageVariant(COVERAGE_DEFAULT_VARIANT);
+}
 
-            __m256i iMask = _mm256_castpd_si256(_mm256_cmp_pd(iDist, _mm256_setzero_pd(), _CMP_LT_OQ));
-            __m256i jMask = _mm256_castpd_si256(_mm256_cmp_pd(jDist, _mm256_setzero_pd(), _CMP_LT_OQ));
-            __m256i kMask = _mm256_castpd_si256(_mm256_cmp_pd(kDist, _mm256_setzero_pd(), _CMP_LT_OQ));
-            __m256i lMask =_mm256_castpd_si256( _mm256_cmp_pd(lDist, _mm256_setzero_pd(), _CMP_LT_OQ));
+int getCoverageVariantsCount()
+{
+    return coverageVariantsCount;
+}
 
-            iMask = _mm256_shuffle_epi8(iMask, shuffleMask);
-            jMask = _mm256_shuffle_epi8(jMask, shuffleMask);
-            kMask = _mm256_shuffle_epi8(kMask, shuffleMask);
-            lMask = _mm256_shuffle_epi8(lMask, shuffleMask);
+const char *getCoverageVariantName(int v)
+{
+    return (v >= 0) && (v < coverageVariantsCount) ? coverageVariants[v].name : NULL;
+}
 
-            __m128i mask;
-            {
-            __m128i iMaskLow = _mm256_castsi256_si128(iMask);
-            __m128i jMaskLow = _mm256_castsi256_si128(jMask);
-            __m128i kMaskLow = _mm256_castsi256_si128(kMask);
-            __m128i lMaskLow = _mm256_castsi256_si128(lMask);
-
-            __m128i iMaskHigh = _mm256_extractf128_si256(iMask, 1);
-            __m128i jMaskHigh = _mm256_extractf128_si256(jMask, 1);
-            __m128i kMaskHigh = _mm256_extractf128_si256(kMask, 1);
-            __m128i lMaskHigh = _mm256_extractf128_si256(lMask, 1);
-
-            iMaskLow = _mm_or_si128(iMaskLow, iMaskHigh);
-            jMaskLow = _mm_or_si128(jMaskLow, jMaskHigh);
-            kMaskLow = _mm_or_si128(kMaskLow, kMaskHigh);
-            lMaskLow = _mm_or_si128(lMaskLow, lMaskHigh);
-
-            jMaskLow = _mm_shuffle_epi32(jMaskLow, 0xF3);
-            kMaskLow = _mm_shuffle_epi32(kMaskLow, 0xCF);
-            lMaskLow = _mm_shuffle_epi32(lMaskLow, 0x3F);
-
-            iMaskLow = _mm_or_si128(iMaskLow, jMaskLow);
-            kMaskLow = _mm_or_si128(kMaskLow, lMaskLow);
-            mask = _mm_or_si128(iMaskLow, kMaskLow);
-            }
+// index of the variant called name, -1 if there is none
+int findCoverageVariant(const char *name)
+{
+    for (int v = 0; v < coverageVariantsCount; v++)
+        if (strcmp(coverageVariants[v].name, name) == 0)
+            return v;
+    return -1;
+}
+
+// must be called before any thread uses the kernel
+void setCoverageVariant(int v)
+{
+    if ((v < 0) || (v >= coverageVariantsCount))
+        throwError("setCoverageVariant: %d is not a variant of buildUncoveredMask", v);
+    coverageVariant = v;
+}
+
+int getCoverageVariant()
+{
+    return coverageVariant;
+}
 
-            mask = _mm_or_si128(mask, u128);
+// Set bit i of mask when point i is outside at least one edge of the hull. mask must hold (pts->n + 63) / 64 words
+void buildUncoveredMask(Data *hull, Data *pts, uint64_t *mask, bool keepOnEdge)
+{
+    coverageVariants[coverageVariant].fn(hull, pts, mask, keepOnEdge);
+}
 
-            _mm_storeu_si128((__m128i_u*)&uncoveredCache[i], mask);
-        }// */
+// left-pack the indices of the 8 points of a block with the same permutation used for their coordinates
+static inline void compactIndices8(const PointIndex *src, uint8_t m, PointIndex *dst)
+{
+    #ifdef LARGE_POINT_INDICES
+        // 8 indices of 64 bits are two vectors, each packed with its half of the mask
+        __m256i lo = _mm256_loadu_si256((const __m256i_u*)src);
+        __m256i hi = _mm256_loadu_si256((const __m256i_u*)&src[4]);
+        #if defined(__AVX512F__) && defined(__AVX512VL__)
+            lo = _mm256_maskz_compress_epi64(m & 0xF, lo);
+            hi = _mm256_maskz_compress_epi64(m >> 4, hi);
+        #else
+            lo = _mm256_permutevar8x32_epi32(lo, _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(leftPackLUT64[m & 0xF])));
+            hi = _mm256_permutevar8x32_epi32(hi, _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(leftPackLUT64[m >> 4])));
         #endif
-        for (size_t i=l-12; i < uncoveredPts->n; i+=4)
+        _mm256_storeu_si256((__m256i_u*)dst, lo);
+        _mm256_storeu_si256((__m256i_u*)&dst[__builtin_popcount(m & 0xF)], hi);
+    #else
+        __m256i idx = _mm256_loadu_si256((const __m256i_u*)src);
+        #if defined(__AVX512F__) && defined(__AVX512VL__)
+            idx = _mm256_maskz_compress_epi32(m, idx);
+        #else
+            idx = _mm256_permutevar8x32_epi32(idx, _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(leftPackLUT[m])));
+        #endif
+        _mm256_storeu_si256((__m256i_u*)dst, idx);
+    #endif
+}
+
+// withIndices is a constant in both instantiations made by compactPoints, so the index-free one has no trace of the indices
+static inline __attribute__((always_inline)) size_t compactPointsImpl(Data *pts, uint64_t *mask, float *dstX, float *dstY, PointIndex *dstI, const bool withIndices)
+{
+    size_t n = pts->n;
+    size_t nFullBlocks = n / 8;
+    uint8_t *blockMasks = (uint8_t*)mask; // little endian: byte k of the mask holds the bits of block k
+    size_t k = 0;
+
+    for (size_t blk = 0; blk < nFullBlocks; blk++)
+    {
+        uint8_t m = blockMasks[blk];
+        if (m == 0)
+            continue;
+
+        __m256 x = _mm256_loadu_ps(&pts->X[blk*8]);
+        __m256 y = _mm256_loadu_ps(&pts->Y[blk*8]);
+        #if defined(__AVX512F__) && defined(__AVX512VL__)
+            x = _mm256_maskz_compress_ps(m, x);
+            y = _mm256_maskz_compress_ps(m, y);
+        #else
+            __m256i perm = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(leftPackLUT[m]));
+            x = _mm256_permutevar8x32_ps(x, perm);
+            y = _mm256_permutevar8x32_ps(y, perm);
+        #endif
+        // the whole vector is stored: the lanes after the packed ones end up at most at blk*8+7, which has already been loaded
+        _mm256_storeu_ps(&dstX[k], x);
+        _mm256_storeu_ps(&dstY[k], y);
+        if (withIndices)
+            compactIndices8(&pts->I[blk*8], m, &dstI[k]);
+        k += __builtin_popcount(m);
+    }
+
+    for (size_t i = nFullBlocks * 8; i < n; i++)
+    {
+        if ((mask[i / 64] >> (i % 64)) & 1)
         {
-            __m256d iDist;
-            __m256d ptX = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->X[i]));
-            __m256d ptY = _mm256_cvtps_pd(_mm_loadu_ps(&uncoveredPts->Y[i]));
+            dstX[k] = pts->X[i];
+            dstY[k] = pts->Y[i];
+            if (withIndices)
+                dstI[k] = pts->I[i];
+            k++;
+        }
+    }
 
-            __m128i u128 = _mm_loadu_si128((__m128i_u*)&uncoveredCache[i]);
+    return k;
+}
+
+// Left-pack the points whose bit is set in mask into dstX/dstY (and their indices into dstI when pts->I is not NULL),
+// returns how many were written. dst can be pts itself (in place). Full vectors are stored, so up to 7 floats (and 7 32 bit or
+// 3 64 bit indices) after the last packed point are overwritten: out of place, dst needs that much padding and nobody else may be writing there
+size_t compactPoints(Data *pts, uint64_t *mask, float *dstX, float *dstY, PointIndex *dstI)
+{
+    if (pts->I == NULL)
+        return compactPointsImpl(pts, mask, dstX, dstY, NULL, false);
+    return compactPointsImpl(pts, mask, dstX, dstY, dstI, true);
+}
 
-            iDist = _mm256_fmadd_pd(b, ptX, c);
-            iDist = _mm256_fmadd_pd(a, ptY, iDist);
+// distances of 4 consecutive points from the edge, lanes past the last point get dist=0: neither uncovered nor farthest
+static inline __m256d edgeDist4(const float *X, const float *Y, __m256d a, __m256d b, __m256d c, __m256d validLanes)
+{
+    __m256d ptX = _mm256_cvtps_pd(_mm_loadu_ps(X));
+    __m256d ptY = _mm256_cvtps_pd(_mm_loadu_ps(Y));
+    __m256d dist = _mm256_fmadd_pd(b, ptX, c);
+    dist = _mm256_fmadd_pd(a, ptY, dist);
+    return _mm256_and_pd(dist, validLanes);
+}
 
-            __m256i iMask = _mm256_castpd_si256(_mm256_cmp_pd(iDist, _mm256_setzero_pd(), _CMP_LT_OQ));
+static inline void updateFarthest(__m256d dist, __m256i idx, __m256d *minDist, __m256i *minDistIdx)
+{
+    __m256d farther = _mm256_cmp_pd(dist, *minDist, _CMP_LT_OQ);
+    *minDist = _mm256_min_pd(*minDist, dist);
+    *minDistIdx = _mm256_blendv_epi8(*minDistIdx, idx, _mm256_castpd_si256(farther));
+}
 
-            iMask = _mm256_shuffle_epi8(iMask, shuffleMask);
+// keeps in minDist/minIdx the farther of the two candidates of every lane, the lower index on a tie. A lane without candidate
+// has dist=0 and index -1, and a candidate has dist<0, so an index -1 never wins over a real one
+static inline void reduceFarthest(__m256d *minDist, __m256i *minIdx, __m256d dist, __m256i idx)
+{
+    __m256d farther = _mm256_cmp_pd(dist, *minDist, _CMP_LT_OQ);
+    __m256i tie = _mm256_and_si256(_mm256_castpd_si256(_mm256_cmp_pd(dist, *minDist, _CMP_EQ_OQ)), _mm256_cmpgt_epi64(*minIdx, idx));
+    *minDist = _mm256_min_pd(*minDist, dist);
+    *minIdx = _mm256_blendv_epi8(*minIdx, idx, _mm256_or_si256(_mm256_castpd_si256(farther), tie));
+}
 
-            __m128i mask;
-            {
-            __m128i iMaskLow = _mm256_castsi256_si128(iMask);
-            __m128i iMaskHigh = _mm256_extractf128_si256(iMask, 1);
-            iMaskLow = _mm_or_si128(iMaskLow, iMaskHigh);
-            mask = iMaskLow;
-            }
+static inline uint64_t uncoveredBitsOf(__m256d dist)
+{
+    return (uint64_t)_mm256_movemask_pd(_mm256_cmp_pd(dist, _mm256_setzero_pd(), _CMP_LT_OQ));
+}
 
-            mask = _mm_or_si128(mask, u128);
+// Fused removeCoveredPoints + findFarthestPts: a single pass over tiles of points x edges marks the uncovered points and, for every
+// edge, finds the farthest point outside it with the reduction vectorized across points. The uncovered points are then packed at
+// the beginning of uncoveredPts and maxDistPtIndices[h] is the index (after packing) of the farthest point outside edge h, -1 if none.
+// mask must hold (n + 63) / 64 words and maxDist hull->n doubles (if NULL they are allocated here), maxDistPtIndices hull->n elements
+void removeCoveredFindFarthest(Data *hull, Data *uncoveredPts, uint64_t *mask, double *maxDist, size_t *maxDistPtIndices, ProcThreadIDCombo *id)
+{
+    size_t n = uncoveredPts->n;
+    size_t nWords = (n + 63) / 64;
+    float *X = uncoveredPts->X;
+    float *Y = uncoveredPts->Y;
+
+    uint64_t *allocatedMask = NULL;
+    double *allocatedMaxDist = NULL;
+    if (mask == NULL)
+    {
+        mask = allocatedMask = malloc(nWords * sizeof(uint64_t) + MALLOC_PADDING);
+        if (mask == NULL)
+            throwError("p[%2d] t[%3d] removeCoveredFindFarthest: Failed to allocate memory for the uncovered mask", id->p, id->t);
+    }
+    if (maxDist == NULL)
+    {
+        maxDist = allocatedMaxDist = malloc(hull->n * sizeof(double) + MALLOC_PADDING);
+        if (maxDist == NULL)
+            throwError("p[%2d] t[%3d] removeCoveredFindFarthest: Failed to allocate memory for the farthest distances", id->p, id->t);
+    }
 
-            _mm_storeu_si128((__m128i_u*)&uncoveredCache[i], mask);
-        }// */
+    for (size_t h = 0; h < hull->n; h++)
+    {
+        maxDist[h] = 0;
+        maxDistPtIndices[h] = -1;
     }
 
+    const __m256i laneOffsets = _mm256_setr_epi64x(0, 1, 2, 3);
+    const __m256i four = _mm256_set1_epi64x(4);
+    const __m256i eight = _mm256_set1_epi64x(8);
+    const __m256i twelve = _mm256_set1_epi64x(12);
+    const __m256i sixteen = _mm256_set1_epi64x(16);
+    const __m256d allLanes = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
 
-    size_t i = 0;
-    size_t j = uncoveredPts->n - 1;
-    while (i <= j)
+    for (size_t tile = 0; tile < nWords; tile += COVERAGE_TILE_WORDS)
     {
-        if (uncoveredCache[i] == 0)
+        size_t tileEnd = tile + COVERAGE_TILE_WORDS < nWords ? tile + COVERAGE_TILE_WORDS : nWords;
+        for (size_t w = tile; w < tileEnd; w++)
+            mask[w] = 0;
+
+        for (size_t h = 0; h < hull->n; h++)
         {
-            while ((j > i) && (uncoveredCache[j] == 0))
-                j--;
+            __m256d a, b, c;
+            {
+                __m256d hX0 = _mm256_cvtps_pd(_mm_broadcast_ss(&hull->X[h]));
+                __m256d hX1 = _mm256_cvtps_pd(_mm_broadcast_ss(&hull->X[h+1]));
+                __m256d hY0 = _mm256_cvtps_pd(_mm_broadcast_ss(&hull->Y[h]));
+                __m256d hY1 = _mm256_cvtps_pd(_mm_broadcast_ss(&hull->Y[h+1]));
+                a = _mm256_sub_pd(hX1, hX0);
+                b = _mm256_sub_pd(hY0, hY1);
+                c = _mm256_fmsub_pd(hX0, hY1, _mm256_mul_pd(hX1, hY0));
+            }
 
-            if (i == j) break;
+            // 4 independent accumulators so that the min/blend chains do not serialize the loop when many points are outside
+            __m256d minDist0 = _mm256_setzero_pd(), minDist1 = _mm256_setzero_pd(), minDist2 = _mm256_setzero_pd(), minDist3 = _mm256_setzero_pd();
+            __m256i minIdx0 = _mm256_set1_epi64x(-1), minIdx1 = minIdx0, minIdx2 = minIdx0, minIdx3 = minIdx0;
+            uint64_t tileBits = 0; // any point of the tile outside the edge
 
-            swapElems(uncoveredCache[i], uncoveredCache[j])
-            swapElems(uncoveredPts->X[i], uncoveredPts->X[j])
-            swapElems(uncoveredPts->Y[i], uncoveredPts->Y[j])
-            
-            j--;
+            for (size_t w = tile; w < tileEnd; w++)
+            {
+                size_t base = w * 64;
+                uint64_t bits = 0;
+                __m256i idx = _mm256_add_epi64(_mm256_set1_epi64x(base), laneOffsets);
+                if (base + 64 <= n)
+                {
+                    for (size_t i = 0; i < 64; i += 16)
+                    {
+                        __m256d iDist = edgeDist4(&X[base+i], &Y[base+i], a, b, c, allLanes);
+                        __m256d jDist = edgeDist4(&X[base+i+4], &Y[base+i+4], a, b, c, allLanes);
+                        __m256d kDist = edgeDist4(&X[base+i+8], &Y[base+i+8], a, b, c, allLanes);
+                        __m256d lDist = edgeDist4(&X[base+i+12], &Y[base+i+12], a, b, c, allLanes);
+                        uint64_t stepBits = uncoveredBitsOf(iDist) | (uncoveredBitsOf(jDist) << 4) | (uncoveredBitsOf(kDist) << 8) | (uncoveredBitsOf(lDist) << 12);
+
+                        // most points are inside most edges: the farthest candidates are only touched when some point is outside
+                        if (stepBits)
+                        {
+                            bits |= stepBits << i;
+                            updateFarthest(iDist, idx, &minDist0, &minIdx0);
+                            updateFarthest(jDist, _mm256_add_epi64(idx, four), &minDist1, &minIdx1);
+                            updateFarthest(kDist, _mm256_add_epi64(idx, eight), &minDist2, &minIdx2);
+                            updateFarthest(lDist, _mm256_add_epi64(idx, twelve), &minDist3, &minIdx3);
+                        }
+                        idx = _mm256_add_epi64(idx, sixteen);
+                    }
+                }
+                else // last partial word: never read past the last point
+                {
+                    size_t i = 0;
+                    for (; i + 4 <= n - base; i += 4)
+                    {
+                        __m256d dist = edgeDist4(&X[base+i], &Y[base+i], a, b, c, allLanes);
+                        bits |= uncoveredBitsOf(dist) << i;
+                        updateFarthest(dist, idx, &minDist0, &minIdx0);
+                        idx = _mm256_add_epi64(idx, four);
+                    }
+                    if (i < n - base)
+                    {
+                        size_t rem = n - base - i;
+                        float tailX[4] = { 0 }, tailY[4] = { 0 };
+                        for (size_t k = 0; k < rem; k++)
+                        {
+                            tailX[k] = X[base+i+k];
+                            tailY[k] = Y[base+i+k];
+                        }
+                        __m256d validLanes = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(rem), laneOffsets));
+                        __m256d dist = edgeDist4(tailX, tailY, a, b, c, validLanes);
+                        bits |= uncoveredBitsOf(dist) << i;
+                        updateFarthest(dist, idx, &minDist0, &minIdx0);
+                    }
+                }
+                mask[w] |= bits;
+                tileBits |= bits;
+            }
+            if (tileBits == 0)
+                continue;
+
+            // reduce the accumulators and then the lanes, the lowest index wins ties like in findFarthestPts
+            reduceFarthest(&minDist0, &minIdx0, minDist1, minIdx1);
+            reduceFarthest(&minDist2, &minIdx2, minDist3, minIdx3);
+            reduceFarthest(&minDist0, &minIdx0, minDist2, minIdx2);
+            double dists[4];
+            int64_t idxs[4];
+            _mm256_storeu_pd(dists, minDist0);
+            _mm256_storeu_si256((__m256i_u*)idxs, minIdx0);
+            for (int l = 0; l < 4; l++)
+            {
+                if (idxs[l] < 0)
+                    continue;
+                if ((dists[l] < maxDist[h]) || ((dists[l] == maxDist[h]) && ((size_t)idxs[l] < maxDistPtIndices[h])))
+                {
+                    maxDist[h] = dists[l];
+                    maxDistPtIndices[h] = idxs[l];
+                }
+            }
         }
-        i++;
     }
 
-    if (allocatedMem)
-        free(uncoveredCache);
+    // the farthest points are uncovered, so they survive the packing: their new index is the number of uncovered points before them
+    size_t *wordPrefix = malloc(nWords * sizeof(size_t) + MALLOC_PADDING);
+    if (wordPrefix == NULL)
+        throwError("p[%2d] t[%3d] removeCoveredFindFarthest: Failed to allocate memory for the mask prefix sum", id->p, id->t);
+    for (size_t w = 0, count = 0; w < nWords; w++)
+    {
+        wordPrefix[w] = count;
+        count += __builtin_popcountll(mask[w]);
+    }
+    for (size_t h = 0; h < hull->n; h++)
+    {
+        if (maxDistPtIndices[h] == -1)
+            continue;
+        size_t w = maxDistPtIndices[h] / 64;
+        maxDistPtIndices[h] = wordPrefix[w] + __builtin_popcountll(mask[w] & ((1UL << (maxDistPtIndices[h] % 64)) - 1));
+    }
+    free(wordPrefix);
+
+    uncoveredPts->n = compactPoints(uncoveredPts, mask, X, Y, uncoveredPts->I);
 
-    uncoveredPts->n = i;
+    free(allocatedMask);
+    free(allocatedMaxDist);
 }
 
-static void findFarthestPts(Data *hull, Data *uncoveredPts, size_t *maxDistPtIndices)
+void findFarthestPts(Data *hull, Data *uncoveredPts, size_t *maxDistPtIndices)
 {
     for (size_t k = 0; k < hull->n; k+=4)
     {
@@ -379,7 +760,74 @@ static void findFarthestPts(Data *hull, Data *uncoveredPts, size_t *maxDistPtInd
     }
 }
 
-static void addPtsToHull(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndicesPtr, size_t **offsetCounterPtr, size_t *allocatedElemsCount, ProcThreadIDCombo *id)
+// the steps of a quickhull iteration before addPtsToHull, as two passes: removeCoveredPoints skips the words already outside and
+// findFarthestPts only reads the points left, which the fused pass of removeCoveredFindFarthest cannot do
+static void removeCoveredThenFindFarthest(Data *hull, Data *uncoveredPts, uint64_t *mask, double *maxDist, size_t *maxDistPtIndices, ProcThreadIDCombo *id)
+{
+    (void)maxDist;
+    removeCoveredPoints(hull, uncoveredPts, mask, false, id);
+    if (uncoveredPts->n > 0)
+        findFarthestPts(hull, uncoveredPts, maxDistPtIndices);
+}
+
+// Variants of the coverage and farthest points step of quickhull, picked at runtime like the ones of buildUncoveredMask (see
+// tuning.c). Both find the same farthest points, which one is faster depends on the machine and on how fast the points get covered
+typedef void (*IterationKernel)(Data *hull, Data *uncoveredPts, uint64_t *mask, double *maxDist, size_t *maxDistPtIndices, ProcThreadIDCombo *id);
+static const struct
+{
+    const char *name;
+    IterationKernel fn;
+} iterationVariants[] = { { .name="separate", .fn=removeCoveredThenFindFarthest }, { .name="fused", .fn=removeCoveredFindFarthest } };
+static const int iterationVariantsCount = sizeof(iterationVariants) / sizeof(*iterationVariants);
+#define ITERATION_DEFAULT_VARIANT "separate"
+
+static int iterationVariant; // index in iterationVariants
+
+__attribute__((constructor)) static void initIterationVariant()
+{
+    iterationVariant = findIterationVariant(ITERATION_DEFAULT_VARIANT);
+}
+
+int getIterationVariantsCount()
+{
+    return iterationVariantsCount;
+}
+
+const char *getIterationVariantName(int v)
+{
+    return (v >= 0) && (v < iterationVariantsCount) ? iterationVariants[v].name : NULL;
+}
+
+// index of the variant called name, -1 if there is none
+int findIterationVariant(const char *name)
+{
+    for (int v = 0; v < iterationVariantsCount; v++)
+        if (strcmp(iterationVariants[v].name, name) == 0)
+            return v;
+    return -1;
+}
+
+// must be called before any thread runs quickhull
+void setIterationVariant(int v)
+{
+    if ((v < 0) || (v >= iterationVariantsCount))
+        throwError("setIterationVariant: %d is not a variant of the quickhull iteration", v);
+    iterationVariant = v;
+}
+
+int getIterationVariant()
+{
+    return iterationVariant;
+}
+
+// Remove the points covered by the hull from uncoveredPts (packed in place) and set maxDistPtIndices[h] to the farthest point
+// outside edge h, -1 if none. maxDist is scratch for hull->n doubles
+static void coverAndFindFarthest(Data *hull, Data *uncoveredPts, uint64_t *mask, double *maxDist, size_t *maxDistPtIndices, ProcThreadIDCombo *id)
+{
+    iterationVariants[iterationVariant].fn(hull, uncoveredPts, mask, maxDist, maxDistPtIndices, id);
+}
+
+static inline __attribute__((always_inline)) void addPtsToHullImpl(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndicesPtr, size_t **offsetCounterPtr, size_t *allocatedElemsCount, ProcThreadIDCombo *id, const bool withIndices)
 {
     size_t *offsetCounter = *offsetCounterPtr;
     size_t *maxDistPtIndices = *maxDistPtIndicesPtr;
@@ -406,6 +854,12 @@ static void addPtsToHull(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndic
         hull->Y = realloc(hull->Y, *allocatedElemsCount * sizeof(float) + MALLOC_PADDING);
         if (hull->Y == NULL)
             throwError("p[%2d] t[%3d] addPtToHull: Failed to reallocate hull.Y. uncoveredPts=%ld", id->p, id->t, uncoveredPts->n);
+        if (withIndices)
+        {
+            hull->I = realloc(hull->I, *allocatedElemsCount * sizeof(PointIndex) + MALLOC_PADDING);
+            if (hull->I == NULL)
+                throwError("p[%2d] t[%3d] addPtToHull: Failed to reallocate hull.I. uncoveredPts=%ld", id->p, id->t, uncoveredPts->n);
+        }
     }
 
     // make space in hull.X and hull.Y to fit new points
@@ -414,6 +868,8 @@ static void addPtsToHull(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndic
         size_t iOffset = i + offsetCounter[i];
         hull->X[iOffset] = hull->X[i];
         hull->Y[iOffset] = hull->Y[i];
+        if (withIndices)
+            hull->I[iOffset] = hull->I[i];
         #ifdef DEBUG
             hull->X[i] = 0;
             hull->Y[i] = 0;
@@ -429,6 +885,8 @@ static void addPtsToHull(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndic
             size_t iOffset = i + offsetCounter[i] + 1;
             hull->X[iOffset] = uncoveredPts->X[maxDistPtIndices[i]];
             hull->Y[iOffset] = uncoveredPts->Y[maxDistPtIndices[i]];
+            if (withIndices)
+                hull->I[iOffset] = uncoveredPts->I[maxDistPtIndices[i]];
         }
     }
 
@@ -471,6 +929,8 @@ static void addPtsToHull(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndic
         uncoveredPts->n--;
         swapElems(uncoveredPts->X[maxDistPtIndices[k]], uncoveredPts->X[uncoveredPts->n]);
         swapElems(uncoveredPts->Y[maxDistPtIndices[k]], uncoveredPts->Y[uncoveredPts->n]);
+        if (withIndices)
+            swapElems(uncoveredPts->I[maxDistPtIndices[k]], uncoveredPts->I[uncoveredPts->n]);
     }
 
     size_t addedElemsCount = offsetCounter[hull->n];
@@ -487,6 +947,15 @@ static void addPtsToHull(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndic
     hull->n += addedElemsCount;
 }
 
+// the hull and the uncovered points carry indices together (quickhull allocates hull.I only when the points have them)
+void addPtsToHull(Data *hull, Data *uncoveredPts, size_t **maxDistPtIndicesPtr, size_t **offsetCounterPtr, size_t *allocatedElemsCount, ProcThreadIDCombo *id)
+{
+    if (hull->I == NULL)
+        addPtsToHullImpl(hull, uncoveredPts, maxDistPtIndicesPtr, offsetCounterPtr, allocatedElemsCount, id, false);
+    else
+        addPtsToHullImpl(hull, uncoveredPts, maxDistPtIndicesPtr, offsetCounterPtr, allocatedElemsCount, id, true);
+}
+
 
 #ifdef DEBUG
 int hullConvexityCheck(Data *hull, ProcThreadIDCombo *id)
@@ -520,7 +989,7 @@ int finalCoverageCheck(Data *hull, Data *pts, ProcThreadIDCombo *id)
 {
     Data p = *pts;
 
-    removeCoveredPoints(hull, &p, NULL, id);
+    removeCoveredPoints(hull, &p, NULL, false, id);
 
     for (size_t i = 0; i < p.n; i++)
     {
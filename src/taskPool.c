@@ -0,0 +1,276 @@
+#include "parallhull.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define TASK_DEQUE_CAPACITY (1L << 12) // tasks queued per worker, must be a power of 2 (when full the task runs inline)
+#define TASK_STEAL_ROUNDS 64 // failed steal rounds before an idle worker yields the cpu
+
+typedef struct
+{
+    TaskFn fn;
+    void *arg;
+} Task;
+
+// Chase-Lev deque: the owner pushes and pops at the bottom, thieves take from the top.
+// The buffer is fixed, so an element is never moved while a thief may be reading it
+typedef struct
+{
+    int64_t top;
+    int64_t bottom;
+    Task *tasks[TASK_DEQUE_CAPACITY];
+} TaskDeque;
+
+struct TaskWorker
+{
+    TaskDeque deque;
+    TaskPool *pool;
+    ProcThreadIDCombo id;
+    uint64_t rng; // victim selection
+    pthread_t thread;
+} __attribute__((aligned(64)));
+
+struct TaskPool
+{
+    int nThreads;
+    TaskWorker *workers;
+    size_t pending; // spawned tasks not finished yet, the pool is done when it drops to 0
+};
+
+typedef struct ParallelFor ParallelFor;
+
+typedef struct
+{
+    ParallelFor *pf;
+    size_t block;
+} ParallelForBlock;
+
+// shared by the blocks of a taskParallelFor and freed with them, the last block to finish runs done
+struct ParallelFor
+{
+    TaskBlockFn body;
+    TaskFn done;
+    void *ctx;
+    size_t remaining;
+    ParallelForBlock blocks[];
+};
+
+static void *taskWorkerThread(void *arg);
+static void parallelForBlock(void *arg, TaskWorker *w);
+
+static bool dequePush(TaskDeque *dq, Task *t)
+{
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    if (b - top >= TASK_DEQUE_CAPACITY)
+        return false;
+
+    __atomic_store_n(&dq->tasks[b & (TASK_DEQUE_CAPACITY - 1)], t, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static Task *dequePop(TaskDeque *dq)
+{
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    Task *t = NULL;
+    if (top <= b)
+    {
+        t = __atomic_load_n(&dq->tasks[b & (TASK_DEQUE_CAPACITY - 1)], __ATOMIC_RELAXED);
+        if (top == b) // last task: race against the thieves for it
+        {
+            if (!__atomic_compare_exchange_n(&dq->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                t = NULL;
+            __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    }
+    else
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+
+    return t;
+}
+
+static Task *dequeSteal(TaskDeque *dq)
+{
+    int64_t top = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+    if (top >= b)
+        return NULL;
+
+    Task *t = __atomic_load_n(&dq->tasks[top & (TASK_DEQUE_CAPACITY - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&dq->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL; // another thief (or the owner) got it first
+    return t;
+}
+
+// Runs root and every task it spawns on nThreads workers, returns when all of them are done.
+// The workers are the same kind of pthreads used by parallhullThreaded, ids are (procID, 0..nThreads-1)
+void taskPoolRun(int nThreads, int procID, TaskFn root, void *arg)
+{
+    if (nThreads < 1)
+        nThreads = 1;
+    if (nThreads > MAX_THREADS)
+        throwError("p[%2d] taskPoolRun: At most %d threads are supported", procID, MAX_THREADS);
+
+    TaskPool pool = { .nThreads=nThreads, .pending=0 };
+    pool.workers = aligned_alloc(64, nThreads * sizeof(TaskWorker));
+    if (pool.workers == NULL)
+        throwError("p[%2d] taskPoolRun: Failed to allocate the workers", procID);
+    for (int i = 0; i < nThreads; i++)
+    {
+        pool.workers[i].deque.top = pool.workers[i].deque.bottom = 0;
+        pool.workers[i].pool = &pool;
+        pool.workers[i].id.p = procID;
+        pool.workers[i].id.t = i;
+        pool.workers[i].rng = 0x9E3779B97F4A7C15UL * (i + 1);
+    }
+
+    // the root goes to worker 0, the others start by stealing from it
+    taskSpawn(&pool.workers[0], root, arg);
+
+    for (int i = 0; i < nThreads; i++)
+        pthread_create(&pool.workers[i].thread, NULL, taskWorkerThread, (void*)&pool.workers[i]);
+    for (int i = 0; i < nThreads; i++)
+        pthread_join(pool.workers[i].thread, NULL);
+
+    free(pool.workers);
+}
+
+void taskSpawn(TaskWorker *w, TaskFn fn, void *arg)
+{
+    Task *t = malloc(sizeof(Task));
+    if (t == NULL)
+        throwError("p[%2d] t[%3d] taskSpawn: Failed to allocate a task", w->id.p, w->id.t);
+    t->fn = fn;
+    t->arg = arg;
+
+    // counted before it becomes visible, so pending cannot reach 0 while the task is queued
+    __atomic_fetch_add(&w->pool->pending, 1, __ATOMIC_ACQ_REL);
+    if (!dequePush(&w->deque, t))
+    {
+        __atomic_fetch_sub(&w->pool->pending, 1, __ATOMIC_ACQ_REL);
+        free(t);
+        fn(arg, w); // deque full: the parent is still running, so running the child inline is always safe
+    }
+}
+
+// Runs body(ctx, b) for every b in [0, nBlocks) as separate tasks, then done(ctx) on the worker that completes the last block.
+// The caller does not wait: whatever has to happen after the blocks goes in done
+void taskParallelFor(TaskWorker *w, size_t nBlocks, TaskBlockFn body, TaskFn done, void *ctx)
+{
+    if (nBlocks <= 1)
+    {
+        if (nBlocks == 1)
+            body(ctx, 0, w);
+        done(ctx, w);
+        return;
+    }
+
+    ParallelFor *pf = malloc(sizeof(ParallelFor) + nBlocks * sizeof(ParallelForBlock));
+    if (pf == NULL)
+        throwError("p[%2d] t[%3d] taskParallelFor: Failed to allocate %ld blocks", w->id.p, w->id.t, nBlocks);
+    pf->body = body;
+    pf->done = done;
+    pf->ctx = ctx;
+    pf->remaining = nBlocks;
+    for (size_t b = 0; b < nBlocks; b++)
+    {
+        pf->blocks[b].pf = pf;
+        pf->blocks[b].block = b;
+    }
+
+    // spawned in reverse so that the owner pops the low blocks first while thieves take the high ones, block 0 runs right away
+    for (size_t b = nBlocks; b-- > 1;)
+        taskSpawn(w, parallelForBlock, &pf->blocks[b]);
+    parallelForBlock(&pf->blocks[0], w);
+}
+
+ProcThreadIDCombo *taskWorkerID(TaskWorker *w)
+{
+    return &w->id;
+}
+
+static void parallelForBlock(void *arg, TaskWorker *w)
+{
+    ParallelForBlock *blk = (ParallelForBlock*)arg;
+    ParallelFor *pf = blk->pf;
+    pf->body(pf->ctx, blk->block, w);
+    if (__atomic_sub_fetch(&pf->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        TaskFn done = pf->done;
+        void *ctx = pf->ctx;
+        free(pf);
+        done(ctx, w);
+    }
+}
+
+static inline uint64_t nextRandom(uint64_t *state)
+{
+    // xorshift64
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void *taskWorkerThread(void *arg)
+{
+    TaskWorker *w = (TaskWorker*)arg;
+    TaskPool *pool = w->pool;
+    perfThreadOpen();
+    PerfValues perfStart = perfRead();
+
+    size_t executed = 0, stolen = 0;
+    int failedRounds = 0;
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0)
+    {
+        bool isStolen = false;
+        Task *t = dequePop(&w->deque);
+        if ((t == NULL) && (pool->nThreads > 1))
+        {
+            // one round tries every other worker once, starting from a random one
+            int first = (int)(nextRandom(&w->rng) % pool->nThreads);
+            for (int i = 0; (i < pool->nThreads) && (t == NULL); i++)
+            {
+                int victim = (first + i) % pool->nThreads;
+                if (victim != w->id.t)
+                    t = dequeSteal(&pool->workers[victim].deque);
+            }
+            isStolen = (t != NULL);
+        }
+
+        if (t == NULL)
+        {
+            // yielding matters when there are more workers than cores, the worker holding the work must get the cpu
+            if (++failedRounds >= TASK_STEAL_ROUNDS)
+            {
+                sched_yield();
+                failedRounds = 0;
+            }
+            else
+                __builtin_ia32_pause();
+            continue;
+        }
+        failedRounds = 0;
+
+        traceBegin(&w->id, TRACE_TASK);
+        t->fn(t->arg, w);
+        traceEnd(&w->id, TRACE_TASK, isStolen);
+        free(t);
+        executed++;
+        stolen += isStolen;
+        __atomic_fetch_sub(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    }
+
+    perfAccumulate(&w->id, PHASE_QUICKHULL, &perfStart);
+    perfThreadClose();
+    LOG(LOG_LVL_DEBUG, "p[%2d] t[%3d] taskWorkerThread: Executed %ld tasks, %ld of them stolen", w->id.p, w->id.t, executed, stolen);
+
+    return NULL;
+}
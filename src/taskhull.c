@@ -0,0 +1,587 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <immintrin.h>
+
+#define TASKHULL_BLOCK_POINTS (1UL << 16) // points classified by one task, larger sets are split in blocks of this size
+#define TASKHULL_SPAWN_THRESHOLD 1024 // smaller outside sets are hulled by the task that found them instead of by a new task
+#define TASKHULL_MAX_EDGES 4
+
+// Task-parallel quickhull: the outside set of every edge is an independent task that finds its farthest point, splits the set
+// between the two new edges and hands them to two child tasks. The classification of a set larger than a block is itself split
+// in block tasks, so the first levels (few sets, many points) use every worker too
+
+typedef struct HullNode
+{
+    float x, y;
+    PointIndex i; // only set when the points have indices
+    struct HullNode *left, *right; // hull vertices between the start of the edge and this one, and between this one and the end
+} HullNode;
+
+// per block counters of a SplitJob
+typedef struct
+{
+    size_t count[TASKHULL_MAX_EDGES];
+    size_t offset[TASKHULL_MAX_EDGES];
+    double maxDist[TASKHULL_MAX_EDGES];
+    size_t farthest[TASKHULL_MAX_EDGES]; // index in src
+} SplitBlock;
+
+// splits src among the outside sets of a chain of edges: classify every point (blocks in parallel), size the sets,
+// scatter the points into them (blocks in parallel) and finally start an EdgeTask for every set that is not empty
+typedef struct
+{
+    Data src;
+    bool ownsSrc; // src.X (X and Y in one allocation) and src.I are freed when the split is done
+    int nEdges;
+    float chainX[TASKHULL_MAX_EDGES+1], chainY[TASKHULL_MAX_EDGES+1]; // edge e goes from chain[e] to chain[e+1]
+    double a[TASKHULL_MAX_EDGES], b[TASKHULL_MAX_EDGES], c[TASKHULL_MAX_EDGES];
+    HullNode **slots[TASKHULL_MAX_EDGES]; // where the vertices found outside edge e are attached
+    size_t nBlocks;
+    uint8_t *labels; // edge the point is outside of, nEdges if it is inside all of them
+    SplitBlock *blocks;
+    Data out[TASKHULL_MAX_EDGES];
+    size_t farthestSrc[TASKHULL_MAX_EDGES]; // index in src of the farthest point of each set
+    size_t farthest[TASKHULL_MAX_EDGES]; // index in out of the same point
+} SplitJob;
+
+typedef struct
+{
+    float ax, ay, bx, by;
+    Data pts;
+    size_t farthest;
+    HullNode **slot;
+} EdgeTask;
+
+typedef struct
+{
+    Data *d;
+    size_t nBlocks;
+    size_t (*extremes)[4]; // per block: lowest, rightmost, highest, leftmost point
+    int nVertices;
+    float X[TASKHULL_MAX_EDGES], Y[TASKHULL_MAX_EDGES];
+    PointIndex I[TASKHULL_MAX_EDGES];
+    HullNode *subtrees[TASKHULL_MAX_EDGES];
+} TaskhullRoot;
+
+static void rootTask(void *arg, TaskWorker *w);
+static void splitJobStart(SplitJob *job, TaskWorker *w);
+static size_t countNodes(HullNode *node);
+static void collectNodes(HullNode *node, Data *hull);
+
+Data taskhull(Data *d, int procID, int nThreads)
+{
+    double startTime = getTime();
+
+    TaskhullRoot root = { .d=d, .nVertices=0 };
+    for (int e = 0; e < TASKHULL_MAX_EDGES; e++)
+        root.subtrees[e] = NULL;
+    if (d->n > 0)
+        taskPoolRun(nThreads, procID, rootTask, &root);
+
+    size_t n = root.nVertices;
+    for (int e = 0; e < root.nVertices; e++)
+        n += countNodes(root.subtrees[e]);
+
+    // same layout as the hulls of quickhull: CCW from the lowest point, X and Y in two allocations, closing point at [n]
+    Data hull = { .n=0 };
+    hull.X = malloc((n+1) * sizeof(float) + MALLOC_PADDING);
+    hull.Y = malloc((n+1) * sizeof(float) + MALLOC_PADDING);
+    hull.I = NULL;
+    if (d->I != NULL)
+        hull.I = malloc((n+1) * sizeof(PointIndex) + MALLOC_PADDING);
+    if ((hull.X == NULL) || (hull.Y == NULL) || ((d->I != NULL) && (hull.I == NULL)))
+        throwError("p[%2d] taskhull: Failed to allocate memory for a hull of %ld points", procID, n);
+    for (int e = 0; e < root.nVertices; e++)
+    {
+        hull.X[hull.n] = root.X[e];
+        hull.Y[hull.n] = root.Y[e];
+        if (hull.I != NULL)
+            hull.I[hull.n] = root.I[e];
+        hull.n++;
+        collectNodes(root.subtrees[e], &hull);
+    }
+    if (hull.n > 0)
+    {
+        hull.X[hull.n] = hull.X[0];
+        hull.Y[hull.n] = hull.Y[0];
+        if (hull.I != NULL)
+            hull.I[hull.n] = hull.I[0];
+    }
+
+    #ifdef DEBUG
+        ProcThreadIDCombo id = { .p=procID, .t=0 };
+        if (hullConvexityCheck(&hull, &id))
+            throwError("p[%2d] taskhull: Hull is not convex. n=%ld, hullSize=%ld", procID, d->n, hull.n);
+        if (finalCoverageCheck(&hull, d, &id) != 0)
+            throwError("p[%2d] taskhull: Some points are not inside the hull", procID);
+    #endif
+
+    LOG(LOG_LVL_NOTICE, "p[%2d] taskhull: finished hull computation in %lfs, hullSize=%ld", procID, getTime() - startTime, hull.n);
+
+    return hull;
+}
+
+// k: 0 lowest (rightmost on ties), 1 rightmost (upmost), 2 highest (leftmost), 3 leftmost (lowest), like getExtremeCoordsPts of quickhull
+static inline bool moreExtreme(int k, float x, float y, float bestX, float bestY)
+{
+    switch (k)
+    {
+    case 0: return (y < bestY) || ((y == bestY) && (x > bestX));
+    case 1: return (x > bestX) || ((x == bestX) && (y > bestY));
+    case 2: return (y > bestY) || ((y == bestY) && (x < bestX));
+    default: return (x < bestX) || ((x == bestX) && (y < bestY));
+    }
+}
+
+static void extremesBlock(void *ctx, size_t block, TaskWorker *w)
+{
+    TaskhullRoot *root = (TaskhullRoot*)ctx;
+    float *X = root->d->X, *Y = root->d->Y;
+    size_t first = block * TASKHULL_BLOCK_POINTS;
+    size_t last = first + TASKHULL_BLOCK_POINTS < root->d->n ? first + TASKHULL_BLOCK_POINTS : root->d->n;
+
+    size_t *ext = root->extremes[block];
+    for (int k = 0; k < 4; k++)
+        ext[k] = first;
+
+    size_t i = first + 1;
+    if (last - first >= 16)
+    {
+        // every direction as (primary, secondary) keys where higher is better: (-y, x), (x, y), (y, -x), (-x, -y).
+        // 8 lanes keep their own best, indices are relative to the block so they fit 32 bits
+        const __m256 signBit = _mm256_set1_ps(-0.f);
+        __m256 bestP[4], bestS[4];
+        __m256i bestIdx[4];
+        __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i eight = _mm256_set1_epi32(8);
+        for (i = first; i + 8 <= last; i += 8)
+        {
+            __m256 x = _mm256_loadu_ps(&X[i]);
+            __m256 y = _mm256_loadu_ps(&Y[i]);
+            __m256 negX = _mm256_xor_ps(x, signBit);
+            __m256 negY = _mm256_xor_ps(y, signBit);
+            __m256 P[4] = { negY, x, y, negX };
+            __m256 S[4] = { x, y, negX, negY };
+            for (int k = 0; k < 4; k++)
+            {
+                if (i == first)
+                {
+                    bestP[k] = P[k];
+                    bestS[k] = S[k];
+                    bestIdx[k] = idx;
+                    continue;
+                }
+                __m256 better = _mm256_or_ps(_mm256_cmp_ps(P[k], bestP[k], _CMP_GT_OQ),
+                                             _mm256_and_ps(_mm256_cmp_ps(P[k], bestP[k], _CMP_EQ_OQ), _mm256_cmp_ps(S[k], bestS[k], _CMP_GT_OQ)));
+                bestP[k] = _mm256_blendv_ps(bestP[k], P[k], better);
+                bestS[k] = _mm256_blendv_ps(bestS[k], S[k], better);
+                bestIdx[k] = _mm256_blendv_epi8(bestIdx[k], idx, _mm256_castps_si256(better));
+            }
+            idx = _mm256_add_epi32(idx, eight);
+        }
+
+        for (int k = 0; k < 4; k++)
+        {
+            int32_t idxs[8];
+            _mm256_storeu_si256((__m256i_u*)idxs, bestIdx[k]);
+            for (int l = 0; l < 8; l++)
+                if (moreExtreme(k, X[first + idxs[l]], Y[first + idxs[l]], X[ext[k]], Y[ext[k]]))
+                    ext[k] = first + idxs[l];
+        }
+    }
+
+    for (; i < last; i++)
+        for (int k = 0; k < 4; k++)
+            if (moreExtreme(k, X[i], Y[i], X[ext[k]], Y[ext[k]]))
+                ext[k] = i;
+}
+
+static void extremesDone(void *ctx, TaskWorker *w)
+{
+    TaskhullRoot *root = (TaskhullRoot*)ctx;
+    float *X = root->d->X, *Y = root->d->Y;
+
+    size_t ext[4];
+    for (int k = 0; k < 4; k++)
+    {
+        ext[k] = root->extremes[0][k];
+        for (size_t b = 1; b < root->nBlocks; b++)
+            if (moreExtreme(k, X[root->extremes[b][k]], Y[root->extremes[b][k]], X[ext[k]], Y[ext[k]]))
+                ext[k] = root->extremes[b][k];
+    }
+    free(root->extremes);
+
+    // the extreme points in CCW order, without repetitions when the same point is extreme in more directions
+    for (int k = 0; k < 4; k++)
+    {
+        float x = X[ext[k]], y = Y[ext[k]];
+        if ((root->nVertices > 0) && (((root->X[root->nVertices-1] == x) && (root->Y[root->nVertices-1] == y)) || ((root->X[0] == x) && (root->Y[0] == y))))
+            continue;
+        root->X[root->nVertices] = x;
+        root->Y[root->nVertices] = y;
+        if (root->d->I != NULL)
+            root->I[root->nVertices] = root->d->I[ext[k]];
+        root->nVertices++;
+    }
+    if (root->nVertices < 2)
+        return; // every point is the same point
+
+    SplitJob *job = malloc(sizeof(SplitJob));
+    if (job == NULL)
+        throwError("p[%2d] t[%3d] taskhull: Failed to allocate a split job", taskWorkerID(w)->p, taskWorkerID(w)->t);
+    job->src = *root->d;
+    job->ownsSrc = false;
+    job->nEdges = root->nVertices;
+    for (int e = 0; e < root->nVertices; e++)
+    {
+        job->chainX[e] = root->X[e];
+        job->chainY[e] = root->Y[e];
+        job->slots[e] = &root->subtrees[e];
+    }
+    job->chainX[root->nVertices] = root->X[0];
+    job->chainY[root->nVertices] = root->Y[0];
+    splitJobStart(job, w);
+}
+
+static void rootTask(void *arg, TaskWorker *w)
+{
+    TaskhullRoot *root = (TaskhullRoot*)arg;
+    root->nBlocks = (root->d->n + TASKHULL_BLOCK_POINTS - 1) / TASKHULL_BLOCK_POINTS;
+    root->extremes = malloc(root->nBlocks * sizeof(*root->extremes));
+    if (root->extremes == NULL)
+        throwError("p[%2d] t[%3d] taskhull: Failed to allocate memory for the extreme points", taskWorkerID(w)->p, taskWorkerID(w)->t);
+    taskParallelFor(w, root->nBlocks, extremesBlock, extremesDone, root);
+}
+
+static void edgeTask(void *arg, TaskWorker *w)
+{
+    EdgeTask *et = (EdgeTask*)arg;
+
+    HullNode *node = malloc(sizeof(HullNode));
+    SplitJob *job = malloc(sizeof(SplitJob));
+    if ((node == NULL) || (job == NULL))
+        throwError("p[%2d] t[%3d] edgeTask: Failed to allocate memory", taskWorkerID(w)->p, taskWorkerID(w)->t);
+    node->x = et->pts.X[et->farthest];
+    node->y = et->pts.Y[et->farthest];
+    if (et->pts.I != NULL)
+        node->i = et->pts.I[et->farthest];
+    node->left = node->right = NULL;
+    *et->slot = node;
+
+    // the farthest point splits the edge in two, the points inside the triangle they form are discarded
+    job->src = et->pts;
+    job->ownsSrc = true;
+    job->nEdges = 2;
+    job->chainX[0] = et->ax; job->chainY[0] = et->ay;
+    job->chainX[1] = node->x; job->chainY[1] = node->y;
+    job->chainX[2] = et->bx; job->chainY[2] = et->by;
+    job->slots[0] = &node->left;
+    job->slots[1] = &node->right;
+    free(et);
+
+    splitJobStart(job, w);
+}
+
+// lane masks of the classification: byte l of laneBytes[m] is 0xFF when bit l of m is set
+static const uint32_t laneBytes[16] = {
+    0x00000000, 0x000000FF, 0x0000FF00, 0x0000FFFF, 0x00FF0000, 0x00FF00FF, 0x00FFFF00, 0x00FFFFFF,
+    0xFF000000, 0xFF0000FF, 0xFF00FF00, 0xFF00FFFF, 0xFFFF0000, 0xFFFF00FF, 0xFFFFFF00, 0xFFFFFFFF
+};
+
+// a point can be outside only one edge of the chain: the chains are either the extreme points of the set,
+// whose outside regions are the disjoint corners of the bounding box, or two edges meeting at the farthest point.
+// Rounding can put the end points of an edge a hair outside it, they would come back as farthest point forever, so they are excluded
+static inline bool isEdgeEnd(SplitJob *job, int e, float x, float y)
+{
+    return ((x == job->chainX[e]) && (y == job->chainY[e])) || ((x == job->chainX[e+1]) && (y == job->chainY[e+1]));
+}
+
+typedef struct
+{
+    __m128 x0, y0, x1, y1;
+} EdgeEnds;
+
+// lanes of 4 points that are one of the end points of the edge
+static inline int edgeEnds4(__m128 x, __m128 y, EdgeEnds *ends)
+{
+    __m128 isStart = _mm_and_ps(_mm_cmpeq_ps(x, ends->x0), _mm_cmpeq_ps(y, ends->y0));
+    __m128 isEnd = _mm_and_ps(_mm_cmpeq_ps(x, ends->x1), _mm_cmpeq_ps(y, ends->y1));
+    return _mm_movemask_ps(_mm_or_ps(isStart, isEnd));
+}
+
+static void classifyBlock(void *ctx, size_t block, TaskWorker *w)
+{
+    SplitJob *job = (SplitJob*)ctx;
+    float *X = job->src.X, *Y = job->src.Y;
+    size_t first = block * TASKHULL_BLOCK_POINTS;
+    size_t last = first + TASKHULL_BLOCK_POINTS < job->src.n ? first + TASKHULL_BLOCK_POINTS : job->src.n;
+    int nEdges = job->nEdges;
+
+    __m256d a[TASKHULL_MAX_EDGES], b[TASKHULL_MAX_EDGES], c[TASKHULL_MAX_EDGES];
+    __m256d minDist[TASKHULL_MAX_EDGES];
+    __m256i minDistIdx[TASKHULL_MAX_EDGES];
+    size_t count[TASKHULL_MAX_EDGES];
+    EdgeEnds ends[TASKHULL_MAX_EDGES];
+    for (int e = 0; e < nEdges; e++)
+    {
+        ends[e].x0 = _mm_set1_ps(job->chainX[e]);
+        ends[e].y0 = _mm_set1_ps(job->chainY[e]);
+        ends[e].x1 = _mm_set1_ps(job->chainX[e+1]);
+        ends[e].y1 = _mm_set1_ps(job->chainY[e+1]);
+        a[e] = _mm256_set1_pd(job->a[e]);
+        b[e] = _mm256_set1_pd(job->b[e]);
+        c[e] = _mm256_set1_pd(job->c[e]);
+        minDist[e] = _mm256_setzero_pd();
+        minDistIdx[e] = _mm256_set1_epi64x(-1);
+        count[e] = 0;
+    }
+    const __m256i laneBits = _mm256_setr_epi64x(1, 2, 4, 8);
+    const __m256i four = _mm256_set1_epi64x(4);
+    __m256i idx = _mm256_add_epi64(_mm256_set1_epi64x(first), _mm256_setr_epi64x(0, 1, 2, 3));
+
+    size_t i = first;
+    for (; i + 4 <= last; i += 4)
+    {
+        __m128 fX = _mm_loadu_ps(&X[i]);
+        __m128 fY = _mm_loadu_ps(&Y[i]);
+        __m256d ptX = _mm256_cvtps_pd(fX);
+        __m256d ptY = _mm256_cvtps_pd(fY);
+        uint32_t labels = nEdges * 0x01010101U;
+        for (int e = 0; e < nEdges; e++)
+        {
+            __m256d dist = _mm256_fmadd_pd(a[e], ptY, _mm256_fmadd_pd(b[e], ptX, c[e]));
+            int m = _mm256_movemask_pd(_mm256_cmp_pd(dist, _mm256_setzero_pd(), _CMP_LT_OQ)) & ~edgeEnds4(fX, fY, &ends[e]);
+
+            count[e] += __builtin_popcount(m);
+            labels = (labels & ~laneBytes[m]) | (laneBytes[m] & (e * 0x01010101U));
+            // the lanes that are not outside get dist=0, which never beats the current farthest
+            __m256i lanes = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(m), laneBits), laneBits);
+            dist = _mm256_and_pd(dist, _mm256_castsi256_pd(lanes));
+            __m256d farther = _mm256_cmp_pd(dist, minDist[e], _CMP_LT_OQ);
+            minDist[e] = _mm256_min_pd(minDist[e], dist);
+            minDistIdx[e] = _mm256_blendv_epi8(minDistIdx[e], idx, _mm256_castpd_si256(farther));
+        }
+        memcpy(&job->labels[i], &labels, sizeof(labels));
+        idx = _mm256_add_epi64(idx, four);
+    }
+
+    // reduce the lanes, on ties the lowest index wins like in the serial order
+    SplitBlock *sb = &job->blocks[block];
+    for (int e = 0; e < nEdges; e++)
+    {
+        double dists[4];
+        int64_t idxs[4];
+        _mm256_storeu_pd(dists, minDist[e]);
+        _mm256_storeu_si256((__m256i_u*)idxs, minDistIdx[e]);
+        sb->count[e] = count[e];
+        sb->maxDist[e] = 0;
+        sb->farthest[e] = -1;
+        for (int l = 0; l < 4; l++)
+        {
+            if (idxs[l] < 0)
+                continue;
+            if ((dists[l] < sb->maxDist[e]) || ((dists[l] == sb->maxDist[e]) && ((size_t)idxs[l] < sb->farthest[e])))
+            {
+                sb->maxDist[e] = dists[l];
+                sb->farthest[e] = idxs[l];
+            }
+        }
+    }
+
+    for (; i < last; i++)
+    {
+        double x = X[i], y = Y[i];
+        uint8_t label = nEdges;
+        for (int e = 0; e < nEdges; e++)
+        {
+            double dist = job->b[e] * x + job->a[e] * y + job->c[e];
+            if (dist < 0)
+            {
+                if (isEdgeEnd(job, e, X[i], Y[i]))
+                    break;
+                label = e;
+                sb->count[e]++;
+                if (dist < sb->maxDist[e])
+                {
+                    sb->maxDist[e] = dist;
+                    sb->farthest[e] = i;
+                }
+                break;
+            }
+        }
+        job->labels[i] = label;
+    }
+}
+
+// withIndices is a constant in the two instantiations below, classifyDone picks the one matching the points
+static inline __attribute__((always_inline)) void scatterBlockImpl(void *ctx, size_t block, const bool withIndices)
+{
+    SplitJob *job = (SplitJob*)ctx;
+    float *X = job->src.X, *Y = job->src.Y;
+    PointIndex *I = job->src.I;
+    size_t first = block * TASKHULL_BLOCK_POINTS;
+    size_t last = first + TASKHULL_BLOCK_POINTS < job->src.n ? first + TASKHULL_BLOCK_POINTS : job->src.n;
+    int nEdges = job->nEdges;
+
+    // branch-free: the points inside every edge are written to a sink whose position never advances
+    float sinkX[1], sinkY[1];
+    PointIndex sinkI[1];
+    float *dstX[TASKHULL_MAX_EDGES+1], *dstY[TASKHULL_MAX_EDGES+1];
+    PointIndex *dstI[TASKHULL_MAX_EDGES+1];
+    size_t pos[TASKHULL_MAX_EDGES+1];
+    size_t farthestSrc[TASKHULL_MAX_EDGES+1];
+    SplitBlock *sb = &job->blocks[block];
+    for (int e = 0; e < nEdges; e++)
+    {
+        dstX[e] = job->out[e].X;
+        dstY[e] = job->out[e].Y;
+        dstI[e] = job->out[e].I;
+        pos[e] = sb->offset[e];
+        farthestSrc[e] = job->farthestSrc[e];
+    }
+    dstX[nEdges] = sinkX;
+    dstY[nEdges] = sinkY;
+    dstI[nEdges] = sinkI;
+    pos[nEdges] = 0;
+    farthestSrc[nEdges] = -1;
+
+    for (size_t i = first; i < last; i++)
+    {
+        int e = job->labels[i];
+        dstX[e][pos[e]] = X[i];
+        dstY[e][pos[e]] = Y[i];
+        if (withIndices)
+            dstI[e][pos[e]] = I[i];
+        if (i == farthestSrc[e])
+            job->farthest[e] = pos[e];
+        pos[e] += (e != nEdges);
+    }
+}
+
+static void scatterBlock(void *ctx, size_t block, TaskWorker *w)
+{
+    scatterBlockImpl(ctx, block, false);
+}
+
+static void scatterBlockIndices(void *ctx, size_t block, TaskWorker *w)
+{
+    scatterBlockImpl(ctx, block, true);
+}
+
+static void scatterDone(void *ctx, TaskWorker *w)
+{
+    SplitJob *job = (SplitJob*)ctx;
+
+    free(job->labels);
+    free(job->blocks);
+    if (job->ownsSrc)
+    {
+        free(job->src.X);
+        free(job->src.I);
+    }
+
+    for (int e = 0; e < job->nEdges; e++)
+    {
+        if (job->out[e].n == 0)
+            continue;
+
+        EdgeTask *et = malloc(sizeof(EdgeTask));
+        if (et == NULL)
+            throwError("p[%2d] t[%3d] taskhull: Failed to allocate an edge task", taskWorkerID(w)->p, taskWorkerID(w)->t);
+        et->ax = job->chainX[e];
+        et->ay = job->chainY[e];
+        et->bx = job->chainX[e+1];
+        et->by = job->chainY[e+1];
+        et->pts = job->out[e];
+        et->farthest = job->farthest[e];
+        et->slot = job->slots[e];
+
+        if (et->pts.n >= TASKHULL_SPAWN_THRESHOLD)
+            taskSpawn(w, edgeTask, et);
+        else
+            edgeTask(et, w);
+    }
+
+    free(job);
+}
+
+static void classifyDone(void *ctx, TaskWorker *w)
+{
+    SplitJob *job = (SplitJob*)ctx;
+
+    for (int e = 0; e < job->nEdges; e++)
+    {
+        // the blocks are visited in order and only a strictly farther point wins, so ties go to the lowest index like in quickhull
+        size_t n = 0;
+        double maxDist = 0;
+        job->farthestSrc[e] = -1;
+        for (size_t b = 0; b < job->nBlocks; b++)
+        {
+            SplitBlock *sb = &job->blocks[b];
+            sb->offset[e] = n;
+            n += sb->count[e];
+            if ((sb->count[e] > 0) && (sb->maxDist[e] < maxDist))
+            {
+                maxDist = sb->maxDist[e];
+                job->farthestSrc[e] = sb->farthest[e];
+            }
+        }
+
+        job->out[e].n = n;
+        job->out[e].X = job->out[e].Y = NULL;
+        job->out[e].I = NULL;
+        if (n == 0)
+            continue;
+        job->out[e].X = malloc(n * 2 * sizeof(float) + MALLOC_PADDING);
+        if (job->src.I != NULL)
+            job->out[e].I = malloc(n * sizeof(PointIndex) + MALLOC_PADDING);
+        if ((job->out[e].X == NULL) || ((job->src.I != NULL) && (job->out[e].I == NULL)))
+            throwError("p[%2d] t[%3d] taskhull: Failed to allocate memory for an outside set of %ld points", taskWorkerID(w)->p, taskWorkerID(w)->t, n);
+        job->out[e].Y = &job->out[e].X[n];
+    }
+
+    taskParallelFor(w, job->nBlocks, job->src.I == NULL ? scatterBlock : scatterBlockIndices, scatterDone, job);
+}
+
+static void splitJobStart(SplitJob *job, TaskWorker *w)
+{
+    for (int e = 0; e < job->nEdges; e++)
+    {
+        double x0 = job->chainX[e], y0 = job->chainY[e];
+        double x1 = job->chainX[e+1], y1 = job->chainY[e+1];
+        job->a[e] = x1 - x0;
+        job->b[e] = y0 - y1;
+        job->c[e] = x0 * y1 - x1 * y0;
+    }
+
+    job->nBlocks = (job->src.n + TASKHULL_BLOCK_POINTS - 1) / TASKHULL_BLOCK_POINTS;
+    job->labels = malloc(job->src.n * sizeof(uint8_t) + MALLOC_PADDING);
+    job->blocks = malloc(job->nBlocks * sizeof(SplitBlock));
+    if ((job->labels == NULL) || (job->blocks == NULL))
+        throwError("p[%2d] t[%3d] taskhull: Failed to allocate memory to split %ld points", taskWorkerID(w)->p, taskWorkerID(w)->t, job->src.n);
+
+    taskParallelFor(w, job->nBlocks, classifyBlock, classifyDone, job);
+}
+
+static size_t countNodes(HullNode *node)
+{
+    if (node == NULL)
+        return 0;
+    return 1 + countNodes(node->left) + countNodes(node->right);
+}
+
+// appends the vertices of the subtree in hull order and frees it
+static void collectNodes(HullNode *node, Data *hull)
+{
+    if (node == NULL)
+        return;
+    collectNodes(node->left, hull);
+    hull->X[hull->n] = node->x;
+    hull->Y[hull->n] = node->y;
+    if (hull->I != NULL)
+        hull->I[hull->n] = node->i;
+    hull->n++;
+    collectNodes(node->right, hull);
+    free(node);
+}
@@ -0,0 +1,430 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <immintrin.h>
+#ifndef NON_MPI_MODE
+    #include <mpi.h>
+#endif
+
+#define TEXT_MIN_BYTES_PER_THREAD (1UL << 20) // smaller parts are not worth a thread
+#define TEXT_MAX_SIGNIFICANT_DIGITS 19 // the mantissa fits in a uint64, longer numbers go through strtod
+#define TEXT_MAX_POW10 22 // 10^22 is the largest power of ten exact in a double
+
+// Text input (--input-format text): one point per line as "x,y" (what --output writes, a third column like its indices is ignored),
+// the separator can be a comma, a semicolon or blanks. Blank lines and lines starting with # are skipped, and so is the first line
+// of the file when it is not a point (a CSV header). The file is mapped, split at line boundaries among the ranks and then among
+// the threads of each rank, and every thread parses its lines straight into the SoA arrays:
+// 1) the newlines are counted 32 bytes at a time with AVX2, the prefix sum of the counts gives every thread its output position
+// 2) the numbers are parsed up to 8 digits at a time with SWAR arithmetic (the digits in one 64 bit word), rounded once from an exact
+//    integer mantissa and an exact power of ten like strtod does in the common case
+// 3) the parts are compacted over the slots left by the skipped lines
+// With --text-cache the points are also written to the raw FILENAME.raw, which later runs read instead while it is newer than the text
+
+typedef struct {
+    const char *text; // whole file
+    size_t begin, end; // lines of the thread, end is a line start (or the end of the file)
+    size_t *counts; // newlines of every thread, then the points parsed
+    float **points; // shared allocation of 2 * bound floats, the X then the Y
+    size_t *bound; // upper bound of the points of the rank
+    float *X, *Y; // part of the thread in points, at the prefix sum of the counts
+    pthread_barrier_t *barrier;
+    size_t badLine; // offset in the file of the first line that is not a point, SIZE_MAX if none
+    int nThreads;
+    ProcThreadIDCombo id;
+} TextThreadData;
+
+static const double pow10Table[TEXT_MAX_POW10 + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const uint64_t pow10Int[9] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+static void *textThread(void *arg);
+static size_t nextLineStart(const char *text, size_t size, size_t pos);
+static size_t countNewlines(const char *text, size_t size);
+static size_t parseLines(TextThreadData *thData, size_t first);
+static const char *parseNumber(const char *s, const char *end, float *value);
+static bool writeRawCache(Data *d, const char *path, size_t first, size_t total, int rank, int nProcs);
+
+size_t readFileText(Data *d, Params *p, int rank, int nProcs)
+{
+    char cachePath[1010];
+    snprintf(cachePath, sizeof(cachePath), "%s.raw", p->inputFile);
+
+    // the cache is used while it is newer than the text, rank 0 decides for all so that no rank sees it being rewritten
+    int useCache = 0;
+    if (p->textCache && (rank == 0))
+    {
+        struct stat textStat, cacheStat;
+        useCache = (stat(p->inputFile, &textStat) == 0) && (stat(cachePath, &cacheStat) == 0) && (cacheStat.st_mtime >= textStat.st_mtime);
+    }
+    #ifndef NON_MPI_MODE
+        if (p->textCache && (nProcs > 1))
+            MPI_Bcast(&useCache, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    #endif
+    if (useCache)
+    {
+        Params cacheParams = *p;
+        strncpy(cacheParams.inputFile, cachePath, sizeof(cacheParams.inputFile) - 1);
+        cacheParams.nProcs = nProcs;
+        if (nProcs > 1)
+            readFilePart(d, &cacheParams, rank);
+        else
+            readFile(d, &cacheParams);
+        LOG(LOG_LVL_INFO, "p[%2d] readFileText: Read %ld points from the cache %s", rank, d->n, cachePath);
+        return d->n * 2 * sizeof(float);
+    }
+
+    double startTime = getTime();
+    int fd = open(p->inputFile, O_RDONLY);
+    if (fd < 0)
+        throwError("p[%2d] readFileText: Could not open %s", rank, p->inputFile);
+    struct stat fileStat;
+    if (fstat(fd, &fileStat))
+        throwError("p[%2d] readFileText: Could not stat %s", rank, p->inputFile);
+    size_t size = fileStat.st_size;
+    const char *text = NULL;
+    if (size > 0)
+    {
+        text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED)
+            throwError("p[%2d] readFileText: Could not map %s", rank, p->inputFile);
+        madvise((void*)text, size, MADV_SEQUENTIAL);
+    }
+
+    // the lines starting in [size*rank/nProcs, size*(rank+1)/nProcs) belong to the rank, those of its bytes to each thread
+    size_t rankBegin = nextLineStart(text, size, size / nProcs * rank);
+    size_t rankEnd = rank == nProcs - 1 ? size : nextLineStart(text, size, size / nProcs * (rank + 1));
+    int nThreads = p->nThreads;
+    if ((rankEnd - rankBegin) / TEXT_MIN_BYTES_PER_THREAD < (size_t)nThreads)
+        nThreads = (rankEnd - rankBegin) / TEXT_MIN_BYTES_PER_THREAD > 0 ? (int)((rankEnd - rankBegin) / TEXT_MIN_BYTES_PER_THREAD) : 1;
+
+    pthread_t threads[MAX_THREADS];
+    TextThreadData ds[MAX_THREADS];
+    size_t counts[MAX_THREADS], bound = 0;
+    float *points = NULL;
+    Data out = { .n=0, .X=NULL, .Y=NULL, .I=NULL };
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, nThreads);
+    for (int i = 0; i < nThreads; i++)
+    {
+        ds[i].text = text;
+        ds[i].begin = i == 0 ? rankBegin : nextLineStart(text, rankEnd, rankBegin + (rankEnd - rankBegin) / nThreads * i);
+        ds[i].end = i == nThreads - 1 ? rankEnd : nextLineStart(text, rankEnd, rankBegin + (rankEnd - rankBegin) / nThreads * (i + 1));
+        ds[i].counts = counts;
+        ds[i].points = &points;
+        ds[i].bound = &bound;
+        ds[i].X = NULL;
+        ds[i].Y = NULL;
+        ds[i].barrier = &barrier;
+        ds[i].badLine = SIZE_MAX;
+        ds[i].nThreads = nThreads;
+        ds[i].id.p = rank;
+        ds[i].id.t = i;
+    }
+    for (int i = 0; i < nThreads; i++)
+        pthread_create(&threads[i], NULL, textThread, (void*)&ds[i]);
+    for (int i = 0; i < nThreads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&barrier);
+
+    for (int i = 0; i < nThreads; i++)
+        if (ds[i].badLine != SIZE_MAX)
+        {
+            const char *line = &text[ds[i].badLine];
+            const char *lineEnd = memchr(line, '\n', rankEnd - ds[i].badLine);
+            int length = (lineEnd == NULL ? &text[rankEnd] : lineEnd) - line;
+            length = length < 60 ? length : 60;
+            throwError("p[%2d] readFileText: The line at byte %ld of %s is not a point: \"%.*s\"", rank, ds[i].badLine, p->inputFile, length, line);
+        }
+
+    // 3) the parts were written at the positions of an upper bound of the points, compacted here in order (the destination never
+    // passes the source), first the X then the Y which end up right after the last X
+    out.X = points;
+    for (int i = 0; i < nThreads; i++)
+    {
+        memmove(&out.X[out.n], ds[i].X, counts[i] * sizeof(float));
+        out.n += counts[i];
+    }
+    out.Y = &out.X[out.n];
+    for (size_t i = 0, k = 0; i < (size_t)nThreads; k += counts[i], i++)
+        memmove(&out.Y[k], ds[i].Y, counts[i] * sizeof(float));
+
+    if (text != NULL)
+        munmap((void*)text, size);
+    close(fd);
+
+    size_t first = 0, total = out.n;
+    #ifndef NON_MPI_MODE
+        if (nProcs > 1) // a single rank can read the whole file on its own, e.g. for a check
+        {
+            unsigned long localN = out.n, before = 0, all = 0;
+            MPI_Exscan(&localN, &before, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+            MPI_Allreduce(&localN, &all, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+            first = rank == 0 ? 0 : before; // the result of MPI_Exscan is undefined on rank 0
+            total = all;
+        }
+    #endif
+    if (p->trackIndices)
+        initIndices(&out, first, total);
+    *d = out;
+    double parseTime = getTime() - startTime;
+    LOG(LOG_LVL_INFO, "p[%2d] readFileText: Parsed %ld points from %ld bytes with %d threads in %lfs (%.0lf MB/s)", rank, d->n, rankEnd - rankBegin, nThreads,
+        parseTime, (rankEnd - rankBegin) / parseTime / 1e6);
+
+    if (p->textCache)
+    {
+        int failed = !writeRawCache(d, cachePath, first, total, rank, nProcs);
+        #ifndef NON_MPI_MODE
+            if (nProcs > 1)
+                MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        #endif
+        char tmpPath[1020];
+        snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", cachePath);
+        if ((rank == 0) && (failed || rename(tmpPath, cachePath)))
+        {
+            unlink(tmpPath);
+            LOG(LOG_LVL_WARN, "p[%2d] readFileText: Could not write the cache %s, the text will be parsed again next time", rank, cachePath);
+        }
+        else if (rank == 0)
+            LOG(LOG_LVL_INFO, "p[%2d] readFileText: Points cached in %s", rank, cachePath);
+    }
+
+    return rankEnd - rankBegin;
+}
+
+static void *textThread(void *arg)
+{
+    TextThreadData *thData = (TextThreadData*)arg;
+    int t = thData->id.t;
+
+    // 1) upper bound of the points: one per line, the last one may have no newline
+    size_t length = thData->end - thData->begin;
+    thData->counts[t] = countNewlines(&thData->text[thData->begin], length);
+    if ((length > 0) && (thData->text[thData->end - 1] != '\n'))
+        thData->counts[t]++;
+
+    // one thread allocates for all once every count is known
+    if (pthread_barrier_wait(thData->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    {
+        *thData->bound = 0;
+        for (int i = 0; i < thData->nThreads; i++)
+            *thData->bound += thData->counts[i];
+        *thData->points = malloc(*thData->bound * 2 * sizeof(float) + MALLOC_PADDING);
+        if (*thData->points == NULL)
+            throwError("p[%2d] readFileText: Failed to allocate memory for %ld points", thData->id.p, *thData->bound);
+    }
+    pthread_barrier_wait(thData->barrier);
+    size_t offset = 0;
+    for (int i = 0; i < t; i++)
+        offset += thData->counts[i];
+    thData->X = &(*thData->points)[offset];
+    thData->Y = &(*thData->points)[*thData->bound + offset];
+    pthread_barrier_wait(thData->barrier); // the counts of the previous threads are read before they are replaced
+
+    // 2) the counts are replaced by the points actually parsed
+    thData->counts[t] = parseLines(thData, thData->begin);
+    return NULL;
+}
+
+// start of the first line that starts at or after pos
+static size_t nextLineStart(const char *text, size_t size, size_t pos)
+{
+    if ((pos == 0) || (pos >= size))
+        return pos < size ? pos : size;
+    const char *newline = memchr(&text[pos - 1], '\n', size - pos + 1);
+    return newline == NULL ? size : (size_t)(newline - text) + 1;
+}
+
+static size_t countNewlines(const char *text, size_t size)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0, i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i_u*)&text[i]);
+        count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, newline)));
+    }
+    for (; i < size; i++)
+        count += text[i] == '\n';
+    return count;
+}
+
+// points parsed from the lines of the thread into X and Y, the first line that is not a point goes to badLine (except the header)
+static size_t parseLines(TextThreadData *thData, size_t first)
+{
+    const char *s = &thData->text[first], *end = &thData->text[thData->end];
+    size_t k = 0;
+    // no number, blank or separator goes past a newline, so the line end is only looked for when the line is not just "x,y\n"
+    while (s < end)
+    {
+        const char *lineStart = s;
+        while ((s < end) && ((*s == ' ') || (*s == '\t')))
+            s++;
+        bool skip = (s == end) || (*s == '\n') || (*s == '#') || (*s == '\r');
+        if (!skip)
+        {
+            s = parseNumber(s, end, &thData->X[k]);
+            if (s != NULL)
+            {
+                while ((s < end) && ((*s == ' ') || (*s == '\t')))
+                    s++;
+                if ((s < end) && ((*s == ',') || (*s == ';')))
+                    s++;
+                while ((s < end) && ((*s == ' ') || (*s == '\t')))
+                    s++;
+                s = parseNumber(s, end, &thData->Y[k]);
+            }
+            if ((s != NULL) && (s < end) && (*s != '\n') && (*s != ',') && (*s != ';') && (*s != ' ') && (*s != '\t') && (*s != '\r'))
+                s = NULL; // trailing garbage glued to y
+            if (s != NULL)
+                k++;
+            else if ((lineStart != thData->text) && (thData->badLine == SIZE_MAX)) // the first line of the file can be a header
+                thData->badLine = lineStart - thData->text;
+        }
+        if ((s != NULL) && (s < end) && (*s == '\n'))
+            s++;
+        else
+        {
+            const char *lineEnd = memchr(lineStart, '\n', end - lineStart);
+            s = lineEnd == NULL ? end : lineEnd + 1;
+        }
+    }
+    return k;
+}
+
+static inline uint64_t load8(const char *s)
+{
+    uint64_t v;
+    memcpy(&v, s, sizeof(v));
+    return v;
+}
+
+// leading bytes of v (from the lowest one) that are ASCII digits. A carry of the addition only reaches the bytes after a byte of
+// at least 0xFA, which is not a digit
+static inline int leadingDigits(uint64_t v)
+{
+    uint64_t notDigits = ((v & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL);
+    return notDigits == 0 ? 8 : __builtin_ctzll(notDigits) / 8;
+}
+
+// the 8 digits of v (first digit in the lowest byte) as an integer: pairs, then quads, then the 8 digits with 3 multiplications
+static inline uint32_t parseEightDigits(uint64_t v)
+{
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * 0x000F424000000064ULL) + (((v >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >> 32;
+    return (uint32_t)v;
+}
+
+// digits of [s, end) into mantissa, returns the first byte after them. Up to 8 digits at a time: the k digits of a word are
+// shifted to its end and preceded by 8-k '0', so that the 8 digit parse gives their value
+static inline const char *parseDigits(const char *s, const char *end, uint64_t *mantissa, int *nDigits)
+{
+    while (s + 8 <= end)
+    {
+        uint64_t v = load8(s);
+        int k = leadingDigits(v);
+        if ((k == 0) || (*nDigits + k > TEXT_MAX_SIGNIFICANT_DIGITS))
+            break;
+        if (k < 8)
+            v = (v << (8 * (8 - k))) | (0x3030303030303030ULL >> (8 * k));
+        *mantissa = *mantissa * pow10Int[k] + parseEightDigits(v);
+        *nDigits += k;
+        s += k;
+        if (k < 8)
+            return s;
+    }
+    for (; (s < end) && (*s >= '0') && (*s <= '9'); s++, (*nDigits)++)
+        *mantissa = *mantissa * 10 + (*s - '0');
+    return s;
+}
+
+// [+-]digits[.digits][(e|E)[+-]digits], returns the first byte after the number or NULL if there is none
+static const char *parseNumber(const char *s, const char *end, float *value)
+{
+    const char *start = s;
+    bool negative = false;
+    if ((s < end) && ((*s == '-') || (*s == '+')))
+        negative = *s++ == '-';
+
+    uint64_t mantissa = 0;
+    int nDigits = 0, exp10 = 0;
+    s = parseDigits(s, end, &mantissa, &nDigits);
+    if ((s < end) && (*s == '.'))
+    {
+        const char *fraction = ++s;
+        s = parseDigits(s, end, &mantissa, &nDigits);
+        exp10 -= s - fraction;
+    }
+    if (nDigits == 0)
+        return NULL;
+    if ((s < end) && ((*s == 'e') || (*s == 'E')))
+    {
+        s++;
+        bool negativeExp = false;
+        if ((s < end) && ((*s == '-') || (*s == '+')))
+            negativeExp = *s++ == '-';
+        if ((s == end) || (*s < '0') || (*s > '9'))
+            return NULL;
+        int e = 0;
+        for (; (s < end) && (*s >= '0') && (*s <= '9'); s++)
+            e = e < 10000 ? e * 10 + (*s - '0') : e;
+        exp10 += negativeExp ? -e : e;
+    }
+
+    // exact mantissa and power of ten: a single rounding. Otherwise (long mantissas, huge exponents) strtod rounds it
+    if ((nDigits <= TEXT_MAX_SIGNIFICANT_DIGITS) && (mantissa < (1ULL << 53)) && (exp10 >= -TEXT_MAX_POW10) && (exp10 <= TEXT_MAX_POW10))
+    {
+        double v = exp10 < 0 ? (double)mantissa / pow10Table[-exp10] : (double)mantissa * pow10Table[exp10];
+        *value = negative ? -v : v;
+        return s;
+    }
+    char buffer[128];
+    if (s - start >= (long)sizeof(buffer))
+        return NULL;
+    memcpy(buffer, start, s - start);
+    buffer[s - start] = 0;
+    *value = strtod(buffer, NULL);
+    return s;
+}
+
+// points of the rank at position first of the total in the raw layout (all the X then all the Y), in FILENAME.raw.tmp
+static bool writeRawCache(Data *d, const char *path, size_t first, size_t total, int rank, int nProcs)
+{
+    char tmpPath[1020];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    int fd = -1;
+    if (rank == 0)
+        fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    #ifndef NON_MPI_MODE
+        if (nProcs > 1)
+            MPI_Barrier(MPI_COMM_WORLD); // created by rank 0 before the others open it
+    #endif
+    if (rank != 0)
+        fd = open(tmpPath, O_WRONLY);
+    if (fd < 0)
+        return false;
+
+    bool ok = true;
+    const char *parts[2] = { (const char*)d->X, (const char*)d->Y };
+    off_t offsets[2] = { first * sizeof(float), (total + first) * sizeof(float) };
+    for (int k = 0; (k < 2) && ok; k++)
+    {
+        size_t done = 0, bytes = d->n * sizeof(float);
+        while (ok && (done < bytes))
+        {
+            ssize_t written = pwrite(fd, &parts[k][done], bytes - done, offsets[k] + done);
+            ok = written > 0;
+            done += ok ? (size_t)written : 0;
+        }
+    }
+    if (close(fd))
+        ok = false;
+    return ok;
+}
@@ -0,0 +1,172 @@
+#include "parallhull.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifndef NON_MPI_MODE
+    #include <mpi.h>
+#endif
+
+#define TRACE_RING_CAPACITY (1UL << 16) // events kept per thread, must be a power of 2 (older ones are overwritten)
+
+typedef struct
+{
+    uint64_t ts; // ns from the trace origin
+    uint64_t arg;
+    uint16_t ev;
+    char ph; // 'B' or 'E' like in the trace-event format
+} TraceRecord;
+
+// every ring is written only by its own thread, so no lock or atomic is needed; aligned to avoid false sharing of the heads
+typedef struct
+{
+    TraceRecord *records;
+    uint64_t head;
+} __attribute__((aligned(64))) TraceRing;
+
+typedef struct
+{
+    bool enabled;
+    int rank;
+    int nThreads;
+    uint64_t origin;
+    TraceRing *rings; // nThreads worker rings + the ring of the main thread at the end
+} TraceState;
+
+// indexed by enum TraceEvent, the argument is the value passed to traceEnd
+static const char *traceEventNames[] = { "read", "prefilter", "quickhull", "quickhullIteration", "mergeP1.2", "spinWait", "mergeP2", "mpiRecv", "mergeMPI", "mpiSend", "task" };
+static const char *traceArgNames[] = { "bytes", "n", "hullSize", "uncovered", "n0", "partner", "n0", "partner", "n0", "partner", "stolen" };
+
+static TraceState trace = { .enabled=false };
+
+static inline uint64_t nowNs()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+static inline void traceRecord(ProcThreadIDCombo *id, enum TraceEvent ev, char ph, uint64_t arg)
+{
+    int slot = (id == NULL) ? trace.nThreads : id->t;
+    if ((slot < 0) || (slot > trace.nThreads))
+        return;
+
+    TraceRing *ring = &trace.rings[slot];
+    TraceRecord *r = &ring->records[ring->head & (TRACE_RING_CAPACITY - 1)];
+    r->ts = nowNs() - trace.origin;
+    r->arg = arg;
+    r->ev = (uint16_t)ev;
+    r->ph = ph;
+    ring->head++;
+}
+
+void traceEnable(int rank, int nThreads)
+{
+    trace.rank = rank;
+    trace.nThreads = nThreads;
+    trace.rings = calloc(nThreads + 1, sizeof(TraceRing));
+    if (trace.rings == NULL)
+        throwError("p[%2d] traceEnable: Failed to allocate the trace rings", rank);
+    for (int i = 0; i <= nThreads; i++)
+    {
+        trace.rings[i].records = malloc(TRACE_RING_CAPACITY * sizeof(TraceRecord));
+        if (trace.rings[i].records == NULL)
+            throwError("p[%2d] traceEnable: Failed to allocate the trace ring of thread %d", rank, i);
+        memset(trace.rings[i].records, 0, TRACE_RING_CAPACITY * sizeof(TraceRecord)); // touch the pages now and not while tracing
+    }
+
+    #ifndef NON_MPI_MODE
+        // ranks take their origin right after a barrier, so that the skew between them is visible on the same timeline
+        MPI_Barrier(MPI_COMM_WORLD);
+    #endif
+    trace.origin = nowNs();
+    trace.enabled = true;
+}
+
+void traceBegin(ProcThreadIDCombo *id, enum TraceEvent ev)
+{
+    if (!trace.enabled) return;
+    traceRecord(id, ev, 'B', 0);
+}
+
+void traceEnd(ProcThreadIDCombo *id, enum TraceEvent ev, uint64_t arg)
+{
+    if (!trace.enabled) return;
+    traceRecord(id, ev, 'E', arg);
+}
+
+static char *serializeTrace()
+{
+    char *buf = NULL;
+    size_t bufLen = 0;
+    FILE *f = open_memstream(&buf, &bufLen);
+    if (f == NULL)
+        throwError("p[%2d] trace: open_memstream failed", trace.rank);
+
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"rank %d\"}}", trace.rank, trace.rank);
+    for (int slot = 0; slot <= trace.nThreads; slot++)
+    {
+        // the main thread is shown first, worker threads are shifted by one
+        int tid = (slot == trace.nThreads) ? 0 : slot + 1;
+        if (slot == trace.nThreads)
+            fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"main\"}}", trace.rank);
+        else
+            fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"t[%d]\"}}", trace.rank, tid, slot);
+
+        TraceRing *ring = &trace.rings[slot];
+        uint64_t first = ring->head > TRACE_RING_CAPACITY ? ring->head - TRACE_RING_CAPACITY : 0;
+        if (first > 0)
+            LOG(LOG_LVL_WARN, "p[%2d] trace: Ring of thread %d overflowed, the oldest %ld events were dropped", trace.rank, slot, first);
+
+        for (uint64_t i = first; i < ring->head; i++)
+        {
+            TraceRecord *r = &ring->records[i & (TRACE_RING_CAPACITY - 1)];
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3lf, \"pid\": %d, \"tid\": %d", traceEventNames[r->ev], r->ph, r->ts / 1000., trace.rank, tid);
+            if (r->ph == 'E')
+                fprintf(f, ", \"args\": {\"%s\": %lu}", traceArgNames[r->ev], r->arg);
+            fprintf(f, "}");
+        }
+    }
+    fclose(f);
+
+    return buf;
+}
+
+// Every rank formats its own events, rank 0 collects them and writes a Chrome/Perfetto trace-event JSON file
+void traceWrite(const char *fname, Params *p)
+{
+    if (!trace.enabled) return;
+    trace.enabled = false;
+
+    char *local = serializeTrace();
+
+    #ifdef NON_MPI_MODE
+        char *all = local;
+    #else
+        char *all = gatherText(local, trace.rank, p->nProcs, ",\n");
+        free(local);
+    #endif
+
+    for (int i = 0; i <= trace.nThreads; i++)
+        free(trace.rings[i].records);
+    free(trace.rings);
+
+    #ifndef NON_MPI_MODE
+        if (trace.rank != 0)
+            return;
+    #endif
+
+    FILE *f = fopen(fname, "w");
+    if (f == NULL)
+    {
+        LOG(LOG_LVL_ERROR, "traceWrite: Could not open %s", fname);
+        free(all);
+        return;
+    }
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n%s\n]}\n", all);
+    fclose(f);
+    free(all);
+
+    LOG(LOG_LVL_INFO, "Trace written to %s", fname);
+}
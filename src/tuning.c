@@ -0,0 +1,307 @@
+#include "parallhull.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#define TUNING_REPS 5
+#define TUNING_SEED 0x7E57ULL
+#define TUNING_RADIUS 1000.
+
+// Runtime choice of the kernel variants (--tune). The variants of buildUncoveredMask (see COVERAGE_VARIANTS in quickhull.c) and
+// of the quickhull iteration (separate or fused coverage and farthest points passes) are timed on synthetic points on the machine
+// at hand, the fastest are written to a tuning cache next to the name of the CPU model, and every later run on a CPU of the same
+// model loads them at startup. A cache shared by heterogeneous nodes (e.g. in a shared home) keeps lines per node type, so --tune
+// has to run once on each of them and no rebuild is needed.
+// Cache format, one variant per line: "<kernel> <variant> <cpu model>"
+
+// workloads timed for buildUncoveredMask, like the first iteration of quickhull (many points, few edges) and a later one (fewer points, more edges)
+static const struct
+{
+    size_t n;
+    size_t hullSize;
+} coverageWorkloads[] = { { 1 << 20, 8 }, { 1 << 16, 128 } };
+
+// workloads timed for the quickhull iteration: most points covered in the first iterations, and all of them on the hull
+static const struct
+{
+    size_t n;
+    enum Distribution dist;
+} iterationWorkloads[] = { { 1 << 20, DIST_DISK }, { 1 << 12, DIST_CIRCLE } };
+
+static void timeCoverageVariants(double *times, int procID);
+static void timeIterationVariants(double *times, int procID);
+
+// the kernels with variants, tuned in this order (the iteration is timed with the coverage variant already picked)
+static const struct
+{
+    const char *name;
+    int (*count)();
+    const char *(*variantName)(int v);
+    int (*find)(const char *name);
+    void (*set)(int v);
+    void (*time)(double *times, int procID); // adds the time of variant v on the workloads to times[v]
+} tunedKernels[] = {
+    { .name="buildUncoveredMask", .count=getCoverageVariantsCount, .variantName=getCoverageVariantName, .find=findCoverageVariant, .set=setCoverageVariant, .time=timeCoverageVariants },
+    { .name="quickhullIteration", .count=getIterationVariantsCount, .variantName=getIterationVariantName, .find=findIterationVariant, .set=setIterationVariant, .time=timeIterationVariants }
+};
+#define TUNED_KERNELS_COUNT (int)(sizeof(tunedKernels) / sizeof(*tunedKernels))
+
+static int findTunedKernel(const char *name);
+static void tuningCachePath(Params *p, char *path, size_t size);
+static void cpuModel(char *model, size_t size);
+static Data regularPolygon(size_t k, double radius);
+
+void loadTuning(Params *p, int procID)
+{
+    char path[1100], model[256];
+    tuningCachePath(p, path, sizeof(path));
+    cpuModel(model, sizeof(model));
+
+    FILE *fileptr = fopen(path, "r");
+    if (fileptr == NULL)
+    {
+        LOG(LOG_LVL_DEBUG, "p[%2d] loadTuning: No tuning cache at %s, the default variants are used", procID, path);
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), fileptr) != NULL)
+    {
+        char kernel[64], variant[64];
+        int offset;
+        if (sscanf(line, "%63s %63s %n", kernel, variant, &offset) != 2)
+            continue;
+        line[strcspn(line, "\n")] = 0;
+        int k = findTunedKernel(kernel);
+        if ((k < 0) || (strcmp(&line[offset], model) != 0))
+            continue;
+        int v = tunedKernels[k].find(variant);
+        if (v < 0)
+        {
+            LOG(LOG_LVL_WARN, "p[%2d] loadTuning: Unknown variant %s of %s in %s, run --tune again", procID, variant, kernel, path);
+            continue;
+        }
+        tunedKernels[k].set(v);
+        LOG(LOG_LVL_INFO, "p[%2d] loadTuning: Using variant %s of %s from %s", procID, variant, kernel, path);
+    }
+    fclose(fileptr);
+}
+
+void runTuning(Params *p, int procID)
+{
+    char path[1100], model[256];
+    tuningCachePath(p, path, sizeof(path));
+    cpuModel(model, sizeof(model));
+
+    int best[TUNED_KERNELS_COUNT];
+    for (int k = 0; k < TUNED_KERNELS_COUNT; k++)
+    {
+        const int nVariants = tunedKernels[k].count();
+        LOG(LOG_LVL_NOTICE, "p[%2d] runTuning: Timing %d variants of %s on %s", procID, nVariants, tunedKernels[k].name, model);
+        double *times = calloc(nVariants, sizeof(double));
+        if (times == NULL)
+            throwError("p[%2d] runTuning: Failed to allocate memory for the timings", procID);
+        tunedKernels[k].time(times, procID);
+
+        best[k] = 0;
+        for (int v = 0; v < nVariants; v++)
+        {
+            LOG(LOG_LVL_NOTICE, "p[%2d] runTuning: %-8s %.3lfms", procID, tunedKernels[k].variantName(v), times[v] * 1e3);
+            if (times[v] < times[best[k]])
+                best[k] = v;
+        }
+        tunedKernels[k].set(best[k]);
+        LOG(LOG_LVL_NOTICE, "p[%2d] runTuning: Fastest variant of %s is %s", procID, tunedKernels[k].name, tunedKernels[k].variantName(best[k]));
+        free(times);
+    }
+
+    // the lines of the other CPU models and kernels are kept, the ones of this model are replaced
+    char tmpPath[1110];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE *out = fopen(tmpPath, "w");
+    if (out == NULL)
+        throwError("p[%2d] runTuning: Could not write the tuning cache %s", procID, tmpPath);
+    FILE *in = fopen(path, "r");
+    if (in != NULL)
+    {
+        char line[512];
+        while (fgets(line, sizeof(line), in) != NULL)
+        {
+            char kernel[64], variant[64];
+            int offset;
+            if (sscanf(line, "%63s %63s %n", kernel, variant, &offset) != 2)
+                continue;
+            char *lineModel = &line[offset];
+            lineModel[strcspn(lineModel, "\n")] = 0;
+            if ((findTunedKernel(kernel) >= 0) && (strcmp(lineModel, model) == 0))
+                continue;
+            fprintf(out, "%s %s %s\n", kernel, variant, lineModel);
+        }
+        fclose(in);
+    }
+    for (int k = 0; k < TUNED_KERNELS_COUNT; k++)
+        fprintf(out, "%s %s %s\n", tunedKernels[k].name, tunedKernels[k].variantName(best[k]), model);
+    fclose(out);
+    if (rename(tmpPath, path))
+        throwError("p[%2d] runTuning: Could not replace the tuning cache %s", procID, path);
+    LOG(LOG_LVL_NOTICE, "p[%2d] runTuning: Tuning cache %s updated", procID, path);
+}
+
+static void timeCoverageVariants(double *times, int procID)
+{
+    const int nWorkloads = sizeof(coverageWorkloads) / sizeof(*coverageWorkloads);
+    const int nVariants = getCoverageVariantsCount();
+    for (int w = 0; w < nWorkloads; w++)
+    {
+        size_t n = coverageWorkloads[w].n;
+        Data pts = { .n=n, .I=NULL };
+        pts.X = malloc(n * 2 * sizeof(float) + MALLOC_PADDING);
+        uint64_t *mask = malloc((n + 63) / 64 * sizeof(uint64_t) + MALLOC_PADDING);
+        uint64_t *reference = malloc((n + 63) / 64 * sizeof(uint64_t) + MALLOC_PADDING);
+        if ((pts.X == NULL) || (mask == NULL) || (reference == NULL))
+            throwError("p[%2d] runTuning: Failed to allocate memory for %ld points", procID, n);
+        pts.Y = &pts.X[n];
+        genPoints(pts.X, pts.Y, 0, n, DIST_DISK, TUNING_SEED, TUNING_RADIUS);
+        Data hull = regularPolygon(coverageWorkloads[w].hullSize, 0.9 * TUNING_RADIUS);
+
+        for (int v = 0; v < nVariants; v++)
+        {
+            setCoverageVariant(v);
+            double best = DBL_MAX; // no INFINITY, -ffast-math assumes there is none
+            for (int r = 0; r < TUNING_REPS; r++)
+            {
+                double start = getTime();
+                buildUncoveredMask(&hull, &pts, mask, false);
+                best = fmin(best, getTime() - start);
+            }
+            times[v] += best;
+
+            // every variant must build the same mask, a wrong one would otherwise win by skipping work
+            if (v == 0)
+                memcpy(reference, mask, (n + 63) / 64 * sizeof(uint64_t));
+            else if (memcmp(reference, mask, (n + 63) / 64 * sizeof(uint64_t)) != 0)
+                throwError("p[%2d] runTuning: Variant %s of buildUncoveredMask builds a different mask", procID, getCoverageVariantName(v));
+        }
+
+        free(pts.X);
+        free(mask);
+        free(reference);
+        free(hull.X);
+        free(hull.Y);
+    }
+}
+
+// whole quickhulls, since the fused pass trades the skipped work of the separate passes for a single read of the points
+static void timeIterationVariants(double *times, int procID)
+{
+    const int nWorkloads = sizeof(iterationWorkloads) / sizeof(*iterationWorkloads);
+    const int nVariants = getIterationVariantsCount();
+    ProcThreadIDCombo id = { .p=procID, .t=0 };
+    for (int w = 0; w < nWorkloads; w++)
+    {
+        size_t n = iterationWorkloads[w].n;
+        float *src = malloc(n * 2 * sizeof(float) + MALLOC_PADDING);
+        Data pts = { .n=n, .I=NULL };
+        pts.X = malloc(n * 2 * sizeof(float) + MALLOC_PADDING);
+        if ((src == NULL) || (pts.X == NULL))
+            throwError("p[%2d] runTuning: Failed to allocate memory for %ld points", procID, n);
+        pts.Y = &pts.X[n];
+        genPoints(src, &src[n], 0, n, iterationWorkloads[w].dist, TUNING_SEED, TUNING_RADIUS);
+        Data reference = { .n=0, .X=NULL, .Y=NULL, .I=NULL };
+
+        for (int v = 0; v < nVariants; v++)
+        {
+            setIterationVariant(v);
+            double best = DBL_MAX;
+            for (int r = 0; r < TUNING_REPS; r++)
+            {
+                // quickhull consumes its input
+                memcpy(pts.X, src, n * 2 * sizeof(float));
+                pts.n = n;
+                double start = getTime();
+                Data hull = quickhull(&pts, &id);
+                best = fmin(best, getTime() - start);
+
+                // every variant must find the same hull, a wrong one would otherwise win by skipping work
+                if ((v == 0) && (r == 0))
+                    reference = hull;
+                else
+                {
+                    if ((hull.n != reference.n) || (memcmp(hull.X, reference.X, hull.n * sizeof(float)) != 0) || (memcmp(hull.Y, reference.Y, hull.n * sizeof(float)) != 0))
+                        throwError("p[%2d] runTuning: Variant %s of quickhullIteration finds a different hull", procID, getIterationVariantName(v));
+                    free(hull.X);
+                    free(hull.Y);
+                }
+            }
+            times[v] += best;
+        }
+
+        free(src);
+        free(pts.X);
+        free(reference.X);
+        free(reference.Y);
+    }
+}
+
+// index of name in tunedKernels, -1 if it is not one of them
+static int findTunedKernel(const char *name)
+{
+    for (int k = 0; k < TUNED_KERNELS_COUNT; k++)
+        if (strcmp(tunedKernels[k].name, name) == 0)
+            return k;
+    return -1;
+}
+
+// --tuning-cache, else $XDG_CACHE_HOME/parallhull_tuning, else ~/.cache/parallhull_tuning, else ./.parallhull_tuning
+static void tuningCachePath(Params *p, char *path, size_t size)
+{
+    if (p->tuningCache[0] != 0)
+        snprintf(path, size, "%s", p->tuningCache);
+    else if ((getenv("XDG_CACHE_HOME") != NULL) && (getenv("XDG_CACHE_HOME")[0] != 0))
+        snprintf(path, size, "%s/parallhull_tuning", getenv("XDG_CACHE_HOME"));
+    else if (getenv("HOME") != NULL)
+        snprintf(path, size, "%s/.cache/parallhull_tuning", getenv("HOME"));
+    else
+        snprintf(path, size, ".parallhull_tuning");
+}
+
+// "model name" of /proc/cpuinfo, "unknown" when not available
+static void cpuModel(char *model, size_t size)
+{
+    snprintf(model, size, "unknown");
+    FILE *fileptr = fopen("/proc/cpuinfo", "r");
+    if (fileptr == NULL)
+        return;
+    char line[512];
+    while (fgets(line, sizeof(line), fileptr) != NULL)
+        if (strncmp(line, "model name", 10) == 0)
+        {
+            char *value = strchr(line, ':');
+            if (value != NULL)
+            {
+                value += strspn(value, ": \t");
+                value[strcspn(value, "\n")] = 0;
+                snprintf(model, size, "%s", value);
+            }
+            break;
+        }
+    fclose(fileptr);
+}
+
+// k vertices CCW from the lowest one, with the closing point, as quickhull lays out its hulls
+static Data regularPolygon(size_t k, double radius)
+{
+    Data hull = { .n=k, .I=NULL };
+    hull.X = malloc((k + 1) * sizeof(float) + MALLOC_PADDING);
+    hull.Y = malloc((k + 1) * sizeof(float) + MALLOC_PADDING);
+    if ((hull.X == NULL) || (hull.Y == NULL))
+        throwError("regularPolygon: Failed to allocate memory for %ld vertices", k);
+    for (size_t i = 0; i <= k; i++)
+    {
+        double t = -M_PI_2 + 2. * M_PI * (i % k) / k;
+        hull.X[i] = radius * cos(t);
+        hull.Y[i] = radius * sin(t);
+    }
+    return hull;
+}
@@ -0,0 +1,187 @@
+#include "parallhull.h"
+
+#include <string.h>
+#include <math.h>
+#ifndef NON_MPI_MODE
+    #include <mpi.h>
+#endif
+
+#define VERIFY_RELATIVE_TOLERANCE 1e-6 // of the size of the hull, covers the rounding of the float coordinates in the edge tests
+#define VERIFY_MAX_REPORTED 10 // points outside and bad turns logged
+#define VERIFY_MAX_RECHECKED (1UL << 20) // points flagged by the SIMD pass rechecked against every edge before giving up
+
+// Runtime verification of the final hull (--verify), cheap enough to be left on in production, unlike the DEBUG checks.
+// Convexity: one pass over the vertices, no turn can be a right turn and the turns must add up to a single revolution
+// (a star polygon has only left turns too). Coverage: every rank reads again its own part of the file and
+// classifies it against the hull with the threaded SIMD wedge query of --query (hullQueryClassify). The few points it
+// flags as outside (on the boundary, a float rounding can put a point outside by an ulp) are rechecked against every edge
+// with a tolerance, and the misses are summed over the ranks
+
+static size_t convexityScan(Data *hull, int procID);
+static size_t recheckOutside(Data *hull, Data *pts, uint64_t *mask, double tolerance, int procID);
+
+// tolerance: distance from the hull allowed to the points, the error bound of --approx (0 for the exact hull)
+void runVerify(Params *p, Data *hull, double tolerance, int rank, int nProcs)
+{
+    double startTime = getTime();
+    Data h = *hull;
+
+    #ifndef NON_MPI_MODE
+        // the final hull is on rank 0 only
+        unsigned long hullSize = hull->n;
+        int MPIErrCode = MPI_Bcast(&hullSize, 1, MPI_UNSIGNED_LONG, 0, MPI_COMM_WORLD);
+        if (MPIErrCode)
+            throwError("p[%2d] runVerify: Got error %d on broadcasting the hull size", rank, MPIErrCode);
+        if (rank != 0)
+        {
+            h.n = hullSize;
+            h.I = NULL;
+            h.X = malloc((h.n + 1) * sizeof(float) + MALLOC_PADDING);
+            h.Y = malloc((h.n + 1) * sizeof(float) + MALLOC_PADDING);
+            if ((h.X == NULL) || (h.Y == NULL))
+                throwError("p[%2d] runVerify: Failed to allocate memory for the hull", rank);
+        }
+        MPIErrCode = MPI_Bcast(h.X, h.n + 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+        if (!MPIErrCode)
+            MPIErrCode = MPI_Bcast(h.Y, h.n + 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+        if (MPIErrCode)
+            throwError("p[%2d] runVerify: Got error %d on broadcasting the hull", rank, MPIErrCode);
+    #endif
+
+    size_t badTurns = rank == 0 ? convexityScan(&h, rank) : 0;
+
+    Params verifyParams = *p;
+    verifyParams.trackIndices = false;
+    verifyParams.nProcs = nProcs;
+    verifyParams.textCache = false;
+    Data d;
+    if (verifyParams.inputFormat == INPUT_FORMAT_TEXT)
+        readFileText(&d, &verifyParams, rank, nProcs);
+    else if (nProcs > 1)
+        readFilePart(&d, &verifyParams, rank);
+    else
+        readFile(&d, &verifyParams);
+
+    uint64_t *mask = malloc((d.n + 63) / 64 * sizeof(uint64_t) + MALLOC_PADDING);
+    if (mask == NULL)
+        throwError("p[%2d] runVerify: Failed to allocate memory for the mask", rank);
+    HullQuery q = hullQueryBuild(&h, rank);
+    size_t flagged = d.n - hullQueryClassify(&q, &d, mask, p->nThreads, rank);
+    hullQueryFree(&q);
+    unsigned long outside = flagged > 0 ? recheckOutside(&h, &d, mask, tolerance, rank) : 0;
+    unsigned long checked = d.n;
+
+    #ifndef NON_MPI_MODE
+        unsigned long local[2] = { outside, checked }, total[2];
+        MPIErrCode = MPI_Reduce(local, total, 2, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (MPIErrCode)
+            throwError("p[%2d] runVerify: Got error %d on reducing the coverage results", rank, MPIErrCode);
+        outside = total[0];
+        checked = total[1];
+        if (rank != 0)
+        {
+            free(h.X);
+            free(h.Y);
+        }
+    #endif
+
+    free(mask);
+    free(d.X);
+
+    if (rank != 0)
+        return;
+    if ((badTurns > 0) || (outside > 0))
+        throwError("p[%2d] runVerify: Verification failed: %ld bad turns in the hull of %ld vertices, %ld of %ld points outside", rank, badTurns, hull->n, outside, checked);
+    LOG(LOG_LVL_NOTICE, "p[%2d] runVerify: Hull of %ld vertices is convex and covers all the %ld points%s, verified in %lfs", rank, hull->n, checked,
+        tolerance > 0 ? " within the approximation bound" : "", getTime() - startTime);
+}
+
+// Number of vertices where the hull turns right, plus one if the turns do not add up to a single revolution
+static size_t convexityScan(Data *hull, int procID)
+{
+    size_t n = hull->n;
+    if (n < 3)
+        return 0;
+
+    size_t bad = 0, collinear = 0;
+    double winding = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t i1 = (i + 1) % n, i2 = (i + 2) % n;
+        double ax = (double)hull->X[i1] - hull->X[i], ay = (double)hull->Y[i1] - hull->Y[i];
+        double bx = (double)hull->X[i2] - hull->X[i1], by = (double)hull->Y[i2] - hull->Y[i1];
+        double cross = ax * by - ay * bx; // exact sign: the differences and products of floats are exact in double
+        if (cross < 0)
+        {
+            if (bad < VERIFY_MAX_REPORTED)
+                LOG(LOG_LVL_ERROR, "p[%2d] runVerify: Right turn at vertex %ld (%f, %f), cross product %e", procID, i1, hull->X[i1], hull->Y[i1], cross);
+            bad++;
+        }
+        else if (cross == 0)
+            collinear++;
+        winding += atan2(cross, ax * bx + ay * by);
+    }
+    // a vertex on the segment of its neighbours does not make the hull wrong, just one vertex longer
+    if (collinear > 0)
+        LOG(LOG_LVL_WARN, "p[%2d] runVerify: %ld vertices of the hull are collinear with their neighbours", procID, collinear);
+    if (fabs(winding - 2. * M_PI) > 1e-6)
+    {
+        LOG(LOG_LVL_ERROR, "p[%2d] runVerify: The turns of the hull add up to %lf revolutions", procID, winding / (2. * M_PI));
+        bad++;
+    }
+    return bad;
+}
+
+// The points whose mask bit is clear, checked against every edge: they are outside when farther than the tolerance from
+// the inner side of any edge. After VERIFY_MAX_RECHECKED points the hull is certainly wrong and the rest count as outside
+static size_t recheckOutside(Data *hull, Data *pts, uint64_t *mask, double tolerance, int procID)
+{
+    double minX = hull->X[0], maxX = hull->X[0], minY = hull->Y[0], maxY = hull->Y[0];
+    for (size_t j = 1; j < hull->n; j++)
+    {
+        minX = fmin(minX, hull->X[j]);
+        maxX = fmax(maxX, hull->X[j]);
+        minY = fmin(minY, hull->Y[j]);
+        maxY = fmax(maxY, hull->Y[j]);
+    }
+    tolerance += VERIFY_RELATIVE_TOLERANCE * (fmax(fabs(minX), fabs(maxX)) + fmax(fabs(minY), fabs(maxY)));
+
+    size_t outside = 0, rechecked = 0;
+    for (size_t i = 0; i < pts->n; i++)
+    {
+        if ((mask[i / 64] >> (i % 64)) & 1)
+            continue;
+        if (rechecked++ == VERIFY_MAX_RECHECKED)
+        {
+            LOG(LOG_LVL_ERROR, "p[%2d] runVerify: More than %ld points flagged as outside, not rechecking the others", procID, VERIFY_MAX_RECHECKED);
+            for (; i < pts->n; i++)
+                outside += !((mask[i / 64] >> (i % 64)) & 1);
+            break;
+        }
+
+        double x = pts->X[i], y = pts->Y[i];
+        bool isOutside = hull->n == 0;
+        for (size_t j = 0; (j < hull->n) && !isOutside; j++)
+        {
+            size_t j1 = (j + 1) % hull->n;
+            double ex = (double)hull->X[j1] - hull->X[j], ey = (double)hull->Y[j1] - hull->Y[j];
+            double len = hypot(ex, ey);
+            if (len == 0) // single point hull
+                isOutside = hypot(x - hull->X[j], y - hull->Y[j]) > tolerance;
+            else if (hull->n == 2) // segment: distance from it
+            {
+                double t = fmin(fmax(((x - hull->X[j]) * ex + (y - hull->Y[j]) * ey) / (len * len), 0.), 1.);
+                isOutside = hypot(x - hull->X[j] - t * ex, y - hull->Y[j] - t * ey) > tolerance;
+                break;
+            }
+            else
+                isOutside = (ex * (y - hull->Y[j]) - ey * (x - hull->X[j])) / len < -tolerance;
+        }
+        if (!isOutside)
+            continue;
+        if (outside < VERIFY_MAX_REPORTED)
+            LOG(LOG_LVL_ERROR, "p[%2d] runVerify: Point (%f, %f) is outside the hull", procID, pts->X[i], pts->Y[i]);
+        outside++;
+    }
+    return outside;
+}